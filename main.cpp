@@ -3,48 +3,113 @@
 #include <cmath>
 #include <vector>
 #include <stack>
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+#include <thread>
+#include <algorithm>
+#include <type_traits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <fstream>
+#include <deque>
+#include <functional>
+#include <future>
+#include <condition_variable>
+#include <limits>
+#include <utility>
+#include <cstddef>
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <x86intrin.h>
+#endif
+#if defined(__unix__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
-class Quaternion;
+// в C++20 арифметика constexpr и константные формулы сворачиваются при
+// компиляции; в C++17 мешают виртуальные функции, макрос пустой
+#if __cplusplus >= 202002L
+#define NUMBER_CONSTEXPR constexpr
+#else
+#define NUMBER_CONSTEXPR
+#endif
+
+template <class T>
+class BasicQuaternion;
+
+// constexpr-замена std::fabs для формул деления
+template <class T>
+constexpr T absoluteValue(T x) {
+    return x < 0 ? -x : x;
+}
+
+// Квадрат модуля делителя, при котором conj / norm считается без
+// переполнения и без ухода в денормализованные числа. Вне этого диапазона
+// деление идёт медленным масштабированным путём.
+template <class T>
+constexpr bool isRegularNorm(T norm) {
+    return norm >= std::numeric_limits<T>::min() /
+        std::numeric_limits<T>::epsilon() &&
+        norm <= std::numeric_limits<T>::max() *
+        std::numeric_limits<T>::epsilon();
+}
 
 enum ComplexKind {CK_COMPLEX_NUMBER, CK_QUATERNION};
 
-class ComplexNumber {
+template <class T>
+class BasicComplexNumber {
 public:
-    ComplexNumber() : real(0), iCoef(0) {}
+    NUMBER_CONSTEXPR BasicComplexNumber() : real(0), iCoef(0) {}
     
-    ComplexNumber(double _real, double _iCoef) : 
+    NUMBER_CONSTEXPR BasicComplexNumber(T _real, T _iCoef) : 
         real(_real), iCoef(_iCoef) {}
     
-    ComplexNumber(const ComplexNumber& other) : 
+    NUMBER_CONSTEXPR BasicComplexNumber(const BasicComplexNumber& other) : 
         real(other.real), iCoef(other.iCoef) {}
 
-    virtual ~ComplexNumber() {}
+    template <class U>
+    NUMBER_CONSTEXPR explicit BasicComplexNumber(
+        const BasicComplexNumber<U>& other) :
+        real(T(other.getReal())), iCoef(T(other.getI())) {}
+
+    NUMBER_CONSTEXPR virtual ~BasicComplexNumber() {}
 
-    virtual ComplexKind getKind() const {
+    NUMBER_CONSTEXPR virtual ComplexKind getKind() const {
         return CK_COMPLEX_NUMBER;
     }
 
     virtual void show() const {
-        std::cout << real << " + " << iCoef << "i" << std::endl;
+        std::cout << real << " + " << iCoef << "i" << '\n';
     }
 
-    double getReal() const {
+    NUMBER_CONSTEXPR T getReal() const {
         return real;
     }
 
-    double getI() const {
+    NUMBER_CONSTEXPR T getI() const {
         return iCoef;
     }
     
-    void setReal(double _real) {
+    NUMBER_CONSTEXPR void setReal(T _real) {
         real = _real;
     }
 
-    void setI(double _iCoef) {
+    NUMBER_CONSTEXPR void setI(T _iCoef) {
         iCoef = _iCoef;
     }
 
-    virtual void setImaginary(const std::vector<double>& imagPart) {
+    virtual void setImaginary(const std::vector<T>& imagPart) {
         if (imagPart.size() > 1) {
             std::cout << "Expected one imaginary coefficient, but got " <<
                 imagPart.size() << std::endl;
@@ -53,7 +118,28 @@ public:
         iCoef = imagPart[0];
     }
 
-    bool operator== (const ComplexNumber &obj) const {
+    // квадрат модуля, как std::norm
+    NUMBER_CONSTEXPR T norm() const {
+        return real * real + iCoef * iCoef;
+    }
+
+    // 1 / z теми же двумя путями, что и operator/=
+    NUMBER_CONSTEXPR BasicComplexNumber reciprocal() const {
+        T squares = norm();
+        if (isRegularNorm(squares)) {
+            T inverse = 1 / squares;
+            return BasicComplexNumber(real * inverse, -iCoef * inverse);
+        }
+        bool wide = absoluteValue(real) >= absoluteValue(iCoef);
+        T larger = wide ? real : iCoef;
+        T smaller = wide ? iCoef : real;
+        T ratio = smaller / larger;
+        T inverse = 1 / (larger + smaller * ratio);
+        return wide ? BasicComplexNumber(inverse, -ratio * inverse) :
+            BasicComplexNumber(ratio * inverse, -inverse);
+    }
+
+    NUMBER_CONSTEXPR bool operator== (const BasicComplexNumber &obj) const {
         if (
             real == obj.real &&
             iCoef == obj.iCoef
@@ -61,9 +147,9 @@ public:
         return false;
     }
 
-    bool operator== (const Quaternion &obj) const;
+    NUMBER_CONSTEXPR bool operator== (const BasicQuaternion<T> &obj) const;
 
-    bool operator== (double num) const {
+    NUMBER_CONSTEXPR bool operator== (T num) const {
         if (
             real == num &&
             iCoef == 0
@@ -71,504 +157,1073 @@ public:
         return false;
     }
 
-    ComplexNumber operator+= (const ComplexNumber &obj) {
+    NUMBER_CONSTEXPR BasicComplexNumber& operator+= (
+        const BasicComplexNumber &obj) {
         real += obj.real;
         iCoef += obj.iCoef;
         return *this;
     }
 
-    ComplexNumber operator+= (double num) {
+    NUMBER_CONSTEXPR BasicComplexNumber& operator+= (T num) {
         real += num;
         return *this;
     }
 
-    ComplexNumber operator+ (const ComplexNumber &obj) const {
-        ComplexNumber tmp(*this);
+    NUMBER_CONSTEXPR BasicComplexNumber operator+ (
+        const BasicComplexNumber &obj) const {
+        BasicComplexNumber tmp(*this);
         tmp += obj;
         return tmp;
     }
 
-    Quaternion operator+ (const Quaternion &obj) const;
+    NUMBER_CONSTEXPR BasicQuaternion<T> operator+ (
+        const BasicQuaternion<T> &obj) const;
 
-    ComplexNumber operator+ (double num) const {
-        ComplexNumber tmp(*this);
+    NUMBER_CONSTEXPR BasicComplexNumber operator+ (T num) const {
+        BasicComplexNumber tmp(*this);
         tmp += num;
         return tmp;
     }
 
-    ComplexNumber operator-= (const ComplexNumber &obj) {
+    NUMBER_CONSTEXPR BasicComplexNumber& operator-= (
+        const BasicComplexNumber &obj) {
         real -= obj.real;
         iCoef -= obj.iCoef;
         return *this;
     }
 
-    ComplexNumber operator-= (double num) {
+    NUMBER_CONSTEXPR BasicComplexNumber& operator-= (T num) {
         real -= num;
         return *this;
     }
 
-    ComplexNumber operator- (const ComplexNumber &obj) const {
-        ComplexNumber tmp(*this);
+    NUMBER_CONSTEXPR BasicComplexNumber operator- (
+        const BasicComplexNumber &obj) const {
+        BasicComplexNumber tmp(*this);
         tmp -= obj;
         return tmp;
     }
 
-    Quaternion operator- (const Quaternion &obj) const;
+    NUMBER_CONSTEXPR BasicQuaternion<T> operator- (
+        const BasicQuaternion<T> &obj) const;
 
-    ComplexNumber operator- (double num) {
-        ComplexNumber tmp(*this);
+    NUMBER_CONSTEXPR BasicComplexNumber operator- (T num) {
+        BasicComplexNumber tmp(*this);
         tmp -= num;
         return tmp;
     }
 
-    ComplexNumber operator= (const ComplexNumber &obj) {
+    NUMBER_CONSTEXPR BasicComplexNumber& operator= (
+        const BasicComplexNumber &obj) {
         real = obj.real;
         iCoef = obj.iCoef;
         return *this;
     }
 
-    ComplexNumber operator= (double num) {
+    NUMBER_CONSTEXPR BasicComplexNumber& operator= (T num) {
         real = num;
         iCoef = 0;
         return *this;
     }
 
-    ComplexNumber operator*= (const ComplexNumber &obj) {
-        double realRes = real * obj.real - iCoef * obj.iCoef;
-        double iCoefRes = real * obj.iCoef + iCoef * obj.real;
+    NUMBER_CONSTEXPR BasicComplexNumber& operator*= (
+        const BasicComplexNumber &obj) {
+        T realRes = real * obj.real - iCoef * obj.iCoef;
+        T iCoefRes = real * obj.iCoef + iCoef * obj.real;
         real = realRes;
         iCoef = iCoefRes;
         return *this;
     }
 
-    ComplexNumber operator*= (double num) {
+    NUMBER_CONSTEXPR BasicComplexNumber& operator*= (T num) {
         real *= num;
         iCoef *= num;
         return *this;
     }
 
-    ComplexNumber operator* (const ComplexNumber &obj) const {
-        ComplexNumber tmp(*this);
+    NUMBER_CONSTEXPR BasicComplexNumber operator* (
+        const BasicComplexNumber &obj) const {
+        BasicComplexNumber tmp(*this);
         tmp *= obj;
         return tmp;
     }
 
-    Quaternion operator* (const Quaternion &obj) const;
+    NUMBER_CONSTEXPR BasicQuaternion<T> operator* (
+        const BasicQuaternion<T> &obj) const;
 
-    ComplexNumber operator* (double num) const {
-        ComplexNumber tmp(*this);
+    NUMBER_CONSTEXPR BasicComplexNumber operator* (T num) const {
+        BasicComplexNumber tmp(*this);
         tmp *= num;
         return tmp;
     }
 
-    ComplexNumber operator/= (const ComplexNumber &obj) {
-        double realRes = (real * obj.real + iCoef * obj.iCoef) / 
-            (std::pow(obj.real, 2) + std::pow(obj.iCoef, 2));
-        double iCoefRes = (obj.real * iCoef - obj.iCoef * real) / 
-            (std::pow(obj.real, 2) + std::pow(obj.iCoef, 2));
+    // Деление - умножение на conj(obj) / |obj|^2, одно деление на всё.
+    // Младшие биты результата могут отличаться от деления каждой
+    // компоненты на |obj|^2.
+    // Когда |obj|^2 у границ диапазона, делим по Смиту: на большую по модулю
+    // компоненту делителя, тогда промежуточные величины не переполняются,
+    // пока представимо само частное. Ошибка каждой компоненты - до 4 eps от
+    // модуля частного.
+    NUMBER_CONSTEXPR BasicComplexNumber& operator/= (
+        const BasicComplexNumber &obj) {
+        T objNorm = obj.norm();
+        if (isRegularNorm(objNorm)) {
+            T inverse = 1 / objNorm;
+            return *this *= BasicComplexNumber(obj.real * inverse,
+                -obj.iCoef * inverse);
+        }
+        bool wide = absoluteValue(obj.real) >= absoluteValue(obj.iCoef);
+        T larger = wide ? obj.real : obj.iCoef;
+        T smaller = wide ? obj.iCoef : obj.real;
+        T ratio = smaller / larger;
+        T inverse = 1 / (larger + smaller * ratio);
+        T first = wide ? real : iCoef;
+        T second = wide ? iCoef : real;
+        T realRes = (first + second * ratio) * inverse;
+        T iCoefRes = (wide ? second - first * ratio :
+            first * ratio - second) * inverse;
         real = realRes;
         iCoef = iCoefRes;
         return *this;
     }
 
-    ComplexNumber operator/= (double num) {
+    NUMBER_CONSTEXPR BasicComplexNumber& operator/= (T num) {
         real /= num;
         iCoef /= num;
         return *this;
     }
 
-    ComplexNumber operator/ (const ComplexNumber &obj) const {
-        ComplexNumber tmp(*this);
+    NUMBER_CONSTEXPR BasicComplexNumber operator/ (
+        const BasicComplexNumber &obj) const {
+        BasicComplexNumber tmp(*this);
         tmp /= obj;
         return tmp;
     }
 
-    Quaternion operator/ (const Quaternion &obj) const;
+    NUMBER_CONSTEXPR BasicQuaternion<T> operator/ (
+        const BasicQuaternion<T> &obj) const;
 
-    ComplexNumber operator/ (double num) const {
-        ComplexNumber tmp(*this);
+    NUMBER_CONSTEXPR BasicComplexNumber operator/ (T num) const {
+        BasicComplexNumber tmp(*this);
         tmp /= num;
         return tmp;
     }
 protected: // вроде не обязательно private
-    double real;
-    double iCoef;
+    T real;
+    T iCoef;
 };
 
-class Quaternion : public ComplexNumber {
+template <class T>
+class BasicQuaternion : public BasicComplexNumber<T> {
 public:
-    Quaternion() : ComplexNumber(), jCoef(0), kCoef(0) {}
+    NUMBER_CONSTEXPR BasicQuaternion() :
+        BasicComplexNumber<T>(), jCoef(0), kCoef(0) {}
 
-    Quaternion(double _real, double _iCoef, double _jCoef, double _kCoef) :
-        ComplexNumber(_real, _iCoef), jCoef(_jCoef), kCoef(_kCoef) {}
+    NUMBER_CONSTEXPR BasicQuaternion(T _real, T _iCoef, T _jCoef, T _kCoef) :
+        BasicComplexNumber<T>(_real, _iCoef), jCoef(_jCoef), kCoef(_kCoef) {}
 
-    Quaternion(const ComplexNumber& other) :
-        ComplexNumber(other),
+    NUMBER_CONSTEXPR BasicQuaternion(const BasicComplexNumber<T>& other) :
+        BasicComplexNumber<T>(other),
         jCoef(0),
         kCoef(0) {}
 
-    Quaternion(const Quaternion& other) :
-        ComplexNumber((ComplexNumber)other),
+    NUMBER_CONSTEXPR BasicQuaternion(const BasicQuaternion& other) :
+        BasicComplexNumber<T>(other),
         jCoef(other.jCoef),
         kCoef(other.kCoef) {}
 
-    ~Quaternion() override {}
+    template <class U>
+    NUMBER_CONSTEXPR explicit BasicQuaternion(const BasicQuaternion<U>& other) :
+        BasicComplexNumber<T>(T(other.getReal()), T(other.getI())),
+        jCoef(T(other.getJ())),
+        kCoef(T(other.getK())) {}
 
-    ComplexKind getKind() const override {
+    NUMBER_CONSTEXPR ~BasicQuaternion() override {}
+
+    NUMBER_CONSTEXPR ComplexKind getKind() const override {
         return CK_QUATERNION;
     }
 
     void show() const override {
-        std::cout << getReal() << " + " << getI() << "i + " <<
-            jCoef << "j + " << kCoef << "k" << std::endl;
+        std::cout << this->getReal() << " + " << this->getI() << "i + " <<
+            jCoef << "j + " << kCoef << "k" << '\n';
     }
 
-    double getJ() const {
+    NUMBER_CONSTEXPR T norm() const {
+        return this->real * this->real + this->iCoef * this->iCoef +
+            jCoef * jCoef + kCoef * kCoef;
+    }
+
+    // Сопряжённое, делённое на квадрат модуля. Если квадрат модуля у границ
+    // диапазона, число сначала масштабируется на наибольшую компоненту:
+    // сумма квадратов попадает в [1, 4] и не переполняется. Ошибка каждой
+    // компоненты - до 3 eps от модуля результата.
+    NUMBER_CONSTEXPR BasicQuaternion reciprocal() const {
+        T squares = norm();
+        if (isRegularNorm(squares)) {
+            T inverse = 1 / squares;
+            return BasicQuaternion(this->real * inverse,
+                -this->iCoef * inverse, -jCoef * inverse, -kCoef * inverse);
+        }
+        T inverseScale = 0;
+        BasicQuaternion result = scaledReciprocal(inverseScale);
+        result *= inverseScale;
+        return result;
+    }
+
+    // Поворот точки (x, y, z): то же, что q * (0, x, y, z) / q, через
+    // векторные произведения: t = 2 (v x p) / |q|^2, p' = p + w t + v x t.
+    // q не обязан быть единичным.
+    NUMBER_CONSTEXPR void rotate(T& x, T& y, T& z) const {
+        T scale = 2 / norm();
+        T tX = scale * (jCoef * z - kCoef * y);
+        T tY = scale * (kCoef * x - this->iCoef * z);
+        T tZ = scale * (this->iCoef * y - jCoef * x);
+        T rX = x + this->real * tX + jCoef * tZ - kCoef * tY;
+        T rY = y + this->real * tY + kCoef * tX - this->iCoef * tZ;
+        T rZ = z + this->real * tZ + this->iCoef * tY - jCoef * tX;
+        x = rX;
+        y = rY;
+        z = rZ;
+    }
+
+    NUMBER_CONSTEXPR T getJ() const {
         return jCoef;
     }
 
-    double getK() const {
+    NUMBER_CONSTEXPR T getK() const {
         return kCoef;
     }
 
-    void setJ(double _jCoef) {
+    NUMBER_CONSTEXPR void setJ(T _jCoef) {
         jCoef = _jCoef;
     }
     
-    void setK(double _kCoef) {
+    NUMBER_CONSTEXPR void setK(T _kCoef) {
         kCoef = _kCoef;
     }
 
-    void setImaginary(const std::vector<double>& imagPart) override {
+    void setImaginary(const std::vector<T>& imagPart) override {
         if (imagPart.size() != 3) {
             std::cout << 
             "Expected three imaginary coefficients, but got " << 
             imagPart.size() << std::endl;
             return;
         }
-        iCoef = imagPart[0];
+        this->iCoef = imagPart[0];
         jCoef = imagPart[1];
         kCoef = imagPart[2];
     }
 
-    bool operator== (const Quaternion &obj) const {
+    NUMBER_CONSTEXPR bool operator== (const BasicQuaternion &obj) const {
         if (
-            real == obj.real &&
-            iCoef == obj.iCoef &&
+            this->real == obj.real &&
+            this->iCoef == obj.iCoef &&
             jCoef == obj.jCoef &&
             kCoef == obj.kCoef
         ) return true;
         return false;
     }
     
-    bool operator== (const ComplexNumber &obj) const {
+    NUMBER_CONSTEXPR bool operator== (const BasicComplexNumber<T> &obj) const {
         if (
-            real == obj.getReal() &&
-            iCoef == obj.getI() &&
+            this->real == obj.getReal() &&
+            this->iCoef == obj.getI() &&
             jCoef == 0 &&
             kCoef == 0
         ) return true;
         return false;
     }
 
-    bool operator== (double num) const {
+    NUMBER_CONSTEXPR bool operator== (T num) const {
         if (
-            real == num &&
-            iCoef == 0 &&
+            this->real == num &&
+            this->iCoef == 0 &&
             jCoef == 0 &&
             kCoef == 0
         ) return true;
         return false;
     }
 
-    Quaternion operator+= (const Quaternion &obj) {
-        real += obj.real;
-        iCoef += obj.iCoef;
+    NUMBER_CONSTEXPR BasicQuaternion& operator+= (const BasicQuaternion &obj) {
+        this->real += obj.real;
+        this->iCoef += obj.iCoef;
         jCoef += obj.jCoef;
         kCoef += obj.kCoef;
         return *this;
     }
 
-    Quaternion operator+= (const ComplexNumber &obj) {
-        real += obj.getReal();
-        iCoef += obj.getI();
+    NUMBER_CONSTEXPR BasicQuaternion& operator+= (
+        const BasicComplexNumber<T> &obj) {
+        this->real += obj.getReal();
+        this->iCoef += obj.getI();
         return *this;
     }
 
-    Quaternion operator+= (double num) {
-        real += num;
+    NUMBER_CONSTEXPR BasicQuaternion& operator+= (T num) {
+        this->real += num;
         return *this;
     }
 
-    Quaternion operator+ (const ComplexNumber &obj) const {
-        Quaternion tmp(*this);
+    NUMBER_CONSTEXPR BasicQuaternion operator+ (
+        const BasicComplexNumber<T> &obj) const {
+        BasicQuaternion tmp(*this);
         tmp += obj;
         return tmp;
     }
 
-    Quaternion operator+ (const Quaternion &obj) const {
-        Quaternion tmp(*this);
+    NUMBER_CONSTEXPR BasicQuaternion operator+ (
+        const BasicQuaternion &obj) const {
+        BasicQuaternion tmp(*this);
         tmp += obj;
         return tmp;
     }
 
-    Quaternion operator+ (double num) const {
-        Quaternion tmp(*this);
+    NUMBER_CONSTEXPR BasicQuaternion operator+ (T num) const {
+        BasicQuaternion tmp(*this);
         tmp += num;
         return tmp;
     }
 
-    Quaternion operator-= (const Quaternion &obj) {
-        real -= obj.real;
-        iCoef -= obj.iCoef;
+    NUMBER_CONSTEXPR BasicQuaternion& operator-= (const BasicQuaternion &obj) {
+        this->real -= obj.real;
+        this->iCoef -= obj.iCoef;
         jCoef -= obj.jCoef;
         kCoef -= obj.kCoef;
         return *this;
     }
 
-    Quaternion operator-= (const ComplexNumber &obj) {
-        real -= obj.getReal();
-        iCoef -= obj.getI();
+    NUMBER_CONSTEXPR BasicQuaternion& operator-= (
+        const BasicComplexNumber<T> &obj) {
+        this->real -= obj.getReal();
+        this->iCoef -= obj.getI();
         return *this;
     }
 
-    Quaternion operator-= (double num) {
-        real -= num;
+    NUMBER_CONSTEXPR BasicQuaternion& operator-= (T num) {
+        this->real -= num;
         return *this;
     }
 
-    Quaternion operator- (const Quaternion &obj) const {
-        Quaternion tmp(*this);
+    NUMBER_CONSTEXPR BasicQuaternion operator- (
+        const BasicQuaternion &obj) const {
+        BasicQuaternion tmp(*this);
         tmp -= obj;
         return tmp;
     }
 
-    Quaternion operator- (const ComplexNumber &obj) const {
-        Quaternion tmp(*this);
+    NUMBER_CONSTEXPR BasicQuaternion operator- (
+        const BasicComplexNumber<T> &obj) const {
+        BasicQuaternion tmp(*this);
         tmp -= obj;
         return tmp;
     }
 
-    Quaternion operator- (double num) const {
-        Quaternion tmp(*this);
+    NUMBER_CONSTEXPR BasicQuaternion operator- (T num) const {
+        BasicQuaternion tmp(*this);
         tmp -= num;
         return tmp;
     }
 
-    Quaternion operator= (const Quaternion &obj) {
-        real = obj.real;
-        iCoef = obj.iCoef;
+    NUMBER_CONSTEXPR BasicQuaternion& operator= (const BasicQuaternion &obj) {
+        this->real = obj.real;
+        this->iCoef = obj.iCoef;
         jCoef = obj.jCoef;
         kCoef = obj.kCoef;
         return *this;
     }
 
-    Quaternion operator= (const ComplexNumber &obj) {
-        real = obj.getReal();
-        iCoef = obj.getI();
+    NUMBER_CONSTEXPR BasicQuaternion& operator= (
+        const BasicComplexNumber<T> &obj) {
+        this->real = obj.getReal();
+        this->iCoef = obj.getI();
         jCoef = 0;
         kCoef = 0;
         return *this;
     }
 
-    Quaternion operator= (double num) {
-        real = num;
-        iCoef = 0;
+    NUMBER_CONSTEXPR BasicQuaternion& operator= (T num) {
+        this->real = num;
+        this->iCoef = 0;
         jCoef = 0;
         kCoef = 0;
         return *this;
     }
 
-    Quaternion operator*= (const Quaternion &obj) {
-        double realRes = real * obj.real - iCoef * obj.iCoef -
+    NUMBER_CONSTEXPR BasicQuaternion& operator*= (const BasicQuaternion &obj) {
+        T realRes = this->real * obj.real - this->iCoef * obj.iCoef -
             jCoef * obj.jCoef - kCoef * obj.kCoef;
-        double iCoefRes = real * obj.iCoef + iCoef * obj.real +
+        T iCoefRes = this->real * obj.iCoef + this->iCoef * obj.real +
             jCoef * obj.kCoef - kCoef * obj.jCoef;
-        double jCoefRes = real * obj.jCoef - iCoef * obj.kCoef +
+        T jCoefRes = this->real * obj.jCoef - this->iCoef * obj.kCoef +
             jCoef * obj.real + kCoef * obj.iCoef;
-        double kCoefRes = real * obj.kCoef + iCoef * obj.jCoef -
+        T kCoefRes = this->real * obj.kCoef + this->iCoef * obj.jCoef -
             jCoef * obj.iCoef + kCoef * obj.real;
-        real = realRes;
-        iCoef = iCoefRes;
+        this->real = realRes;
+        this->iCoef = iCoefRes;
         jCoef = jCoefRes;
         kCoef = kCoefRes;
         return *this;
     }
 
-    Quaternion operator*= (const ComplexNumber &obj) {
-        double realRes = real * obj.getReal() - iCoef * obj.getI();
-        double iCoefRes = real * obj.getI() + iCoef * obj.getReal();
-        double jCoefRes = jCoef * obj.getReal() + kCoef * obj.getI();
-        double kCoefRes = -jCoef * obj.getI() + kCoef * obj.getReal();
-        real = realRes;
-        iCoef = iCoefRes;
+    NUMBER_CONSTEXPR BasicQuaternion& operator*= (
+        const BasicComplexNumber<T> &obj) {
+        T realRes = this->real * obj.getReal() - this->iCoef * obj.getI();
+        T iCoefRes = this->real * obj.getI() + this->iCoef * obj.getReal();
+        T jCoefRes = jCoef * obj.getReal() + kCoef * obj.getI();
+        T kCoefRes = -jCoef * obj.getI() + kCoef * obj.getReal();
+        this->real = realRes;
+        this->iCoef = iCoefRes;
         jCoef = jCoefRes;
         kCoef = kCoefRes;
         return *this;
     }
 
-    Quaternion operator*= (double num) {
-        real *= num;
-        iCoef *= num;
+    NUMBER_CONSTEXPR BasicQuaternion& operator*= (T num) {
+        this->real *= num;
+        this->iCoef *= num;
         jCoef *= num;
         kCoef *= num;
         return *this;
     }
 
-    Quaternion operator* (const Quaternion &obj) const {
-        Quaternion tmp(*this);
+    NUMBER_CONSTEXPR BasicQuaternion operator* (
+        const BasicQuaternion &obj) const {
+        BasicQuaternion tmp(*this);
         tmp *= obj;
         return tmp;
     }
 
-    Quaternion operator* (const ComplexNumber &obj) const {
-        Quaternion tmp(*this);
+    NUMBER_CONSTEXPR BasicQuaternion operator* (
+        const BasicComplexNumber<T> &obj) const {
+        BasicQuaternion tmp(*this);
         tmp *= obj;
         return tmp;
     }
 
-    Quaternion operator* (double num) const {
-        Quaternion tmp(*this);
+    NUMBER_CONSTEXPR BasicQuaternion operator* (T num) const {
+        BasicQuaternion tmp(*this);
         tmp *= num;
         return tmp;
     }
 
-    Quaternion operator/= (const Quaternion &obj) {
-        Quaternion reverse(obj.real, -obj.iCoef, -obj.jCoef, -obj.kCoef);
-        reverse /= (std::pow(obj.real, 2) + std::pow(obj.iCoef, 2) +
-                std::pow(obj.jCoef, 2) + std::pow(obj.kCoef, 2));
-        *this *= reverse;
-        return *this;
+    // умножение на обратное; у границ диапазона - на обратное к
+    // масштабированному делителю и затем на масштаб, чтобы не переполнялось
+    // промежуточное 1 / obj
+    NUMBER_CONSTEXPR BasicQuaternion& operator/= (const BasicQuaternion &obj) {
+        T squares = obj.norm();
+        if (isRegularNorm(squares)) {
+            T inverse = 1 / squares;
+            return *this *= BasicQuaternion(obj.real * inverse,
+                -obj.iCoef * inverse, -obj.jCoef * inverse,
+                -obj.kCoef * inverse);
+        }
+        T inverseScale = 0;
+        *this *= obj.scaledReciprocal(inverseScale);
+        return *this *= inverseScale;
     }
 
-    Quaternion operator/= (const ComplexNumber &obj) {
-        Quaternion reverse(obj.getReal(), -obj.getI(), 0, 0);
-        reverse /= (std::pow(obj.getReal(), 2) + std::pow(obj.getI(), 2));
-        *this *= reverse;
-        return *this;
+    NUMBER_CONSTEXPR BasicQuaternion& operator/= (
+        const BasicComplexNumber<T> &obj) {
+        return *this /= BasicQuaternion(obj);
     }
 
-    Quaternion operator/= (double num) {
-        real /= num;
-        iCoef /= num;
+    NUMBER_CONSTEXPR BasicQuaternion& operator/= (T num) {
+        this->real /= num;
+        this->iCoef /= num;
         jCoef /= num;
         kCoef /= num;
         return *this;
     }
 
-    Quaternion operator/ (const Quaternion &obj) const {
-        Quaternion tmp(*this);
+    NUMBER_CONSTEXPR BasicQuaternion operator/ (
+        const BasicQuaternion &obj) const {
+        BasicQuaternion tmp(*this);
         tmp /= obj;
         return tmp;
     }
 
-    Quaternion operator/ (const ComplexNumber &obj) const {
-        Quaternion tmp(*this);
+    NUMBER_CONSTEXPR BasicQuaternion operator/ (
+        const BasicComplexNumber<T> &obj) const {
+        BasicQuaternion tmp(*this);
         tmp /= obj;
         return tmp;
     }
 
-    Quaternion operator/ (double num) const {
-        Quaternion tmp(*this);
+    NUMBER_CONSTEXPR BasicQuaternion operator/ (T num) const {
+        BasicQuaternion tmp(*this);
         tmp /= num;
         return tmp;
     }
 private:
-    double jCoef;
-    double kCoef;
+    // обратное к числу, делённому на наибольшую по модулю компоненту;
+    // inverseScale - множитель, которым это обратное переводится в 1 / q
+    NUMBER_CONSTEXPR BasicQuaternion scaledReciprocal(T& inverseScale) const {
+        T scale = std::max(std::max(absoluteValue(this->real),
+            absoluteValue(this->iCoef)),
+            std::max(absoluteValue(jCoef), absoluteValue(kCoef)));
+        inverseScale = 1 / scale;
+        T scaledReal = this->real * inverseScale;
+        T scaledI = this->iCoef * inverseScale;
+        T scaledJ = jCoef * inverseScale;
+        T scaledK = kCoef * inverseScale;
+        T inverse = 1 / (scaledReal * scaledReal + scaledI * scaledI +
+            scaledJ * scaledJ + scaledK * scaledK);
+        return BasicQuaternion(scaledReal * inverse, -scaledI * inverse,
+            -scaledJ * inverse, -scaledK * inverse);
+    }
+
+    T jCoef;
+    T kCoef;
 };
 
-bool ComplexNumber::operator== (const Quaternion &obj) const {
-        if (
-            real == obj.getReal() &&
-            iCoef == obj.getI() &&
-            obj.getJ() == 0 &&
-            obj.getK() == 0
-        ) return true;
-        return false;
-    }
+template <class T>
+NUMBER_CONSTEXPR bool BasicComplexNumber<T>::operator== (
+    const BasicQuaternion<T> &obj) const {
+    if (
+        real == obj.getReal() &&
+        iCoef == obj.getI() &&
+        obj.getJ() == 0 &&
+        obj.getK() == 0
+    ) return true;
+    return false;
+}
 
-Quaternion ComplexNumber::operator+ (const Quaternion &obj) const {
-    Quaternion tmp(*this);
+template <class T>
+NUMBER_CONSTEXPR BasicQuaternion<T> BasicComplexNumber<T>::operator+ (
+    const BasicQuaternion<T> &obj) const {
+    BasicQuaternion<T> tmp(*this);
     tmp += obj;
     return tmp;
 }
 
-Quaternion ComplexNumber::operator* (const Quaternion &obj) const {
-    Quaternion tmp(*this);
+template <class T>
+NUMBER_CONSTEXPR BasicQuaternion<T> BasicComplexNumber<T>::operator* (
+    const BasicQuaternion<T> &obj) const {
+    BasicQuaternion<T> tmp(*this);
     tmp *= obj;
     return tmp;
 }
 
-Quaternion ComplexNumber::operator- (const Quaternion &obj) const {
-    Quaternion tmp(*this);
+template <class T>
+NUMBER_CONSTEXPR BasicQuaternion<T> BasicComplexNumber<T>::operator- (
+    const BasicQuaternion<T> &obj) const {
+    BasicQuaternion<T> tmp(*this);
     tmp -= obj;
     return tmp;
 }
 
-Quaternion ComplexNumber::operator/ (const Quaternion &obj) const {
-    Quaternion tmp(*this);
+template <class T>
+NUMBER_CONSTEXPR BasicQuaternion<T> BasicComplexNumber<T>::operator/ (
+    const BasicQuaternion<T> &obj) const {
+    BasicQuaternion<T> tmp(*this);
     tmp /= obj;
     return tmp;
 }
 
+
+template class BasicComplexNumber<float>;
+template class BasicComplexNumber<double>;
+template class BasicComplexNumber<long double>;
+template class BasicQuaternion<float>;
+template class BasicQuaternion<double>;
+template class BasicQuaternion<long double>;
+
+// Элементарные функции. Кватернион q = w + v на оси v / |v| ведёт себя как
+// комплексное число w + i |v|, поэтому его функции - комплексные формулы
+// с |v| вместо мнимой части. Ветви главные, разрез по отрицательной
+// вещественной оси; для отрицательного вещественного кватерниона log и
+// sqrt выбирают ось i, как и ComplexNumber.
+template <class T>
+BasicComplexNumber<T> exp(const BasicComplexNumber<T>& z) {
+    T magnitude = std::exp(z.getReal());
+    return BasicComplexNumber<T>(magnitude * std::cos(z.getI()),
+        magnitude * std::sin(z.getI()));
+}
+
+template <class T>
+BasicComplexNumber<T> log(const BasicComplexNumber<T>& z) {
+    return BasicComplexNumber<T>(std::log(std::hypot(z.getReal(), z.getI())),
+        std::atan2(z.getI(), z.getReal()));
+}
+
+template <class T>
+BasicComplexNumber<T> sqrt(const BasicComplexNumber<T>& z) {
+    T root = std::sqrt((std::hypot(z.getReal(), z.getI()) +
+        std::fabs(z.getReal())) / 2);
+    if (root == 0) {
+        return BasicComplexNumber<T>();
+    }
+    if (z.getReal() >= 0) {
+        return BasicComplexNumber<T>(root, z.getI() / (2 * root));
+    }
+    return BasicComplexNumber<T>(std::fabs(z.getI()) / (2 * root),
+        std::copysign(root, z.getI()));
+}
+
+// Тип показателя не выводится из аргумента: T берётся из основания, и
+// pow(BasicQuaternion<float>, 2.5) или pow(z, 2) не ломают вывод шаблона
+template <class T>
+struct PowerExponent {
+    typedef T type;
+};
+
+// z^p = exp(p log z); 0^p = 0 при p > 0
+template <class T>
+BasicComplexNumber<T> pow(const BasicComplexNumber<T>& z,
+    typename PowerExponent<T>::type p) {
+    if (p == 0) {
+        return BasicComplexNumber<T>(1, 0);
+    }
+    if (z.getReal() == 0 && z.getI() == 0 && p > 0) {
+        return BasicComplexNumber<T>();
+    }
+    BasicComplexNumber<T> power = log(z);
+    power *= p;
+    return exp(power);
+}
+
+template <class T>
+BasicComplexNumber<T> pow(const BasicComplexNumber<T>& z,
+    const BasicComplexNumber<T>& p) {
+    if (p.getReal() == 0 && p.getI() == 0) {
+        return BasicComplexNumber<T>(1, 0);
+    }
+    if (z.getReal() == 0 && z.getI() == 0 && p.getReal() > 0) {
+        return BasicComplexNumber<T>();
+    }
+    BasicComplexNumber<T> power = log(z);
+    power *= p;
+    return exp(power);
+}
+
+template <class T>
+BasicComplexNumber<T> sin(const BasicComplexNumber<T>& z) {
+    return BasicComplexNumber<T>(
+        std::sin(z.getReal()) * std::cosh(z.getI()),
+        std::cos(z.getReal()) * std::sinh(z.getI()));
+}
+
+template <class T>
+BasicComplexNumber<T> cos(const BasicComplexNumber<T>& z) {
+    return BasicComplexNumber<T>(
+        std::cos(z.getReal()) * std::cosh(z.getI()),
+        -std::sin(z.getReal()) * std::sinh(z.getI()));
+}
+
+// |v| - модуль векторной части
+template <class T>
+T vectorLength(const BasicQuaternion<T>& q) {
+    return std::sqrt(q.getI() * q.getI() + q.getJ() * q.getJ() +
+        q.getK() * q.getK());
+}
+
+// (real, v * vectorScale)
+template <class T>
+BasicQuaternion<T> alongVector(const BasicQuaternion<T>& q, T real,
+    T vectorScale) {
+    return BasicQuaternion<T>(real, q.getI() * vectorScale,
+        q.getJ() * vectorScale, q.getK() * vectorScale);
+}
+
+template <class T>
+BasicQuaternion<T> exp(const BasicQuaternion<T>& q) {
+    T angle = vectorLength(q);
+    T magnitude = std::exp(q.getReal());
+    return alongVector(q, magnitude * std::cos(angle), angle > 0 ?
+        magnitude * std::sin(angle) / angle : magnitude);
+}
+
+template <class T>
+BasicQuaternion<T> log(const BasicQuaternion<T>& q) {
+    T angle = vectorLength(q);
+    T real = std::log(std::hypot(q.getReal(), angle));
+    T phase = std::atan2(angle, q.getReal());
+    if (angle > 0) {
+        return alongVector(q, real, phase / angle);
+    }
+    return BasicQuaternion<T>(real, phase, 0, 0);
+}
+
+template <class T>
+BasicQuaternion<T> sqrt(const BasicQuaternion<T>& q) {
+    T angle = vectorLength(q);
+    T root = std::sqrt((std::hypot(q.getReal(), angle) +
+        std::fabs(q.getReal())) / 2);
+    if (root == 0) {
+        return BasicQuaternion<T>();
+    }
+    if (q.getReal() >= 0) {
+        return alongVector(q, root, 1 / (2 * root));
+    }
+    if (angle > 0) {
+        return alongVector(q, angle / (2 * root), root / angle);
+    }
+    return BasicQuaternion<T>(0, root, 0, 0);
+}
+
+// q^p = exp(p log q), без повторного умножения; 0^p = 0 при p > 0
+template <class T>
+BasicQuaternion<T> pow(const BasicQuaternion<T>& q,
+    typename PowerExponent<T>::type p) {
+    if (p == 0) {
+        return BasicQuaternion<T>(1, 0, 0, 0);
+    }
+    if (q.norm() == 0 && p > 0) {
+        return BasicQuaternion<T>();
+    }
+    BasicQuaternion<T> power = log(q);
+    power *= p;
+    return exp(power);
+}
+
+template <class T>
+BasicQuaternion<T> sin(const BasicQuaternion<T>& q) {
+    T angle = vectorLength(q);
+    T shape = angle > 0 ? std::sinh(angle) / angle : 1;
+    return alongVector(q, std::sin(q.getReal()) * std::cosh(angle),
+        std::cos(q.getReal()) * shape);
+}
+
+template <class T>
+BasicQuaternion<T> cos(const BasicQuaternion<T>& q) {
+    T angle = vectorLength(q);
+    T shape = angle > 0 ? std::sinh(angle) / angle : 1;
+    return alongVector(q, std::cos(q.getReal()) * std::cosh(angle),
+        -std::sin(q.getReal()) * shape);
+}
+
+typedef BasicComplexNumber<double> ComplexNumber;
+typedef BasicQuaternion<double> Quaternion;
 enum Operations {OP_ADD, OP_SUBTRACT, OP_MULTIPLY, OP_DIVIDE};
 
+// Инструментирование Calculator включается макросом CALCULATOR_STATS; без
+// него ни счётчиков, ни замеров времени в коде нет. Счётчики точные, время
+// замеряется у каждого CALCULATOR_STATS_SAMPLE-го вызова: чтение таймера
+// под виртуализацией стоит десятки наносекунд.
+#if defined(CALCULATOR_STATS)
+#if !defined(CALCULATOR_STATS_SAMPLE)
+#define CALCULATOR_STATS_SAMPLE 16
+#endif
+// такты TSC на x86-64, иначе наносекунды steady_clock
+inline uint64_t calculatorTicks() {
+#if defined(__x86_64__) && defined(__GNUC__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// Лог-линейная гистограмма: значения до 8 - по одному в корзине, дальше
+// каждая степень двойки делится на 8 равных корзин (ошибка до 12.5%).
+class LatencyHistogram {
+public:
+    static const int SUB_BUCKETS = 8;
+    static const int BUCKET_COUNT = 62 * SUB_BUCKETS;
+
+    LatencyHistogram() {
+        reset();
+    }
+
+    void reset() {
+        std::fill(counts, counts + BUCKET_COUNT, 0);
+        total = 0;
+    }
+
+    void record(uint64_t value) {
+        ++counts[bucketIndex(value)];
+        ++total;
+    }
+
+    uint64_t getCount() const {
+        return total;
+    }
+
+    // нижняя граница корзины, в которую попадает доля quantile значений
+    uint64_t percentile(double quantile) const {
+        uint64_t rank = uint64_t(std::ceil(quantile * total));
+        uint64_t seen = 0;
+        for (int i = 0; i < BUCKET_COUNT; ++i) {
+            seen += counts[i];
+            if (seen >= rank && counts[i]) {
+                return bucketLowerBound(i);
+            }
+        }
+        return 0;
+    }
+
+    void writeJson(std::ostream& out) const {
+        out << "[";
+        bool first = true;
+        for (int i = 0; i < BUCKET_COUNT; ++i) {
+            if (counts[i]) {
+                out << (first ? "" : ", ") << "[" << bucketLowerBound(i) <<
+                    ", " << counts[i] << "]";
+                first = false;
+            }
+        }
+        out << "]";
+    }
+
+    static int bucketIndex(uint64_t value) {
+        if (value < SUB_BUCKETS) {
+            return int(value);
+        }
+        int exponent = 63 - __builtin_clzll(value);
+        return (exponent - 2) * SUB_BUCKETS +
+            int((value >> (exponent - 3)) & (SUB_BUCKETS - 1));
+    }
+
+    static uint64_t bucketLowerBound(int index) {
+        if (index < SUB_BUCKETS) {
+            return index;
+        }
+        int exponent = index / SUB_BUCKETS + 2;
+        return uint64_t(SUB_BUCKETS + index % SUB_BUCKETS) << (exponent - 3);
+    }
+private:
+    uint64_t counts[BUCKET_COUNT];
+    uint64_t total;
+};
+
+// Виды операндов пары: первая буква - левый операнд (вершина стека)
+enum CalculatorPromotion {CP_CC, CP_CQ, CP_QC, CP_QQ};
+
+struct CalculatorStats {
+    uint64_t operations[4];
+    uint64_t promotions[4];
+    uint64_t divideByZero;
+    uint64_t emptyStack;
+    uint64_t oneOperand;
+    uint64_t peakDepth;
+    uint64_t allocations;
+    uint64_t allocatedBytes;
+    uint64_t calls;
+    LatencyHistogram latency[4];
+
+    CalculatorStats() {
+        reset();
+    }
+
+    void reset() {
+        std::fill(operations, operations + 4, 0);
+        std::fill(promotions, promotions + 4, 0);
+        divideByZero = emptyStack = oneOperand = 0;
+        peakDepth = allocations = allocatedBytes = calls = 0;
+        for (LatencyHistogram& histogram : latency) {
+            histogram.reset();
+        }
+    }
+
+    void writeJson(std::ostream& out) const {
+        const char* operationNames[] = {"add", "subtract", "multiply",
+            "divide"};
+        const char* promotionNames[] = {"CC", "CQ", "QC", "QQ"};
+        out << "{\"operations\": {";
+        for (int i = 0; i < 4; ++i) {
+            out << (i ? ", " : "") << "\"" << operationNames[i] << "\": " <<
+                operations[i];
+        }
+        out << "}, \"promotions\": {";
+        for (int i = 0; i < 4; ++i) {
+            out << (i ? ", " : "") << "\"" << promotionNames[i] << "\": " <<
+                promotions[i];
+        }
+        out << "}, \"divide_by_zero\": " << divideByZero <<
+            ", \"empty_stack\": " << emptyStack <<
+            ", \"one_operand\": " << oneOperand <<
+            ", \"peak_depth\": " << peakDepth <<
+            ", \"allocations\": " << allocations <<
+            ", \"allocated_bytes\": " << allocatedBytes <<
+            ", \"latency_sample\": " << CALCULATOR_STATS_SAMPLE <<
+            ", \"latency_unit\": \"" <<
+#if defined(__x86_64__) && defined(__GNUC__)
+            "tsc_ticks" <<
+#else
+            "ns" <<
+#endif
+            "\", \"latency\": {";
+        for (int i = 0; i < 4; ++i) {
+            out << (i ? ", " : "") << "\"" << operationNames[i] << "\": ";
+            latency[i].writeJson(out);
+        }
+        out << "}}";
+    }
+};
+
+// замеряет вызов calculate целиком, включая ранние выходы
+class CalculatorStatsTimer {
+public:
+    CalculatorStatsTimer(CalculatorStats& _stats, Operations _operation) :
+        stats(_stats), operation(_operation),
+        sampled(stats.calls++ % CALCULATOR_STATS_SAMPLE == 0),
+        start(sampled ? calculatorTicks() : 0) {}
+
+    ~CalculatorStatsTimer() {
+        if (sampled) {
+            stats.latency[operation].record(calculatorTicks() - start);
+        }
+    }
+private:
+    CalculatorStats& stats;
+    Operations operation;
+    bool sampled;
+    uint64_t start;
+};
+
+#define CALCULATOR_STAT(statement) statement
+#else
+#define CALCULATOR_STAT(statement)
+#endif
+
+class CalculationCache;
+
+// Узел стека Calculator. Узлы неизменяемы, хвост стека общий у всех
+// копий калькулятора и живёт, пока на него ссылается хоть одна из них.
+struct CalculatorNode {
+    ComplexNumber* number;
+    std::shared_ptr<const CalculatorNode> next;
+
+    CalculatorNode(ComplexNumber* _number,
+        std::shared_ptr<const CalculatorNode> _next) :
+        number(_number), next(std::move(_next)) {}
+};
+
+// Узел списка результатов, посчитанных калькулятором и его предками по
+// копированию; владеет числом
+struct CalculatorResult {
+    std::unique_ptr<ComplexNumber> number;
+    std::shared_ptr<const CalculatorResult> next;
+
+    CalculatorResult(ComplexNumber* _number,
+        std::shared_ptr<const CalculatorResult> _next) :
+        number(_number), next(std::move(_next)) {}
+};
+
+// Отпускает список без рекурсии по next: пока голова ничья, кроме нас,
+// сначала берётся ссылка на следующий узел, так что узел умирает один
+template <class Node>
+void releasePersistentList(std::shared_ptr<const Node>& head) {
+    while (head && head.use_count() == 1) {
+        std::shared_ptr<const Node> next = head->next;
+        head = std::move(next);
+    }
+    head.reset();
+}
+
+// Стек - персистентный список, поэтому копия калькулятора стоит O(1):
+// копия и оригинал делят стек и дальше расходятся независимо. Результаты
+// операций живут, пока жив калькулятор или любая копия, сделанная после
+// их появления: указатель из top() не повисает, когда число ушло со
+// стека или оригинал уничтожен. Счётчики ссылок атомарны, и копии можно
+// отдавать в другие потоки.
 class Calculator {
 public:
-    Calculator() {
-        numbers = std::stack<ComplexNumber*>();
+    Calculator() : depth(0), cache(nullptr) {}
+
+    Calculator(const std::stack<ComplexNumber*>& stack) :
+        depth(0), cache(nullptr) {
+        std::stack<ComplexNumber*> rest = stack;
+        std::vector<ComplexNumber*> bottomUp;
+        for (; !rest.empty(); rest.pop()) {
+            bottomUp.push_back(rest.top());
+        }
+        for (size_t i = bottomUp.size(); i-- > 0;) {
+            push(*bottomUp[i]);
+        }
     }
 
-    Calculator(const std::stack<ComplexNumber*>& stack) {
-        numbers = stack;
+    Calculator(const Calculator& other) :
+        numbers(other.numbers),
+        results(other.results),
+        depth(other.depth),
+        cache(other.cache) {
+        CALCULATOR_STAT(stats = other.stats);
     }
 
-    Calculator(const Calculator& other) {
-        numbers = other.numbers;
+    Calculator& operator= (const Calculator& other) {
+        std::shared_ptr<const CalculatorNode> otherNumbers = other.numbers;
+        std::shared_ptr<const CalculatorResult> otherResults = other.results;
+        releasePersistentList(numbers);
+        releasePersistentList(results);
+        numbers = std::move(otherNumbers);
+        results = std::move(otherResults);
+        depth = other.depth;
+        cache = other.cache;
+        CALCULATOR_STAT(stats = other.stats);
+        return *this;
     }
 
     ~Calculator() {
-        while (numbersToDel.size() > 0) {
-            ComplexNumber* toDel = numbersToDel.top();
-            numbersToDel.pop();
-            delete toDel;
-        }
+        releasePersistentList(numbers);
+        releasePersistentList(results);
         std::cout << "new items deleted" << std::endl;
     }
 
     void push(ComplexNumber& number) {
-        numbers.push(&number);
+        numbers = std::make_shared<const CalculatorNode>(&number,
+            std::move(numbers));
+        ++depth;
+        CALCULATOR_STAT(stats.peakDepth =
+            std::max<uint64_t>(stats.peakDepth, depth));
     }
 
     ComplexNumber* top() const {
-        return numbers.top();
+        return numbers->number;
     }
 
     int size() const {
-        return numbers.size();
+        return depth;
+    }
+
+    // результаты операций берутся из cache и кладутся в него; nullptr -
+    // без кэша. Кэш не принадлежит калькулятору и может быть общим.
+    void setCache(CalculationCache* _cache) {
+        cache = _cache;
+    }
+
+#if defined(CALCULATOR_STATS)
+    const CalculatorStats& getStats() const {
+        return stats;
+    }
+
+    void resetStats() {
+        stats.reset();
     }
+#endif
 
     void calculate(Operations operation) {
-        if (numbers.size() == 0) {
+        CALCULATOR_STAT(CalculatorStatsTimer timer(stats, operation));
+        CALCULATOR_STAT(++stats.operations[operation]);
+        if (depth == 0) {
+            CALCULATOR_STAT(++stats.emptyStack);
             std::cout << "the stack is empty" << std::endl;
             return;
         }
-        if (numbers.size() == 1) {
+        if (depth == 1) {
+            CALCULATOR_STAT(++stats.oneOperand);
             std::cout << "only one operand in stack" << std::endl;
             return;
         }
         ComplexNumber* lOperand = top();
-        numbers.pop();
+        pop();
         ComplexNumber* rOperand = top();
-        numbers.pop();
+        pop();
         bool isQuaternion = (lOperand->getKind() == CK_QUATERNION ||
             rOperand->getKind() == CK_QUATERNION);
+        CALCULATOR_STAT(++stats.promotions[
+            (lOperand->getKind() == CK_QUATERNION) * 2 +
+            (rOperand->getKind() == CK_QUATERNION)]);
+        if (cache != nullptr) {
+            calculateCached(operation, lOperand, rOperand);
+            return;
+        }
         switch (operation) {
         case OP_ADD:
             if (isQuaternion) {
                 Quaternion* res = new Quaternion;
-                *res = *(Quaternion*)lOperand + *(Quaternion*)rOperand;
+                *res = promote(lOperand) + promote(rOperand);
                 pushNew(*res);
             } else {
                 ComplexNumber* res = new ComplexNumber;
@@ -579,7 +1234,7 @@ public:
         case OP_SUBTRACT:
             if (isQuaternion) {
                 Quaternion* res = new Quaternion;
-                *res = *(Quaternion*)lOperand - *(Quaternion*)rOperand;
+                *res = promote(lOperand) - promote(rOperand);
                 pushNew(*res);
             } else {
                 ComplexNumber* res = new ComplexNumber;
@@ -590,7 +1245,7 @@ public:
         case OP_MULTIPLY:
             if (isQuaternion) {
                 Quaternion* res = new Quaternion;
-                *res = *(Quaternion*)lOperand * *(Quaternion*)rOperand;
+                *res = promote(lOperand) * promote(rOperand);
                 pushNew(*res);
             } else {
                 ComplexNumber* res = new ComplexNumber;
@@ -600,6 +1255,7 @@ public:
             break;
         case OP_DIVIDE:
             if (*rOperand == 0) {
+                CALCULATOR_STAT(++stats.divideByZero);
                 std::cout << "can't divide by 0" << std::endl;
                 push(*rOperand);
                 push(*lOperand);
@@ -607,7 +1263,7 @@ public:
             }
             if (isQuaternion) {
                 Quaternion* res = new Quaternion;
-                *res = *(Quaternion*)lOperand / *(Quaternion*)rOperand;
+                *res = promote(lOperand) / promote(rOperand);
                 pushNew(*res);
             } else {
                 ComplexNumber* res = new ComplexNumber;
@@ -618,82 +1274,7794 @@ public:
         }
     }
 private:
-    std::stack<ComplexNumber*> numbers;
-    std::stack<ComplexNumber*> numbersToDel;
+    std::shared_ptr<const CalculatorNode> numbers;
+    std::shared_ptr<const CalculatorResult> results;
+    int depth;
+    CalculationCache* cache;
+#if defined(CALCULATOR_STATS)
+    CalculatorStats stats;
+#endif
+
+    void calculateCached(Operations operation, ComplexNumber* lOperand,
+        ComplexNumber* rOperand);
 
     void pushNew(ComplexNumber& num) {
+        CALCULATOR_STAT(++stats.allocations);
+        CALCULATOR_STAT(stats.allocatedBytes += num.getKind() ==
+            CK_QUATERNION ? sizeof(Quaternion) : sizeof(ComplexNumber));
+        results = std::make_shared<const CalculatorResult>(&num,
+            std::move(results));
         push(num);
-        numbersToDel.push(&num);
+    }
+
+    void pop() {
+        numbers = numbers->next;
+        --depth;
+    }
+
+    // комплексный операнд дополняется нулевыми j и k, а не читается
+    // за пределами объекта
+    static Quaternion promote(const ComplexNumber* number) {
+        return number->getKind() == CK_QUATERNION ?
+            *static_cast<const Quaternion*>(number) : Quaternion(*number);
     }
 };
 
-int main() {
-    ComplexNumber a;
-    assert(a.getReal() == 0);
-    assert(a.getI() == 0);
-    ComplexNumber b(1, 2);
-    assert(b.getReal() == 1);
-    assert(b.getI() == 2);
-    ComplexNumber c(b);
-    assert(c.getReal() == 1);
-    assert(c.getI() == 2);
-    c.setI(5);
-    c.setReal(4);
-    assert(c.getReal() == 4);
-    assert(c.getI() == 5);
-    c.setImaginary({6});
-    assert(c.getI() == 6);
-    
-    Quaternion qu1;
-    assert(qu1.getReal() == 0);
-    assert(qu1.getI() == 0);
-    assert(qu1.getJ() == 0);
-    assert(qu1.getK() == 0);
-    Quaternion qu2(1, -2, 3, -4);
-    Quaternion qu3(qu2);
+// компоненты числа без vptr; у комплексного j и k равны нулю
+struct Components {
+    double real;
+    double iCoef;
+    double jCoef;
+    double kCoef;
+};
 
-    assert(qu2.getReal() == 1);
-    assert(qu2.getI() == -2);
-    assert(qu2.getJ() == 3);
-    assert(qu2.getK() == -4);
-    assert(qu2.getReal() == qu3.getReal());
-    assert(qu2.getI() == qu3.getI());
-    qu1.setReal(1);
-    assert(qu1.getReal() == 1);
-    qu1.setI(10);
-    qu1.setJ(11);
-    qu1.setK(12);
-    assert(qu1.getI() == 10);
-    assert(qu1.getJ() == 11);
-    assert(qu1.getK() == 12);
-    qu1.setImaginary({1, 5, 9});
-    assert(qu1.getI() == 1);
-    assert(qu1.getJ() == 5);
-    assert(qu1.getK() == 9);
-    assert(a.getKind() == CK_COMPLEX_NUMBER);
-    assert(qu1.getKind() == CK_QUATERNION);
-    ComplexNumber* temp = &qu1;
-    assert(temp->getKind() == CK_QUATERNION);
+// Делитель, на котором Calculator::calculate печатает "can't divide by 0":
+// *rOperand == 0 сравнивает через ComplexNumber только real и i, поэтому
+// кватернион (0, 0, j, k) тоже считается нулём
+constexpr bool isCalculatorZeroDivisor(const Components& a) {
+    return a.real == 0 && a.iCoef == 0;
+}
 
-    ComplexNumber c1(2, 3);
-    ComplexNumber c2(4, 5);
-    ComplexNumber c3(2, 3);
-    ComplexNumber c4(0, 0);
+constexpr Components addComponents(const Components& a, const Components& b) {
+    Components res = {a.real + b.real, a.iCoef + b.iCoef,
+        a.jCoef + b.jCoef, a.kCoef + b.kCoef};
+    return res;
+}
 
-    assert(c1 == c3);
-    assert(!(c1 == c2));
-    assert(c4 == 0);
-    assert(!(c1 == c4));
+constexpr Components subtractComponents(const Components& a,
+    const Components& b) {
+    Components res = {a.real - b.real, a.iCoef - b.iCoef,
+        a.jCoef - b.jCoef, a.kCoef - b.kCoef};
+    return res;
+}
 
-    ComplexNumber c5 = c1 + c2;
-    assert(c5 == ComplexNumber(6, 8));
-    ComplexNumber c6 = c1 + 2;
-    assert(c6 == ComplexNumber(4, 3));
+constexpr Components multiplyComplexComponents(const Components& a,
+    const Components& b) {
+    Components res = {a.real * b.real - a.iCoef * b.iCoef,
+        a.real * b.iCoef + a.iCoef * b.real, 0, 0};
+    return res;
+}
 
-    ComplexNumber c7 = c1 - c2;
-    assert(c7 == ComplexNumber(-2, -2));
-    ComplexNumber c8 = c1 - 2;
-    assert(c8 == ComplexNumber(0, 3));
+constexpr Components multiplyQuaternionComponents(const Components& a,
+    const Components& b) {
+    Components res = {
+        a.real * b.real - a.iCoef * b.iCoef -
+            a.jCoef * b.jCoef - a.kCoef * b.kCoef,
+        a.real * b.iCoef + a.iCoef * b.real +
+            a.jCoef * b.kCoef - a.kCoef * b.jCoef,
+        a.real * b.jCoef - a.iCoef * b.kCoef +
+            a.jCoef * b.real + a.kCoef * b.iCoef,
+        a.real * b.kCoef + a.iCoef * b.jCoef -
+            a.jCoef * b.iCoef + a.kCoef * b.real
+    };
+    return res;
+}
+
+// та же последовательность операций, что в ComplexNumber::operator/=
+constexpr Components divideComplexComponents(const Components& a,
+    const Components& b) {
+    double norm = b.real * b.real + b.iCoef * b.iCoef;
+    if (isRegularNorm(norm)) {
+        double inverse = 1 / norm;
+        Components reverse = {b.real * inverse, -b.iCoef * inverse, 0, 0};
+        return multiplyComplexComponents(a, reverse);
+    }
+    bool wide = absoluteValue(b.real) >= absoluteValue(b.iCoef);
+    double larger = wide ? b.real : b.iCoef;
+    double smaller = wide ? b.iCoef : b.real;
+    double ratio = smaller / larger;
+    double inverse = 1 / (larger + smaller * ratio);
+    double first = wide ? a.real : a.iCoef;
+    double second = wide ? a.iCoef : a.real;
+    Components res = {
+        (first + second * ratio) * inverse,
+        (wide ? second - first * ratio : first * ratio - second) * inverse,
+        0, 0
+    };
+    return res;
+}
+
+// как Quaternion::scaledReciprocal
+constexpr Components scaledReciprocalComponents(const Components& b,
+    double& inverseScale) {
+    double scale = std::max(std::max(absoluteValue(b.real),
+        absoluteValue(b.iCoef)),
+        std::max(absoluteValue(b.jCoef), absoluteValue(b.kCoef)));
+    inverseScale = 1 / scale;
+    double scaledReal = b.real * inverseScale;
+    double scaledI = b.iCoef * inverseScale;
+    double scaledJ = b.jCoef * inverseScale;
+    double scaledK = b.kCoef * inverseScale;
+    double inverse = 1 / (scaledReal * scaledReal + scaledI * scaledI +
+        scaledJ * scaledJ + scaledK * scaledK);
+    Components res = {scaledReal * inverse, -scaledI * inverse,
+        -scaledJ * inverse, -scaledK * inverse};
+    return res;
+}
+
+constexpr Components scaleComponents(const Components& a, double num) {
+    Components res = {a.real * num, a.iCoef * num,
+        a.jCoef * num, a.kCoef * num};
+    return res;
+}
+
+constexpr Components conjugateComponents(const Components& a, double num) {
+    Components res = {a.real * num, -a.iCoef * num,
+        -a.jCoef * num, -a.kCoef * num};
+    return res;
+}
+
+// как Quaternion::reciprocal
+constexpr Components reciprocalQuaternionComponents(const Components& b) {
+    double norm = b.real * b.real + b.iCoef * b.iCoef +
+        b.jCoef * b.jCoef + b.kCoef * b.kCoef;
+    if (isRegularNorm(norm)) {
+        return conjugateComponents(b, 1 / norm);
+    }
+    double inverseScale = 0;
+    Components res = scaledReciprocalComponents(b, inverseScale);
+    return scaleComponents(res, inverseScale);
+}
+
+// как Quaternion::operator/=
+constexpr Components divideQuaternionComponents(const Components& a,
+    const Components& b) {
+    double norm = b.real * b.real + b.iCoef * b.iCoef +
+        b.jCoef * b.jCoef + b.kCoef * b.kCoef;
+    if (isRegularNorm(norm)) {
+        return multiplyQuaternionComponents(a,
+            conjugateComponents(b, 1 / norm));
+    }
+    double inverseScale = 0;
+    Components reverse = scaledReciprocalComponents(b, inverseScale);
+    return scaleComponents(multiplyQuaternionComponents(a, reverse),
+        inverseScale);
+}
+
+class Operand {
+public:
+    Operand() :
+        kind(CK_COMPLEX_NUMBER), real(0), iCoef(0), jCoef(0), kCoef(0) {}
+
+    Operand(const ComplexNumber& number) :
+        kind(number.getKind()),
+        real(number.getReal()),
+        iCoef(number.getI()),
+        jCoef(0),
+        kCoef(0) {
+        if (kind == CK_QUATERNION) {
+            const Quaternion& quaternion =
+                static_cast<const Quaternion&>(number);
+            jCoef = quaternion.getJ();
+            kCoef = quaternion.getK();
+        }
+    }
+
+    Operand(ComplexKind _kind, const Components& components) :
+        kind(_kind),
+        real(components.real),
+        iCoef(components.iCoef),
+        jCoef(components.jCoef),
+        kCoef(components.kCoef) {}
+
+    ComplexKind getKind() const {
+        return kind;
+    }
+
+    double getReal() const {
+        return real;
+    }
+
+    double getI() const {
+        return iCoef;
+    }
+
+    double getJ() const {
+        return jCoef;
+    }
+
+    double getK() const {
+        return kCoef;
+    }
+
+    Components toComponents() const {
+        Components res = {real, iCoef, jCoef, kCoef};
+        return res;
+    }
+
+    bool isZero() const {
+        return real == 0 && iCoef == 0 && jCoef == 0 && kCoef == 0;
+    }
+
+    ComplexNumber toComplexNumber() const {
+        return ComplexNumber(real, iCoef);
+    }
+
+    // комплексное число повышается до кватерниона с нулевыми j и k
+    Quaternion toQuaternion() const {
+        return Quaternion(real, iCoef, jCoef, kCoef);
+    }
+private:
+    ComplexKind kind;
+    double real;
+    double iCoef;
+    double jCoef;
+    double kCoef;
+};
+
+// Calculator, хранящий операнды по значению: результаты пишутся прямо
+// в слот стека, поэтому calculate() не выделяет память
+class ValueCalculator {
+public:
+    ValueCalculator() {}
+
+    ValueCalculator(size_t capacity) {
+        numbers.reserve(capacity);
+    }
+
+    void push(const ComplexNumber& number) {
+        numbers.push_back(Operand(number));
+    }
+
+    void push(const Operand& operand) {
+        numbers.push_back(operand);
+    }
+
+    const Operand& top() const {
+        return numbers.back();
+    }
+
+    void pop() {
+        numbers.pop_back();
+    }
+
+    int size() const {
+        return numbers.size();
+    }
+
+    void calculate(Operations operation) {
+        if (numbers.size() == 0) {
+            std::cout << "the stack is empty" << std::endl;
+            return;
+        }
+        if (numbers.size() == 1) {
+            std::cout << "only one operand in stack" << std::endl;
+            return;
+        }
+        const Operand& lOperand = numbers[numbers.size() - 1];
+        const Operand& rOperand = numbers[numbers.size() - 2];
+        if (operation == OP_DIVIDE &&
+            isCalculatorZeroDivisor(rOperand.toComponents())) {
+            std::cout << "can't divide by 0" << std::endl;
+            return;
+        }
+        Operand res;
+        if (lOperand.getKind() == CK_QUATERNION ||
+            rOperand.getKind() == CK_QUATERNION) {
+            Quaternion lhs = lOperand.toQuaternion();
+            Quaternion rhs = rOperand.toQuaternion();
+            switch (operation) {
+            case OP_ADD:
+                res = Operand(lhs + rhs);
+                break;
+            case OP_SUBTRACT:
+                res = Operand(lhs - rhs);
+                break;
+            case OP_MULTIPLY:
+                res = Operand(lhs * rhs);
+                break;
+            case OP_DIVIDE:
+                res = Operand(lhs / rhs);
+                break;
+            }
+        } else {
+            ComplexNumber lhs = lOperand.toComplexNumber();
+            ComplexNumber rhs = rOperand.toComplexNumber();
+            switch (operation) {
+            case OP_ADD:
+                res = Operand(lhs + rhs);
+                break;
+            case OP_SUBTRACT:
+                res = Operand(lhs - rhs);
+                break;
+            case OP_MULTIPLY:
+                res = Operand(lhs * rhs);
+                break;
+            case OP_DIVIDE:
+                res = Operand(lhs / rhs);
+                break;
+            }
+        }
+        numbers.pop_back();
+        numbers.back() = res;
+    }
+private:
+    std::vector<Operand> numbers;
+};
+
+// Ленивые выражения: lazy(a) * b + c * d собирает дерево из лёгких узлов,
+// evaluate() считает его покомпонентно за один проход без промежуточных
+// ComplexNumber/Quaternion. Вид результата выводится при компиляции, смешанные
+// операнды повышаются до кватерниона, как в Calculator. Если у платформы
+// есть быстрый FMA, сумма с произведением считается через std::fma.
+#ifdef FP_FAST_FMA
+const bool EXPRESSION_USE_FMA = true;
+#else
+const bool EXPRESSION_USE_FMA = false;
+#endif
+
+class ExpressionBase {};
+
+template <class T>
+struct IsExpression : std::is_base_of<ExpressionBase, T> {};
+
+// Листья хранят копию операнда, а не ссылку: выражение можно сохранить в
+// auto и посчитать позже, даже если операндом было временное c * d.
+class ComplexLeaf : public ExpressionBase {
+public:
+    static const ComplexKind kind = CK_COMPLEX_NUMBER;
+
+    // вид листа известен при компиляции, поэтому кватернион, переданный
+    // через ComplexNumber&, потерял бы j и k
+    ComplexLeaf(const ComplexNumber& _value) :
+        real(_value.getReal()), iCoef(_value.getI()) {
+        assert(_value.getKind() == CK_COMPLEX_NUMBER);
+    }
+
+    Components eval() const {
+        Components res = {real, iCoef, 0, 0};
+        return res;
+    }
+private:
+    double real;
+    double iCoef;
+};
+
+class QuaternionLeaf : public ExpressionBase {
+public:
+    static const ComplexKind kind = CK_QUATERNION;
+
+    QuaternionLeaf(const Quaternion& _value) : value{_value.getReal(),
+        _value.getI(), _value.getJ(), _value.getK()} {}
+
+    Components eval() const {
+        return value;
+    }
+private:
+    Components value;
+};
+
+class ScalarLeaf : public ExpressionBase {
+public:
+    static const ComplexKind kind = CK_COMPLEX_NUMBER;
+
+    ScalarLeaf(double _value) : value(_value) {}
+
+    Components eval() const {
+        Components res = {value, 0, 0, 0};
+        return res;
+    }
+private:
+    double value;
+};
+
+inline ComplexLeaf wrapOperand(const ComplexNumber& value) {
+    return ComplexLeaf(value);
+}
+
+inline QuaternionLeaf wrapOperand(const Quaternion& value) {
+    return QuaternionLeaf(value);
+}
+
+inline ScalarLeaf wrapOperand(double value) {
+    return ScalarLeaf(value);
+}
+
+template <class E,
+    class = typename std::enable_if<IsExpression<E>::value>::type>
+const E& wrapOperand(const E& expression) {
+    return expression;
+}
+
+template <class T>
+auto lazy(const T& value) -> decltype(wrapOperand(value)) {
+    return wrapOperand(value);
+}
+
+constexpr Components negateComponents(const Components& a) {
+    Components res = {-a.real, -a.iCoef, -a.jCoef, -a.kCoef};
+    return res;
+}
+
+template <Operations Op, class L, class R>
+class BinaryExpression : public ExpressionBase {
+public:
+    static const ComplexKind kind =
+        L::kind == CK_QUATERNION || R::kind == CK_QUATERNION ?
+        CK_QUATERNION : CK_COMPLEX_NUMBER;
+
+    BinaryExpression(const L& _left, const R& _right) :
+        left(_left), right(_right) {}
+
+    Components eval() const {
+        if (Op == OP_ADD || Op == OP_SUBTRACT) {
+            return evalSum(left, right, Op == OP_SUBTRACT ? -1.0 : 1.0);
+        }
+        Components a = left.eval();
+        Components b = right.eval();
+        if (Op == OP_MULTIPLY) {
+            return kind == CK_QUATERNION ?
+                multiplyQuaternionComponents(a, b) :
+                multiplyComplexComponents(a, b);
+        }
+        return kind == CK_QUATERNION ?
+            divideQuaternionComponents(a, b) :
+            divideComplexComponents(a, b);
+    }
+
+    // addend + sign * (left * right), каждое произведение - через std::fma
+    Components accumulate(const Components& addend, double sign) const {
+        Components a = left.eval();
+        Components b = right.eval();
+        a.real *= sign;
+        a.iCoef *= sign;
+        a.jCoef *= sign;
+        a.kCoef *= sign;
+        Components res;
+        res.real = std::fma(a.real, b.real, std::fma(-a.iCoef, b.iCoef,
+            addend.real));
+        res.iCoef = std::fma(a.real, b.iCoef, std::fma(a.iCoef, b.real,
+            addend.iCoef));
+        res.jCoef = addend.jCoef;
+        res.kCoef = addend.kCoef;
+        if (kind == CK_QUATERNION) {
+            res.real = std::fma(-a.jCoef, b.jCoef, std::fma(-a.kCoef, b.kCoef,
+                res.real));
+            res.iCoef = std::fma(a.jCoef, b.kCoef, std::fma(-a.kCoef, b.jCoef,
+                res.iCoef));
+            res.jCoef = std::fma(a.real, b.jCoef, std::fma(-a.iCoef, b.kCoef,
+                std::fma(a.jCoef, b.real, std::fma(a.kCoef, b.iCoef,
+                addend.jCoef))));
+            res.kCoef = std::fma(a.real, b.kCoef, std::fma(a.iCoef, b.jCoef,
+                std::fma(-a.jCoef, b.iCoef, std::fma(a.kCoef, b.real,
+                addend.kCoef))));
+        }
+        return res;
+    }
+private:
+    L left;
+    R right;
+
+    template <class A, class B>
+    static Components evalSum(const A& a, const B& b, double sign) {
+        Components x = a.eval();
+        Components y = b.eval();
+        return sign > 0 ? addComponents(x, y) : subtractComponents(x, y);
+    }
+
+    template <class A, class BL, class BR>
+    static Components evalSum(const A& a,
+        const BinaryExpression<OP_MULTIPLY, BL, BR>& b, double sign) {
+        if (!EXPRESSION_USE_FMA) {
+            Components x = a.eval();
+            Components y = b.eval();
+            return sign > 0 ? addComponents(x, y) : subtractComponents(x, y);
+        }
+        return b.accumulate(a.eval(), sign);
+    }
+
+    template <class AL, class AR, class B>
+    static Components evalSum(const BinaryExpression<OP_MULTIPLY, AL, AR>& a,
+        const B& b, double sign) {
+        if (!EXPRESSION_USE_FMA) {
+            Components x = a.eval();
+            Components y = b.eval();
+            return sign > 0 ? addComponents(x, y) : subtractComponents(x, y);
+        }
+        Components y = b.eval();
+        return a.accumulate(sign > 0 ? y : negateComponents(y), 1.0);
+    }
+
+    template <class AL, class AR, class BL, class BR>
+    static Components evalSum(const BinaryExpression<OP_MULTIPLY, AL, AR>& a,
+        const BinaryExpression<OP_MULTIPLY, BL, BR>& b, double sign) {
+        if (!EXPRESSION_USE_FMA) {
+            Components x = a.eval();
+            Components y = b.eval();
+            return sign > 0 ? addComponents(x, y) : subtractComponents(x, y);
+        }
+        return b.accumulate(a.eval(), sign);
+    }
+};
+
+template <Operations Op, class L, class R>
+BinaryExpression<Op, L, R> makeExpression(const L& left, const R& right) {
+    return BinaryExpression<Op, L, R>(left, right);
+}
+
+template <class L, class R, class = typename std::enable_if<
+    IsExpression<L>::value || IsExpression<R>::value>::type>
+auto operator+ (const L& left, const R& right) ->
+    decltype(makeExpression<OP_ADD>(wrapOperand(left), wrapOperand(right))) {
+    return makeExpression<OP_ADD>(wrapOperand(left), wrapOperand(right));
+}
+
+template <class L, class R, class = typename std::enable_if<
+    IsExpression<L>::value || IsExpression<R>::value>::type>
+auto operator- (const L& left, const R& right) -> decltype(
+    makeExpression<OP_SUBTRACT>(wrapOperand(left), wrapOperand(right))) {
+    return makeExpression<OP_SUBTRACT>(wrapOperand(left), wrapOperand(right));
+}
+
+template <class L, class R, class = typename std::enable_if<
+    IsExpression<L>::value || IsExpression<R>::value>::type>
+auto operator* (const L& left, const R& right) -> decltype(
+    makeExpression<OP_MULTIPLY>(wrapOperand(left), wrapOperand(right))) {
+    return makeExpression<OP_MULTIPLY>(wrapOperand(left), wrapOperand(right));
+}
+
+template <class L, class R, class = typename std::enable_if<
+    IsExpression<L>::value || IsExpression<R>::value>::type>
+auto operator/ (const L& left, const R& right) -> decltype(
+    makeExpression<OP_DIVIDE>(wrapOperand(left), wrapOperand(right))) {
+    return makeExpression<OP_DIVIDE>(wrapOperand(left), wrapOperand(right));
+}
+
+template <class E>
+typename std::enable_if<E::kind == CK_QUATERNION, Quaternion>::type
+evaluate(const E& expression) {
+    Components res = expression.eval();
+    return Quaternion(res.real, res.iCoef, res.jCoef, res.kCoef);
+}
+
+template <class E>
+typename std::enable_if<E::kind == CK_COMPLEX_NUMBER, ComplexNumber>::type
+evaluate(const E& expression) {
+    Components res = expression.eval();
+    return ComplexNumber(res.real, res.iCoef);
+}
+
+#if defined(__GNUC__) && defined(__x86_64__) && defined(__linux__)
+// Отдельные версии ядра под AVX-512/AVX2, выбор при загрузке через ifunc.
+// Из флагов -O3 ядрам нужна только векторизация с обычной моделью
+// стоимости: на -O2 GCC векторизует лишь циклы без хвоста. Короткие
+// циклы рядов помечены #pragma GCC unroll, так как -O2 их не раскрывает.
+#define SIMD_KERNEL __attribute__((target_clones("avx512f", "avx2", "default"), \
+    optimize("tree-vectorize", "vect-cost-model=dynamic")))
+#else
+#define SIMD_KERNEL
+#endif
+
+// вспомогательные функции ядер: на размере этого файла GCC упирается в
+// лимит роста при встраивании, и цикл ядра перестаёт векторизоваться
+#if defined(__GNUC__)
+#define KERNEL_INLINE inline __attribute__((always_inline))
+#else
+#define KERNEL_INLINE inline
+#endif
+
+// встраивает в функцию все вызовы из неё, вглубь до конца
+#if defined(__GNUC__)
+#define FLATTEN __attribute__((flatten))
+#else
+#define FLATTEN
+#endif
+
+// раздаёт задачи 0..tasks-1 потокам по одной через общий счётчик;
+// function(task, worker) получает номер потока для своих буферов
+template <class Function>
+void parallelFor(size_t tasks, unsigned threads, const Function& function) {
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    if (threads > tasks) {
+        threads = tasks;
+    }
+    if (threads <= 1) {
+        for (size_t task = 0; task < tasks; ++task) {
+            function(task, 0u);
+        }
+        return;
+    }
+    std::atomic<size_t> next(0);
+    auto worker = [&](unsigned id) {
+        for (size_t task = next++; task < tasks; task = next++) {
+            function(task, id);
+        }
+    };
+    std::vector<std::thread> pool;
+    for (unsigned id = 1; id < threads; ++id) {
+        pool.emplace_back(worker, id);
+    }
+    worker(0);
+    for (std::thread& thread : pool) {
+        thread.join();
+    }
+}
+
+inline unsigned workerCount(unsigned threads) {
+    return threads ? threads :
+        std::max(1u, std::thread::hardware_concurrency());
+}
+
+const size_t SIMD_ALIGNMENT = 64;
+
+template <class T>
+class AlignedAllocator {
+public:
+    typedef T value_type;
+
+    AlignedAllocator() {}
+
+    template <class U>
+    AlignedAllocator(const AlignedAllocator<U>&) {}
+
+    T* allocate(size_t count) {
+        return static_cast<T*>(::operator new(count * sizeof(T),
+            std::align_val_t(SIMD_ALIGNMENT)));
+    }
+
+    void deallocate(T* ptr, size_t) {
+        ::operator delete(ptr, std::align_val_t(SIMD_ALIGNMENT));
+    }
+
+    template <class U>
+    bool operator== (const AlignedAllocator<U>&) const {
+        return true;
+    }
+
+    template <class U>
+    bool operator!= (const AlignedAllocator<U>&) const {
+        return false;
+    }
+};
+
+typedef std::vector<double, AlignedAllocator<double>> AlignedLane;
+
+// Ядра повторяют формулы операторов ComplexNumber/Quaternion. Сложение,
+// вычитание и операции с double совпадают со скалярными операторами
+// побитово. В умножении и делении компилятор может слить a * b + c * d в FMA
+// (так делает версия под AVX-512), тогда каждая
+// компонента отличается от скалярного результата не больше чем на
+// 2 * eps * |a|_1 * |b|_1 для умножения и 4 * eps * |a|_1 * |b|_1 / |b|^2
+// для деления, где eps = DBL_EPSILON, |x|_1 - сумма модулей компонент.
+// Без FMA результаты совпадают побитово.
+
+SIMD_KERNEL void addLanesKernel(size_t n, const double* a, const double* b,
+    double* out) {
+    for (size_t i = 0; i < n; ++i) {
+        out[i] = a[i] + b[i];
+    }
+}
+
+SIMD_KERNEL void addScalarLanesKernel(size_t n, const double* a, double b,
+    double* out) {
+    for (size_t i = 0; i < n; ++i) {
+        out[i] = a[i] + b;
+    }
+}
+
+SIMD_KERNEL void subtractLanesKernel(size_t n, const double* a,
+    const double* b, double* out) {
+    for (size_t i = 0; i < n; ++i) {
+        out[i] = a[i] - b[i];
+    }
+}
+
+SIMD_KERNEL void subtractScalarLanesKernel(size_t n, const double* a,
+    double b, double* out) {
+    for (size_t i = 0; i < n; ++i) {
+        out[i] = a[i] - b;
+    }
+}
+
+SIMD_KERNEL void multiplyScalarLanesKernel(size_t n, const double* a,
+    double b, double* out) {
+    for (size_t i = 0; i < n; ++i) {
+        out[i] = a[i] * b;
+    }
+}
+
+SIMD_KERNEL void divideScalarLanesKernel(size_t n, const double* a,
+    double b, double* out) {
+    for (size_t i = 0; i < n; ++i) {
+        out[i] = a[i] / b;
+    }
+}
+
+SIMD_KERNEL void complexMultiplyKernel(size_t n,
+    const double* aReal, const double* aI,
+    const double* bReal, const double* bI,
+    double* outReal, double* outI) {
+    for (size_t i = 0; i < n; ++i) {
+        double realRes = aReal[i] * bReal[i] - aI[i] * bI[i];
+        double iCoefRes = aReal[i] * bI[i] + aI[i] * bReal[i];
+        outReal[i] = realRes;
+        outI[i] = iCoefRes;
+    }
+}
+
+SIMD_KERNEL void complexMultiplyScalarKernel(size_t n,
+    const double* aReal, const double* aI, double bReal, double bI,
+    double* outReal, double* outI) {
+    for (size_t i = 0; i < n; ++i) {
+        double realRes = aReal[i] * bReal - aI[i] * bI;
+        double iCoefRes = aReal[i] * bI + aI[i] * bReal;
+        outReal[i] = realRes;
+        outI[i] = iCoefRes;
+    }
+}
+
+// Быстрый путь деления - умножение на conj(b) / |b|^2. Если хотя бы у одного
+// делителя блока |b|^2 у границ диапазона, блок делится поэлементно теми же
+// функциями, что и Calculator: такие блоки редки, а проверка векторизуется.
+SIMD_KERNEL size_t countIrregularNorms(size_t n, const double* bReal,
+    const double* bI) {
+    size_t irregular = 0;
+    for (size_t i = 0; i < n; ++i) {
+        irregular += !isRegularNorm(bReal[i] * bReal[i] + bI[i] * bI[i]);
+    }
+    return irregular;
+}
+
+SIMD_KERNEL size_t countIrregularNorms(size_t n, const double* bReal,
+    const double* bI, const double* bJ, const double* bK) {
+    size_t irregular = 0;
+    for (size_t i = 0; i < n; ++i) {
+        irregular += !isRegularNorm(bReal[i] * bReal[i] + bI[i] * bI[i] +
+            bJ[i] * bJ[i] + bK[i] * bK[i]);
+    }
+    return irregular;
+}
+
+SIMD_KERNEL void complexDivideKernel(size_t n,
+    const double* aReal, const double* aI,
+    const double* bReal, const double* bI,
+    double* outReal, double* outI) {
+    if (countIrregularNorms(n, bReal, bI) != 0) {
+        for (size_t i = 0; i < n; ++i) {
+            Components a = {aReal[i], aI[i], 0, 0};
+            Components b = {bReal[i], bI[i], 0, 0};
+            Components res = divideComplexComponents(a, b);
+            outReal[i] = res.real;
+            outI[i] = res.iCoef;
+        }
+        return;
+    }
+    for (size_t i = 0; i < n; ++i) {
+        double inverse = 1 / (bReal[i] * bReal[i] + bI[i] * bI[i]);
+        double rReal = bReal[i] * inverse;
+        double rI = -bI[i] * inverse;
+        double realRes = aReal[i] * rReal - aI[i] * rI;
+        double iCoefRes = aReal[i] * rI + aI[i] * rReal;
+        outReal[i] = realRes;
+        outI[i] = iCoefRes;
+    }
+}
+
+SIMD_KERNEL void complexDivideScalarKernel(size_t n,
+    const double* aReal, const double* aI, double bReal, double bI,
+    double* outReal, double* outI) {
+    double norm = bReal * bReal + bI * bI;
+    if (!isRegularNorm(norm)) {
+        Components b = {bReal, bI, 0, 0};
+        for (size_t i = 0; i < n; ++i) {
+            Components a = {aReal[i], aI[i], 0, 0};
+            Components res = divideComplexComponents(a, b);
+            outReal[i] = res.real;
+            outI[i] = res.iCoef;
+        }
+        return;
+    }
+    double inverse = 1 / norm;
+    double rReal = bReal * inverse;
+    double rI = -bI * inverse;
+    for (size_t i = 0; i < n; ++i) {
+        double realRes = aReal[i] * rReal - aI[i] * rI;
+        double iCoefRes = aReal[i] * rI + aI[i] * rReal;
+        outReal[i] = realRes;
+        outI[i] = iCoefRes;
+    }
+}
+
+SIMD_KERNEL void quaternionMultiplyKernel(size_t n,
+    const double* aReal, const double* aI, const double* aJ, const double* aK,
+    const double* bReal, const double* bI, const double* bJ, const double* bK,
+    double* outReal, double* outI, double* outJ, double* outK) {
+    for (size_t i = 0; i < n; ++i) {
+        double realRes = aReal[i] * bReal[i] - aI[i] * bI[i] -
+            aJ[i] * bJ[i] - aK[i] * bK[i];
+        double iCoefRes = aReal[i] * bI[i] + aI[i] * bReal[i] +
+            aJ[i] * bK[i] - aK[i] * bJ[i];
+        double jCoefRes = aReal[i] * bJ[i] - aI[i] * bK[i] +
+            aJ[i] * bReal[i] + aK[i] * bI[i];
+        double kCoefRes = aReal[i] * bK[i] + aI[i] * bJ[i] -
+            aJ[i] * bI[i] + aK[i] * bReal[i];
+        outReal[i] = realRes;
+        outI[i] = iCoefRes;
+        outJ[i] = jCoefRes;
+        outK[i] = kCoefRes;
+    }
+}
+
+SIMD_KERNEL void quaternionMultiplyScalarKernel(size_t n,
+    const double* aReal, const double* aI, const double* aJ, const double* aK,
+    double bReal, double bI, double bJ, double bK,
+    double* outReal, double* outI, double* outJ, double* outK) {
+    for (size_t i = 0; i < n; ++i) {
+        double realRes = aReal[i] * bReal - aI[i] * bI -
+            aJ[i] * bJ - aK[i] * bK;
+        double iCoefRes = aReal[i] * bI + aI[i] * bReal +
+            aJ[i] * bK - aK[i] * bJ;
+        double jCoefRes = aReal[i] * bJ - aI[i] * bK +
+            aJ[i] * bReal + aK[i] * bI;
+        double kCoefRes = aReal[i] * bK + aI[i] * bJ -
+            aJ[i] * bI + aK[i] * bReal;
+        outReal[i] = realRes;
+        outI[i] = iCoefRes;
+        outJ[i] = jCoefRes;
+        outK[i] = kCoefRes;
+    }
+}
+
+SIMD_KERNEL void quaternionDivideKernel(size_t n,
+    const double* aReal, const double* aI, const double* aJ, const double* aK,
+    const double* bReal, const double* bI, const double* bJ, const double* bK,
+    double* outReal, double* outI, double* outJ, double* outK) {
+    if (countIrregularNorms(n, bReal, bI, bJ, bK) != 0) {
+        for (size_t i = 0; i < n; ++i) {
+            Components a = {aReal[i], aI[i], aJ[i], aK[i]};
+            Components b = {bReal[i], bI[i], bJ[i], bK[i]};
+            Components res = divideQuaternionComponents(a, b);
+            outReal[i] = res.real;
+            outI[i] = res.iCoef;
+            outJ[i] = res.jCoef;
+            outK[i] = res.kCoef;
+        }
+        return;
+    }
+#pragma GCC ivdep
+    for (size_t i = 0; i < n; ++i) {
+        double inverse = 1 / (bReal[i] * bReal[i] + bI[i] * bI[i] +
+            bJ[i] * bJ[i] + bK[i] * bK[i]);
+        double rReal = bReal[i] * inverse;
+        double rI = -bI[i] * inverse;
+        double rJ = -bJ[i] * inverse;
+        double rK = -bK[i] * inverse;
+        double realRes = aReal[i] * rReal - aI[i] * rI -
+            aJ[i] * rJ - aK[i] * rK;
+        double iCoefRes = aReal[i] * rI + aI[i] * rReal +
+            aJ[i] * rK - aK[i] * rJ;
+        double jCoefRes = aReal[i] * rJ - aI[i] * rK +
+            aJ[i] * rReal + aK[i] * rI;
+        double kCoefRes = aReal[i] * rK + aI[i] * rJ -
+            aJ[i] * rI + aK[i] * rReal;
+        outReal[i] = realRes;
+        outI[i] = iCoefRes;
+        outJ[i] = jCoefRes;
+        outK[i] = kCoefRes;
+    }
+}
+
+// деление на один кватернион: при норме в isRegularNorm - умножение на
+// conj(b) / |b|^2, иначе масштабированный путь divideQuaternionComponents
+SIMD_KERNEL void quaternionDivideScalarKernel(size_t n,
+    const double* aReal, const double* aI, const double* aJ, const double* aK,
+    double bReal, double bI, double bJ, double bK,
+    double* outReal, double* outI, double* outJ, double* outK) {
+    double norm = bReal * bReal + bI * bI + bJ * bJ + bK * bK;
+    if (!isRegularNorm(norm)) {
+        Components b = {bReal, bI, bJ, bK};
+        for (size_t i = 0; i < n; ++i) {
+            Components a = {aReal[i], aI[i], aJ[i], aK[i]};
+            Components res = divideQuaternionComponents(a, b);
+            outReal[i] = res.real;
+            outI[i] = res.iCoef;
+            outJ[i] = res.jCoef;
+            outK[i] = res.kCoef;
+        }
+        return;
+    }
+    double inverse = 1 / norm;
+    double rReal = bReal * inverse;
+    double rI = -bI * inverse;
+    double rJ = -bJ * inverse;
+    double rK = -bK * inverse;
+    for (size_t i = 0; i < n; ++i) {
+        double realRes = aReal[i] * rReal - aI[i] * rI -
+            aJ[i] * rJ - aK[i] * rK;
+        double iCoefRes = aReal[i] * rI + aI[i] * rReal +
+            aJ[i] * rK - aK[i] * rJ;
+        double jCoefRes = aReal[i] * rJ - aI[i] * rK +
+            aJ[i] * rReal + aK[i] * rI;
+        double kCoefRes = aReal[i] * rK + aI[i] * rJ -
+            aJ[i] * rI + aK[i] * rReal;
+        outReal[i] = realRes;
+        outI[i] = iCoefRes;
+        outJ[i] = jCoefRes;
+        outK[i] = kCoefRes;
+    }
+}
+
+SIMD_KERNEL void reciprocalLanesKernel(size_t n, const double* a,
+    double* out) {
+    for (size_t i = 0; i < n; ++i) {
+        out[i] = 1 / a[i];
+    }
+}
+
+#if defined(__GNUC__) && defined(__x86_64__)
+// vrcp14pd даёт 14 верных бит, два шага Ньютона x += x * (1 - d * x) на FMA
+// доводят ошибку до 1 ulp. Нули, бесконечности, NaN и значения вне
+// [2^-1020, 2^1020], где приближение или шаг Ньютона не работают, честно
+// делятся.
+__attribute__((target("avx512f")))
+inline void reciprocalLanesAvx512(size_t n, const double* a, double* out) {
+    const __m512d one = _mm512_set1_pd(1.0);
+    const __m512d lowest = _mm512_set1_pd(0x1p-1020);
+    const __m512d highest = _mm512_set1_pd(0x1p1020);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m512d d = _mm512_loadu_pd(a + i);
+        __m512d x = _mm512_maskz_rcp14_pd(__mmask8(0xff), d);
+        __m512d error = _mm512_fnmadd_pd(d, x, one);
+        x = _mm512_fmadd_pd(x, error, x);
+        error = _mm512_fnmadd_pd(d, x, one);
+        x = _mm512_fmadd_pd(x, error, x);
+        __m512d magnitude = _mm512_castsi512_pd(_mm512_and_epi64(
+            _mm512_castpd_si512(d), _mm512_set1_epi64(0x7fffffffffffffff)));
+        __mmask8 regular =
+            _mm512_cmp_pd_mask(magnitude, lowest, _CMP_GE_OQ) &
+            _mm512_cmp_pd_mask(magnitude, highest, _CMP_LE_OQ);
+        x = _mm512_mask_div_pd(x, __mmask8(~regular), one, d);
+        _mm512_storeu_pd(out + i, x);
+    }
+    for (; i < n; ++i) {
+        out[i] = 1 / a[i];
+    }
+}
+#endif
+
+// Пачка обратных величин. С AVX-512 - приближение и уточнение Ньютоном,
+// ошибка до 1 ulp; иначе - точное деление, округлённое корректно.
+inline void reciprocalLanes(size_t n, const double* a, double* out) {
+#if defined(__GNUC__) && defined(__x86_64__)
+    static const bool avx512 = __builtin_cpu_supports("avx512f");
+    if (avx512) {
+        reciprocalLanesAvx512(n, a, out);
+        return;
+    }
+#endif
+    reciprocalLanesKernel(n, a, out);
+}
+
+SIMD_KERNEL void multiplyLanesKernel(size_t n, const double* a,
+    const double* b, double* out) {
+    for (size_t i = 0; i < n; ++i) {
+        out[i] = a[i] * b[i];
+    }
+}
+
+SIMD_KERNEL void maxMagnitudeKernel(size_t n, const double* a,
+    const double* b, double* out) {
+    for (size_t i = 0; i < n; ++i) {
+        double aMagnitude = absoluteValue(a[i]);
+        double bMagnitude = absoluteValue(b[i]);
+        out[i] = aMagnitude > bMagnitude ? aMagnitude : bMagnitude;
+    }
+}
+
+// out += (a * scale)^2 + (b * scale)^2
+SIMD_KERNEL void addScaledSquaresKernel(size_t n, const double* a,
+    const double* b, const double* scale, double* out) {
+    for (size_t i = 0; i < n; ++i) {
+        double scaledA = a[i] * scale[i];
+        double scaledB = b[i] * scale[i];
+        out[i] += scaledA * scaledA + scaledB * scaledB;
+    }
+}
+
+// out = sign * (a * scale) * inverse
+SIMD_KERNEL void scaledConjugateKernel(size_t n, const double* a,
+    const double* scale, const double* inverse, double sign, double* out) {
+    for (size_t i = 0; i < n; ++i) {
+        out[i] = sign * (a[i] * scale[i]) * inverse[i];
+    }
+}
+
+class QuaternionArray;
+
+class ComplexArray {
+public:
+    ComplexArray() {}
+
+    explicit ComplexArray(size_t size) : real(size), iCoef(size) {}
+
+    ComplexArray(const std::vector<ComplexNumber>& numbers) :
+        real(numbers.size()), iCoef(numbers.size()) {
+        for (size_t i = 0; i < numbers.size(); ++i) {
+            set(i, numbers[i]);
+        }
+    }
+
+    size_t size() const {
+        return real.size();
+    }
+
+    void resize(size_t size) {
+        real.resize(size);
+        iCoef.resize(size);
+    }
+
+    void pushBack(const ComplexNumber& number) {
+        real.push_back(number.getReal());
+        iCoef.push_back(number.getI());
+    }
+
+    ComplexNumber get(size_t index) const {
+        return ComplexNumber(real[index], iCoef[index]);
+    }
+
+    void set(size_t index, const ComplexNumber& number) {
+        real[index] = number.getReal();
+        iCoef[index] = number.getI();
+    }
+
+    double* getRealData() {
+        return real.data();
+    }
+
+    const double* getRealData() const {
+        return real.data();
+    }
+
+    double* getIData() {
+        return iCoef.data();
+    }
+
+    const double* getIData() const {
+        return iCoef.data();
+    }
+
+    ComplexArray& operator+= (const ComplexArray &obj) {
+        if (!checkSize(obj)) return *this;
+        addLanesKernel(size(), real.data(), obj.real.data(), real.data());
+        addLanesKernel(size(), iCoef.data(), obj.iCoef.data(), iCoef.data());
+        return *this;
+    }
+
+    ComplexArray& operator+= (const ComplexNumber &obj) {
+        addScalarLanesKernel(size(), real.data(), obj.getReal(), real.data());
+        addScalarLanesKernel(size(), iCoef.data(), obj.getI(), iCoef.data());
+        return *this;
+    }
+
+    ComplexArray& operator+= (double num) {
+        addScalarLanesKernel(size(), real.data(), num, real.data());
+        return *this;
+    }
+
+    ComplexArray& operator-= (const ComplexArray &obj) {
+        if (!checkSize(obj)) return *this;
+        subtractLanesKernel(size(), real.data(), obj.real.data(),
+            real.data());
+        subtractLanesKernel(size(), iCoef.data(), obj.iCoef.data(),
+            iCoef.data());
+        return *this;
+    }
+
+    ComplexArray& operator-= (const ComplexNumber &obj) {
+        subtractScalarLanesKernel(size(), real.data(), obj.getReal(),
+            real.data());
+        subtractScalarLanesKernel(size(), iCoef.data(), obj.getI(),
+            iCoef.data());
+        return *this;
+    }
+
+    ComplexArray& operator-= (double num) {
+        subtractScalarLanesKernel(size(), real.data(), num, real.data());
+        return *this;
+    }
+
+    ComplexArray& operator*= (const ComplexArray &obj) {
+        if (!checkSize(obj)) return *this;
+        complexMultiplyKernel(size(), real.data(), iCoef.data(),
+            obj.real.data(), obj.iCoef.data(), real.data(), iCoef.data());
+        return *this;
+    }
+
+    ComplexArray& operator*= (const ComplexNumber &obj) {
+        complexMultiplyScalarKernel(size(), real.data(), iCoef.data(),
+            obj.getReal(), obj.getI(), real.data(), iCoef.data());
+        return *this;
+    }
+
+    ComplexArray& operator*= (double num) {
+        multiplyScalarLanesKernel(size(), real.data(), num, real.data());
+        multiplyScalarLanesKernel(size(), iCoef.data(), num, iCoef.data());
+        return *this;
+    }
+
+    ComplexArray& operator/= (const ComplexArray &obj) {
+        if (!checkSize(obj)) return *this;
+        complexDivideKernel(size(), real.data(), iCoef.data(),
+            obj.real.data(), obj.iCoef.data(), real.data(), iCoef.data());
+        return *this;
+    }
+
+    ComplexArray& operator/= (const ComplexNumber &obj) {
+        complexDivideScalarKernel(size(), real.data(), iCoef.data(),
+            obj.getReal(), obj.getI(), real.data(), iCoef.data());
+        return *this;
+    }
+
+    ComplexArray& operator/= (double num) {
+        divideScalarLanesKernel(size(), real.data(), num, real.data());
+        divideScalarLanesKernel(size(), iCoef.data(), num, iCoef.data());
+        return *this;
+    }
+
+    template <class T>
+    ComplexArray operator+ (const T &obj) const {
+        ComplexArray tmp(*this);
+        tmp += obj;
+        return tmp;
+    }
+
+    template <class T>
+    ComplexArray operator- (const T &obj) const {
+        ComplexArray tmp(*this);
+        tmp -= obj;
+        return tmp;
+    }
+
+    template <class T>
+    ComplexArray operator* (const T &obj) const {
+        ComplexArray tmp(*this);
+        tmp *= obj;
+        return tmp;
+    }
+
+    template <class T>
+    ComplexArray operator/ (const T &obj) const {
+        ComplexArray tmp(*this);
+        tmp /= obj;
+        return tmp;
+    }
+private:
+    AlignedLane real;
+    AlignedLane iCoef;
+
+    bool checkSize(const ComplexArray& other) const {
+        if (other.size() != size()) {
+            std::cout << "Expected array of size " << size() <<
+                ", but got " << other.size() << std::endl;
+            return false;
+        }
+        return true;
+    }
+};
+
+class QuaternionArray {
+public:
+    QuaternionArray() {}
+
+    explicit QuaternionArray(size_t size) :
+        real(size), iCoef(size), jCoef(size), kCoef(size) {}
+
+    QuaternionArray(const std::vector<Quaternion>& numbers) :
+        real(numbers.size()),
+        iCoef(numbers.size()),
+        jCoef(numbers.size()),
+        kCoef(numbers.size()) {
+        for (size_t i = 0; i < numbers.size(); ++i) {
+            set(i, numbers[i]);
+        }
+    }
+
+    QuaternionArray(const ComplexArray& numbers) :
+        real(numbers.getRealData(), numbers.getRealData() + numbers.size()),
+        iCoef(numbers.getIData(), numbers.getIData() + numbers.size()),
+        jCoef(numbers.size()),
+        kCoef(numbers.size()) {}
+
+    size_t size() const {
+        return real.size();
+    }
+
+    void resize(size_t size) {
+        real.resize(size);
+        iCoef.resize(size);
+        jCoef.resize(size);
+        kCoef.resize(size);
+    }
+
+    void pushBack(const Quaternion& number) {
+        real.push_back(number.getReal());
+        iCoef.push_back(number.getI());
+        jCoef.push_back(number.getJ());
+        kCoef.push_back(number.getK());
+    }
+
+    Quaternion get(size_t index) const {
+        return Quaternion(real[index], iCoef[index],
+            jCoef[index], kCoef[index]);
+    }
+
+    void set(size_t index, const Quaternion& number) {
+        real[index] = number.getReal();
+        iCoef[index] = number.getI();
+        jCoef[index] = number.getJ();
+        kCoef[index] = number.getK();
+    }
+
+    double* getRealData() {
+        return real.data();
+    }
+
+    const double* getRealData() const {
+        return real.data();
+    }
+
+    double* getIData() {
+        return iCoef.data();
+    }
+
+    const double* getIData() const {
+        return iCoef.data();
+    }
+
+    double* getJData() {
+        return jCoef.data();
+    }
+
+    const double* getJData() const {
+        return jCoef.data();
+    }
+
+    double* getKData() {
+        return kCoef.data();
+    }
+
+    const double* getKData() const {
+        return kCoef.data();
+    }
+
+    QuaternionArray& operator+= (const QuaternionArray &obj) {
+        if (!checkSize(obj)) return *this;
+        addLanesKernel(size(), real.data(), obj.real.data(), real.data());
+        addLanesKernel(size(), iCoef.data(), obj.iCoef.data(), iCoef.data());
+        addLanesKernel(size(), jCoef.data(), obj.jCoef.data(), jCoef.data());
+        addLanesKernel(size(), kCoef.data(), obj.kCoef.data(), kCoef.data());
+        return *this;
+    }
+
+    QuaternionArray& operator+= (const Quaternion &obj) {
+        addScalarLanesKernel(size(), real.data(), obj.getReal(), real.data());
+        addScalarLanesKernel(size(), iCoef.data(), obj.getI(), iCoef.data());
+        addScalarLanesKernel(size(), jCoef.data(), obj.getJ(), jCoef.data());
+        addScalarLanesKernel(size(), kCoef.data(), obj.getK(), kCoef.data());
+        return *this;
+    }
+
+    QuaternionArray& operator+= (const ComplexNumber &obj) {
+        addScalarLanesKernel(size(), real.data(), obj.getReal(), real.data());
+        addScalarLanesKernel(size(), iCoef.data(), obj.getI(), iCoef.data());
+        return *this;
+    }
+
+    QuaternionArray& operator+= (double num) {
+        addScalarLanesKernel(size(), real.data(), num, real.data());
+        return *this;
+    }
+
+    QuaternionArray& operator-= (const QuaternionArray &obj) {
+        if (!checkSize(obj)) return *this;
+        subtractLanesKernel(size(), real.data(), obj.real.data(),
+            real.data());
+        subtractLanesKernel(size(), iCoef.data(), obj.iCoef.data(),
+            iCoef.data());
+        subtractLanesKernel(size(), jCoef.data(), obj.jCoef.data(),
+            jCoef.data());
+        subtractLanesKernel(size(), kCoef.data(), obj.kCoef.data(),
+            kCoef.data());
+        return *this;
+    }
+
+    QuaternionArray& operator-= (const Quaternion &obj) {
+        subtractScalarLanesKernel(size(), real.data(), obj.getReal(),
+            real.data());
+        subtractScalarLanesKernel(size(), iCoef.data(), obj.getI(),
+            iCoef.data());
+        subtractScalarLanesKernel(size(), jCoef.data(), obj.getJ(),
+            jCoef.data());
+        subtractScalarLanesKernel(size(), kCoef.data(), obj.getK(),
+            kCoef.data());
+        return *this;
+    }
+
+    QuaternionArray& operator-= (const ComplexNumber &obj) {
+        subtractScalarLanesKernel(size(), real.data(), obj.getReal(),
+            real.data());
+        subtractScalarLanesKernel(size(), iCoef.data(), obj.getI(),
+            iCoef.data());
+        return *this;
+    }
+
+    QuaternionArray& operator-= (double num) {
+        subtractScalarLanesKernel(size(), real.data(), num, real.data());
+        return *this;
+    }
+
+    QuaternionArray& operator*= (const QuaternionArray &obj) {
+        if (!checkSize(obj)) return *this;
+        quaternionMultiplyKernel(size(),
+            real.data(), iCoef.data(), jCoef.data(), kCoef.data(),
+            obj.real.data(), obj.iCoef.data(),
+            obj.jCoef.data(), obj.kCoef.data(),
+            real.data(), iCoef.data(), jCoef.data(), kCoef.data());
+        return *this;
+    }
+
+    QuaternionArray& operator*= (const Quaternion &obj) {
+        quaternionMultiplyScalarKernel(size(),
+            real.data(), iCoef.data(), jCoef.data(), kCoef.data(),
+            obj.getReal(), obj.getI(), obj.getJ(), obj.getK(),
+            real.data(), iCoef.data(), jCoef.data(), kCoef.data());
+        return *this;
+    }
+
+    QuaternionArray& operator*= (const ComplexNumber &obj) {
+        return *this *= Quaternion(obj);
+    }
+
+    QuaternionArray& operator*= (double num) {
+        multiplyScalarLanesKernel(size(), real.data(), num, real.data());
+        multiplyScalarLanesKernel(size(), iCoef.data(), num, iCoef.data());
+        multiplyScalarLanesKernel(size(), jCoef.data(), num, jCoef.data());
+        multiplyScalarLanesKernel(size(), kCoef.data(), num, kCoef.data());
+        return *this;
+    }
+
+    QuaternionArray& operator/= (const QuaternionArray &obj) {
+        if (!checkSize(obj)) return *this;
+        quaternionDivideKernel(size(),
+            real.data(), iCoef.data(), jCoef.data(), kCoef.data(),
+            obj.real.data(), obj.iCoef.data(),
+            obj.jCoef.data(), obj.kCoef.data(),
+            real.data(), iCoef.data(), jCoef.data(), kCoef.data());
+        return *this;
+    }
+
+    QuaternionArray& operator/= (const Quaternion &obj) {
+        quaternionDivideScalarKernel(size(),
+            real.data(), iCoef.data(), jCoef.data(), kCoef.data(),
+            obj.getReal(), obj.getI(), obj.getJ(), obj.getK(),
+            real.data(), iCoef.data(), jCoef.data(), kCoef.data());
+        return *this;
+    }
+
+    QuaternionArray& operator/= (const ComplexNumber &obj) {
+        return *this /= Quaternion(obj);
+    }
+
+    QuaternionArray& operator/= (double num) {
+        divideScalarLanesKernel(size(), real.data(), num, real.data());
+        divideScalarLanesKernel(size(), iCoef.data(), num, iCoef.data());
+        divideScalarLanesKernel(size(), jCoef.data(), num, jCoef.data());
+        divideScalarLanesKernel(size(), kCoef.data(), num, kCoef.data());
+        return *this;
+    }
+
+    template <class T>
+    QuaternionArray operator+ (const T &obj) const {
+        QuaternionArray tmp(*this);
+        tmp += obj;
+        return tmp;
+    }
+
+    template <class T>
+    QuaternionArray operator- (const T &obj) const {
+        QuaternionArray tmp(*this);
+        tmp -= obj;
+        return tmp;
+    }
+
+    template <class T>
+    QuaternionArray operator* (const T &obj) const {
+        QuaternionArray tmp(*this);
+        tmp *= obj;
+        return tmp;
+    }
+
+    template <class T>
+    QuaternionArray operator/ (const T &obj) const {
+        QuaternionArray tmp(*this);
+        tmp /= obj;
+        return tmp;
+    }
+private:
+    AlignedLane real;
+    AlignedLane iCoef;
+    AlignedLane jCoef;
+    AlignedLane kCoef;
+
+    bool checkSize(const QuaternionArray& other) const {
+        if (other.size() != size()) {
+            std::cout << "Expected array of size " << size() <<
+                ", but got " << other.size() << std::endl;
+            return false;
+        }
+        return true;
+    }
+};
+
+const size_t RECIPROCAL_TILE_SIZE = 512;
+
+// Обратные ко всем элементам, масштабирование как в Quaternion::reciprocal,
+// но обе обратные величины (к масштабу и к сумме квадратов) считаются
+// пачкой через reciprocalLanes. Ошибка каждой компоненты - до 4 eps от
+// модуля результата на AVX-512 и до 3 eps без него.
+inline void reciprocalTile(size_t n, const double* const lanes[4],
+    int components, double* const out[4]) {
+    alignas(SIMD_ALIGNMENT) double scale[RECIPROCAL_TILE_SIZE];
+    alignas(SIMD_ALIGNMENT) double inverseScale[RECIPROCAL_TILE_SIZE];
+    alignas(SIMD_ALIGNMENT) double norm[RECIPROCAL_TILE_SIZE];
+    alignas(SIMD_ALIGNMENT) double inverse[RECIPROCAL_TILE_SIZE];
+    maxMagnitudeKernel(n, lanes[0], lanes[1], scale);
+    if (components == 4) {
+        maxMagnitudeKernel(n, lanes[2], lanes[3], norm);
+        maxMagnitudeKernel(n, scale, norm, scale);
+    }
+    reciprocalLanes(n, scale, inverseScale);
+    std::fill(norm, norm + n, 0.0);
+    for (int c = 0; c < components; c += 2) {
+        addScaledSquaresKernel(n, lanes[c], lanes[c + 1], inverseScale, norm);
+    }
+    reciprocalLanes(n, norm, inverse);
+    multiplyLanesKernel(n, inverse, inverseScale, inverse);
+    for (int c = 0; c < components; ++c) {
+        scaledConjugateKernel(n, lanes[c], inverseScale, inverse,
+            c ? -1.0 : 1.0, out[c]);
+    }
+}
+
+inline void reciprocal(const ComplexArray& numbers, ComplexArray& result) {
+    result.resize(numbers.size());
+    for (size_t offset = 0; offset < numbers.size();
+        offset += RECIPROCAL_TILE_SIZE) {
+        size_t n = std::min(RECIPROCAL_TILE_SIZE, numbers.size() - offset);
+        const double* lanes[4] = {numbers.getRealData() + offset,
+            numbers.getIData() + offset, nullptr, nullptr};
+        double* out[4] = {result.getRealData() + offset,
+            result.getIData() + offset, nullptr, nullptr};
+        reciprocalTile(n, lanes, 2, out);
+    }
+}
+
+inline void reciprocal(const QuaternionArray& numbers,
+    QuaternionArray& result) {
+    result.resize(numbers.size());
+    for (size_t offset = 0; offset < numbers.size();
+        offset += RECIPROCAL_TILE_SIZE) {
+        size_t n = std::min(RECIPROCAL_TILE_SIZE, numbers.size() - offset);
+        const double* lanes[4] = {numbers.getRealData() + offset,
+            numbers.getIData() + offset, numbers.getJData() + offset,
+            numbers.getKData() + offset};
+        double* out[4] = {result.getRealData() + offset,
+            result.getIData() + offset, result.getJData() + offset,
+            result.getKData() + offset};
+        reciprocalTile(n, lanes, 4, out);
+    }
+}
+
+const size_t CHAIN_BLOCK_SIZE = 1 << 14;
+const size_t CHAIN_LANES = 4;
+
+inline Components quaternionComponents(const QuaternionArray& chain,
+    size_t index) {
+    Components res = {chain.getRealData()[index], chain.getIData()[index],
+        chain.getJData()[index], chain.getKData()[index]};
+    return res;
+}
+
+inline Components normalizeComponents(const Components& a) {
+    double norm = std::sqrt(a.real * a.real + a.iCoef * a.iCoef +
+        a.jCoef * a.jCoef + a.kCoef * a.kCoef);
+    Components res = {a.real / norm, a.iCoef / norm,
+        a.jCoef / norm, a.kCoef / norm};
+    return res;
+}
+
+// Упорядоченное произведение chain[begin] * ... * chain[end - 1]. Отрезок
+// делится на CHAIN_LANES подряд идущих частей, которые умножаются в одном
+// цикле, чтобы независимые цепочки зависимостей шли параллельно.
+inline Components chainBlockProduct(const QuaternionArray& chain,
+    size_t begin, size_t end, size_t renormalizeEvery) {
+    const Components identity = {1, 0, 0, 0};
+    size_t step = (end - begin) / CHAIN_LANES;
+    Components acc[CHAIN_LANES];
+    for (size_t lane = 0; lane < CHAIN_LANES; ++lane) {
+        acc[lane] = identity;
+    }
+    for (size_t t = 0; t < step; ++t) {
+        for (size_t lane = 0; lane < CHAIN_LANES; ++lane) {
+            acc[lane] = multiplyQuaternionComponents(acc[lane],
+                quaternionComponents(chain, begin + lane * step + t));
+        }
+        if (renormalizeEvery && (t + 1) % renormalizeEvery == 0) {
+            for (size_t lane = 0; lane < CHAIN_LANES; ++lane) {
+                acc[lane] = normalizeComponents(acc[lane]);
+            }
+        }
+    }
+    Components res = acc[0];
+    for (size_t lane = 1; lane < CHAIN_LANES; ++lane) {
+        res = multiplyQuaternionComponents(res, acc[lane]);
+    }
+    for (size_t i = begin + CHAIN_LANES * step; i < end; ++i) {
+        res = multiplyQuaternionComponents(res,
+            quaternionComponents(chain, i));
+    }
+    return renormalizeEvery ? normalizeComponents(res) : res;
+}
+
+// Произведение всей цепочки в порядке индексов. Умножение кватернионов
+// ассоциативно, поэтому блоки считаются в разных потоках и сводятся по
+// порядку; результат отличается от последовательного *= только округлением.
+// renormalizeEvery > 0 нормирует промежуточные произведения (для цепочек
+// поворотов), и результат получается единичным.
+inline Quaternion chainProduct(const QuaternionArray& chain,
+    unsigned threads = 0, size_t renormalizeEvery = 0) {
+    size_t blocks = (chain.size() + CHAIN_BLOCK_SIZE - 1) / CHAIN_BLOCK_SIZE;
+    std::vector<Components> partial(blocks);
+    parallelFor(blocks, threads, [&](size_t block, unsigned) {
+        partial[block] = chainBlockProduct(chain, block * CHAIN_BLOCK_SIZE,
+            std::min(chain.size(), (block + 1) * CHAIN_BLOCK_SIZE),
+            renormalizeEvery);
+    });
+    Components res = {1, 0, 0, 0};
+    for (const Components& block : partial) {
+        res = multiplyQuaternionComponents(res, block);
+        if (renormalizeEvery) {
+            res = normalizeComponents(res);
+        }
+    }
+    return Quaternion(res.real, res.iCoef, res.jCoef, res.kCoef);
+}
+
+// prefix[i] = chain[0] * ... * chain[i]. Первый проход считает произведения
+// блоков, затем их префиксы последовательно, второй проход в каждом блоке
+// продолжает умножение от префикса предыдущих блоков.
+inline void chainPrefixProduct(const QuaternionArray& chain,
+    QuaternionArray& prefix, unsigned threads = 0,
+    size_t renormalizeEvery = 0) {
+    size_t n = chain.size();
+    size_t blocks = (n + CHAIN_BLOCK_SIZE - 1) / CHAIN_BLOCK_SIZE;
+    prefix.resize(n);
+    std::vector<Components> offsets(blocks);
+    parallelFor(blocks, threads, [&](size_t block, unsigned) {
+        offsets[block] = chainBlockProduct(chain, block * CHAIN_BLOCK_SIZE,
+            std::min(n, (block + 1) * CHAIN_BLOCK_SIZE), renormalizeEvery);
+    });
+    Components acc = {1, 0, 0, 0};
+    for (size_t block = 0; block < blocks; ++block) {
+        Components total = offsets[block];
+        offsets[block] = acc;
+        acc = multiplyQuaternionComponents(acc, total);
+        if (renormalizeEvery) {
+            acc = normalizeComponents(acc);
+        }
+    }
+    double* lanes[] = {prefix.getRealData(), prefix.getIData(),
+        prefix.getJData(), prefix.getKData()};
+    parallelFor(blocks, threads, [&](size_t block, unsigned) {
+        Components running = offsets[block];
+        size_t end = std::min(n, (block + 1) * CHAIN_BLOCK_SIZE);
+        for (size_t i = block * CHAIN_BLOCK_SIZE; i < end; ++i) {
+            running = multiplyQuaternionComponents(running,
+                quaternionComponents(chain, i));
+            if (renormalizeEvery && (i + 1) % renormalizeEvery == 0) {
+                running = normalizeComponents(running);
+            }
+            lanes[0][i] = running.real;
+            lanes[1][i] = running.iCoef;
+            lanes[2][i] = running.jCoef;
+            lanes[3][i] = running.kCoef;
+        }
+    });
+}
+
+// Точки трёхмерного пространства, каждая координата в своём массиве
+class PointArray {
+public:
+    PointArray() {}
+
+    explicit PointArray(size_t size) : x(size), y(size), z(size) {}
+
+    size_t size() const {
+        return x.size();
+    }
+
+    void resize(size_t size) {
+        x.resize(size);
+        y.resize(size);
+        z.resize(size);
+    }
+
+    void get(size_t index, double& pointX, double& pointY,
+        double& pointZ) const {
+        pointX = x[index];
+        pointY = y[index];
+        pointZ = z[index];
+    }
+
+    void set(size_t index, double pointX, double pointY, double pointZ) {
+        x[index] = pointX;
+        y[index] = pointY;
+        z[index] = pointZ;
+    }
+
+    double* getXData() {
+        return x.data();
+    }
+
+    const double* getXData() const {
+        return x.data();
+    }
+
+    double* getYData() {
+        return y.data();
+    }
+
+    const double* getYData() const {
+        return y.data();
+    }
+
+    double* getZData() {
+        return z.data();
+    }
+
+    const double* getZData() const {
+        return z.data();
+    }
+
+private:
+    AlignedLane x;
+    AlignedLane y;
+    AlignedLane z;
+};
+
+const size_t ROTATE_CHUNK_SIZE = 1 << 14;
+
+// Матрица поворота q * p / q по строкам. Для неединичного q делится на
+// |q|^2, как и Quaternion::rotate.
+struct RotationMatrix {
+    double m[9];
+};
+
+inline RotationMatrix rotationMatrix(const Quaternion& rotation) {
+    double w = rotation.getReal();
+    double x = rotation.getI();
+    double y = rotation.getJ();
+    double z = rotation.getK();
+    double scale = 2 / rotation.norm();
+    RotationMatrix res = {{
+        1 - scale * (y * y + z * z), scale * (x * y - w * z),
+            scale * (x * z + w * y),
+        scale * (x * y + w * z), 1 - scale * (x * x + z * z),
+            scale * (y * z - w * x),
+        scale * (x * z - w * y), scale * (y * z + w * x),
+            1 - scale * (x * x + y * y)
+    }};
+    return res;
+}
+
+SIMD_KERNEL void rotatePointsKernel(size_t n, const double* m,
+    const double* x, const double* y, const double* z,
+    double* outX, double* outY, double* outZ) {
+    double m00 = m[0], m01 = m[1], m02 = m[2];
+    double m10 = m[3], m11 = m[4], m12 = m[5];
+    double m20 = m[6], m21 = m[7], m22 = m[8];
+#pragma GCC ivdep
+    for (size_t i = 0; i < n; ++i) {
+        double rX = m00 * x[i] + m01 * y[i] + m02 * z[i];
+        double rY = m10 * x[i] + m11 * y[i] + m12 * z[i];
+        double rZ = m20 * x[i] + m21 * y[i] + m22 * z[i];
+        outX[i] = rX;
+        outY[i] = rY;
+        outZ[i] = rZ;
+    }
+}
+
+// Поворот n точек из внешних SoA-буферов; выходные буферы могут совпадать
+// со входными. Кватернион переводится в матрицу один раз, точки идут
+// кусками по ROTATE_CHUNK_SIZE между потоками. Отличие от
+// Quaternion::rotate - в пределах нескольких eps * |p|.
+inline void rotate(const Quaternion& rotation, size_t n,
+    const double* x, const double* y, const double* z,
+    double* outX, double* outY, double* outZ, unsigned threads = 0) {
+    RotationMatrix matrix = rotationMatrix(rotation);
+    size_t chunks = (n + ROTATE_CHUNK_SIZE - 1) / ROTATE_CHUNK_SIZE;
+    parallelFor(chunks, threads, [&](size_t chunk, unsigned) {
+        size_t begin = chunk * ROTATE_CHUNK_SIZE;
+        size_t count = std::min(ROTATE_CHUNK_SIZE, n - begin);
+        rotatePointsKernel(count, matrix.m, x + begin, y + begin, z + begin,
+            outX + begin, outY + begin, outZ + begin);
+    });
+}
+
+inline void rotate(const Quaternion& rotation, const PointArray& points,
+    PointArray& result, unsigned threads = 0) {
+    result.resize(points.size());
+    rotate(rotation, points.size(), points.getXData(), points.getYData(),
+        points.getZData(), result.getXData(), result.getYData(),
+        result.getZData(), threads);
+}
+
+// Интерполяция единичных кватернионов. Скалярные функции считают через
+// libm; в ядрах синус, арктангенс и корень заменены многочленами и шагами
+// Ньютона, чтобы цикл векторизовался. Расхождение - несколько eps.
+enum InterpolationMode {IM_NLERP, IM_SLERP, IM_SQUAD};
+
+// 1 / ((2k)(2k + 1)) для ряда Тейлора синуса
+const double SIN_SERIES[14] = {
+    1.0 / (2 * 3), 1.0 / (4 * 5), 1.0 / (6 * 7), 1.0 / (8 * 9),
+    1.0 / (10 * 11), 1.0 / (12 * 13), 1.0 / (14 * 15), 1.0 / (16 * 17),
+    1.0 / (18 * 19), 1.0 / (20 * 21), 1.0 / (22 * 23), 1.0 / (24 * 25),
+    1.0 / (26 * 27), 1.0 / (28 * 29)
+};
+
+// 1 / (2k + 1) для ряда арктангенса
+const double ATAN_SERIES[11] = {
+    1.0, 1.0 / 3, 1.0 / 5, 1.0 / 7, 1.0 / 9, 1.0 / 11, 1.0 / 13, 1.0 / 15,
+    1.0 / 17, 1.0 / 19, 1.0 / 21
+};
+
+// Ниже этого угла скалярный SLERP берёт коэффициенты из ряда по углу
+const double SLERP_SERIES_ANGLE = 1.0 / 256;
+
+const size_t INTERPOLATION_CHUNK_SIZE = 1 << 14;
+
+// sin(x) / x для x из [0, pi] рядом Тейлора до x^28, без деления и
+// поэтому верно и в нуле. Относительная ошибка - несколько ulp до pi / 2,
+// ближе к pi растёт вместе с 1 / sin(x).
+KERNEL_INLINE double sincPolynomial(double x) {
+    double square = x * x;
+    double term = 1;
+#pragma GCC unroll 16
+    for (int k = 13; k >= 0; --k) {
+        term = 1 - square * SIN_SERIES[k] * term;
+    }
+    return term;
+}
+
+// sqrt(x) для конечных x >= 0, кроме денормализованных: std::sqrt из-за
+// errno не даёт GCC векторизовать цикл. Приближение к 1 / sqrt(x) по битам
+// числа, четыре шага Ньютона и поправка результата - ошибка до 1 ulp.
+KERNEL_INLINE double squareRoot(double x) {
+    uint64_t bits;
+    std::memcpy(&bits, &x, sizeof(bits));
+    bits = 0x5fe6eb50c7b537a9ull - (bits >> 1);
+    double inverse;
+    std::memcpy(&inverse, &bits, sizeof(inverse));
+    double half = 0.5 * x;
+#pragma GCC unroll 16
+    for (int step = 0; step < 4; ++step) {
+        inverse *= 1.5 - half * inverse * inverse;
+    }
+    double root = x * inverse;
+    return root + 0.5 * inverse * (x - root * root);
+}
+
+// atan(x) для x из [0, 1]: дважды atan(x) = 2 atan(x / (1 + sqrt(1 + x^2))),
+// и на [0, 0.2] хватает ряда до x^21
+KERNEL_INLINE double atanPolynomial(double x) {
+    x = x / (1 + squareRoot(1 + x * x));
+    x = x / (1 + squareRoot(1 + x * x));
+    double square = x * x;
+    double term = ATAN_SERIES[10];
+#pragma GCC unroll 16
+    for (int k = 9; k >= 0; --k) {
+        term = ATAN_SERIES[k] - square * term;
+    }
+    return 4 * x * term;
+}
+
+KERNEL_INLINE double dotComponents(const Components& a, const Components& b) {
+    return a.real * b.real + a.iCoef * b.iCoef + a.jCoef * b.jCoef +
+        a.kCoef * b.kCoef;
+}
+
+// Угол между единичными кватернионами как векторами в R^4. Через
+// 2 atan(|a - b| / |a + b|) он точен и для близких кватернионов, где acos
+// от скалярного произведения теряет половину знаков.
+KERNEL_INLINE double quaternionAngle(const Components& a, const Components& b) {
+    Components difference = subtractComponents(a, b);
+    Components sum = addComponents(a, b);
+    double differenceSquare = dotComponents(difference, difference);
+    double sumSquare = dotComponents(sum, sum);
+    bool invert = differenceSquare > sumSquare;
+    double half = atanPolynomial(squareRoot(
+        (invert ? sumSquare : differenceSquare) /
+        (invert ? differenceSquare : sumSquare)));
+    // выбор между константами, а не между выражениями: так GCC
+    // if-конвертирует цикл и без масок AVX-512
+    double offset = invert ? M_PI / 2 : 0;
+    double sign = invert ? -1 : 1;
+    return 2 * (offset + sign * half);
+}
+
+// Коэффициенты sin((1 - t) angle) / sin(angle) и sin(t angle) / sin(angle)
+// через sinc: не нужно отдельно обходить angle = 0, и ядра обходятся без
+// ветвлений. inverseSinc = 1 / sincPolynomial(angle).
+KERNEL_INLINE void slerpWeights(double angle, double inverseSinc, double t,
+    double& first, double& second) {
+    double rest = 1 - t;
+    first = rest * sincPolynomial(rest * angle) * inverseSinc;
+    second = t * sincPolynomial(t * angle) * inverseSinc;
+}
+
+// Быстрый путь для малых углов: ряд a (1 + (1 - a^2) angle^2 / 6 +
+// (7 - 10 a^2 + 3 a^4) angle^4 / 360), ошибка которого меньше eps при
+// angle < 2^-8, вместо двух многочленов синуса
+inline void slerpSeriesWeights(double angle, double t, double& first,
+    double& second) {
+    double rest = 1 - t;
+    double square = angle * angle;
+    double restSquare = rest * rest;
+    double tSquare = t * t;
+    first = rest * (1 + square * ((1 - restSquare) / 6 +
+        square * (7 - 10 * restSquare + 3 * restSquare * restSquare) / 360));
+    second = t * (1 + square * ((1 - tSquare) / 6 +
+        square * (7 - 10 * tSquare + 3 * tSquare * tSquare) / 360));
+}
+
+KERNEL_INLINE Components blendComponents(const Components& a, double first,
+    const Components& b, double second) {
+    Components res = {a.real * first + b.real * second,
+        a.iCoef * first + b.iCoef * second,
+        a.jCoef * first + b.jCoef * second,
+        a.kCoef * first + b.kCoef * second};
+    return res;
+}
+
+// SLERP без выбора кратчайшего пути, как в squad
+inline Components slerpComponents(const Components& a, const Components& b,
+    double t) {
+    Components difference = subtractComponents(a, b);
+    Components sum = addComponents(a, b);
+    // |a - b| = 2 sin(angle / 2), |a + b| = 2 cos(angle / 2)
+    double chord = std::sqrt(dotComponents(difference, difference));
+    double complement = std::sqrt(dotComponents(sum, sum));
+    double angle = 2 * std::atan2(chord, complement);
+    double first, second;
+    if (angle < SLERP_SERIES_ANGLE) {
+        slerpSeriesWeights(angle, t, first, second);
+    } else {
+        double inverseSin = 2 / (chord * complement);
+        first = std::sin((1 - t) * angle) * inverseSin;
+        second = std::sin(t * angle) * inverseSin;
+    }
+    return blendComponents(a, first, b, second);
+}
+
+inline Components toComponents(const Quaternion& number) {
+    Components res = {number.getReal(), number.getI(), number.getJ(),
+        number.getK()};
+    return res;
+}
+
+inline Quaternion fromComponents(const Components& a) {
+    return Quaternion(a.real, a.iCoef, a.jCoef, a.kCoef);
+}
+
+// Нормированная линейная интерполяция по кратчайшему пути
+inline Quaternion nlerp(const Quaternion& a, const Quaternion& b, double t) {
+    Components first = toComponents(a);
+    Components second = toComponents(b);
+    double sign = dotComponents(first, second) < 0 ? -1 : 1;
+    Components res = blendComponents(first, 1 - t, second, sign * t);
+    return fromComponents(scaleComponents(res,
+        1 / std::sqrt(dotComponents(res, res))));
+}
+
+// Сферическая интерполяция по кратчайшему пути: при отрицательном
+// скалярном произведении b заменяется на -b, это тот же поворот
+inline Quaternion slerp(const Quaternion& a, const Quaternion& b, double t) {
+    Components first = toComponents(a);
+    Components second = toComponents(b);
+    if (dotComponents(first, second) < 0) {
+        second = negateComponents(second);
+    }
+    return fromComponents(slerpComponents(first, second, t));
+}
+
+// squad(q0, q1, s0, s1, t) = slerp(slerp(q0, q1, t), slerp(s0, s1, t),
+// 2t(1 - t)). Знаки не выбираются: соседние ключи должны лежать в одной
+// полусфере, как их выравнивает KeyframeTrack.
+inline Quaternion squad(const Quaternion& q0, const Quaternion& q1,
+    const Quaternion& s0, const Quaternion& s1, double t) {
+    Components path = slerpComponents(toComponents(q0), toComponents(q1), t);
+    Components control = slerpComponents(toComponents(s0),
+        toComponents(s1), t);
+    return fromComponents(slerpComponents(path, control, 2 * t * (1 - t)));
+}
+
+// Логарифм и экспонента единичного кватерниона для контрольных точек squad
+inline Components logUnitComponents(const Components& a) {
+    double length = std::sqrt(a.iCoef * a.iCoef + a.jCoef * a.jCoef +
+        a.kCoef * a.kCoef);
+    double scale = length > 0 ? std::atan2(length, a.real) / length : 0;
+    Components res = {0, a.iCoef * scale, a.jCoef * scale, a.kCoef * scale};
+    return res;
+}
+
+inline Components expPureComponents(const Components& a) {
+    double length = std::sqrt(a.iCoef * a.iCoef + a.jCoef * a.jCoef +
+        a.kCoef * a.kCoef);
+    double scale = length > 0 ? std::sin(length) / length : 1;
+    Components res = {std::cos(length), a.iCoef * scale, a.jCoef * scale,
+        a.kCoef * scale};
+    return res;
+}
+
+// s = q exp(-(log(q^-1 next) + log(q^-1 previous)) / 4)
+inline Quaternion squadControlPoint(const Quaternion& previous,
+    const Quaternion& current, const Quaternion& next) {
+    Components inverse = conjugateComponents(toComponents(current), 1);
+    Components sum = addComponents(
+        logUnitComponents(multiplyQuaternionComponents(inverse,
+            toComponents(next))),
+        logUnitComponents(multiplyQuaternionComponents(inverse,
+            toComponents(previous))));
+    return fromComponents(multiplyQuaternionComponents(
+        toComponents(current), expPureComponents(scaleComponents(sum,
+        -0.25))));
+}
+
+struct KeyframeLanes {
+    const double* key[4];
+    const double* control[4];
+    const double* angle;
+    const double* inverseSinc;
+    const double* controlAngle;
+    const double* controlInverseSinc;
+};
+
+// Отрезок и доля t для момента time в единицах номеров ключей
+KERNEL_INLINE double keyframeSegment(double time, double last, int lastSegment,
+    int& segment) {
+    double clamped = time > 0 ? time : 0;
+    clamped = clamped < last ? clamped : last;
+    segment = static_cast<int>(clamped);
+    segment = segment < lastSegment ? segment : lastSegment;
+    return clamped - segment;
+}
+
+KERNEL_INLINE Components gatherComponents(const double* const lanes[4],
+    int index) {
+    Components res = {lanes[0][index], lanes[1][index], lanes[2][index],
+        lanes[3][index]};
+    return res;
+}
+
+KERNEL_INLINE void scatterComponents(double* const out[4], size_t index,
+    const Components& a) {
+    out[0][index] = a.real;
+    out[1][index] = a.iCoef;
+    out[2][index] = a.jCoef;
+    out[3][index] = a.kCoef;
+}
+
+SIMD_KERNEL void nlerpKeyframesKernel(size_t n, const double* times,
+    int lastSegment, KeyframeLanes lanes, double* const out[4]) {
+#pragma GCC ivdep
+    for (size_t i = 0; i < n; ++i) {
+        int segment;
+        double t = keyframeSegment(times[i], lastSegment + 1, lastSegment,
+            segment);
+        Components res = blendComponents(
+            gatherComponents(lanes.key, segment), 1 - t,
+            gatherComponents(lanes.key, segment + 1), t);
+        scatterComponents(out, i, scaleComponents(res,
+            1 / squareRoot(dotComponents(res, res))));
+    }
+}
+
+SIMD_KERNEL void slerpKeyframesKernel(size_t n, const double* times,
+    int lastSegment, KeyframeLanes lanes, double* const out[4]) {
+#pragma GCC ivdep
+    for (size_t i = 0; i < n; ++i) {
+        int segment;
+        double t = keyframeSegment(times[i], lastSegment + 1, lastSegment,
+            segment);
+        double first, second;
+        slerpWeights(lanes.angle[segment], lanes.inverseSinc[segment], t,
+            first, second);
+        scatterComponents(out, i, blendComponents(
+            gatherComponents(lanes.key, segment), first,
+            gatherComponents(lanes.key, segment + 1), second));
+    }
+}
+
+SIMD_KERNEL void squadKeyframesKernel(size_t n, const double* times,
+    int lastSegment, KeyframeLanes lanes, double* const out[4]) {
+#pragma GCC ivdep
+    for (size_t i = 0; i < n; ++i) {
+        int segment;
+        double t = keyframeSegment(times[i], lastSegment + 1, lastSegment,
+            segment);
+        double first, second;
+        slerpWeights(lanes.angle[segment], lanes.inverseSinc[segment], t,
+            first, second);
+        Components path = blendComponents(
+            gatherComponents(lanes.key, segment), first,
+            gatherComponents(lanes.key, segment + 1), second);
+        slerpWeights(lanes.controlAngle[segment],
+            lanes.controlInverseSinc[segment], t, first, second);
+        Components control = blendComponents(
+            gatherComponents(lanes.control, segment), first,
+            gatherComponents(lanes.control, segment + 1), second);
+        double angle = quaternionAngle(path, control);
+        slerpWeights(angle, 1 / sincPolynomial(angle), 2 * t * (1 - t),
+            first, second);
+        scatterComponents(out, i, blendComponents(path, first, control,
+            second));
+    }
+}
+
+// Последовательность единичных ключевых кватернионов в моменты 0, 1, ...
+// Конструктор один раз выравнивает знаки ключей (кратчайший путь между
+// соседями), считает углы отрезков и контрольные точки squad; sample
+// затем интерполирует в любые моменты пакетно. Результаты отличаются от
+// скалярных nlerp, slerp и squad по выровненным ключам на несколько eps.
+class KeyframeTrack {
+public:
+    explicit KeyframeTrack(const QuaternionArray& keyframes) :
+        keys(keyframes.size()) {
+        size_t n = keys.size();
+        for (size_t i = 0; i < n; ++i) {
+            Components key = quaternionComponents(keyframes, i);
+            if (i > 0 && dotComponents(quaternionComponents(keys, i - 1),
+                key) < 0) {
+                key = negateComponents(key);
+            }
+            keys.set(i, fromComponents(key));
+        }
+        controls = keys;
+        for (size_t i = 1; i + 1 < n; ++i) {
+            controls.set(i, squadControlPoint(keys.get(i - 1), keys.get(i),
+                keys.get(i + 1)));
+        }
+        size_t segments = n > 1 ? n - 1 : 0;
+        angles.resize(segments);
+        inverseSincs.resize(segments);
+        controlAngles.resize(segments);
+        controlInverseSines.resize(segments);
+        for (size_t i = 0; i < segments; ++i) {
+            angles[i] = quaternionAngle(quaternionComponents(keys, i),
+                quaternionComponents(keys, i + 1));
+            inverseSincs[i] = 1 / sincPolynomial(angles[i]);
+            controlAngles[i] = quaternionAngle(
+                quaternionComponents(controls, i),
+                quaternionComponents(controls, i + 1));
+            controlInverseSines[i] = 1 / sincPolynomial(controlAngles[i]);
+        }
+    }
+
+    size_t size() const {
+        return keys.size();
+    }
+
+    const QuaternionArray& getKeys() const {
+        return keys;
+    }
+
+    const QuaternionArray& getControls() const {
+        return controls;
+    }
+
+    // Значения в моменты times[0..count-1]; моменты вне [0, size() - 1]
+    // прижимаются к концам. false, если ключей нет.
+    bool sample(const double* times, size_t count, InterpolationMode mode,
+        QuaternionArray& result, unsigned threads = 0) const {
+        if (keys.size() == 0 ||
+            keys.size() > size_t(std::numeric_limits<int>::max())) {
+            return false;
+        }
+        result.resize(count);
+        double* out[4] = {result.getRealData(), result.getIData(),
+            result.getJData(), result.getKData()};
+        if (keys.size() == 1) {
+            for (size_t i = 0; i < count; ++i) {
+                result.set(i, keys.get(0));
+            }
+            return true;
+        }
+        KeyframeLanes lanes = {
+            {keys.getRealData(), keys.getIData(), keys.getJData(),
+                keys.getKData()},
+            {controls.getRealData(), controls.getIData(),
+                controls.getJData(), controls.getKData()},
+            angles.data(), inverseSincs.data(), controlAngles.data(),
+            controlInverseSines.data()
+        };
+        int lastSegment = static_cast<int>(keys.size()) - 2;
+        size_t chunks = (count + INTERPOLATION_CHUNK_SIZE - 1) /
+            INTERPOLATION_CHUNK_SIZE;
+        parallelFor(chunks, threads, [&](size_t chunk, unsigned) {
+            size_t begin = chunk * INTERPOLATION_CHUNK_SIZE;
+            size_t n = std::min(INTERPOLATION_CHUNK_SIZE, count - begin);
+            double* chunkOut[4] = {out[0] + begin, out[1] + begin,
+                out[2] + begin, out[3] + begin};
+            switch (mode) {
+                case IM_NLERP:
+                    nlerpKeyframesKernel(n, times + begin, lastSegment,
+                        lanes, chunkOut);
+                    break;
+                case IM_SLERP:
+                    slerpKeyframesKernel(n, times + begin, lastSegment,
+                        lanes, chunkOut);
+                    break;
+                case IM_SQUAD:
+                    squadKeyframesKernel(n, times + begin, lastSegment,
+                        lanes, chunkOut);
+                    break;
+            }
+        });
+        return true;
+    }
+
+private:
+    QuaternionArray keys;
+    QuaternionArray controls;
+    AlignedLane angles;
+    AlignedLane inverseSincs;
+    AlignedLane controlAngles;
+    AlignedLane controlInverseSines;
+};
+
+enum FftDirection {FFT_FORWARD, FFT_INVERSE};
+
+const size_t FFT_PARALLEL_THRESHOLD = 1 << 16;
+const size_t FFT_CHUNK_SIZE = 1 << 13;
+
+SIMD_KERNEL void fftButterflyKernel(size_t n, double* aReal, double* aI,
+    double* bReal, double* bI, const double* wReal, const double* wI) {
+    for (size_t i = 0; i < n; ++i) {
+        double tReal = bReal[i] * wReal[i] - bI[i] * wI[i];
+        double tI = bReal[i] * wI[i] + bI[i] * wReal[i];
+        bReal[i] = aReal[i] - tReal;
+        bI[i] = aI[i] - tI;
+        aReal[i] += tReal;
+        aI[i] += tI;
+    }
+}
+
+// Таблицы поворотных множителей для одного размера. Степени двойки считаются
+// на месте по радикс-2 (множители каждой стадии лежат подряд), остальные
+// размеры - по Стокхэму с радиксами из разложения n на простые множители;
+// простой множитель p стоит O(n * p).
+class FftPlan {
+public:
+    explicit FftPlan(size_t _n) : n(_n), powerOfTwo(_n && !(_n & (_n - 1))) {
+        if (n < 2) {
+            return;
+        }
+        if (powerOfTwo) {
+            twiddleReal.resize(n - 1);
+            twiddleI.resize(n - 1);
+            for (size_t half = 1; half < n; half *= 2) {
+                for (size_t j = 0; j < half; ++j) {
+                    double angle = -M_PI * j / half;
+                    twiddleReal[half - 1 + j] = std::cos(angle);
+                    twiddleI[half - 1 + j] = std::sin(angle);
+                }
+            }
+            return;
+        }
+        size_t rest = n;
+        for (size_t p = 2; p * p <= rest; ++p) {
+            while (rest % p == 0) {
+                radices.push_back(p);
+                rest /= p;
+            }
+        }
+        if (rest > 1) {
+            radices.push_back(rest);
+        }
+        size_t stride = 1;
+        for (size_t radix : radices) {
+            AlignedLane stageReal(stride * radix);
+            AlignedLane stageI(stride * radix);
+            for (size_t k = 0; k < stride; ++k) {
+                for (size_t r = 0; r < radix; ++r) {
+                    double angle = -2 * M_PI * double(r * k) /
+                        double(stride * radix);
+                    stageReal[k * radix + r] = std::cos(angle);
+                    stageI[k * radix + r] = std::sin(angle);
+                }
+            }
+            stageTwiddleReal.push_back(stageReal);
+            stageTwiddleI.push_back(stageI);
+            AlignedLane rootReal(radix);
+            AlignedLane rootI(radix);
+            for (size_t m = 0; m < radix; ++m) {
+                double angle = -2 * M_PI * double(m) / radix;
+                rootReal[m] = std::cos(angle);
+                rootI[m] = std::sin(angle);
+            }
+            stageRootReal.push_back(rootReal);
+            stageRootI.push_back(rootI);
+            stride *= radix;
+        }
+    }
+
+    size_t size() const {
+        return n;
+    }
+
+    void transform(double* real, double* iCoef, unsigned threads) const {
+        if (n < 2) {
+            return;
+        }
+        if (threads != 1 && n < FFT_PARALLEL_THRESHOLD) {
+            threads = 1;
+        }
+        if (powerOfTwo) {
+            radix2(real, iCoef, threads);
+        } else {
+            stockham(real, iCoef, threads);
+        }
+    }
+private:
+    size_t n;
+    bool powerOfTwo;
+    AlignedLane twiddleReal;
+    AlignedLane twiddleI;
+    std::vector<size_t> radices;
+    std::vector<AlignedLane> stageTwiddleReal;
+    std::vector<AlignedLane> stageTwiddleI;
+    // корни степени radix из единицы для ДПФ внутри стадии
+    std::vector<AlignedLane> stageRootReal;
+    std::vector<AlignedLane> stageRootI;
+
+    void radix2(double* real, double* iCoef, unsigned threads) const {
+        int bits = 0;
+        while ((size_t(1) << bits) < n) {
+            ++bits;
+        }
+        size_t chunks = (n + FFT_CHUNK_SIZE - 1) / FFT_CHUNK_SIZE;
+        parallelFor(chunks, threads, [&](size_t chunk, unsigned) {
+            size_t end = std::min(n, (chunk + 1) * FFT_CHUNK_SIZE);
+            for (size_t i = chunk * FFT_CHUNK_SIZE; i < end; ++i) {
+                size_t reversed = 0;
+                for (int b = 0; b < bits; ++b) {
+                    reversed |= ((i >> b) & 1) << (bits - 1 - b);
+                }
+                if (i < reversed) {
+                    std::swap(real[i], real[reversed]);
+                    std::swap(iCoef[i], iCoef[reversed]);
+                }
+            }
+        });
+        size_t butterflies = n / 2;
+        size_t butterflyChunks =
+            (butterflies + FFT_CHUNK_SIZE - 1) / FFT_CHUNK_SIZE;
+        for (size_t half = 1; half < n; half *= 2) {
+            const double* wReal = twiddleReal.data() + half - 1;
+            const double* wI = twiddleI.data() + half - 1;
+            parallelFor(butterflyChunks, threads, [&](size_t chunk, unsigned) {
+                size_t b = chunk * FFT_CHUNK_SIZE;
+                size_t end = std::min(butterflies, b + FFT_CHUNK_SIZE);
+                while (b < end) {
+                    size_t block = b / half;
+                    size_t j = b % half;
+                    size_t count = std::min(half - j, end - b);
+                    size_t top = block * 2 * half + j;
+                    fftButterflyKernel(count, real + top, iCoef + top,
+                        real + top + half, iCoef + top + half,
+                        wReal + j, wI + j);
+                    b += count;
+                }
+            });
+        }
+    }
+
+    void stockham(double* real, double* iCoef, unsigned threads) const {
+        AlignedLane scratchReal(n);
+        AlignedLane scratchI(n);
+        double* srcReal = real;
+        double* srcI = iCoef;
+        double* dstReal = scratchReal.data();
+        double* dstI = scratchI.data();
+        size_t stride = 1;
+        for (size_t stage = 0; stage < radices.size(); ++stage) {
+            size_t radix = radices[stage];
+            size_t columns = n / radix;
+            const double* wReal = stageTwiddleReal[stage].data();
+            const double* wI = stageTwiddleI[stage].data();
+            const double* rootReal = stageRootReal[stage].data();
+            const double* rootI = stageRootI[stage].data();
+            size_t chunks = (columns + FFT_CHUNK_SIZE - 1) / FFT_CHUNK_SIZE;
+            parallelFor(chunks, threads, [&](size_t chunk, unsigned) {
+                std::vector<double> v(4 * radix);
+                double* vReal = v.data();
+                double* vI = vReal + radix;
+                double* outReal = vI + radix;
+                double* outI = outReal + radix;
+                size_t end = std::min(columns, (chunk + 1) * FFT_CHUNK_SIZE);
+                for (size_t j = chunk * FFT_CHUNK_SIZE; j < end; ++j) {
+                    size_t k = j % stride;
+                    for (size_t r = 0; r < radix; ++r) {
+                        double xReal = srcReal[j + r * columns];
+                        double xI = srcI[j + r * columns];
+                        double tReal = wReal[k * radix + r];
+                        double tI = wI[k * radix + r];
+                        vReal[r] = xReal * tReal - xI * tI;
+                        vI[r] = xReal * tI + xI * tReal;
+                    }
+                    smallDft(radix, rootReal, rootI, vReal, vI, outReal,
+                        outI);
+                    size_t base = (j / stride) * stride * radix + k;
+                    for (size_t s = 0; s < radix; ++s) {
+                        dstReal[base + s * stride] = outReal[s];
+                        dstI[base + s * stride] = outI[s];
+                    }
+                }
+            });
+            std::swap(srcReal, dstReal);
+            std::swap(srcI, dstI);
+            stride *= radix;
+        }
+        if (srcReal != real) {
+            std::copy(srcReal, srcReal + n, real);
+            std::copy(srcI, srcI + n, iCoef);
+        }
+    }
+
+    static void smallDft(size_t radix, const double* rootReal,
+        const double* rootI, const double* inReal, const double* inI,
+        double* outReal, double* outI) {
+        if (radix == 2) {
+            outReal[0] = inReal[0] + inReal[1];
+            outI[0] = inI[0] + inI[1];
+            outReal[1] = inReal[0] - inReal[1];
+            outI[1] = inI[0] - inI[1];
+            return;
+        }
+        for (size_t s = 0; s < radix; ++s) {
+            double sumReal = 0;
+            double sumI = 0;
+            // root = (r * s) % radix без деления
+            size_t root = 0;
+            for (size_t r = 0; r < radix; ++r) {
+                double c = rootReal[root];
+                double d = rootI[root];
+                sumReal += inReal[r] * c - inI[r] * d;
+                sumI += inReal[r] * d + inI[r] * c;
+                root += s;
+                if (root >= radix) {
+                    root -= radix;
+                }
+            }
+            outReal[s] = sumReal;
+            outI[s] = sumI;
+        }
+    }
+};
+
+// планы кэшируются по размеру и разделяются между потоками
+inline std::shared_ptr<const FftPlan> getFftPlan(size_t n) {
+    static std::mutex mutex;
+    static std::map<size_t, std::shared_ptr<const FftPlan>> plans;
+    std::lock_guard<std::mutex> lock(mutex);
+    std::shared_ptr<const FftPlan>& plan = plans[n];
+    if (!plan) {
+        plan = std::make_shared<const FftPlan>(n);
+    }
+    return plan;
+}
+
+// Преобразование Фурье на месте: X[s] = sum x[r] * exp(-2 pi i r s / n),
+// обратное - с противоположным знаком и делением на n
+inline void fft(ComplexArray& data, FftDirection direction = FFT_FORWARD,
+    unsigned threads = 0) {
+    size_t n = data.size();
+    double* real = data.getRealData();
+    double* iCoef = data.getIData();
+    if (direction == FFT_INVERSE) {
+        multiplyScalarLanesKernel(n, iCoef, -1, iCoef);
+    }
+    getFftPlan(n)->transform(real, iCoef, threads);
+    if (direction == FFT_INVERSE) {
+        multiplyScalarLanesKernel(n, real, 1.0 / n, real);
+        multiplyScalarLanesKernel(n, iCoef, -1.0 / n, iCoef);
+    }
+}
+
+enum MatrixStatus {MS_OK, MS_SIZE_MISMATCH, MS_SINGULAR};
+
+// Плотная комплексная матрица по строкам, вещественные и мнимые части в
+// отдельных массивах. Строки дополнены до SIMD_ALIGNMENT и выровнены.
+class ComplexMatrix {
+public:
+    ComplexMatrix() : rowCount(0), columnCount(0), stride(0) {}
+
+    ComplexMatrix(size_t rows, size_t columns) :
+        rowCount(rows), columnCount(columns),
+        stride(paddedStride(columns)),
+        real(rows * stride), iCoef(rows * stride) {}
+
+    size_t getRows() const {
+        return rowCount;
+    }
+
+    size_t getColumns() const {
+        return columnCount;
+    }
+
+    size_t getStride() const {
+        return stride;
+    }
+
+    ComplexNumber get(size_t row, size_t column) const {
+        return ComplexNumber(real[row * stride + column],
+            iCoef[row * stride + column]);
+    }
+
+    void set(size_t row, size_t column, const ComplexNumber& number) {
+        real[row * stride + column] = number.getReal();
+        iCoef[row * stride + column] = number.getI();
+    }
+
+    double* getRealData() {
+        return real.data();
+    }
+
+    const double* getRealData() const {
+        return real.data();
+    }
+
+    double* getIData() {
+        return iCoef.data();
+    }
+
+    const double* getIData() const {
+        return iCoef.data();
+    }
+
+private:
+    static size_t paddedStride(size_t columns) {
+        const size_t lane = SIMD_ALIGNMENT / sizeof(double);
+        return (columns + lane - 1) / lane * lane;
+    }
+
+    size_t rowCount;
+    size_t columnCount;
+    size_t stride;
+    AlignedLane real;
+    AlignedLane iCoef;
+};
+
+// Блочное умножение в духе GotoBLAS: панель B размером GEMM_KC x GEMM_NC и
+// блок A размером GEMM_MC x GEMM_KC упаковываются полосами по GEMM_NR
+// столбцов и GEMM_MR строк, микроядро держит плитку C GEMM_MR x GEMM_NR
+// (вещественную и мнимую) в регистрах. Блоки A делятся между потоками.
+const size_t GEMM_MR = 4;
+const size_t GEMM_NR = 8;
+const size_t GEMM_KC = 256;
+const size_t GEMM_MC = 64;
+const size_t GEMM_NC = 2048;
+const size_t LU_BLOCK_SIZE = 64;
+
+// Упакованные полосы: на каждый шаг p сначала GEMM_MR (GEMM_NR)
+// вещественных частей, затем столько же мнимых. tile получает плитку
+// произведения: GEMM_MR x GEMM_NR вещественных частей, затем мнимые.
+// Полосы B и tile выровнены на SIMD_ALIGNMENT.
+#if defined(__GNUC__)
+// Строка плитки - один вектор GCC: автовекторизация оставляет накопители в
+// памяти, а так каждая версия target_clones раскладывает его на свои
+// регистры (один zmm, два ymm или четыре xmm).
+typedef double GemmVector __attribute__((vector_size(GEMM_NR *
+    sizeof(double))));
+
+SIMD_KERNEL void complexGemmMicroKernel(size_t kc, const double* a,
+    const double* b, double* tile) {
+    GemmVector tileReal[GEMM_MR] = {};
+    GemmVector tileI[GEMM_MR] = {};
+    for (size_t p = 0; p < kc; ++p) {
+        const double* aStep = a + p * 2 * GEMM_MR;
+        GemmVector bReal = *reinterpret_cast<const GemmVector*>(
+            b + p * 2 * GEMM_NR);
+        GemmVector bI = *reinterpret_cast<const GemmVector*>(
+            b + p * 2 * GEMM_NR + GEMM_NR);
+#pragma GCC unroll 8
+        for (size_t r = 0; r < GEMM_MR; ++r) {
+            double aReal = aStep[r];
+            double aI = aStep[GEMM_MR + r];
+            tileReal[r] += aReal * bReal - aI * bI;
+            tileI[r] += aReal * bI + aI * bReal;
+        }
+    }
+#pragma GCC unroll 8
+    for (size_t r = 0; r < GEMM_MR; ++r) {
+        *reinterpret_cast<GemmVector*>(tile + r * GEMM_NR) = tileReal[r];
+        *reinterpret_cast<GemmVector*>(tile + (GEMM_MR + r) * GEMM_NR) =
+            tileI[r];
+    }
+}
+#else
+SIMD_KERNEL void complexGemmMicroKernel(size_t kc, const double* a,
+    const double* b, double* tile) {
+    double tileReal[GEMM_MR][GEMM_NR] = {};
+    double tileI[GEMM_MR][GEMM_NR] = {};
+    for (size_t p = 0; p < kc; ++p) {
+        const double* aStep = a + p * 2 * GEMM_MR;
+        const double* bStep = b + p * 2 * GEMM_NR;
+        for (size_t r = 0; r < GEMM_MR; ++r) {
+            double aReal = aStep[r];
+            double aI = aStep[GEMM_MR + r];
+            for (size_t j = 0; j < GEMM_NR; ++j) {
+                tileReal[r][j] += aReal * bStep[j] - aI * bStep[GEMM_NR + j];
+                tileI[r][j] += aReal * bStep[GEMM_NR + j] + aI * bStep[j];
+            }
+        }
+    }
+    for (size_t r = 0; r < GEMM_MR; ++r) {
+        for (size_t j = 0; j < GEMM_NR; ++j) {
+            tile[r * GEMM_NR + j] = tileReal[r][j];
+            tile[(GEMM_MR + r) * GEMM_NR + j] = tileI[r][j];
+        }
+    }
+}
+#endif
+
+// y -= alpha * x
+SIMD_KERNEL void complexSubtractScaledKernel(size_t n, double alphaReal,
+    double alphaI, const double* xReal, const double* xI, double* yReal,
+    double* yI) {
+    for (size_t i = 0; i < n; ++i) {
+        double realRes = yReal[i] - (alphaReal * xReal[i] - alphaI * xI[i]);
+        double iCoefRes = yI[i] - (alphaReal * xI[i] + alphaI * xReal[i]);
+        yReal[i] = realRes;
+        yI[i] = iCoefRes;
+    }
+}
+
+// Полоса из rows строк (rows <= width) и kc столбцов, недостающие строки
+// заполняются нулями. Для A строки - это строки матрицы, для B - столбцы.
+inline void packGemmStrip(size_t rows, size_t kc, size_t width,
+    const double* real, const double* iCoef, size_t rowStep,
+    size_t columnStep, double* packed) {
+    for (size_t p = 0; p < kc; ++p) {
+        double* step = packed + p * 2 * width;
+        for (size_t r = 0; r < width; ++r) {
+            bool inside = r < rows;
+            size_t offset = inside ? r * rowStep + p * columnStep : 0;
+            step[r] = inside ? real[offset] : 0;
+            step[width + r] = inside ? iCoef[offset] : 0;
+        }
+    }
+}
+
+// C += sign * A * B для матриц m x k и k x n, заданных указателями на
+// первые элементы и шагом строк. C не должна пересекаться с A и B.
+inline void complexGemm(size_t m, size_t n, size_t k, double sign,
+    const double* aReal, const double* aI, size_t aStride,
+    const double* bReal, const double* bI, size_t bStride,
+    double* cReal, double* cI, size_t cStride, unsigned threads = 0) {
+    if (m == 0 || n == 0 || k == 0) {
+        return;
+    }
+    size_t rowBlocks = (m + GEMM_MC - 1) / GEMM_MC;
+    unsigned workers = workerCount(threads);
+    size_t depth = std::min(k, GEMM_KC);
+    AlignedLane bPacked(2 * depth * ((std::min(n, GEMM_NC) + GEMM_NR - 1) /
+        GEMM_NR * GEMM_NR));
+    std::vector<AlignedLane> aPacked(workers, AlignedLane(2 * depth *
+        ((std::min(m, GEMM_MC) + GEMM_MR - 1) / GEMM_MR * GEMM_MR)));
+    for (size_t jc = 0; jc < n; jc += GEMM_NC) {
+        size_t nc = std::min(GEMM_NC, n - jc);
+        size_t strips = (nc + GEMM_NR - 1) / GEMM_NR;
+        for (size_t pc = 0; pc < k; pc += GEMM_KC) {
+            size_t kc = std::min(GEMM_KC, k - pc);
+            parallelFor(strips, threads, [&](size_t strip, unsigned) {
+                size_t column = jc + strip * GEMM_NR;
+                packGemmStrip(std::min(GEMM_NR, n - column), kc, GEMM_NR,
+                    bReal + pc * bStride + column,
+                    bI + pc * bStride + column, 1, bStride,
+                    bPacked.data() + strip * 2 * GEMM_NR * kc);
+            });
+            parallelFor(rowBlocks, threads, [&](size_t block,
+                unsigned worker) {
+                size_t ic = block * GEMM_MC;
+                size_t mc = std::min(GEMM_MC, m - ic);
+                double* packedA = aPacked[worker].data();
+                for (size_t ir = 0; ir < mc; ir += GEMM_MR) {
+                    packGemmStrip(std::min(GEMM_MR, mc - ir), kc, GEMM_MR,
+                        aReal + (ic + ir) * aStride + pc,
+                        aI + (ic + ir) * aStride + pc, aStride, 1,
+                        packedA + ir * 2 * kc);
+                }
+                alignas(SIMD_ALIGNMENT) double tile[2 * GEMM_MR * GEMM_NR];
+                for (size_t strip = 0; strip < strips; ++strip) {
+                    size_t column = jc + strip * GEMM_NR;
+                    size_t width = std::min(GEMM_NR, n - column);
+                    for (size_t ir = 0; ir < mc; ir += GEMM_MR) {
+                        complexGemmMicroKernel(kc, packedA + ir * 2 * kc,
+                            bPacked.data() + strip * 2 * GEMM_NR * kc, tile);
+                        size_t height = std::min(GEMM_MR, mc - ir);
+                        for (size_t r = 0; r < height; ++r) {
+                            size_t offset = (ic + ir + r) * cStride + column;
+                            for (size_t j = 0; j < width; ++j) {
+                                cReal[offset + j] +=
+                                    sign * tile[r * GEMM_NR + j];
+                                cI[offset + j] +=
+                                    sign * tile[(GEMM_MR + r) * GEMM_NR + j];
+                            }
+                        }
+                    }
+                }
+            });
+        }
+    }
+}
+
+inline MatrixStatus multiply(const ComplexMatrix& a, const ComplexMatrix& b,
+    ComplexMatrix& result, unsigned threads = 0) {
+    if (a.getColumns() != b.getRows()) {
+        return MS_SIZE_MISMATCH;
+    }
+    // отдельная матрица, чтобы result мог совпадать с a или b
+    ComplexMatrix product(a.getRows(), b.getColumns());
+    complexGemm(a.getRows(), b.getColumns(), a.getColumns(), 1,
+        a.getRealData(), a.getIData(), a.getStride(),
+        b.getRealData(), b.getIData(), b.getStride(),
+        product.getRealData(), product.getIData(), product.getStride(),
+        threads);
+    result = std::move(product);
+    return MS_OK;
+}
+
+// LU-разложение с выбором ведущего элемента по столбцу на месте:
+// P A = L U, L с единичной диагональю хранится под диагональю, U - на ней и
+// выше. pivots[j] - строка, переставленная с j на шаге j. Блочный вариант:
+// панель из LU_BLOCK_SIZE столбцов раскладывается построчно, затем
+// считается блок U справа от неё и остаток обновляется через complexGemm.
+inline MatrixStatus luDecompose(ComplexMatrix& a, std::vector<size_t>& pivots,
+    unsigned threads = 0) {
+    size_t n = a.getRows();
+    if (a.getColumns() != n) {
+        return MS_SIZE_MISMATCH;
+    }
+    size_t stride = a.getStride();
+    double* real = a.getRealData();
+    double* iCoef = a.getIData();
+    pivots.resize(n);
+    for (size_t j0 = 0; j0 < n; j0 += LU_BLOCK_SIZE) {
+        size_t panelEnd = std::min(n, j0 + LU_BLOCK_SIZE);
+        for (size_t j = j0; j < panelEnd; ++j) {
+            size_t pivot = j;
+            double largest = 0;
+            for (size_t i = j; i < n; ++i) {
+                double norm = ComplexNumber(real[i * stride + j],
+                    iCoef[i * stride + j]).norm();
+                if (norm > largest) {
+                    largest = norm;
+                    pivot = i;
+                }
+            }
+            if (largest == 0) {
+                return MS_SINGULAR;
+            }
+            pivots[j] = pivot;
+            if (pivot != j) {
+                std::swap_ranges(real + j * stride, real + j * stride + n,
+                    real + pivot * stride);
+                std::swap_ranges(iCoef + j * stride, iCoef + j * stride + n,
+                    iCoef + pivot * stride);
+            }
+            ComplexNumber inverse = ComplexNumber(real[j * stride + j],
+                iCoef[j * stride + j]).reciprocal();
+            for (size_t i = j + 1; i < n; ++i) {
+                ComplexNumber factor = ComplexNumber(real[i * stride + j],
+                    iCoef[i * stride + j]) * inverse;
+                real[i * stride + j] = factor.getReal();
+                iCoef[i * stride + j] = factor.getI();
+                complexSubtractScaledKernel(panelEnd - j - 1,
+                    factor.getReal(), factor.getI(),
+                    real + j * stride + j + 1, iCoef + j * stride + j + 1,
+                    real + i * stride + j + 1, iCoef + i * stride + j + 1);
+            }
+        }
+        // U12 = L11^-1 A12
+        for (size_t j = j0; j < panelEnd; ++j) {
+            for (size_t i = j + 1; i < panelEnd; ++i) {
+                complexSubtractScaledKernel(n - panelEnd,
+                    real[i * stride + j], iCoef[i * stride + j],
+                    real + j * stride + panelEnd,
+                    iCoef + j * stride + panelEnd,
+                    real + i * stride + panelEnd,
+                    iCoef + i * stride + panelEnd);
+            }
+        }
+        // A22 -= L21 U12
+        size_t rest = n - panelEnd;
+        complexGemm(rest, rest, panelEnd - j0, -1,
+            real + panelEnd * stride + j0, iCoef + panelEnd * stride + j0,
+            stride, real + j0 * stride + panelEnd,
+            iCoef + j0 * stride + panelEnd, stride,
+            real + panelEnd * stride + panelEnd,
+            iCoef + panelEnd * stride + panelEnd, stride, threads);
+    }
+    return MS_OK;
+}
+
+// Решение A X = B по разложению luDecompose, правые части - столбцы b,
+// результат записывается на их место
+inline MatrixStatus luSolve(const ComplexMatrix& lu,
+    const std::vector<size_t>& pivots, ComplexMatrix& b) {
+    size_t n = lu.getRows();
+    if (lu.getColumns() != n || pivots.size() != n || b.getRows() != n) {
+        return MS_SIZE_MISMATCH;
+    }
+    size_t columns = b.getColumns();
+    size_t stride = lu.getStride();
+    size_t bStride = b.getStride();
+    const double* real = lu.getRealData();
+    const double* iCoef = lu.getIData();
+    double* bReal = b.getRealData();
+    double* bI = b.getIData();
+    for (size_t j = 0; j < n; ++j) {
+        if (pivots[j] != j) {
+            std::swap_ranges(bReal + j * bStride, bReal + j * bStride +
+                columns, bReal + pivots[j] * bStride);
+            std::swap_ranges(bI + j * bStride, bI + j * bStride + columns,
+                bI + pivots[j] * bStride);
+        }
+    }
+    for (size_t j = 0; j < n; ++j) {
+        for (size_t i = j + 1; i < n; ++i) {
+            complexSubtractScaledKernel(columns, real[i * stride + j],
+                iCoef[i * stride + j], bReal + j * bStride, bI + j * bStride,
+                bReal + i * bStride, bI + i * bStride);
+        }
+    }
+    for (size_t j = n; j-- > 0;) {
+        ComplexNumber inverse = ComplexNumber(real[j * stride + j],
+            iCoef[j * stride + j]).reciprocal();
+        complexMultiplyScalarKernel(columns, bReal + j * bStride,
+            bI + j * bStride, inverse.getReal(), inverse.getI(),
+            bReal + j * bStride, bI + j * bStride);
+        for (size_t i = 0; i < j; ++i) {
+            complexSubtractScaledKernel(columns, real[i * stride + j],
+                iCoef[i * stride + j], bReal + j * bStride, bI + j * bStride,
+                bReal + i * bStride, bI + i * bStride);
+        }
+    }
+    return MS_OK;
+}
+
+// X = A^-1 B; a и b не меняются
+inline MatrixStatus solve(const ComplexMatrix& a, const ComplexMatrix& b,
+    ComplexMatrix& x, unsigned threads = 0) {
+    if (a.getRows() != b.getRows()) {
+        return MS_SIZE_MISMATCH;
+    }
+    ComplexMatrix lu = a;
+    std::vector<size_t> pivots;
+    MatrixStatus status = luDecompose(lu, pivots, threads);
+    if (status != MS_OK) {
+        return status;
+    }
+    x = b;
+    return luSolve(lu, pivots, x);
+}
+
+// Пакетные exp, log, sqrt, pow, sin и cos. Функция от w + v раскладывается в
+// real + v * scale (+ axis на оси i, если v = 0 и направления нет):
+// ядро коэффициентов считает real, scale и axis по w и |v|^2, а векторная
+// часть затем масштабируется одним умножением. Внутри многочлены вместо
+// libm, чтобы циклы векторизовались. Ошибки против <cmath> по измерениям:
+// у примитивов exp и log - 1-2 ulp, у sin, cos и atan2 - до 3 ulp; у
+// ответа - до 6 eps от его модуля, но log при |q| около 1 даёт абсолютную
+// ошибку в несколько eps, а pow - ещё |p log q| eps. Диапазон: |q| из
+// [1e-150, 1e150], |v| либо 0, либо больше 1e-150, аргументы sin и cos
+// до 1e5, cosh переполняется с |v| > 709.78 - дальше точнее скалярные
+// функции.
+
+// 1 / (k + 2) для ряда (e^r - 1) / r
+const double EXP_SERIES[12] = {
+    1.0 / 2, 1.0 / 3, 1.0 / 4, 1.0 / 5, 1.0 / 6, 1.0 / 7, 1.0 / 8, 1.0 / 9,
+    1.0 / 10, 1.0 / 11, 1.0 / 12, 1.0 / 13
+};
+
+// 1 / ((2k + 1)(2k + 2)) для ряда Тейлора косинуса
+const double COS_SERIES[9] = {
+    1.0 / (1 * 2), 1.0 / (3 * 4), 1.0 / (5 * 6), 1.0 / (7 * 8),
+    1.0 / (9 * 10), 1.0 / (11 * 12), 1.0 / (13 * 14), 1.0 / (15 * 16),
+    1.0 / (17 * 18)
+};
+
+// ln 2 и pi / 2 суммами частей, у старших из которых младшие биты нулевые:
+// k * старшая часть точна при |k| < 2^20 (значения из fdlibm)
+const double LN2_HIGH = 6.93147180369123816490e-01;
+const double LN2_LOW = 1.90821492927058770002e-10;
+const double HALF_PI_HIGH = 1.57079632673412561417e+00;
+const double HALF_PI_MIDDLE = 6.07710050630396597660e-11;
+const double HALF_PI_LOW = 2.02226624871116645580e-21;
+
+// x + ROUNDING_SHIFT - ROUNDING_SHIFT округляет x до целого, а младшие биты
+// суммы хранят это целое
+const double ROUNDING_SHIFT = 0x1.8p52;
+
+const size_t TRANSCENDENTAL_TILE_SIZE = 512;
+const size_t TRANSCENDENTAL_CHUNK_SIZE = 1 << 14;
+
+// 2^n для целого n из [-1022, 1023], собранное из битов
+KERNEL_INLINE double powerOfTwo(double n) {
+    double biased = n + (0x1p52 + 1023);
+    uint64_t bits;
+    std::memcpy(&bits, &biased, sizeof(bits));
+    bits <<= 52;
+    double result;
+    std::memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+// Редукция для e^x: x = k ln 2 + r, |r| <= ln 2 / 2. Возвращает e^r - 1
+// рядом до r^13, а 2^k - произведением high * low, чтобы денормализованный
+// e^x округлялся один раз. Ни одна ветка ограничений не должна делать
+// результат константой: иначе GCC сворачивает её и переносит остальное
+// вычисление под условие, и без масок AVX-512 цикл не векторизуется.
+// Поэтому сверху ограничивается k (огромный r сам переполняет ряд), а
+// нижняя граница x берётся как copysign(746, x), которую GCC не сворачивает.
+KERNEL_INLINE double expReduction(double x, double& high, double& low) {
+    x = x < -746 ? std::copysign(746.0, x) : x;
+    double k = (x * M_LOG2E + ROUNDING_SHIFT) - ROUNDING_SHIFT;
+    k = k > 1024 ? std::copysign(1024.0, k) : k;
+    double r = (x - k * LN2_HIGH) - k * LN2_LOW;
+    double term = 1;
+#pragma GCC unroll 16
+    for (int i = 11; i >= 0; --i) {
+        term = 1 + r * EXP_SERIES[i] * term;
+    }
+    double half = (k * 0.5 + ROUNDING_SHIFT) - ROUNDING_SHIFT;
+    high = powerOfTwo(half);
+    low = powerOfTwo(k - half);
+    return r * term;
+}
+
+// e^x с ошибкой до 1 ulp; переполнение даёт inf, NaN сохраняется
+KERNEL_INLINE double expPolynomial(double x) {
+    double high, low;
+    double reduced = expReduction(x, high, low);
+    return (1 + reduced) * high * low;
+}
+
+// ln x: x = 2^e m, m из [sqrt(2) / 2, sqrt(2)), ln m = 2 atanh(s) при
+// s = (m - 1) / (m + 1), |s| <= 0.172 и ряду до s^21 хватает. Мантисса
+// нормализуется целым сдвигом битов на биты sqrt(2) / 2, без выбора по
+// условию. Ошибка до 2 ulp для нормализованных x; 0, отрицательные, inf и
+// NaN дают то же, что std::log, прибавлением к конечному результату.
+KERNEL_INLINE double logPolynomial(double x) {
+    const uint64_t offset = 0x3fe6a09e667f3bcdull;
+    uint64_t bits;
+    std::memcpy(&bits, &x, sizeof(bits));
+    // 1024 << 52 держит разность неотрицательной: сдвиг тогда логический
+    uint64_t shifted = bits - offset + (1024ull << 52);
+    uint64_t exponentBits = (shifted >> 52) | 0x4330000000000000ull;
+    double exponent;
+    std::memcpy(&exponent, &exponentBits, sizeof(exponent));
+    exponent -= 0x1p52 + 1024;
+    bits = (shifted & 0x000fffffffffffffull) + offset;
+    double mantissa;
+    std::memcpy(&mantissa, &bits, sizeof(mantissa));
+    double s = (mantissa - 1) / (mantissa + 1);
+    double square = s * s;
+    double term = ATAN_SERIES[10];
+#pragma GCC unroll 16
+    for (int k = 9; k >= 0; --k) {
+        term = ATAN_SERIES[k] + square * term;
+    }
+    double result = exponent * LN2_HIGH + (2 * s * term + exponent * LN2_LOW);
+    const double infinity = std::numeric_limits<double>::infinity();
+    return result + (x > 0 ? (x == infinity ? infinity : 0) :
+        (x == 0 ? -infinity : std::numeric_limits<double>::quiet_NaN()));
+}
+
+// sin(x) и cos(x): x = n pi / 2 + r, |r| <= pi / 4, и четверть n выбирает
+// знак и ряд. Ошибка до 2 ulp при |x| до 1e5, кроме окрестностей нулей,
+// где ошибка абсолютная, около n * 1e-31.
+KERNEL_INLINE void sinCosPolynomial(double x, double& sine, double& cosine) {
+    double shifted = x * M_2_PI + ROUNDING_SHIFT;
+    double n = shifted - ROUNDING_SHIFT;
+    double r = ((x - n * HALF_PI_HIGH) - n * HALF_PI_MIDDLE) -
+        n * HALF_PI_LOW;
+    double square = r * r;
+    double sineTerm = 1;
+    double cosineTerm = 1;
+#pragma GCC unroll 16
+    for (int k = 8; k >= 0; --k) {
+        sineTerm = 1 - square * SIN_SERIES[k] * sineTerm;
+        cosineTerm = 1 - square * COS_SERIES[k] * cosineTerm;
+    }
+    double reducedSine = r * sineTerm;
+    uint64_t quadrant;
+    std::memcpy(&quadrant, &shifted, sizeof(quadrant));
+    bool odd = quadrant & 1;
+    double sineBase = odd ? cosineTerm : reducedSine;
+    double cosineBase = odd ? reducedSine : cosineTerm;
+    sine = sineBase * ((quadrant & 2) ? -1 : 1);
+    cosine = cosineBase * (((quadrant + 1) & 2) ? -1 : 1);
+}
+
+// x для x > 0 и 1 для x = 0 - делитель, который не бывает нулём. Единица
+// прибавляется, а не выбирается: ветка с константным делителем
+// сворачивается, GCC переносит деление под условие, и без масок AVX-512
+// цикл не векторизуется.
+KERNEL_INLINE double nonZeroDivisor(double x) {
+    return x + (x > 0 ? 0 : 1);
+}
+
+// atan2(y, x) для y >= 0, результат из [0, pi]
+KERNEL_INLINE double phasePolynomial(double y, double x) {
+    double magnitude = absoluteValue(x);
+    bool swap = y > magnitude;
+    double big = swap ? y : magnitude;
+    double small = swap ? magnitude : y;
+    double angle = atanPolynomial(small / nonZeroDivisor(big));
+    angle = (swap ? M_PI / 2 : 0) + (swap ? -1 : 1) * angle;
+    return (x < 0 ? M_PI : 0) + (x < 0 ? -1 : 1) * angle;
+}
+
+// cosh(x) и sinh(x) / x для x >= 0 через E = e^x - 1: sinh(x) / x =
+// E / x * (1 + e^-x) / 2 не теряет точность у нуля. При x = 0 вместо
+// sinh(x) / x возвращается 0: ядра умножают его только на нулевой вектор.
+KERNEL_INLINE void hyperbolicPolynomial(double x, double& cosine,
+    double& sinc) {
+    double high, low;
+    double reduced = expReduction(x, high, low);
+    // 2^k по отдельности конечны, а их произведение у границы - нет
+    double minusOne = (high * reduced + (high - 1 / low)) * low;
+    double growth = minusOne + 1;
+    double decay = 1 / growth;
+    cosine = 0.5 * (growth + decay);
+    sinc = 0.5 * (1 + decay) * minusOne / nonZeroDivisor(x);
+}
+
+// Ядра коэффициентов: по w и squares = |v|^2 пишут real, scale и axis.
+// Сигнатура общая, exponent нужен только pow. При v = 0 scale умножается
+// на нулевой вектор, поэтому годится любое конечное значение.
+typedef void (*CoefficientsKernel)(size_t n, const double* w,
+    const double* squares, double exponent, double* real, double* scale,
+    double* axis);
+
+SIMD_KERNEL void expCoefficientsKernel(size_t n, const double* w,
+    const double* squares, double, double* real, double* scale,
+    double* axis) {
+#pragma GCC ivdep
+    for (size_t i = 0; i < n; ++i) {
+        double angle = squareRoot(squares[i]);
+        double magnitude = expPolynomial(w[i]);
+        double sine, cosine;
+        sinCosPolynomial(angle, sine, cosine);
+        real[i] = magnitude * cosine;
+        scale[i] = magnitude * sine / nonZeroDivisor(angle);
+        axis[i] = 0;
+    }
+}
+
+SIMD_KERNEL void logCoefficientsKernel(size_t n, const double* w,
+    const double* squares, double, double* real, double* scale,
+    double* axis) {
+#pragma GCC ivdep
+    for (size_t i = 0; i < n; ++i) {
+        double angle = squareRoot(squares[i]);
+        double phase = phasePolynomial(angle, w[i]);
+        real[i] = 0.5 * logPolynomial(w[i] * w[i] + squares[i]);
+        scale[i] = phase / nonZeroDivisor(angle);
+        axis[i] = angle > 0 ? 0 : phase;
+    }
+}
+
+// Главный корень: root = sqrt((|q| + |w|) / 2) и other = |v| / (2 root) -
+// большая и меньшая из частей ответа; знак w решает, какая из них
+// вещественная, и близкие числа не вычитаются
+SIMD_KERNEL void sqrtCoefficientsKernel(size_t n, const double* w,
+    const double* squares, double, double* real, double* scale,
+    double* axis) {
+#pragma GCC ivdep
+    for (size_t i = 0; i < n; ++i) {
+        double angle = squareRoot(squares[i]);
+        double root = squareRoot(0.5 * (squareRoot(w[i] * w[i] +
+            squares[i]) + absoluteValue(w[i])));
+        double other = angle * 0.5 / nonZeroDivisor(root);
+        bool negative = w[i] < 0;
+        double vectorPart = negative ? root : other;
+        real[i] = negative ? other : root;
+        scale[i] = vectorPart / nonZeroDivisor(angle);
+        axis[i] = angle > 0 ? 0 : vectorPart;
+    }
+}
+
+// q^p = exp(p log q) без промежуточного кватерниона
+SIMD_KERNEL void powCoefficientsKernel(size_t n, const double* w,
+    const double* squares, double exponent, double* real, double* scale,
+    double* axis) {
+#pragma GCC ivdep
+    for (size_t i = 0; i < n; ++i) {
+        double angle = squareRoot(squares[i]);
+        double power = exponent * 0.5 *
+            logPolynomial(w[i] * w[i] + squares[i]);
+        double magnitude = expPolynomial(power);
+        double sine, cosine;
+        sinCosPolynomial(exponent * phasePolynomial(angle, w[i]), sine,
+            cosine);
+        double sinePart = magnitude * sine;
+        real[i] = magnitude * cosine;
+        scale[i] = sinePart / nonZeroDivisor(angle);
+        axis[i] = angle > 0 ? 0 : sinePart;
+    }
+}
+
+SIMD_KERNEL void sinCoefficientsKernel(size_t n, const double* w,
+    const double* squares, double, double* real, double* scale,
+    double* axis) {
+#pragma GCC ivdep
+    for (size_t i = 0; i < n; ++i) {
+        double sine, cosine, hyperbolicCosine, hyperbolicSinc;
+        sinCosPolynomial(w[i], sine, cosine);
+        hyperbolicPolynomial(squareRoot(squares[i]), hyperbolicCosine,
+            hyperbolicSinc);
+        real[i] = sine * hyperbolicCosine;
+        scale[i] = cosine * hyperbolicSinc;
+        axis[i] = 0;
+    }
+}
+
+SIMD_KERNEL void cosCoefficientsKernel(size_t n, const double* w,
+    const double* squares, double, double* real, double* scale,
+    double* axis) {
+#pragma GCC ivdep
+    for (size_t i = 0; i < n; ++i) {
+        double sine, cosine, hyperbolicCosine, hyperbolicSinc;
+        sinCosPolynomial(w[i], sine, cosine);
+        hyperbolicPolynomial(squareRoot(squares[i]), hyperbolicCosine,
+            hyperbolicSinc);
+        real[i] = cosine * hyperbolicCosine;
+        scale[i] = -sine * hyperbolicSinc;
+        axis[i] = 0;
+    }
+}
+
+SIMD_KERNEL void vectorSquaresKernel(size_t n, const double* i,
+    const double* j, const double* k, double* out) {
+    for (size_t index = 0; index < n; ++index) {
+        out[index] = i[index] * i[index] + j[index] * j[index] +
+            k[index] * k[index];
+    }
+}
+
+// out = a * scale + axis; у комплексного числа знак мнимой части выбирает
+// берег разреза и для нуля со знаком
+SIMD_KERNEL void vectorPartKernel(size_t n, const double* a,
+    const double* scale, const double* axis, bool signedAxis, double* out) {
+    // выбор вынесен из цикла: условие в теле GCC не векторизует
+    if (!signedAxis) {
+#pragma GCC ivdep
+        for (size_t i = 0; i < n; ++i) {
+            out[i] = a[i] * scale[i] + axis[i];
+        }
+        return;
+    }
+#pragma GCC ivdep
+    for (size_t i = 0; i < n; ++i) {
+        out[i] = a[i] * scale[i] + axis[i] * std::copysign(1.0, a[i]);
+    }
+}
+
+// Тайл из components = 2 или 4 полос; result может совпадать с numbers
+inline void transcendentalTile(CoefficientsKernel coefficients,
+    double exponent, size_t n, const double* const* lanes, int components,
+    double* const* out) {
+    alignas(SIMD_ALIGNMENT) double squares[TRANSCENDENTAL_TILE_SIZE];
+    alignas(SIMD_ALIGNMENT) double scale[TRANSCENDENTAL_TILE_SIZE];
+    alignas(SIMD_ALIGNMENT) double axis[TRANSCENDENTAL_TILE_SIZE];
+    if (components == 2) {
+        multiplyLanesKernel(n, lanes[1], lanes[1], squares);
+    } else {
+        vectorSquaresKernel(n, lanes[1], lanes[2], lanes[3], squares);
+    }
+    coefficients(n, lanes[0], squares, exponent, out[0], scale, axis);
+    vectorPartKernel(n, lanes[1], scale, axis, components == 2, out[1]);
+    for (int c = 2; c < components; ++c) {
+        multiplyLanesKernel(n, lanes[c], scale, out[c]);
+    }
+}
+
+inline void applyTranscendental(CoefficientsKernel coefficients,
+    double exponent, size_t size, const double* const* lanes,
+    int components, double* const* out, unsigned threads) {
+    size_t chunks = (size + TRANSCENDENTAL_CHUNK_SIZE - 1) /
+        TRANSCENDENTAL_CHUNK_SIZE;
+    parallelFor(chunks, threads, [&](size_t chunk, unsigned) {
+        size_t end = std::min(size, (chunk + 1) * TRANSCENDENTAL_CHUNK_SIZE);
+        for (size_t offset = chunk * TRANSCENDENTAL_CHUNK_SIZE;
+            offset < end; offset += TRANSCENDENTAL_TILE_SIZE) {
+            size_t n = std::min(TRANSCENDENTAL_TILE_SIZE, end - offset);
+            const double* tileLanes[4] = {};
+            double* tileOut[4] = {};
+            for (int c = 0; c < components; ++c) {
+                tileLanes[c] = lanes[c] + offset;
+                tileOut[c] = out[c] + offset;
+            }
+            transcendentalTile(coefficients, exponent, n, tileLanes,
+                components, tileOut);
+        }
+    });
+}
+
+inline void applyTranscendental(CoefficientsKernel coefficients,
+    double exponent, const ComplexArray& numbers, ComplexArray& result,
+    unsigned threads) {
+    result.resize(numbers.size());
+    const double* lanes[2] = {numbers.getRealData(), numbers.getIData()};
+    double* out[2] = {result.getRealData(), result.getIData()};
+    applyTranscendental(coefficients, exponent, numbers.size(), lanes, 2,
+        out, threads);
+}
+
+inline void applyTranscendental(CoefficientsKernel coefficients,
+    double exponent, const QuaternionArray& numbers, QuaternionArray& result,
+    unsigned threads) {
+    result.resize(numbers.size());
+    const double* lanes[4] = {numbers.getRealData(), numbers.getIData(),
+        numbers.getJData(), numbers.getKData()};
+    double* out[4] = {result.getRealData(), result.getIData(),
+        result.getJData(), result.getKData()};
+    applyTranscendental(coefficients, exponent, numbers.size(), lanes, 4,
+        out, threads);
+}
+
+inline void exp(const ComplexArray& numbers, ComplexArray& result,
+    unsigned threads = 0) {
+    applyTranscendental(expCoefficientsKernel, 0, numbers, result, threads);
+}
+
+inline void log(const ComplexArray& numbers, ComplexArray& result,
+    unsigned threads = 0) {
+    applyTranscendental(logCoefficientsKernel, 0, numbers, result, threads);
+}
+
+inline void sqrt(const ComplexArray& numbers, ComplexArray& result,
+    unsigned threads = 0) {
+    applyTranscendental(sqrtCoefficientsKernel, 0, numbers, result, threads);
+}
+
+// 0^0 = 1, как у скалярной pow, а не exp(0 * log 0)
+inline void pow(const ComplexArray& numbers, double exponent,
+    ComplexArray& result, unsigned threads = 0) {
+    if (exponent == 0) {
+        result.resize(numbers.size());
+        std::fill(result.getRealData(), result.getRealData() + result.size(),
+            1.0);
+        std::fill(result.getIData(), result.getIData() + result.size(), 0.0);
+        return;
+    }
+    applyTranscendental(powCoefficientsKernel, exponent, numbers, result,
+        threads);
+}
+
+inline void sin(const ComplexArray& numbers, ComplexArray& result,
+    unsigned threads = 0) {
+    applyTranscendental(sinCoefficientsKernel, 0, numbers, result, threads);
+}
+
+inline void cos(const ComplexArray& numbers, ComplexArray& result,
+    unsigned threads = 0) {
+    applyTranscendental(cosCoefficientsKernel, 0, numbers, result, threads);
+}
+
+inline void exp(const QuaternionArray& numbers, QuaternionArray& result,
+    unsigned threads = 0) {
+    applyTranscendental(expCoefficientsKernel, 0, numbers, result, threads);
+}
+
+inline void log(const QuaternionArray& numbers, QuaternionArray& result,
+    unsigned threads = 0) {
+    applyTranscendental(logCoefficientsKernel, 0, numbers, result, threads);
+}
+
+inline void sqrt(const QuaternionArray& numbers, QuaternionArray& result,
+    unsigned threads = 0) {
+    applyTranscendental(sqrtCoefficientsKernel, 0, numbers, result, threads);
+}
+
+inline void pow(const QuaternionArray& numbers, double exponent,
+    QuaternionArray& result, unsigned threads = 0) {
+    if (exponent == 0) {
+        result.resize(numbers.size());
+        std::fill(result.getRealData(), result.getRealData() + result.size(),
+            1.0);
+        std::fill(result.getIData(), result.getIData() + result.size(), 0.0);
+        std::fill(result.getJData(), result.getJData() + result.size(), 0.0);
+        std::fill(result.getKData(), result.getKData() + result.size(), 0.0);
+        return;
+    }
+    applyTranscendental(powCoefficientsKernel, exponent, numbers, result,
+        threads);
+}
+
+inline void sin(const QuaternionArray& numbers, QuaternionArray& result,
+    unsigned threads = 0) {
+    applyTranscendental(sinCoefficientsKernel, 0, numbers, result, threads);
+}
+
+inline void cos(const QuaternionArray& numbers, QuaternionArray& result,
+    unsigned threads = 0) {
+    applyTranscendental(cosCoefficientsKernel, 0, numbers, result, threads);
+}
+
+// Многочлены с комплексными коэффициентами: coefficients[k] - при z^k,
+// степень - size() - 1.
+
+const size_t POLYNOMIAL_TILE_SIZE = 256;
+const size_t POLYNOMIAL_CHUNK_SIZE = 1 << 14;
+
+// out = p(x) по схеме Горнера. Внешний цикл - по коэффициентам, внутренний -
+// по точкам тайла: так векторизуется именно он. Накопители на стеке, поэтому
+// out может совпадать с x.
+SIMD_KERNEL void hornerKernel(size_t n, size_t degree, const double* cReal,
+    const double* cI, const double* xReal, const double* xI, double* outReal,
+    double* outI) {
+    alignas(SIMD_ALIGNMENT) double accReal[POLYNOMIAL_TILE_SIZE];
+    alignas(SIMD_ALIGNMENT) double accI[POLYNOMIAL_TILE_SIZE];
+    for (size_t base = 0; base < n; base += POLYNOMIAL_TILE_SIZE) {
+        size_t m = std::min(POLYNOMIAL_TILE_SIZE, n - base);
+        const double* tileReal = xReal + base;
+        const double* tileI = xI + base;
+        for (size_t i = 0; i < m; ++i) {
+            accReal[i] = cReal[degree];
+            accI[i] = cI[degree];
+        }
+        // по два коэффициента за проход: накопители читаются и пишутся
+        // вдвое реже
+        size_t k = degree;
+        for (; k >= 2; k -= 2) {
+            double highReal = cReal[k - 1];
+            double highI = cI[k - 1];
+            double lowReal = cReal[k - 2];
+            double lowI = cI[k - 2];
+            for (size_t i = 0; i < m; ++i) {
+                double real = accReal[i] * tileReal[i] -
+                    accI[i] * tileI[i] + highReal;
+                double iCoef = accReal[i] * tileI[i] +
+                    accI[i] * tileReal[i] + highI;
+                accReal[i] = real * tileReal[i] - iCoef * tileI[i] + lowReal;
+                accI[i] = real * tileI[i] + iCoef * tileReal[i] + lowI;
+            }
+        }
+        if (k == 1) {
+            for (size_t i = 0; i < m; ++i) {
+                double real = accReal[i] * tileReal[i] -
+                    accI[i] * tileI[i] + cReal[0];
+                double iCoef = accReal[i] * tileI[i] +
+                    accI[i] * tileReal[i] + cI[0];
+                accReal[i] = real;
+                accI[i] = iCoef;
+            }
+        }
+        std::copy(accReal, accReal + m, outReal + base);
+        std::copy(accI, accI + m, outI + base);
+    }
+}
+
+// a, где в mask все единицы, и b, где нули. Выбор по битам, а не через
+// ?:, по той же причине, что и в nonZeroDivisor.
+KERNEL_INLINE double selectBits(uint64_t mask, double a, double b) {
+    uint64_t aBits;
+    uint64_t bBits;
+    std::memcpy(&aBits, &a, sizeof(aBits));
+    std::memcpy(&bBits, &b, sizeof(bBits));
+    uint64_t bits = (aBits & mask) | (bBits & ~mask);
+    double result;
+    std::memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+// Поправка Ньютона ratio = p(z) / p'(z) и невязка |p(z)| / sum |c_k| |z|^k.
+// При |z| > 1 считается обращённый многочлен q(y) = y^n p(1/y): p / p' =
+// z q / (n q - y q'), так что степени z не переполняются и у многочленов
+// степени 1000. Невязка от обращения не меняется. absC = |c_k|.
+SIMD_KERNEL void newtonRatioKernel(size_t n, size_t degree,
+    const double* cReal, const double* cI, const double* absC,
+    const double* zReal, const double* zI, double* ratioReal, double* ratioI,
+    double* residual) {
+    alignas(SIMD_ALIGNMENT) double xReal[POLYNOMIAL_TILE_SIZE];
+    alignas(SIMD_ALIGNMENT) double xI[POLYNOMIAL_TILE_SIZE];
+    alignas(SIMD_ALIGNMENT) double radius[POLYNOMIAL_TILE_SIZE];
+    alignas(SIMD_ALIGNMENT) double outside[POLYNOMIAL_TILE_SIZE];
+    alignas(SIMD_ALIGNMENT) uint64_t outsideMask[POLYNOMIAL_TILE_SIZE];
+    alignas(SIMD_ALIGNMENT) double pReal[POLYNOMIAL_TILE_SIZE];
+    alignas(SIMD_ALIGNMENT) double pI[POLYNOMIAL_TILE_SIZE];
+    alignas(SIMD_ALIGNMENT) double dReal[POLYNOMIAL_TILE_SIZE];
+    alignas(SIMD_ALIGNMENT) double dI[POLYNOMIAL_TILE_SIZE];
+    alignas(SIMD_ALIGNMENT) double bound[POLYNOMIAL_TILE_SIZE];
+    for (size_t base = 0; base < n; base += POLYNOMIAL_TILE_SIZE) {
+        size_t m = std::min(POLYNOMIAL_TILE_SIZE, n - base);
+        for (size_t i = 0; i < m; ++i) {
+            double real = zReal[base + i];
+            double iCoef = zI[base + i];
+            double square = real * real + iCoef * iCoef;
+            bool big = square > 1;
+            uint64_t mask = big ? ~uint64_t(0) : 0;
+            // 1 / z = conj(z) / |z|^2; внутри круга множитель равен 1
+            double scale = selectBits(mask, 1 / nonZeroDivisor(square), 1);
+            xReal[i] = real * scale;
+            xI[i] = iCoef * scale * (big ? -1 : 1);
+            radius[i] = squareRoot(square * scale * scale);
+            outside[i] = big ? 1 : 0;
+            outsideMask[i] = mask;
+            pReal[i] = selectBits(mask, cReal[0], cReal[degree]);
+            pI[i] = selectBits(mask, cI[0], cI[degree]);
+            bound[i] = selectBits(mask, absC[0], absC[degree]);
+            dReal[i] = 0;
+            dI[i] = 0;
+        }
+        for (size_t k = 1; k <= degree; ++k) {
+            double forwardReal = cReal[degree - k];
+            double forwardI = cI[degree - k];
+            double forwardAbs = absC[degree - k];
+            double reversedReal = cReal[k];
+            double reversedI = cI[k];
+            double reversedAbs = absC[k];
+            for (size_t i = 0; i < m; ++i) {
+                uint64_t mask = outsideMask[i];
+                double x = xReal[i];
+                double y = xI[i];
+                double derivativeReal = dReal[i] * x - dI[i] * y + pReal[i];
+                double derivativeI = dReal[i] * y + dI[i] * x + pI[i];
+                double valueReal = pReal[i] * x - pI[i] * y +
+                    selectBits(mask, reversedReal, forwardReal);
+                double valueI = pReal[i] * y + pI[i] * x +
+                    selectBits(mask, reversedI, forwardI);
+                dReal[i] = derivativeReal;
+                dI[i] = derivativeI;
+                pReal[i] = valueReal;
+                pI[i] = valueI;
+                bound[i] = bound[i] * radius[i] +
+                    selectBits(mask, reversedAbs, forwardAbs);
+            }
+        }
+        for (size_t i = 0; i < m; ++i) {
+            // внутри круга ratio = p / d, снаружи z p / (n p - y d)
+            double side = outside[i];
+            double real = zReal[base + i];
+            double iCoef = zI[base + i];
+            double factorReal = side * real + (1 - side);
+            double factorI = side * iCoef;
+            double numeratorReal = pReal[i] * factorReal - pI[i] * factorI;
+            double numeratorI = pReal[i] * factorI + pI[i] * factorReal;
+            double shiftedReal = xReal[i] * dReal[i] - xI[i] * dI[i];
+            double shiftedI = xReal[i] * dI[i] + xI[i] * dReal[i];
+            double denominatorReal = side * (degree * pReal[i] -
+                shiftedReal) + (1 - side) * dReal[i];
+            double denominatorI = side * (degree * pI[i] - shiftedI) +
+                (1 - side) * dI[i];
+            double square = denominatorReal * denominatorReal +
+                denominatorI * denominatorI;
+            // p' = 0: поправки нет, корень сдвигает только сумма Аберта
+            double inverse = 1 / nonZeroDivisor(square);
+            ratioReal[base + i] = (numeratorReal * denominatorReal +
+                numeratorI * denominatorI) * inverse;
+            ratioI[base + i] = (numeratorI * denominatorReal -
+                numeratorReal * denominatorI) * inverse;
+            double value = squareRoot(pReal[i] * pReal[i] + pI[i] * pI[i]);
+            residual[base + i] = value / nonZeroDivisor(bound[i]);
+        }
+    }
+}
+
+// sum = sum_j 1 / (x_i - z_j) по всем n корням. Совпавшая точка (и сам
+// корень) даёт d = 0 и вклад 0 через nonZeroDivisor, без ветки.
+SIMD_KERNEL void aberthSumsKernel(size_t m, const double* xReal,
+    const double* xI, size_t n, const double* zReal, const double* zI,
+    double* sumReal, double* sumI) {
+    for (size_t base = 0; base < m; base += POLYNOMIAL_TILE_SIZE) {
+        size_t count = std::min(POLYNOMIAL_TILE_SIZE, m - base);
+        alignas(SIMD_ALIGNMENT) double accReal[POLYNOMIAL_TILE_SIZE] = {};
+        alignas(SIMD_ALIGNMENT) double accI[POLYNOMIAL_TILE_SIZE] = {};
+        const double* tileReal = xReal + base;
+        const double* tileI = xI + base;
+        for (size_t j = 0; j < n; ++j) {
+            double rootReal = zReal[j];
+            double rootI = zI[j];
+            for (size_t i = 0; i < count; ++i) {
+                double differenceReal = tileReal[i] - rootReal;
+                double differenceI = tileI[i] - rootI;
+                double inverse = 1 / nonZeroDivisor(
+                    differenceReal * differenceReal +
+                    differenceI * differenceI);
+                accReal[i] += differenceReal * inverse;
+                accI[i] -= differenceI * inverse;
+            }
+        }
+        std::copy(accReal, accReal + count, sumReal + base);
+        std::copy(accI, accI + count, sumI + base);
+    }
+}
+
+inline ComplexNumber evaluatePolynomial(const ComplexArray& coefficients,
+    const ComplexNumber& point) {
+    if (coefficients.size() == 0) {
+        return ComplexNumber(0, 0);
+    }
+    const double* cReal = coefficients.getRealData();
+    const double* cI = coefficients.getIData();
+    double x = point.getReal();
+    double y = point.getI();
+    size_t degree = coefficients.size() - 1;
+    double real = cReal[degree];
+    double iCoef = cI[degree];
+    for (size_t k = degree; k-- > 0;) {
+        double nextReal = real * x - iCoef * y + cReal[k];
+        iCoef = real * y + iCoef * x + cI[k];
+        real = nextReal;
+    }
+    return ComplexNumber(real, iCoef);
+}
+
+// values = p(points); values может совпадать с points
+inline void evaluatePolynomial(const ComplexArray& coefficients,
+    const ComplexArray& points, ComplexArray& values, unsigned threads = 0) {
+    size_t size = points.size();
+    values.resize(size);
+    if (coefficients.size() == 0) {
+        std::fill(values.getRealData(), values.getRealData() + size, 0.0);
+        std::fill(values.getIData(), values.getIData() + size, 0.0);
+        return;
+    }
+    size_t chunks = (size + POLYNOMIAL_CHUNK_SIZE - 1) /
+        POLYNOMIAL_CHUNK_SIZE;
+    parallelFor(chunks, threads, [&](size_t chunk, unsigned) {
+        size_t offset = chunk * POLYNOMIAL_CHUNK_SIZE;
+        size_t n = std::min(POLYNOMIAL_CHUNK_SIZE, size - offset);
+        hornerKernel(n, coefficients.size() - 1, coefficients.getRealData(),
+            coefficients.getIData(), points.getRealData() + offset,
+            points.getIData() + offset, values.getRealData() + offset,
+            values.getIData() + offset);
+    });
+}
+
+enum RootStatus {RT_OK, RT_NOT_CONVERGED, RT_BAD_POLYNOMIAL};
+
+// Диагностика сходимости findRoots. Невязка корня - |p(z)| / sum |c_k| |z|^k:
+// z - точный корень многочлена, коэффициенты которого отличаются от данных
+// не больше чем на эту долю.
+struct RootReport {
+    RootStatus status;
+    size_t iterations;
+    size_t convergedRoots;
+    double maxCorrection;   // max |w| / |z| на последней итерации
+    double maxResidual;
+};
+
+const size_t ROOT_MAX_ITERATIONS = 100;
+// с этой степени итерация делится между потоками по корням
+const size_t ROOT_PARALLEL_DEGREE = 256;
+
+// Корни многочлена методом Аберта - Эрлиха: все n приближений
+// уточняются одновременно, z_i -= w_i, w_i = r_i / (1 - r_i S_i), где
+// r_i = p / p', S_i = sum_{j != i} 1 / (z_i - z_j). Шаг - по Якоби (все
+// поправки от старых z), поэтому корни одной итерации считаются
+// параллельно. Начальные точки - на окружности радиуса среднего
+// геометрического модулей корней. Корень сходится, когда поправка меньше
+// 4 eps |z| или невязка меньше 4 eps (n + 1) - дальше точность упирается в
+// округление при вычислении p. Кратные корни сходятся линейно и с
+// точностью порядка eps^(1/m). Нулевые младшие коэффициенты дают точные
+// нулевые корни. Результат - roots размера степени (без старших нулевых
+// коэффициентов).
+inline RootReport findRoots(const ComplexArray& coefficients,
+    ComplexArray& roots, unsigned threads = 0,
+    size_t maxIterations = ROOT_MAX_ITERATIONS) {
+    RootReport report = {RT_OK, 0, 0, 0, 0};
+    const double* sourceReal = coefficients.getRealData();
+    const double* sourceI = coefficients.getIData();
+    size_t top = coefficients.size();
+    while (top > 0 && sourceReal[top - 1] == 0 && sourceI[top - 1] == 0) {
+        --top;
+    }
+    bool finite = true;
+    for (size_t k = 0; k < top; ++k) {
+        finite = finite && std::isfinite(sourceReal[k]) &&
+            std::isfinite(sourceI[k]);
+    }
+    if (top == 0 || !finite) {
+        roots.resize(0);
+        report.status = RT_BAD_POLYNOMIAL;
+        return report;
+    }
+    size_t zeros = 0;
+    while (sourceReal[zeros] == 0 && sourceI[zeros] == 0) {
+        ++zeros;
+    }
+    roots.resize(top - 1);
+    std::fill(roots.getRealData(), roots.getRealData() + zeros, 0.0);
+    std::fill(roots.getIData(), roots.getIData() + zeros, 0.0);
+    size_t degree = top - 1 - zeros;
+    report.convergedRoots = zeros;
+    if (degree == 0) {
+        return report;
+    }
+    // приведённый многочлен: старший коэффициент 1
+    ComplexNumber leading(sourceReal[top - 1], sourceI[top - 1]);
+    AlignedLane cReal(degree + 1), cI(degree + 1), absC(degree + 1);
+    for (size_t k = 0; k <= degree; ++k) {
+        ComplexNumber c = ComplexNumber(sourceReal[zeros + k],
+            sourceI[zeros + k]) / leading;
+        cReal[k] = c.getReal();
+        cI[k] = c.getI();
+        absC[k] = std::hypot(cReal[k], cI[k]);
+    }
+    double radius = std::exp(std::log(absC[0]) / degree);
+    double* zReal = roots.getRealData() + zeros;
+    double* zI = roots.getIData() + zeros;
+    for (size_t i = 0; i < degree; ++i) {
+        double angle = 2 * M_PI * i / degree + 0.7;
+        zReal[i] = radius * std::cos(angle);
+        zI[i] = radius * std::sin(angle);
+    }
+    std::vector<size_t> active(degree);
+    for (size_t i = 0; i < degree; ++i) {
+        active[i] = i;
+    }
+    AlignedLane pointReal(degree), pointI(degree), ratioReal(degree),
+        ratioI(degree), sumReal(degree), sumI(degree), residual(degree);
+    unsigned workers = degree >= ROOT_PARALLEL_DEGREE ?
+        workerCount(threads) : 1;
+    // корни одной итерации считаются блоками по тайлу
+    auto corrections = [&](size_t count, bool sums) {
+        size_t blocks = (count + POLYNOMIAL_TILE_SIZE - 1) /
+            POLYNOMIAL_TILE_SIZE;
+        parallelFor(blocks, workers, [&](size_t block, unsigned) {
+            size_t offset = block * POLYNOMIAL_TILE_SIZE;
+            size_t n = std::min(POLYNOMIAL_TILE_SIZE, count - offset);
+            newtonRatioKernel(n, degree, cReal.data(), cI.data(),
+                absC.data(), pointReal.data() + offset,
+                pointI.data() + offset, ratioReal.data() + offset,
+                ratioI.data() + offset, residual.data() + offset);
+            if (sums) {
+                aberthSumsKernel(n, pointReal.data() + offset,
+                    pointI.data() + offset, degree, zReal, zI,
+                    sumReal.data() + offset, sumI.data() + offset);
+            }
+        });
+    };
+    const double epsilon = std::numeric_limits<double>::epsilon();
+    while (!active.empty() && report.iterations < maxIterations) {
+        ++report.iterations;
+        size_t count = active.size();
+        for (size_t a = 0; a < count; ++a) {
+            pointReal[a] = zReal[active[a]];
+            pointI[a] = zI[active[a]];
+        }
+        corrections(count, true);
+        report.maxCorrection = 0;
+        size_t remaining = 0;
+        for (size_t a = 0; a < count; ++a) {
+            ComplexNumber ratio(ratioReal[a], ratioI[a]);
+            ComplexNumber sum(sumReal[a], sumI[a]);
+            ComplexNumber denominator = ComplexNumber(1, 0) - ratio * sum;
+            ComplexNumber correction = denominator.getReal() == 0 &&
+                denominator.getI() == 0 ? ratio : ratio / denominator;
+            double step = std::hypot(correction.getReal(),
+                correction.getI());
+            double magnitude = std::hypot(pointReal[a], pointI[a]);
+            if (std::isfinite(step)) {
+                zReal[active[a]] -= correction.getReal();
+                zI[active[a]] -= correction.getI();
+                report.maxCorrection = std::max(report.maxCorrection,
+                    step / std::max(magnitude, radius * epsilon));
+            }
+            bool converged = step <= 4 * epsilon * magnitude ||
+                residual[a] <= 4 * epsilon * (degree + 1);
+            if (!converged) {
+                active[remaining++] = active[a];
+            }
+        }
+        active.resize(remaining);
+    }
+    for (size_t i = 0; i < degree; ++i) {
+        pointReal[i] = zReal[i];
+        pointI[i] = zI[i];
+    }
+    corrections(degree, false);
+    for (size_t i = 0; i < degree; ++i) {
+        report.maxResidual = std::max(report.maxResidual, residual[i]);
+    }
+    report.convergedRoots = top - 1 - active.size();
+    if (!active.empty()) {
+        report.status = RT_NOT_CONVERGED;
+    }
+    return report;
+}
+
+// Корни многих многочленов: многочлены раздаются потокам целиком
+inline void findRoots(const std::vector<ComplexArray>& polynomials,
+    std::vector<ComplexArray>& roots, std::vector<RootReport>& reports,
+    unsigned threads = 0, size_t maxIterations = ROOT_MAX_ITERATIONS) {
+    roots.resize(polynomials.size());
+    reports.resize(polynomials.size());
+    parallelFor(polynomials.size(), workerCount(threads),
+        [&](size_t index, unsigned) {
+            reports[index] = findRoots(polynomials[index], roots[index], 1,
+                maxIterations);
+        });
+}
+
+// Escape-time: z <- z^2 + c до выхода из круга радиуса escapeRadius или до
+// maxIterations шагов; результат точки - число сделанных шагов. В
+// EM_MANDELBROT точка сетки - это c, z_0 = 0; в EM_JULIA точка - z_0, а c
+// общее.
+enum EscapeMode {EM_MANDELBROT, EM_JULIA};
+
+// Точка (column, row) = origin + (column * realStep, row * iStep). Начало
+// хранится в long double: перспективному рендеру это позволяет уйти глубже,
+// чем разрешает double.
+struct EscapeGrid {
+    size_t width;
+    size_t height;
+    long double realOrigin;
+    long double iOrigin;
+    double realStep;
+    double iStep;
+    unsigned maxIterations;
+    double escapeRadius;
+    EscapeMode mode;
+    double juliaReal;
+    double juliaI;
+
+    EscapeGrid(size_t _width, size_t _height, long double _realOrigin,
+        long double _iOrigin, double _step) :
+        width(_width),
+        height(_height),
+        realOrigin(_realOrigin),
+        iOrigin(_iOrigin),
+        realStep(_step),
+        iStep(_step),
+        maxIterations(256),
+        escapeRadius(2),
+        mode(EM_MANDELBROT),
+        juliaReal(0),
+        juliaI(0) {}
+};
+
+const size_t ESCAPE_TILE_WIDTH = 64;
+const size_t ESCAPE_TILE_HEIGHT = 8;
+const size_t ESCAPE_LANES = 32;
+const unsigned ESCAPE_CHECK_INTERVAL = 16;
+
+// Эталон для одной точки - та же формула, что у ядра
+inline unsigned escapeTime(const ComplexNumber& start,
+    const ComplexNumber& c, unsigned maxIterations, double escapeRadius) {
+    double real = start.getReal();
+    double iCoef = start.getI();
+    double escapeSquare = escapeRadius * escapeRadius;
+    unsigned count = 0;
+    while (count < maxIterations) {
+        double realSquare = real * real;
+        double iSquare = iCoef * iCoef;
+        if (!(realSquare + iSquare <= escapeSquare)) {
+            break;
+        }
+        iCoef = 2 * real * iCoef + c.getI();
+        real = realSquare - iSquare + c.getReal();
+        ++count;
+    }
+    return count;
+}
+
+// Точки идут через ESCAPE_LANES полос; цикл по полосам векторизуется, и
+// версии target_clones раскладывают его на свои регистры. Полоса, точка
+// которой вышла из круга, замораживается выбором, а на проверке раз в
+// ESCAPE_CHECK_INTERVAL шагов получает следующую точку, так что долгие
+// точки не держат простаивающими соседние полосы. Предел шагов в цикле не
+// проверяется: серия короче остатка шагов любой занятой полосы. Счётчики -
+// double, чтобы сравнение шло только в выбор, без перевода маски в целые.
+SIMD_KERNEL void escapeTimeKernel(size_t n, const double* zReal,
+    const double* zI, const double* cReal, const double* cI,
+    unsigned maxIterations, double escapeSquare, uint32_t* counts) {
+    const double outside = std::numeric_limits<double>::infinity();
+    alignas(SIMD_ALIGNMENT) double real[ESCAPE_LANES];
+    alignas(SIMD_ALIGNMENT) double iCoef[ESCAPE_LANES];
+    alignas(SIMD_ALIGNMENT) double addReal[ESCAPE_LANES];
+    alignas(SIMD_ALIGNMENT) double addI[ESCAPE_LANES];
+    alignas(SIMD_ALIGNMENT) double count[ESCAPE_LANES];
+    size_t pixels[ESCAPE_LANES];
+    size_t next = 0;
+    size_t busy = 0;
+    for (size_t lane = 0; lane < ESCAPE_LANES; ++lane) {
+        size_t pixel = next < n ? next++ : n;
+        pixels[lane] = pixel;
+        busy += pixel < n;
+        real[lane] = pixel < n ? zReal[pixel] : outside;
+        iCoef[lane] = pixel < n ? zI[pixel] : 0;
+        addReal[lane] = pixel < n ? cReal[pixel] : 0;
+        addI[lane] = pixel < n ? cI[pixel] : 0;
+        count[lane] = 0;
+    }
+    unsigned steps = std::min(ESCAPE_CHECK_INTERVAL, maxIterations);
+    while (busy > 0) {
+        for (unsigned step = 0; step < steps; ++step) {
+            for (size_t lane = 0; lane < ESCAPE_LANES; ++lane) {
+                double x = real[lane];
+                double y = iCoef[lane];
+                double realSquare = x * x;
+                double iSquare = y * y;
+                uint64_t inside = realSquare + iSquare <= escapeSquare ?
+                    ~uint64_t(0) : 0;
+                double nextI = 2 * x * y + addI[lane];
+                double nextReal = realSquare - iSquare + addReal[lane];
+                real[lane] = selectBits(inside, nextReal, x);
+                iCoef[lane] = selectBits(inside, nextI, y);
+                count[lane] += selectBits(inside, 1, 0);
+            }
+        }
+        steps = ESCAPE_CHECK_INTERVAL;
+        for (size_t lane = 0; lane < ESCAPE_LANES; ++lane) {
+            size_t& pixel = pixels[lane];
+            if (pixel == n) {
+                continue;
+            }
+            double square = real[lane] * real[lane] +
+                iCoef[lane] * iCoef[lane];
+            unsigned done = count[lane];
+            if (square <= escapeSquare && done < maxIterations) {
+                steps = std::min(steps, maxIterations - done);
+                continue;
+            }
+            counts[pixel] = done;
+            if (next < n) {
+                pixel = next++;
+                real[lane] = zReal[pixel];
+                iCoef[lane] = zI[pixel];
+                addReal[lane] = cReal[pixel];
+                addI[lane] = cI[pixel];
+                count[lane] = 0;
+                steps = std::min(steps, maxIterations);
+            } else {
+                pixel = n;
+                real[lane] = outside;
+                iCoef[lane] = 0;
+                --busy;
+            }
+        }
+    }
+}
+
+// Поле escape-time по сетке, counts - построчно width x height. Плитки
+// ESCAPE_TILE_WIDTH x ESCAPE_TILE_HEIGHT раздаются потокам по одной через
+// общий счётчик: работа плиток у границы множества и внутри него
+// различается на порядки.
+inline void renderEscapeTime(const EscapeGrid& grid,
+    std::vector<uint32_t>& counts, unsigned threads = 0) {
+    counts.resize(grid.width * grid.height);
+    size_t tileColumns = (grid.width + ESCAPE_TILE_WIDTH - 1) /
+        ESCAPE_TILE_WIDTH;
+    size_t tileRows = (grid.height + ESCAPE_TILE_HEIGHT - 1) /
+        ESCAPE_TILE_HEIGHT;
+    double realOrigin = grid.realOrigin;
+    double iOrigin = grid.iOrigin;
+    bool julia = grid.mode == EM_JULIA;
+    parallelFor(tileColumns * tileRows, workerCount(threads),
+        [&](size_t tile, unsigned) {
+            const size_t tileSize = ESCAPE_TILE_WIDTH * ESCAPE_TILE_HEIGHT;
+            alignas(SIMD_ALIGNMENT) double startReal[tileSize] = {};
+            alignas(SIMD_ALIGNMENT) double startI[tileSize] = {};
+            alignas(SIMD_ALIGNMENT) double addReal[tileSize] = {};
+            alignas(SIMD_ALIGNMENT) double addI[tileSize] = {};
+            uint32_t tileCounts[tileSize];
+            size_t left = tile % tileColumns * ESCAPE_TILE_WIDTH;
+            size_t top = tile / tileColumns * ESCAPE_TILE_HEIGHT;
+            size_t width = std::min(ESCAPE_TILE_WIDTH, grid.width - left);
+            size_t height = std::min(ESCAPE_TILE_HEIGHT, grid.height - top);
+            for (size_t row = 0; row < height; ++row) {
+                for (size_t column = 0; column < width; ++column) {
+                    size_t i = row * width + column;
+                    double real = realOrigin + (left + column) * grid.realStep;
+                    double iCoef = iOrigin + (top + row) * grid.iStep;
+                    startReal[i] = julia ? real : 0;
+                    startI[i] = julia ? iCoef : 0;
+                    addReal[i] = julia ? grid.juliaReal : real;
+                    addI[i] = julia ? grid.juliaI : iCoef;
+                }
+            }
+            escapeTimeKernel(width * height, startReal, startI, addReal, addI,
+                grid.maxIterations, grid.escapeRadius * grid.escapeRadius,
+                tileCounts);
+            for (size_t row = 0; row < height; ++row) {
+                std::copy(tileCounts + row * width,
+                    tileCounts + (row + 1) * width,
+                    counts.data() + (top + row) * grid.width + left);
+            }
+        });
+}
+
+// Перспективный рендер EM_MANDELBROT для глубокого увеличения. Опорная
+// орбита Z_n считается в long double в центре сетки, точка - отклонением
+// d_n = z_n - Z_n: d_{n+1} = 2 Z_n d_n + d_n^2 + dc. Отклонение dc
+// от центра мало и точно хранится в double, даже когда сами c соседних
+// точек в double совпадают. Когда |Z_n + d_n| < |d_n| или орбита
+// кончилась, точка переходит на начало орбиты: d = Z_n + d_n, n = 0 -
+// так не бывает глюков опорной орбиты. Точки считаются поштучно; false -
+// режим EM_JULIA не поддерживается.
+inline bool renderEscapeTimePerturbed(const EscapeGrid& grid,
+    std::vector<uint32_t>& counts, unsigned threads = 0) {
+    if (grid.mode != EM_MANDELBROT) {
+        return false;
+    }
+    counts.resize(grid.width * grid.height);
+    double halfWidth = 0.5 * grid.width;
+    double halfHeight = 0.5 * grid.height;
+    long double centerReal = grid.realOrigin +
+        (long double)halfWidth * grid.realStep;
+    long double centerI = grid.iOrigin +
+        (long double)halfHeight * grid.iStep;
+    long double escapeSquare = (long double)grid.escapeRadius *
+        grid.escapeRadius;
+    std::vector<double> orbitReal(1, 0.0);
+    std::vector<double> orbitI(1, 0.0);
+    long double real = 0;
+    long double iCoef = 0;
+    while (orbitReal.size() <= grid.maxIterations &&
+        real * real + iCoef * iCoef <= escapeSquare) {
+        long double nextReal = real * real - iCoef * iCoef + centerReal;
+        iCoef = 2 * real * iCoef + centerI;
+        real = nextReal;
+        orbitReal.push_back(real);
+        orbitI.push_back(iCoef);
+    }
+    size_t orbitEnd = orbitReal.size() - 1;
+    double radiusSquare = grid.escapeRadius * grid.escapeRadius;
+    size_t rows = grid.height;
+    parallelFor(rows, workerCount(threads), [&](size_t row, unsigned) {
+        double offsetI = (row - halfHeight) * grid.iStep;
+        for (size_t column = 0; column < grid.width; ++column) {
+            double offsetReal = (column - halfWidth) * grid.realStep;
+            double deltaReal = 0;
+            double deltaI = 0;
+            size_t reference = 0;
+            unsigned count = 0;
+            while (count < grid.maxIterations) {
+                double fullReal = orbitReal[reference] + deltaReal;
+                double fullI = orbitI[reference] + deltaI;
+                double fullSquare = fullReal * fullReal + fullI * fullI;
+                if (!(fullSquare <= radiusSquare)) {
+                    break;
+                }
+                if (fullSquare < deltaReal * deltaReal + deltaI * deltaI ||
+                    reference == orbitEnd) {
+                    deltaReal = fullReal;
+                    deltaI = fullI;
+                    reference = 0;
+                }
+                double zReal = orbitReal[reference];
+                double zI = orbitI[reference];
+                double nextReal = 2 * (zReal * deltaReal - zI * deltaI) +
+                    deltaReal * deltaReal - deltaI * deltaI + offsetReal;
+                deltaI = 2 * (zReal * deltaI + zI * deltaReal) +
+                    2 * deltaReal * deltaI + offsetI;
+                deltaReal = nextReal;
+                ++reference;
+                ++count;
+            }
+            counts[row * grid.width + column] = count;
+        }
+    });
+    return true;
+}
+
+enum RpnStatus {
+    RS_OK, RS_DIVIDE_BY_ZERO, RS_INPUT_KIND_MISMATCH, RS_INPUT_SIZE_MISMATCH,
+    RS_INVALID_PROGRAM, RS_INPUT_NOT_BOUND
+};
+
+enum RpnInstructionKind {RI_PUSH_LITERAL, RI_PUSH_INPUT, RI_OPERATION};
+
+struct RpnInstruction {
+    RpnInstructionKind kind;
+    Operations operation;
+    int inputIndex;
+    Operand literal;
+};
+
+// RPN-программа в терминах Calculator: операция берёт левый операнд с
+// вершины стека, правый - из-под него
+class RpnProgram {
+public:
+    int addInput(ComplexKind kind) {
+        inputKinds.push_back(kind);
+        return inputKinds.size() - 1;
+    }
+
+    void pushLiteral(const Operand& literal) {
+        RpnInstruction instruction = {RI_PUSH_LITERAL, OP_ADD, -1, literal};
+        instructions.push_back(instruction);
+    }
+
+    void pushLiteral(const ComplexNumber& literal) {
+        pushLiteral(Operand(literal));
+    }
+
+    void pushInput(int index) {
+        RpnInstruction instruction =
+            {RI_PUSH_INPUT, OP_ADD, index, Operand()};
+        instructions.push_back(instruction);
+    }
+
+    void apply(Operations operation) {
+        RpnInstruction instruction =
+            {RI_OPERATION, operation, -1, Operand()};
+        instructions.push_back(instruction);
+    }
+
+    void clear() {
+        instructions.clear();
+        inputKinds.clear();
+    }
+
+    const std::vector<RpnInstruction>& getInstructions() const {
+        return instructions;
+    }
+
+    const std::vector<ComplexKind>& getInputKinds() const {
+        return inputKinds;
+    }
+private:
+    std::vector<RpnInstruction> instructions;
+    std::vector<ComplexKind> inputKinds;
+};
+
+// Арифметические коды идут группами по BC_OPERATION_COUNT: левый операнд со
+// стека, из таблицы констант или из входов. Варианты с константой и входом -
+// суперинструкции "push + операция", которые не трогают глубину стека.
+enum BytecodeOp {
+    BC_PUSH_CONST, BC_PUSH_INPUT,
+    BC_ADD, BC_SUBTRACT, BC_MULTIPLY_C, BC_MULTIPLY_Q,
+    BC_DIVIDE_C, BC_DIVIDE_Q,
+    BC_ADD_CONST, BC_SUBTRACT_CONST, BC_MULTIPLY_C_CONST,
+    BC_MULTIPLY_Q_CONST, BC_DIVIDE_C_CONST, BC_DIVIDE_Q_CONST,
+    BC_ADD_INPUT, BC_SUBTRACT_INPUT, BC_MULTIPLY_C_INPUT,
+    BC_MULTIPLY_Q_INPUT, BC_DIVIDE_C_INPUT, BC_DIVIDE_Q_INPUT
+};
+
+const int BC_OPERATION_COUNT = BC_ADD_CONST - BC_ADD;
+
+struct Bytecode {
+    BytecodeOp op;
+    int operand;
+};
+
+class BytecodeProgram {
+public:
+    BytecodeProgram() : resultKind(CK_COMPLEX_NUMBER), maxDepth(0) {}
+
+    // проверяет глубину стека и виды операндов, выводит виды результатов
+    // и переводит программу в байткод
+    bool compile(const RpnProgram& program) {
+        code.clear();
+        constants.clear();
+        constantKinds.clear();
+        inputKinds = program.getInputKinds();
+        error.clear();
+        maxDepth = 0;
+        std::vector<ComplexKind> kinds;
+        const std::vector<RpnInstruction>& instructions =
+            program.getInstructions();
+        for (size_t i = 0; i < instructions.size(); ++i) {
+            const RpnInstruction& instruction = instructions[i];
+            if (instruction.kind == RI_OPERATION) {
+                if (kinds.size() < 2) {
+                    return fail(i, kinds.empty() ? "the stack is empty" :
+                        "only one operand in stack");
+                }
+                ComplexKind lKind = kinds.back();
+                kinds.pop_back();
+                ComplexKind rKind = kinds.back();
+                kinds.back() = promote(lKind, rKind);
+                code.push_back(
+                    makeOperation(instruction.operation, kinds.back(), 0, -1));
+                continue;
+            }
+            ComplexKind kind;
+            int operand;
+            int source;
+            if (instruction.kind == RI_PUSH_LITERAL) {
+                kind = instruction.literal.getKind();
+                operand = constants.size();
+                constants.push_back(instruction.literal.toComponents());
+                constantKinds.push_back(kind);
+                source = 1;
+            } else {
+                if (instruction.inputIndex < 0 ||
+                    instruction.inputIndex >= (int)inputKinds.size()) {
+                    return fail(i, "unknown input");
+                }
+                kind = inputKinds[instruction.inputIndex];
+                operand = instruction.inputIndex;
+                source = 2;
+            }
+            if (!kinds.empty() && i + 1 < instructions.size() &&
+                instructions[i + 1].kind == RI_OPERATION) {
+                kinds.back() = promote(kind, kinds.back());
+                code.push_back(makeOperation(instructions[i + 1].operation,
+                    kinds.back(), source, operand));
+                ++i;
+                continue;
+            }
+            kinds.push_back(kind);
+            if (kinds.size() > maxDepth) {
+                maxDepth = kinds.size();
+            }
+            Bytecode push = {source == 1 ? BC_PUSH_CONST : BC_PUSH_INPUT,
+                operand};
+            code.push_back(push);
+        }
+        if (kinds.empty()) {
+            return fail(instructions.size(), "the stack is empty");
+        }
+        resultKind = kinds.back();
+        return true;
+    }
+
+    RpnStatus run(const Operand* inputs, Operand& result) const {
+        if (code.empty()) {
+            return RS_INVALID_PROGRAM;
+        }
+        for (size_t i = 0; i < inputKinds.size(); ++i) {
+            if (inputs[i].getKind() == CK_QUATERNION &&
+                inputKinds[i] == CK_COMPLEX_NUMBER) {
+                return RS_INPUT_KIND_MISMATCH;
+            }
+        }
+        Components localStack[LOCAL_STACK_SIZE];
+        std::vector<Components> heapStack;
+        Components* stack = localStack;
+        if (maxDepth > LOCAL_STACK_SIZE) {
+            heapStack.resize(maxDepth);
+            stack = heapStack.data();
+        }
+        Components* sp = stack;
+        const Components* pool = constants.data();
+        for (const Bytecode& instruction : code) {
+            switch (instruction.op) {
+            case BC_PUSH_CONST:
+                *sp++ = pool[instruction.operand];
+                break;
+            case BC_PUSH_INPUT:
+                *sp++ = inputs[instruction.operand].toComponents();
+                break;
+            case BC_ADD:
+                sp[-2] = addComponents(sp[-1], sp[-2]);
+                --sp;
+                break;
+            case BC_SUBTRACT:
+                sp[-2] = subtractComponents(sp[-1], sp[-2]);
+                --sp;
+                break;
+            case BC_MULTIPLY_C:
+                sp[-2] = multiplyComplexComponents(sp[-1], sp[-2]);
+                --sp;
+                break;
+            case BC_MULTIPLY_Q:
+                sp[-2] = multiplyQuaternionComponents(sp[-1], sp[-2]);
+                --sp;
+                break;
+            case BC_DIVIDE_C:
+                if (isCalculatorZeroDivisor(sp[-2])) return RS_DIVIDE_BY_ZERO;
+                sp[-2] = divideComplexComponents(sp[-1], sp[-2]);
+                --sp;
+                break;
+            case BC_DIVIDE_Q:
+                if (isCalculatorZeroDivisor(sp[-2])) return RS_DIVIDE_BY_ZERO;
+                sp[-2] = divideQuaternionComponents(sp[-1], sp[-2]);
+                --sp;
+                break;
+            case BC_ADD_CONST:
+                sp[-1] = addComponents(pool[instruction.operand], sp[-1]);
+                break;
+            case BC_SUBTRACT_CONST:
+                sp[-1] = subtractComponents(pool[instruction.operand], sp[-1]);
+                break;
+            case BC_MULTIPLY_C_CONST:
+                sp[-1] = multiplyComplexComponents(pool[instruction.operand],
+                    sp[-1]);
+                break;
+            case BC_MULTIPLY_Q_CONST:
+                sp[-1] = multiplyQuaternionComponents(
+                    pool[instruction.operand], sp[-1]);
+                break;
+            case BC_DIVIDE_C_CONST:
+                if (isCalculatorZeroDivisor(sp[-1])) return RS_DIVIDE_BY_ZERO;
+                sp[-1] = divideComplexComponents(pool[instruction.operand],
+                    sp[-1]);
+                break;
+            case BC_DIVIDE_Q_CONST:
+                if (isCalculatorZeroDivisor(sp[-1])) return RS_DIVIDE_BY_ZERO;
+                sp[-1] = divideQuaternionComponents(pool[instruction.operand],
+                    sp[-1]);
+                break;
+            case BC_ADD_INPUT:
+                sp[-1] = addComponents(
+                    inputs[instruction.operand].toComponents(), sp[-1]);
+                break;
+            case BC_SUBTRACT_INPUT:
+                sp[-1] = subtractComponents(
+                    inputs[instruction.operand].toComponents(), sp[-1]);
+                break;
+            case BC_MULTIPLY_C_INPUT:
+                sp[-1] = multiplyComplexComponents(
+                    inputs[instruction.operand].toComponents(), sp[-1]);
+                break;
+            case BC_MULTIPLY_Q_INPUT:
+                sp[-1] = multiplyQuaternionComponents(
+                    inputs[instruction.operand].toComponents(), sp[-1]);
+                break;
+            case BC_DIVIDE_C_INPUT:
+                if (isCalculatorZeroDivisor(sp[-1])) return RS_DIVIDE_BY_ZERO;
+                sp[-1] = divideComplexComponents(
+                    inputs[instruction.operand].toComponents(), sp[-1]);
+                break;
+            case BC_DIVIDE_Q_INPUT:
+                if (isCalculatorZeroDivisor(sp[-1])) return RS_DIVIDE_BY_ZERO;
+                sp[-1] = divideQuaternionComponents(
+                    inputs[instruction.operand].toComponents(), sp[-1]);
+                break;
+            }
+        }
+        result = Operand(resultKind, sp[-1]);
+        return RS_OK;
+    }
+
+    // для программ без входов: входам программы здесь взяться неоткуда
+    RpnStatus run(Operand& result) const {
+        if (!code.empty() && !inputKinds.empty()) {
+            return RS_INPUT_SIZE_MISMATCH;
+        }
+        return run(nullptr, result);
+    }
+
+    ComplexKind getResultKind() const {
+        return resultKind;
+    }
+
+    size_t getMaxDepth() const {
+        return maxDepth;
+    }
+
+    const std::vector<Bytecode>& getCode() const {
+        return code;
+    }
+
+    const std::vector<Components>& getConstants() const {
+        return constants;
+    }
+
+    const std::vector<ComplexKind>& getConstantKinds() const {
+        return constantKinds;
+    }
+
+    const std::vector<ComplexKind>& getInputKinds() const {
+        return inputKinds;
+    }
+
+    const std::string& getError() const {
+        return error;
+    }
+private:
+    static constexpr size_t LOCAL_STACK_SIZE = 32;
+
+    std::vector<Bytecode> code;
+    std::vector<Components> constants;
+    std::vector<ComplexKind> constantKinds;
+    std::vector<ComplexKind> inputKinds;
+    ComplexKind resultKind;
+    size_t maxDepth;
+    std::string error;
+
+    static ComplexKind promote(ComplexKind lKind, ComplexKind rKind) {
+        return lKind == CK_QUATERNION || rKind == CK_QUATERNION ?
+            CK_QUATERNION : CK_COMPLEX_NUMBER;
+    }
+
+    static Bytecode makeOperation(Operations operation, ComplexKind kind,
+        int source, int operand) {
+        int op = BC_ADD;
+        switch (operation) {
+        case OP_ADD:
+            op = BC_ADD;
+            break;
+        case OP_SUBTRACT:
+            op = BC_SUBTRACT;
+            break;
+        case OP_MULTIPLY:
+            op = kind == CK_QUATERNION ? BC_MULTIPLY_Q : BC_MULTIPLY_C;
+            break;
+        case OP_DIVIDE:
+            op = kind == CK_QUATERNION ? BC_DIVIDE_Q : BC_DIVIDE_C;
+            break;
+        }
+        Bytecode res = {BytecodeOp(op + source * BC_OPERATION_COUNT),
+            operand};
+        return res;
+    }
+
+    bool fail(size_t position, const char* message) {
+        error = std::string(message) + " at instruction " +
+            std::to_string(position);
+        code.clear();
+        constants.clear();
+        constantKinds.clear();
+        return false;
+    }
+};
+
+// Шаги RPN-программы, заданной типом, для StaticRpnProgram. Литерал
+// задаётся классом с полями static constexpr kind и value, например
+// struct Half {static constexpr ComplexKind kind = CK_COMPLEX_NUMBER;
+// static constexpr Components value = {0.5, 0, 0, 0};}.
+template <size_t Index, ComplexKind Kind = CK_COMPLEX_NUMBER>
+struct RpnInput {
+    static constexpr RpnInstructionKind instruction = RI_PUSH_INPUT;
+    static constexpr ComplexKind kind = Kind;
+    static constexpr size_t index = Index;
+    static constexpr Operations operation = OP_ADD;
+
+    template <ComplexKind, size_t Depth>
+    static constexpr RpnStatus apply(Components* stack,
+        const Components* inputs) {
+        stack[Depth] = inputs[Index];
+        return RS_OK;
+    }
+};
+
+template <class Constant>
+struct RpnLiteral {
+    static constexpr RpnInstructionKind instruction = RI_PUSH_LITERAL;
+    static constexpr ComplexKind kind = Constant::kind;
+    static constexpr size_t index = 0;
+    static constexpr Operations operation = OP_ADD;
+
+    template <ComplexKind, size_t Depth>
+    static constexpr RpnStatus apply(Components* stack, const Components*) {
+        stack[Depth] = Constant::value;
+        return RS_OK;
+    }
+};
+
+// Kind - вид результата операции, Depth - глубина стека до неё; обе
+// известны при компиляции, так что остаётся одна ветка без переходов
+template <Operations Op>
+struct RpnApply {
+    static constexpr RpnInstructionKind instruction = RI_OPERATION;
+    static constexpr ComplexKind kind = CK_COMPLEX_NUMBER;
+    static constexpr size_t index = 0;
+    static constexpr Operations operation = Op;
+
+    template <ComplexKind Kind, size_t Depth>
+    static constexpr RpnStatus apply(Components* stack, const Components*) {
+        const Components& l = stack[Depth - 1];
+        Components& r = stack[Depth - 2];
+        if constexpr (Op == OP_ADD) {
+            r = addComponents(l, r);
+        } else if constexpr (Op == OP_SUBTRACT) {
+            r = subtractComponents(l, r);
+        } else if constexpr (Op == OP_MULTIPLY) {
+            r = Kind == CK_QUATERNION ? multiplyQuaternionComponents(l, r) :
+                multiplyComplexComponents(l, r);
+        } else {
+            if (isCalculatorZeroDivisor(r)) {
+                return RS_DIVIDE_BY_ZERO;
+            }
+            r = Kind == CK_QUATERNION ? divideQuaternionComponents(l, r) :
+                divideComplexComponents(l, r);
+        }
+        return RS_OK;
+    }
+};
+
+struct StaticRpnValue {
+    RpnStatus status;
+    Components value;
+};
+
+// Разбор программы при компиляции, как в BytecodeProgram::compile: для
+// каждого шага - глубина стека до него и вид его результата. Массивы на
+// один элемент длиннее, чтобы не было массивов нулевой длины.
+template <size_t Steps>
+struct StaticRpnShape {
+    bool valid;
+    ComplexKind resultKind;
+    size_t resultSlot;
+    size_t maxDepth;
+    size_t inputCount;
+    ComplexKind inputKinds[Steps + 1];
+    bool declaredInputs[Steps + 1];
+    ComplexKind stepKinds[Steps + 1];
+    size_t depths[Steps + 1];
+};
+
+// false в valid - нехватка операндов, пустая программа или вход,
+// объявленный с разными видами
+template <class... Steps>
+constexpr StaticRpnShape<sizeof...(Steps)> staticRpnShape() {
+    const size_t count = sizeof...(Steps);
+    const RpnInstructionKind instructions[] =
+        {RI_OPERATION, Steps::instruction...};
+    const ComplexKind kinds[] = {CK_COMPLEX_NUMBER, Steps::kind...};
+    const size_t indices[] = {0, Steps::index...};
+    StaticRpnShape<count> shape = {};
+    ComplexKind stack[count + 1] = {};
+    size_t depth = 0;
+    for (size_t i = 0; i < count; ++i) {
+        shape.depths[i] = depth;
+        if (instructions[i + 1] == RI_OPERATION) {
+            if (depth < 2) {
+                return shape;
+            }
+            --depth;
+            stack[depth - 1] = stack[depth] == CK_QUATERNION ||
+                stack[depth - 1] == CK_QUATERNION ?
+                CK_QUATERNION : CK_COMPLEX_NUMBER;
+            shape.stepKinds[i] = stack[depth - 1];
+            continue;
+        }
+        if (instructions[i + 1] == RI_PUSH_INPUT) {
+            size_t index = indices[i + 1];
+            if (index >= count || (shape.declaredInputs[index] &&
+                shape.inputKinds[index] != kinds[i + 1])) {
+                return shape;
+            }
+            shape.declaredInputs[index] = true;
+            shape.inputKinds[index] = kinds[i + 1];
+            shape.inputCount = std::max(shape.inputCount, index + 1);
+        }
+        stack[depth++] = kinds[i + 1];
+        shape.stepKinds[i] = kinds[i + 1];
+        shape.maxDepth = std::max(shape.maxDepth, depth);
+    }
+    if (depth == 0) {
+        return shape;
+    }
+    shape.resultKind = stack[depth - 1];
+    shape.resultSlot = depth - 1;
+    shape.valid = true;
+    return shape;
+}
+
+// RPN-программа, заданная типом: StaticRpnProgram<RpnInput<0>,
+// RpnLiteral<Half>, RpnApply<OP_MULTIPLY>>. Глубина стека и виды
+// операндов каждого шага выводятся при компиляции, так что run()
+// разворачивается в прямой код над локальными Components без обращений
+// к getKind() и без выделения памяти, а при постоянных входах считается
+// в constexpr. Операции и правило деления на 0 те же, что у
+// BytecodeProgram и Calculator, и результат совпадает с ними побитно;
+// значение из compute() при компиляции - тоже, если компилятор не
+// сливает умножение со сложением в FMA во время выполнения.
+template <class... Steps>
+class StaticRpnProgram {
+public:
+    static constexpr StaticRpnShape<sizeof...(Steps)> shape =
+        staticRpnShape<Steps...>();
+    static_assert(shape.valid, "invalid static RPN program");
+
+    static constexpr ComplexKind resultKind = shape.resultKind;
+    static constexpr size_t inputCount = shape.inputCount;
+
+    typedef typename std::conditional<resultKind == CK_QUATERNION,
+        Quaternion, ComplexNumber>::type Result;
+
+    // inputs - компоненты входов по номерам; у комплексного входа j и k
+    // равны нулю. При делении на 0 result не меняется.
+    FLATTEN static constexpr RpnStatus run(const Components* inputs,
+        Components& result) {
+        Components stack[shape.maxDepth] = {};
+        RpnStatus status = runSteps(stack, inputs,
+            std::make_index_sequence<sizeof...(Steps)>());
+        if (status == RS_OK) {
+            result = stack[shape.resultSlot];
+        }
+        return status;
+    }
+
+    // то же для constexpr: при постоянных входах значение считается при
+    // компиляции
+    static constexpr StaticRpnValue compute(const Components* inputs) {
+        StaticRpnValue res = {RS_OK, Components()};
+        res.status = run(inputs, res.value);
+        return res;
+    }
+
+    // входы - ComplexNumber или Quaternion по порядку номеров; кватернион
+    // на месте комплексного входа - ошибка компиляции
+    template <class... Inputs>
+    FLATTEN static RpnStatus evaluate(Result& result,
+        const Inputs&... inputs) {
+        static_assert(sizeof...(Inputs) == inputCount,
+            "wrong number of static RPN inputs");
+        static_assert(acceptsInputs<Inputs...>(),
+            "quaternion passed to a complex static RPN input");
+        const Components values[] = {Components(), toComponents(inputs)...};
+        Components res = {};
+        RpnStatus status = run(values + 1, res);
+        if (status == RS_OK) {
+            store(res, result);
+        }
+        return status;
+    }
+private:
+    static Components toComponents(const ComplexNumber& value) {
+        Components res = {value.getReal(), value.getI(), 0, 0};
+        return res;
+    }
+
+    static Components toComponents(const Quaternion& value) {
+        Components res = {value.getReal(), value.getI(), value.getJ(),
+            value.getK()};
+        return res;
+    }
+
+    static void store(const Components& value, ComplexNumber& result) {
+        result = ComplexNumber(value.real, value.iCoef);
+    }
+
+    static void store(const Components& value, Quaternion& result) {
+        result = Quaternion(value.real, value.iCoef, value.jCoef,
+            value.kCoef);
+    }
+
+    template <class... Inputs>
+    static constexpr bool acceptsInputs() {
+        const bool quaternions[] = {false,
+            std::is_same<Inputs, Quaternion>::value...};
+        for (size_t i = 0; i < sizeof...(Inputs); ++i) {
+            if (quaternions[i + 1] &&
+                shape.inputKinds[i] == CK_COMPLEX_NUMBER) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    template <size_t... I>
+    static constexpr RpnStatus runSteps(Components* stack,
+        const Components* inputs, std::index_sequence<I...>) {
+        RpnStatus status = RS_OK;
+        bool ok = (((status = Steps::template apply<shape.stepKinds[I],
+            shape.depths[I]>(stack, inputs)) == RS_OK) && ...);
+        return ok ? RS_OK : status;
+    }
+};
+
+// нулевой делитель - по правилу isCalculatorZeroDivisor, j и k не важны
+SIMD_KERNEL void markZeroDivisorsKernel(size_t n, const double* real,
+    const double* iCoef, unsigned char* status) {
+    for (size_t i = 0; i < n; ++i) {
+        if (real[i] == 0 && iCoef[i] == 0) {
+            status[i] = RS_DIVIDE_BY_ZERO;
+        }
+    }
+}
+
+// Прогоняет одну скомпилированную программу по столбцам входов. Каждый
+// уровень стека - SoA-буфер на BATCH_TILE_SIZE дорожек, тайлы раздаются
+// потокам динамически. Деление на 0 не прерывает вычисление, а отмечается в
+// status для своей дорожки.
+class BatchEvaluator {
+public:
+    static constexpr size_t BATCH_TILE_SIZE = 256;
+
+    BatchEvaluator(const BytecodeProgram& _program, unsigned _threads = 0) :
+        program(_program),
+        threads(_threads),
+        columns(_program.getInputKinds().size()) {}
+
+    void bindInput(int index, const ComplexArray& column) {
+        InputColumn input = {CK_COMPLEX_NUMBER, true, column.size(),
+            {column.getRealData(), column.getIData(), nullptr, nullptr}};
+        columns.at(index) = input;
+    }
+
+    void bindInput(int index, const QuaternionArray& column) {
+        InputColumn input = {CK_QUATERNION, true, column.size(),
+            {column.getRealData(), column.getIData(),
+                column.getJData(), column.getKData()}};
+        columns.at(index) = input;
+    }
+
+    // RS_OK означает, что пакет посчитан; ошибки отдельных дорожек в status
+    RpnStatus evaluate(QuaternionArray& result,
+        std::vector<unsigned char>& status) const {
+        if (program.getCode().empty()) {
+            return RS_INVALID_PROGRAM;
+        }
+        size_t count = columns.empty() ? 1 : columns[0].size;
+        for (size_t i = 0; i < columns.size(); ++i) {
+            if (!columns[i].bound) {
+                return RS_INPUT_NOT_BOUND;
+            }
+            if (columns[i].kind == CK_QUATERNION &&
+                program.getInputKinds()[i] == CK_COMPLEX_NUMBER) {
+                return RS_INPUT_KIND_MISMATCH;
+            }
+            if (columns[i].size != count) {
+                return RS_INPUT_SIZE_MISMATCH;
+            }
+        }
+        result.resize(count);
+        status.assign(count, RS_OK);
+        size_t tiles = (count + BATCH_TILE_SIZE - 1) / BATCH_TILE_SIZE;
+        unsigned workers = std::min<size_t>(workerCount(threads),
+            std::max<size_t>(tiles, 1));
+        std::vector<Workspace> workspaces(workers);
+        parallelFor(tiles, workers, [&](size_t tile, unsigned worker) {
+            Workspace& workspace = workspaces[worker];
+            if (workspace.buffer.empty()) {
+                prepare(workspace);
+            }
+            size_t offset = tile * BATCH_TILE_SIZE;
+            runTile(workspace, offset,
+                std::min(BATCH_TILE_SIZE, count - offset),
+                result, status.data() + offset);
+        });
+        return RS_OK;
+    }
+private:
+    struct InputColumn {
+        ComplexKind kind;
+        bool bound;
+        size_t size;
+        const double* lanes[4];
+    };
+
+    struct TileSlot {
+        ComplexKind kind;
+        const double* lanes[4];
+    };
+
+    struct Workspace {
+        AlignedLane buffer;
+        std::vector<TileSlot> constants;
+        std::vector<TileSlot> stack;
+        const double* zeros;
+    };
+
+    const BytecodeProgram& program;
+    unsigned threads;
+    std::vector<InputColumn> columns;
+
+    // буфер потока: уровни стека, размноженные константы и нулевая дорожка
+    void prepare(Workspace& workspace) const {
+        const std::vector<Components>& constants = program.getConstants();
+        size_t depth = std::max<size_t>(program.getMaxDepth(), 1);
+        size_t lanes = (depth * 2 + constants.size()) * 4 + 1;
+        workspace.buffer.assign(lanes * BATCH_TILE_SIZE, 0);
+        double* base = workspace.buffer.data();
+        workspace.zeros = base + (lanes - 1) * BATCH_TILE_SIZE;
+        workspace.stack.resize(depth);
+        workspace.constants.resize(constants.size());
+        for (size_t i = 0; i < constants.size(); ++i) {
+            double* lane = base + (depth * 2 + i) * 4 * BATCH_TILE_SIZE;
+            const double values[] = {constants[i].real, constants[i].iCoef,
+                constants[i].jCoef, constants[i].kCoef};
+            TileSlot& slot = workspace.constants[i];
+            slot.kind = program.getConstantKinds()[i];
+            for (int c = 0; c < 4; ++c) {
+                std::fill(lane + c * BATCH_TILE_SIZE,
+                    lane + (c + 1) * BATCH_TILE_SIZE, values[c]);
+                slot.lanes[c] = lane + c * BATCH_TILE_SIZE;
+            }
+        }
+    }
+
+    TileSlot inputSlot(const Workspace& workspace, int index,
+        size_t offset) const {
+        const InputColumn& column = columns[index];
+        TileSlot slot = {program.getInputKinds()[index], {
+            column.lanes[0] + offset, column.lanes[1] + offset,
+            column.lanes[2] ? column.lanes[2] + offset : workspace.zeros,
+            column.lanes[3] ? column.lanes[3] + offset : workspace.zeros}};
+        return slot;
+    }
+
+    void runTile(Workspace& workspace, size_t offset, size_t n,
+        QuaternionArray& result, unsigned char* status) const {
+        double* levels = workspace.buffer.data();
+        TileSlot* stack = workspace.stack.data();
+        size_t sp = 0;
+        for (const Bytecode& instruction : program.getCode()) {
+            if (instruction.op == BC_PUSH_CONST) {
+                stack[sp++] = workspace.constants[instruction.operand];
+                continue;
+            }
+            if (instruction.op == BC_PUSH_INPUT) {
+                stack[sp++] = inputSlot(workspace, instruction.operand, offset);
+                continue;
+            }
+            int source = (instruction.op - BC_ADD) / BC_OPERATION_COUNT;
+            int op = BC_ADD + (instruction.op - BC_ADD) % BC_OPERATION_COUNT;
+            TileSlot lhs;
+            size_t dest;
+            if (source == 0) {
+                lhs = stack[sp - 1];
+                dest = sp - 2;
+                --sp;
+            } else {
+                lhs = source == 1 ?
+                    workspace.constants[instruction.operand] :
+                    inputSlot(workspace, instruction.operand, offset);
+                dest = sp - 1;
+            }
+            const TileSlot& rhs = stack[dest];
+            // у каждого уровня два буфера: результат пишется не поверх
+            // операнда, иначе проверка перекрытия в ядрах отключает SIMD
+            double* out[4];
+            double* level = levels + dest * 8 * BATCH_TILE_SIZE;
+            if (rhs.lanes[0] == level) {
+                level += 4 * BATCH_TILE_SIZE;
+            }
+            for (int c = 0; c < 4; ++c) {
+                out[c] = level + c * BATCH_TILE_SIZE;
+            }
+            bool quaternion = lhs.kind == CK_QUATERNION ||
+                rhs.kind == CK_QUATERNION;
+            int lanes = quaternion ? 4 : 2;
+            switch (op) {
+            case BC_ADD:
+                for (int c = 0; c < lanes; ++c) {
+                    addLanesKernel(n, lhs.lanes[c], rhs.lanes[c], out[c]);
+                }
+                break;
+            case BC_SUBTRACT:
+                for (int c = 0; c < lanes; ++c) {
+                    subtractLanesKernel(n, lhs.lanes[c], rhs.lanes[c], out[c]);
+                }
+                break;
+            case BC_MULTIPLY_C:
+                complexMultiplyKernel(n, lhs.lanes[0], lhs.lanes[1],
+                    rhs.lanes[0], rhs.lanes[1], out[0], out[1]);
+                break;
+            case BC_MULTIPLY_Q:
+                quaternionMultiplyKernel(n, lhs.lanes[0], lhs.lanes[1],
+                    lhs.lanes[2], lhs.lanes[3], rhs.lanes[0], rhs.lanes[1],
+                    rhs.lanes[2], rhs.lanes[3], out[0], out[1], out[2], out[3]);
+                break;
+            case BC_DIVIDE_C:
+                markZeroDivisorsKernel(n, rhs.lanes[0], rhs.lanes[1],
+                    status);
+                complexDivideKernel(n, lhs.lanes[0], lhs.lanes[1],
+                    rhs.lanes[0], rhs.lanes[1], out[0], out[1]);
+                break;
+            case BC_DIVIDE_Q:
+                markZeroDivisorsKernel(n, rhs.lanes[0], rhs.lanes[1],
+                    status);
+                quaternionDivideKernel(n, lhs.lanes[0], lhs.lanes[1],
+                    lhs.lanes[2], lhs.lanes[3], rhs.lanes[0], rhs.lanes[1],
+                    rhs.lanes[2], rhs.lanes[3], out[0], out[1], out[2], out[3]);
+                break;
+            }
+            TileSlot res = {quaternion ? CK_QUATERNION : CK_COMPLEX_NUMBER,
+                {out[0], out[1], quaternion ? out[2] : workspace.zeros,
+                    quaternion ? out[3] : workspace.zeros}};
+            stack[dest] = res;
+        }
+        const TileSlot& top = stack[sp - 1];
+        double* resultLanes[] = {result.getRealData(), result.getIData(),
+            result.getJData(), result.getKData()};
+        for (int c = 0; c < 4; ++c) {
+            std::copy(top.lanes[c], top.lanes[c] + n, resultLanes[c] + offset);
+        }
+    }
+};
+
+// Текстовый формат: одна программа в строке, токены через пробелы.
+// Литерал - вещественное число, "(re,im)" или "(r,i,j,k)" без пробелов
+// внутри скобок; операции "+ - * /". Пустые строки и строки с '#' в начале
+// пропускаются.
+inline bool isRpnSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+// Быстрый путь Клингера: до 15 значащих цифр и до 22 знаков после точки
+// мантисса и степень десяти точны в double, одно деление округляется
+// корректно. Остальное (экспонента, длинные мантиссы) - через from_chars.
+inline std::from_chars_result parseRpnNumber(const char* begin,
+    const char* end, double& value) {
+    static const double powersOfTen[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6,
+        1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18,
+        1e19, 1e20, 1e21, 1e22};
+    const char* cursor = begin;
+    bool negative = cursor != end && *cursor == '-';
+    cursor += negative;
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int fraction = -1;
+    for (; cursor != end; ++cursor) {
+        unsigned digit = unsigned(*cursor - '0');
+        if (digit < 10) {
+            mantissa = mantissa * 10 + digit;
+            ++digits;
+            fraction += fraction >= 0;
+        } else if (*cursor == '.' && fraction < 0) {
+            fraction = 0;
+        } else {
+            break;
+        }
+    }
+    bool exponent = cursor != end && (*cursor == 'e' || *cursor == 'E');
+    if (digits == 0 || digits > 15 || fraction > 22 || exponent) {
+        return std::from_chars(begin, end, value);
+    }
+    value = double(mantissa);
+    if (fraction > 0) {
+        value /= powersOfTen[fraction];
+    }
+    if (negative) {
+        value = -value;
+    }
+    return std::from_chars_result{cursor, std::errc()};
+}
+
+inline bool parseRpnLiteral(const char* begin, const char* end,
+    Operand& literal) {
+    double values[4] = {0, 0, 0, 0};
+    int count = 0;
+    if (*begin != '(') {
+        std::from_chars_result parsed = parseRpnNumber(begin, end, values[0]);
+        if (parsed.ec != std::errc() || parsed.ptr != end) {
+            return false;
+        }
+        literal = Operand(CK_COMPLEX_NUMBER, Components{values[0], 0, 0, 0});
+        return true;
+    }
+    if (end - begin < 2 || end[-1] != ')') {
+        return false;
+    }
+    const char* cursor = begin + 1;
+    --end;
+    while (count < 4) {
+        std::from_chars_result parsed =
+            parseRpnNumber(cursor, end, values[count]);
+        if (parsed.ec != std::errc()) {
+            return false;
+        }
+        ++count;
+        cursor = parsed.ptr;
+        if (cursor == end) {
+            break;
+        }
+        if (*cursor++ != ',') {
+            return false;
+        }
+    }
+    if (cursor != end || (count != 2 && count != 4)) {
+        return false;
+    }
+    literal = Operand(count == 2 ? CK_COMPLEX_NUMBER : CK_QUATERNION,
+        Components{values[0], values[1], values[2], values[3]});
+    return true;
+}
+
+// Обходит токены строки [begin, end) без копирования: литералы уходят в
+// onLiteral, операции - в onOperation. false - неизвестный токен.
+template <class LiteralHandler, class OperationHandler>
+bool forEachRpnToken(const char* begin, const char* end,
+    LiteralHandler onLiteral, OperationHandler onOperation) {
+    while (true) {
+        while (begin != end && isRpnSpace(*begin)) {
+            ++begin;
+        }
+        if (begin == end) {
+            return true;
+        }
+        const char* tokenEnd = begin;
+        while (tokenEnd != end && !isRpnSpace(*tokenEnd)) {
+            ++tokenEnd;
+        }
+        if (tokenEnd - begin == 1 && (*begin == '+' || *begin == '-' ||
+            *begin == '*' || *begin == '/')) {
+            onOperation(*begin == '+' ? OP_ADD : *begin == '-' ?
+                OP_SUBTRACT : *begin == '*' ? OP_MULTIPLY : OP_DIVIDE);
+        } else {
+            Operand literal;
+            if (!parseRpnLiteral(begin, tokenEnd, literal)) {
+                return false;
+            }
+            onLiteral(literal);
+        }
+        begin = tokenEnd;
+    }
+}
+
+inline bool parseRpnLine(const char* begin, const char* end,
+    RpnProgram& program) {
+    program.clear();
+    return forEachRpnToken(begin, end,
+        [&](const Operand& literal) { program.pushLiteral(literal); },
+        [&](Operations operation) { program.apply(operation); });
+}
+
+// Считает строку сразу при разборе, без RpnProgram и компиляции; семантика
+// та же, что у BytecodeProgram: ошибка разбора или нехватка операндов важнее
+// деления на ноль. stack - рабочий буфер, переиспользуется между строками.
+inline RpnStatus evaluateRpnLine(const char* begin, const char* end,
+    std::vector<Operand>& stack, Operand& result) {
+    stack.clear();
+    bool invalid = false;
+    bool divideByZero = false;
+    bool parsed = forEachRpnToken(begin, end,
+        [&](const Operand& literal) { stack.push_back(literal); },
+        [&](Operations operation) {
+            if (stack.size() < 2) {
+                invalid = true;
+                return;
+            }
+            const Operand& lOperand = stack.back();
+            Operand& rOperand = stack[stack.size() - 2];
+            ComplexKind kind = lOperand.getKind() == CK_QUATERNION ||
+                rOperand.getKind() == CK_QUATERNION ?
+                CK_QUATERNION : CK_COMPLEX_NUMBER;
+            Components l = lOperand.toComponents();
+            Components r = rOperand.toComponents();
+            switch (operation) {
+            case OP_ADD:
+                r = addComponents(l, r);
+                break;
+            case OP_SUBTRACT:
+                r = subtractComponents(l, r);
+                break;
+            case OP_MULTIPLY:
+                r = kind == CK_QUATERNION ? multiplyQuaternionComponents(l, r) :
+                    multiplyComplexComponents(l, r);
+                break;
+            case OP_DIVIDE:
+                if (isCalculatorZeroDivisor(r)) {
+                    divideByZero = true;
+                    break;
+                }
+                r = kind == CK_QUATERNION ? divideQuaternionComponents(l, r) :
+                    divideComplexComponents(l, r);
+                break;
+            }
+            rOperand = Operand(kind, r);
+            stack.pop_back();
+        });
+    if (!parsed || invalid || stack.empty()) {
+        return RS_INVALID_PROGRAM;
+    }
+    if (divideByZero) {
+        return RS_DIVIDE_BY_ZERO;
+    }
+    result = stack.back();
+    return RS_OK;
+}
+
+const size_t RPN_CHUNK_BYTES = 1 << 20;
+
+// Считает все программы текста. Текст режется на куски по
+// RPN_CHUNK_BYTES с границей на ближайшем переводе строки; куски считаются
+// параллельно, результаты сохраняют порядок строк. Строки, которые не
+// разбираются или не компилируются, получают RS_INVALID_PROGRAM.
+inline void runRpnText(const char* text, size_t length,
+    QuaternionArray& result, std::vector<unsigned char>& status,
+    unsigned threads = 0) {
+    std::vector<size_t> starts(1, 0);
+    for (size_t offset = RPN_CHUNK_BYTES; offset < length;
+        offset += RPN_CHUNK_BYTES) {
+        offset = std::max(offset, starts.back());
+        const void* newline = std::memchr(text + offset, '\n',
+            length - offset);
+        if (!newline) {
+            break;
+        }
+        offset = static_cast<const char*>(newline) - text + 1;
+        starts.push_back(offset);
+    }
+    starts.push_back(length);
+    size_t chunks = starts.size() - 1;
+    std::vector<std::vector<Components>> values(chunks);
+    std::vector<std::vector<unsigned char>> statuses(chunks);
+    parallelFor(chunks, workerCount(threads), [&](size_t chunk, unsigned) {
+        std::vector<Operand> stack;
+        const char* line = text + starts[chunk];
+        const char* chunkEnd = text + starts[chunk + 1];
+        while (line < chunkEnd) {
+            const char* lineEnd = static_cast<const char*>(
+                std::memchr(line, '\n', chunkEnd - line));
+            if (!lineEnd) {
+                lineEnd = chunkEnd;
+            }
+            const char* first = line;
+            while (first != lineEnd && isRpnSpace(*first)) {
+                ++first;
+            }
+            if (first != lineEnd && *first != '#') {
+                Operand value;
+                RpnStatus lineStatus =
+                    evaluateRpnLine(first, lineEnd, stack, value);
+                values[chunk].push_back(lineStatus == RS_OK ?
+                    value.toComponents() : Components{0, 0, 0, 0});
+                statuses[chunk].push_back(lineStatus);
+            }
+            line = lineEnd + 1;
+        }
+    });
+    size_t count = 0;
+    for (size_t chunk = 0; chunk < chunks; ++chunk) {
+        count += values[chunk].size();
+    }
+    result.resize(count);
+    status.resize(count);
+    size_t index = 0;
+    for (size_t chunk = 0; chunk < chunks; ++chunk) {
+        for (size_t i = 0; i < values[chunk].size(); ++i, ++index) {
+            const Components& value = values[chunk][i];
+            result.getRealData()[index] = value.real;
+            result.getIData()[index] = value.iCoef;
+            result.getJData()[index] = value.jCoef;
+            result.getKData()[index] = value.kCoef;
+            status[index] = statuses[chunk][i];
+        }
+    }
+}
+
+// файл только для чтения, отображённый в память целиком
+class MappedFile {
+public:
+    MappedFile() : data(nullptr), length(0) {}
+
+    ~MappedFile() {
+        close();
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator= (const MappedFile&) = delete;
+
+    bool open(const char* path) {
+        close();
+#if defined(__unix__)
+        int descriptor = ::open(path, O_RDONLY);
+        if (descriptor < 0) {
+            return false;
+        }
+        struct stat info;
+        if (fstat(descriptor, &info) != 0) {
+            ::close(descriptor);
+            return false;
+        }
+        length = info.st_size;
+        if (length > 0) {
+            void* mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE,
+                descriptor, 0);
+            if (mapped == MAP_FAILED) {
+                length = 0;
+                ::close(descriptor);
+                return false;
+            }
+            madvise(mapped, length, MADV_SEQUENTIAL);
+            data = static_cast<const char*>(mapped);
+        }
+        ::close(descriptor);
+        return true;
+#else
+        (void)path;
+        return false;
+#endif
+    }
+
+    void close() {
+#if defined(__unix__)
+        if (data) {
+            munmap(const_cast<char*>(data), length);
+        }
+#endif
+        data = nullptr;
+        length = 0;
+    }
+
+    const char* getData() const {
+        return data;
+    }
+
+    size_t size() const {
+        return length;
+    }
+private:
+    const char* data;
+    size_t length;
+};
+
+// false - файл не открылся или не отобразился
+inline bool runRpnFile(const char* path, QuaternionArray& result,
+    std::vector<unsigned char>& status, unsigned threads = 0) {
+    MappedFile file;
+    if (!file.open(path)) {
+        return false;
+    }
+    runRpnText(file.getData(), file.size(), result, status, threads);
+    return true;
+}
+
+// Задание для Calculator: начальный стек (вершина - последний элемент) и
+// последовательность операций
+struct CalculatorJob {
+    std::vector<Operand> stack;
+    std::vector<Operations> operations;
+};
+
+// Ошибки, которые Calculator печатает в std::cout. Операция с ошибкой, как
+// и там, пропускается, стек остаётся прежним.
+enum JobStatus {JS_OK, JS_EMPTY_STACK, JS_ONE_OPERAND, JS_DIVIDE_BY_ZERO};
+
+struct CalculatorJobResult {
+    JobStatus status;   // первая ошибка
+    size_t errorStep;   // номер операции с первой ошибкой
+    size_t errorCount;
+    std::vector<Operand> stack;
+};
+
+// Одна операция Calculator над парой операндов; при делении на 0 result
+// не меняется
+inline JobStatus applyOperation(Operations operation, const Operand& lOperand,
+    const Operand& rOperand, Operand& result) {
+    ComplexKind kind = lOperand.getKind() == CK_QUATERNION ||
+        rOperand.getKind() == CK_QUATERNION ?
+        CK_QUATERNION : CK_COMPLEX_NUMBER;
+    Components l = lOperand.toComponents();
+    Components r = rOperand.toComponents();
+    switch (operation) {
+    case OP_ADD:
+        r = addComponents(l, r);
+        break;
+    case OP_SUBTRACT:
+        r = subtractComponents(l, r);
+        break;
+    case OP_MULTIPLY:
+        r = kind == CK_QUATERNION ? multiplyQuaternionComponents(l, r) :
+            multiplyComplexComponents(l, r);
+        break;
+    case OP_DIVIDE:
+        if (isCalculatorZeroDivisor(r)) {
+            return JS_DIVIDE_BY_ZERO;
+        }
+        r = kind == CK_QUATERNION ? divideQuaternionComponents(l, r) :
+            divideComplexComponents(l, r);
+        break;
+    }
+    result = Operand(kind, r);
+    return JS_OK;
+}
+
+// Одна операция Calculator над стеком операндов: левый операнд - вершина,
+// правый - под ней
+inline JobStatus applyCalculatorOperation(std::vector<Operand>& stack,
+    Operations operation) {
+    if (stack.empty()) {
+        return JS_EMPTY_STACK;
+    }
+    if (stack.size() == 1) {
+        return JS_ONE_OPERAND;
+    }
+    Operand& rOperand = stack[stack.size() - 2];
+    JobStatus status = applyOperation(operation, stack.back(), rOperand,
+        rOperand);
+    if (status == JS_OK) {
+        stack.pop_back();
+    }
+    return status;
+}
+
+// Выполняет задание без вывода в std::cout. stack - память операндов
+// вызывающего потока, переиспользуется между заданиями.
+inline CalculatorJobResult runCalculatorJob(const CalculatorJob& job,
+    std::vector<Operand>& stack) {
+    CalculatorJobResult result = {JS_OK, 0, 0, std::vector<Operand>()};
+    stack.assign(job.stack.begin(), job.stack.end());
+    for (size_t step = 0; step < job.operations.size(); ++step) {
+        JobStatus status = applyCalculatorOperation(stack,
+            job.operations[step]);
+        if (status != JS_OK && result.errorCount++ == 0) {
+            result.status = status;
+            result.errorStep = step;
+        }
+    }
+    result.stack = stack;
+    return result;
+}
+
+// Что убрал optimizeRpnProgram
+struct RpnOptimizationReport {
+    size_t foldedOperations;
+    size_t removedIdentities;
+    size_t reciprocalDivisions;
+    size_t instructionsBefore;
+    size_t instructionsAfter;
+};
+
+// Значение на стеке во время оптимизации: begin - первая инструкция,
+// которая его кладёт; у константы это единственный литерал
+struct RpnStackValue {
+    size_t begin;
+    ComplexKind kind;
+    bool constant;
+};
+
+inline bool isRpnOne(const Operand& literal) {
+    return literal.getReal() == 1 && literal.getI() == 0 &&
+        literal.getJ() == 0 && literal.getK() == 0;
+}
+
+// Упрощает операцию над l и r, код которых лежит в конце code. true -
+// операция - тождество и убрана вместе с константой, result - оставшийся
+// операнд. Тождество убирается, только если константа не повышает вид
+// результата. Деление на константу с нормой в isRegularNorm становится
+// умножением на заранее посчитанное conj / norm: на него умножает и само
+// деление, так что результат совпадает побитно, а у кватерниона константа
+// остаётся справа.
+inline bool simplifyRpnOperation(Operations& operation,
+    const RpnStackValue& l, const RpnStackValue& r,
+    std::vector<RpnInstruction>& code, RpnOptimizationReport& report,
+    RpnStackValue& result) {
+    ComplexKind kind = result.kind;
+    bool lIdentity = l.constant && kind == r.kind &&
+        (operation == OP_ADD ? code[l.begin].literal.isZero() :
+        operation == OP_MULTIPLY && isRpnOne(code[l.begin].literal));
+    bool rIdentity = r.constant && kind == l.kind &&
+        (operation == OP_ADD || operation == OP_SUBTRACT ?
+        code[r.begin].literal.isZero() : isRpnOne(code[r.begin].literal));
+    if (lIdentity) {
+        code.pop_back();
+        result = r;
+        ++report.removedIdentities;
+        return true;
+    }
+    if (rIdentity) {
+        code.erase(code.begin() + r.begin);
+        result = l;
+        result.begin = r.begin;
+        ++report.removedIdentities;
+        return true;
+    }
+    if (operation != OP_DIVIDE || !r.constant) {
+        return false;
+    }
+    Components b = code[r.begin].literal.toComponents();
+    // делитель (0, 0, j, k) run() отклоняет, как Calculator: деление
+    // остаётся, чтобы ошибка не пропала
+    if (isCalculatorZeroDivisor(b)) {
+        return false;
+    }
+    double norm = b.real * b.real + b.iCoef * b.iCoef +
+        b.jCoef * b.jCoef + b.kCoef * b.kCoef;
+    if (!isRegularNorm(norm)) {
+        return false;
+    }
+    double inverse = 1 / norm;
+    Components reverse = {b.real * inverse, -b.iCoef * inverse, 0, 0};
+    if (kind == CK_QUATERNION) {
+        reverse = conjugateComponents(b, inverse);
+    }
+    code[r.begin].literal = Operand(kind, reverse);
+    operation = OP_MULTIPLY;
+    ++report.reciprocalDivisions;
+    return false;
+}
+
+// Алгебраический проход по RPN-программе перед компиляцией: сворачивает
+// операции над константами, убирает сложение с 0, вычитание 0, умножение
+// на 1 и деление на 1, заменяет деление на константу умножением на
+// обратную. Свёртка и замена деления дают тот же результат побитно, что и
+// исходная программа, а у убранного тождества может смениться только знак
+// нуля или NaN на месте inf * 0. Деление на нулевую константу остаётся,
+// чтобы ошибку по-прежнему вернул run(); с первой нехватки операндов или
+// неизвестного входа программа копируется как есть. optimized может быть
+// тем же объектом, что и program.
+inline RpnOptimizationReport optimizeRpnProgram(const RpnProgram& program,
+    RpnProgram& optimized) {
+    const std::vector<RpnInstruction>& instructions =
+        program.getInstructions();
+    const std::vector<ComplexKind>& inputKinds = program.getInputKinds();
+    RpnOptimizationReport report = {0, 0, 0, instructions.size(), 0};
+    std::vector<RpnInstruction> code;
+    std::vector<RpnStackValue> values;
+    size_t i = 0;
+    for (; i < instructions.size(); ++i) {
+        const RpnInstruction& instruction = instructions[i];
+        if (instruction.kind == RI_PUSH_INPUT &&
+            (instruction.inputIndex < 0 ||
+            instruction.inputIndex >= (int)inputKinds.size())) {
+            break;
+        }
+        if (instruction.kind != RI_OPERATION) {
+            bool constant = instruction.kind == RI_PUSH_LITERAL;
+            RpnStackValue value = {code.size(), constant ?
+                instruction.literal.getKind() :
+                inputKinds[instruction.inputIndex], constant};
+            values.push_back(value);
+            code.push_back(instruction);
+            continue;
+        }
+        if (values.size() < 2) {
+            break;
+        }
+        RpnStackValue l = values.back();
+        values.pop_back();
+        RpnStackValue r = values.back();
+        values.pop_back();
+        if (l.constant && r.constant) {
+            Operand folded;
+            if (applyOperation(instruction.operation, code[l.begin].literal,
+                code[r.begin].literal, folded) == JS_OK) {
+                code.pop_back();
+                code.back().literal = folded;
+                RpnStackValue value = {r.begin, folded.getKind(), true};
+                values.push_back(value);
+                ++report.foldedOperations;
+                continue;
+            }
+        }
+        Operations operation = instruction.operation;
+        RpnStackValue value = {r.begin, l.kind == CK_QUATERNION ||
+            r.kind == CK_QUATERNION ? CK_QUATERNION : CK_COMPLEX_NUMBER,
+            false};
+        if (!simplifyRpnOperation(operation, l, r, code, report, value)) {
+            code.push_back(instruction);
+            code.back().operation = operation;
+        }
+        values.push_back(value);
+    }
+    code.insert(code.end(), instructions.begin() + i, instructions.end());
+    RpnProgram result;
+    for (ComplexKind kind : inputKinds) {
+        result.addInput(kind);
+    }
+    for (const RpnInstruction& instruction : code) {
+        switch (instruction.kind) {
+        case RI_PUSH_LITERAL:
+            result.pushLiteral(instruction.literal);
+            break;
+        case RI_PUSH_INPUT:
+            result.pushInput(instruction.inputIndex);
+            break;
+        case RI_OPERATION:
+            result.apply(instruction.operation);
+            break;
+        }
+    }
+    report.instructionsAfter = code.size();
+    optimized = result;
+    return report;
+}
+
+// Счётчики CalculationCache; size - число записей в кэше
+struct CacheCounters {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    size_t size;
+};
+
+// Ограниченный кэш результатов операций Calculator. Ключ - операция, виды
+// и битовые образы операндов, так что 0 и -0 или разные NaN - разные
+// ключи, а результат из кэша совпадает с посчитанным побитно. Деление на 0
+// кэшируется как статус JS_DIVIDE_BY_ZERO. Кэш разбит на шарды по хешу
+// ключа, у каждого шарда свой мутекс, свои записи и своя открытая
+// адресация по ним, так что после конструктора память не выделяется.
+// Вытеснение - CLOCK: попадание ставит записи бит обращения, стрелка
+// снимает биты и вытесняет первую запись без бита. Новая запись
+// приходит без бита, поэтому однократные ключи уходят первыми.
+class CalculationCache {
+public:
+    CalculationCache(size_t capacity, size_t shardCount = 1) {
+        size_t shards = 1;
+        while (shards < shardCount) {
+            shards *= 2;
+        }
+        size_t shardCapacity = std::max<size_t>(1,
+            (capacity + shards - 1) / shards);
+        for (size_t i = 0; i < shards; ++i) {
+            this->shards.emplace_back(new Shard(shardCapacity));
+        }
+    }
+
+    // result и статус операции над lOperand и rOperand, как у
+    // applyOperation
+    JobStatus calculate(Operations operation, const Operand& lOperand,
+        const Operand& rOperand, Operand& result) {
+        Key key;
+        uint64_t hash = makeKey(operation, lOperand, rOperand, key);
+        Shard& shard = *shards[(hash >> 48) & (shards.size() - 1)];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        size_t position = hash & shard.mask;
+        while (shard.index[position] != 0) {
+            Entry& entry = shard.entries[shard.index[position] - 1];
+            if (entry.hash == hash && entry.key == key) {
+                ++shard.counters.hits;
+                entry.referenced = true;
+                if (entry.status == JS_OK) {
+                    result = entry.result;
+                }
+                return entry.status;
+            }
+            position = (position + 1) & shard.mask;
+        }
+        ++shard.counters.misses;
+        Operand value;
+        JobStatus status = applyOperation(operation, lOperand, rOperand,
+            value);
+        size_t slot = shard.counters.size;
+        if (slot < shard.entries.size()) {
+            ++shard.counters.size;
+        } else {
+            slot = shard.evict();
+            position = hash & shard.mask;
+            while (shard.index[position] != 0) {
+                position = (position + 1) & shard.mask;
+            }
+        }
+        Entry& entry = shard.entries[slot];
+        entry.key = key;
+        entry.hash = hash;
+        entry.result = value;
+        entry.status = status;
+        entry.referenced = false;
+        shard.index[position] = slot + 1;
+        if (status == JS_OK) {
+            result = value;
+        }
+        return status;
+    }
+
+    CacheCounters getCounters() const {
+        CacheCounters total = {0, 0, 0, 0};
+        for (const std::unique_ptr<Shard>& shard : shards) {
+            std::lock_guard<std::mutex> lock(shard->mutex);
+            total.hits += shard->counters.hits;
+            total.misses += shard->counters.misses;
+            total.evictions += shard->counters.evictions;
+            total.size += shard->counters.size;
+        }
+        return total;
+    }
+
+    void clear() {
+        for (const std::unique_ptr<Shard>& shard : shards) {
+            std::lock_guard<std::mutex> lock(shard->mutex);
+            std::fill(shard->index.begin(), shard->index.end(), 0);
+            shard->counters = CacheCounters{0, 0, 0, 0};
+            shard->hand = 0;
+        }
+    }
+
+    size_t getShardCount() const {
+        return shards.size();
+    }
+private:
+    struct Key {
+        uint64_t bits[9];
+
+        bool operator== (const Key& other) const {
+            uint64_t difference = 0;
+            for (int i = 0; i < 9; ++i) {
+                difference |= bits[i] ^ other.bits[i];
+            }
+            return difference == 0;
+        }
+    };
+
+    struct Entry {
+        Key key;
+        uint64_t hash;
+        Operand result;
+        JobStatus status;
+        bool referenced;
+    };
+
+    struct alignas(SIMD_ALIGNMENT) Shard {
+        std::mutex mutex;
+        std::vector<Entry> entries;
+        // номер записи + 1, 0 - пусто; заполнено не больше чем наполовину
+        std::vector<uint32_t> index;
+        size_t mask;
+        size_t hand;
+        CacheCounters counters;
+
+        Shard(size_t capacity) : entries(capacity), hand(0) {
+            size_t size = 2;
+            while (size < 2 * capacity) {
+                size *= 2;
+            }
+            index.assign(size, 0);
+            mask = size - 1;
+            counters = CacheCounters{0, 0, 0, 0};
+        }
+
+        // освобождает запись под стрелкой CLOCK и возвращает её номер
+        size_t evict() {
+            while (entries[hand].referenced) {
+                entries[hand].referenced = false;
+                hand = (hand + 1) % entries.size();
+            }
+            size_t victim = hand;
+            hand = (hand + 1) % entries.size();
+            size_t position = entries[victim].hash & mask;
+            while (index[position] != victim + 1) {
+                position = (position + 1) & mask;
+            }
+            // сдвиг назад вместо надгробий: запись из хвоста цепочки
+            // переезжает в дыру, если дыра не раньше её домашней ячейки
+            size_t next = (position + 1) & mask;
+            while (index[next] != 0) {
+                size_t home = entries[index[next] - 1].hash & mask;
+                if (((next - home) & mask) >= ((next - position) & mask)) {
+                    index[position] = index[next];
+                    position = next;
+                }
+                next = (next + 1) & mask;
+            }
+            index[position] = 0;
+            ++counters.evictions;
+            return victim;
+        }
+    };
+
+    std::vector<std::unique_ptr<Shard>> shards;
+
+    static uint64_t makeKey(Operations operation, const Operand& lOperand,
+        const Operand& rOperand, Key& key) {
+        Components l = lOperand.toComponents();
+        Components r = rOperand.toComponents();
+        std::memcpy(key.bits, &l, sizeof(l));
+        std::memcpy(key.bits + 4, &r, sizeof(r));
+        key.bits[8] = operation | lOperand.getKind() << 8 |
+            rOperand.getKind() << 16;
+        // произведения пар слов независимы и идут параллельно, в отличие
+        // от цепочки умножений по одному слову
+        const uint64_t seeds[8] = {
+            0x9E3779B97F4A7C15ull, 0xBF58476D1CE4E5B9ull,
+            0x94D049BB133111EBull, 0xD6E8FEB86659FD93ull,
+            0xA0761D6478BD642Full, 0xE7037ED1A0B428DBull,
+            0x8EBC6AF09C88C6E3ull, 0x589965CC75374CC3ull
+        };
+        uint64_t hash = key.bits[8] * seeds[0];
+        for (int i = 0; i < 8; i += 2) {
+            hash += (key.bits[i] + seeds[i]) * (key.bits[i + 1] + seeds[i + 1]);
+        }
+        hash ^= hash >> 32;
+        hash *= seeds[3];
+        return hash ^ hash >> 29;
+    }
+};
+
+// Проверка делителя на 0 та же, что в calculate(), и идёт до кэша;
+// остальное берётся из кэша
+inline void Calculator::calculateCached(Operations operation,
+    ComplexNumber* lOperand, ComplexNumber* rOperand) {
+    Operand result;
+    if ((operation == OP_DIVIDE && *rOperand == 0) ||
+        cache->calculate(operation, Operand(*lOperand), Operand(*rOperand),
+        result) != JS_OK) {
+        CALCULATOR_STAT(++stats.divideByZero);
+        std::cout << "can't divide by 0" << std::endl;
+        push(*rOperand);
+        push(*lOperand);
+        return;
+    }
+    if (result.getKind() == CK_QUATERNION) {
+        Quaternion* res = new Quaternion(result.toQuaternion());
+        pushNew(*res);
+    } else {
+        ComplexNumber* res = new ComplexNumber(result.toComplexNumber());
+        pushNew(*res);
+    }
+}
+
+// Пул потоков с кражей работы для независимых заданий Calculator. У каждого
+// потока своя очередь и свой стек операндов. Задания извне раскладываются по
+// очередям по кругу; поток берёт задания из начала своей очереди, а когда
+// она пуста - забирает половину чужой с конца, так что потоки почти не
+// трогают общую память. Без работы поток спит, пока не придёт новое задание.
+// Результат приходит через future или колбэк в потоке пула. Колбэк не должен
+// бросать исключений и может ставить новые задания. Деструктор дожидается
+// всех заданий.
+class CalculatorScheduler {
+public:
+    typedef std::function<void(CalculatorJobResult&)> Callback;
+
+    explicit CalculatorScheduler(unsigned threads = 0) :
+        nextQueue(0), epoch(0), sleepers(0), submitted(0), stopping(false) {
+        unsigned count = workerCount(threads);
+        for (unsigned id = 0; id < count; ++id) {
+            workers.emplace_back(new Worker);
+        }
+        for (unsigned id = 0; id < count; ++id) {
+            pool.emplace_back(&CalculatorScheduler::run, this, id);
+        }
+    }
+
+    CalculatorScheduler(const CalculatorScheduler&) = delete;
+    CalculatorScheduler& operator= (const CalculatorScheduler&) = delete;
+
+    ~CalculatorScheduler() {
+        wait();
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            stopping = true;
+        }
+        wakeCondition.notify_all();
+        for (std::thread& thread : pool) {
+            thread.join();
+        }
+    }
+
+    std::future<CalculatorJobResult> submit(CalculatorJob job) {
+        std::shared_ptr<std::promise<CalculatorJobResult>> promise =
+            std::make_shared<std::promise<CalculatorJobResult>>();
+        std::future<CalculatorJobResult> future = promise->get_future();
+        submit(std::move(job), [promise](CalculatorJobResult& result) {
+            promise->set_value(std::move(result));
+        });
+        return future;
+    }
+
+    void submit(CalculatorJob job, Callback callback) {
+        // счётчик растёт раньше очереди, иначе wait() может не дождаться
+        submitted.fetch_add(1);
+        Worker& worker = *workers[nextQueue.fetch_add(1,
+            std::memory_order_relaxed) % workers.size()];
+        {
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            worker.tasks.push_back(Task{std::move(job), std::move(callback)});
+        }
+        epoch.fetch_add(1);
+        if (sleepers.load() > 0) {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            wakeCondition.notify_one();
+        }
+    }
+
+    // Ждёт завершения всех поставленных заданий, включая поставленные из
+    // колбэков
+    void wait() {
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        idleCondition.wait(lock, [this] {
+            return completed() == submitted.load();
+        });
+    }
+
+    unsigned getThreadCount() const {
+        return pool.size();
+    }
+
+private:
+    struct Task {
+        CalculatorJob job;
+        Callback callback;
+    };
+
+    // своя строка кэша на поток, чтобы счётчики и мьютексы соседей не
+    // делили её
+    struct alignas(SIMD_ALIGNMENT) Worker {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+        std::vector<Operand> stack;
+        std::atomic<size_t> completed{0};
+    };
+
+    size_t completed() const {
+        size_t total = 0;
+        for (const std::unique_ptr<Worker>& worker : workers) {
+            total += worker->completed.load();
+        }
+        return total;
+    }
+
+    bool take(unsigned id, Task& task) {
+        Worker& own = *workers[id];
+        {
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty()) {
+                task = std::move(own.tasks.front());
+                own.tasks.pop_front();
+                return true;
+            }
+        }
+        for (size_t offset = 1; offset < workers.size(); ++offset) {
+            Worker& victim = *workers[(id + offset) % workers.size()];
+            std::vector<Task> stolen;
+            {
+                std::lock_guard<std::mutex> lock(victim.mutex);
+                size_t count = (victim.tasks.size() + 1) / 2;
+                for (size_t i = 0; i < count; ++i) {
+                    stolen.push_back(std::move(victim.tasks.back()));
+                    victim.tasks.pop_back();
+                }
+            }
+            if (stolen.empty()) {
+                continue;
+            }
+            task = std::move(stolen.back());
+            stolen.pop_back();
+            if (!stolen.empty()) {
+                std::lock_guard<std::mutex> lock(own.mutex);
+                for (Task& rest : stolen) {
+                    own.tasks.push_back(std::move(rest));
+                }
+            }
+            return true;
+        }
+        return false;
+    }
+
+    void run(unsigned id) {
+        Worker& own = *workers[id];
+        Task task;
+        for (;;) {
+            // эпоха читается до поиска: задание, поставленное после
+            // неудачного поиска, её меняет и не даёт уснуть
+            size_t seen = epoch.load();
+            if (take(id, task)) {
+                CalculatorJobResult result = runCalculatorJob(task.job,
+                    own.stack);
+                task.callback(result);
+                task = Task();
+                own.completed.fetch_add(1);
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            idleCondition.notify_all();
+            if (stopping) {
+                return;
+            }
+            sleepers.fetch_add(1);
+            wakeCondition.wait(lock, [&] {
+                return stopping || epoch.load() != seen;
+            });
+            sleepers.fetch_sub(1);
+        }
+    }
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> pool;
+    std::atomic<size_t> nextQueue;
+    std::atomic<size_t> epoch;
+    std::atomic<unsigned> sleepers;
+    std::atomic<size_t> submitted;
+    bool stopping;
+    std::mutex sleepMutex;
+    std::condition_variable wakeCondition;
+    std::condition_variable idleCondition;
+};
+
+// Двоичный формат наборов: заголовок на 64 байта, затем куски по chunkSize
+// значений. В куске SoA лежат колонки компонент, в AoS - значения подряд;
+// каждая колонка (в AoS - весь кусок) выровнена на SIMD_ALIGNMENT. Все куски,
+// кроме последнего, одного размера, поэтому смещение куска вычисляется сразу.
+// Порядок байт - родной для машины.
+enum DatasetScalar {DS_FLOAT, DS_DOUBLE};
+enum DatasetLayout {DL_SOA, DL_AOS};
+enum DatasetStatus {DS_OK, DS_IO_ERROR, DS_BAD_HEADER, DS_KIND_MISMATCH,
+    DS_OUT_OF_RANGE};
+
+const uint32_t DATASET_MAGIC = 0x53445143;
+const uint16_t DATASET_VERSION = 1;
+const size_t DATASET_DEFAULT_CHUNK = 1 << 16;
+
+struct DatasetHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint8_t kind;
+    uint8_t scalar;
+    uint8_t layout;
+    uint8_t reserved[7];
+    uint64_t count;
+    uint64_t chunkSize;
+    uint8_t padding[32];
+};
+
+static_assert(sizeof(DatasetHeader) == SIMD_ALIGNMENT,
+    "dataset header must keep columns aligned");
+
+inline size_t alignDatasetBytes(size_t bytes) {
+    return (bytes + SIMD_ALIGNMENT - 1) / SIMD_ALIGNMENT * SIMD_ALIGNMENT;
+}
+
+inline int datasetComponents(ComplexKind kind) {
+    return kind == CK_QUATERNION ? 4 : 2;
+}
+
+inline size_t datasetScalarSize(DatasetScalar scalar) {
+    return scalar == DS_FLOAT ? sizeof(float) : sizeof(double);
+}
+
+// размер куска из length значений; для SoA - шаг колонок в *columnBytes
+inline size_t datasetChunkBytes(const DatasetHeader& header, size_t length,
+    size_t* columnBytes = nullptr) {
+    int components = datasetComponents(ComplexKind(header.kind));
+    size_t scalarSize = datasetScalarSize(DatasetScalar(header.scalar));
+    if (header.layout == DL_AOS) {
+        return alignDatasetBytes(length * components * scalarSize);
+    }
+    size_t column = alignDatasetBytes(length * scalarSize);
+    if (columnBytes) {
+        *columnBytes = column;
+    }
+    return column * components;
+}
+
+// Пишет набор потоково: значения копятся до полного куска и сбрасываются на
+// диск, так что набор может быть больше памяти. Количество в заголовке
+// дописывается в close().
+class DatasetWriter {
+public:
+    DatasetWriter() : file(nullptr), pending(0) {}
+
+    ~DatasetWriter() {
+        close();
+    }
+
+    DatasetWriter(const DatasetWriter&) = delete;
+    DatasetWriter& operator= (const DatasetWriter&) = delete;
+
+    DatasetStatus open(const char* path, ComplexKind kind,
+        DatasetScalar scalar = DS_DOUBLE, DatasetLayout layout = DL_SOA,
+        size_t chunkSize = DATASET_DEFAULT_CHUNK) {
+        close();
+        if (chunkSize == 0) {
+            return DS_BAD_HEADER;
+        }
+        header = DatasetHeader();
+        header.magic = DATASET_MAGIC;
+        header.version = DATASET_VERSION;
+        header.kind = kind;
+        header.scalar = scalar;
+        header.layout = layout;
+        header.chunkSize = chunkSize;
+        file = std::fopen(path, "wb");
+        if (!file) {
+            return DS_IO_ERROR;
+        }
+        for (int c = 0; c < datasetComponents(kind); ++c) {
+            lanes[c].resize(chunkSize);
+        }
+        pending = 0;
+        return writeHeader();
+    }
+
+    DatasetStatus append(const ComplexArray& numbers) {
+        const double* source[4] = {numbers.getRealData(), numbers.getIData(),
+            nullptr, nullptr};
+        return appendLanes(numbers.size(), source);
+    }
+
+    DatasetStatus append(const QuaternionArray& numbers) {
+        if (header.kind != CK_QUATERNION) {
+            return DS_KIND_MISMATCH;
+        }
+        const double* source[4] = {numbers.getRealData(), numbers.getIData(),
+            numbers.getJData(), numbers.getKData()};
+        return appendLanes(numbers.size(), source);
+    }
+
+    DatasetStatus close() {
+        if (!file) {
+            return DS_OK;
+        }
+        DatasetStatus status = flush();
+        if (status == DS_OK) {
+            status = writeHeader();
+        }
+        if (std::fclose(file) != 0 && status == DS_OK) {
+            status = DS_IO_ERROR;
+        }
+        file = nullptr;
+        return status;
+    }
+private:
+    std::FILE* file;
+    DatasetHeader header;
+    AlignedLane lanes[4];
+    size_t pending;
+    std::vector<unsigned char> buffer;
+
+    DatasetStatus writeHeader() {
+        if (std::fseek(file, 0, SEEK_SET) != 0 ||
+            std::fwrite(&header, sizeof(header), 1, file) != 1 ||
+            std::fseek(file, 0, SEEK_END) != 0) {
+            return DS_IO_ERROR;
+        }
+        return DS_OK;
+    }
+
+    DatasetStatus appendLanes(size_t n, const double* const source[4]) {
+        if (!file) {
+            return DS_IO_ERROR;
+        }
+        int components = datasetComponents(ComplexKind(header.kind));
+        size_t done = 0;
+        while (done < n) {
+            size_t count = std::min(n - done, header.chunkSize - pending);
+            for (int c = 0; c < components; ++c) {
+                if (source[c]) {
+                    std::copy(source[c] + done, source[c] + done + count,
+                        lanes[c].data() + pending);
+                } else {
+                    std::fill(lanes[c].data() + pending,
+                        lanes[c].data() + pending + count, 0.0);
+                }
+            }
+            pending += count;
+            done += count;
+            if (pending == header.chunkSize) {
+                DatasetStatus status = flush();
+                if (status != DS_OK) {
+                    return status;
+                }
+            }
+        }
+        return DS_OK;
+    }
+
+    template <class Scalar>
+    void packChunk(size_t columnBytes) {
+        int components = datasetComponents(ComplexKind(header.kind));
+        for (int c = 0; c < components; ++c) {
+            for (size_t i = 0; i < pending; ++i) {
+                Scalar value = Scalar(lanes[c][i]);
+                size_t offset = header.layout == DL_AOS ?
+                    (i * components + c) * sizeof(Scalar) :
+                    c * columnBytes + i * sizeof(Scalar);
+                std::memcpy(buffer.data() + offset, &value, sizeof(Scalar));
+            }
+        }
+    }
+
+    DatasetStatus flush() {
+        if (pending == 0) {
+            return DS_OK;
+        }
+        size_t columnBytes = 0;
+        size_t bytes = datasetChunkBytes(header, pending, &columnBytes);
+        buffer.assign(bytes, 0);
+        if (header.scalar == DS_FLOAT) {
+            packChunk<float>(columnBytes);
+        } else {
+            packChunk<double>(columnBytes);
+        }
+        if (std::fwrite(buffer.data(), 1, bytes, file) != bytes) {
+            return DS_IO_ERROR;
+        }
+        header.count += pending;
+        pending = 0;
+        return DS_OK;
+    }
+};
+
+// Читает набор через отображение файла. Колонки double/SoA отдаются
+// указателями прямо в отображение, выровненными под ядра; остальные
+// форматы переводятся в ComplexArray/QuaternionArray по кускам.
+class DatasetReader {
+public:
+    DatasetReader() : header(), chunkStride(0) {}
+
+    // count и chunkSize из заголовка сверяются с размером файла делением
+    // до любых умножений: испорченный заголовок не переполняет смещения
+    DatasetStatus open(const char* path) {
+        header = DatasetHeader();
+        chunkStride = 0;
+        if (!file.open(path)) {
+            return DS_IO_ERROR;
+        }
+        if (file.size() < sizeof(header)) {
+            file.close();
+            return DS_BAD_HEADER;
+        }
+        std::memcpy(&header, file.getData(), sizeof(header));
+        bool valid = header.magic == DATASET_MAGIC &&
+            header.version >= 1 && header.version <= DATASET_VERSION &&
+            header.kind <= CK_QUATERNION && header.scalar <= DS_DOUBLE &&
+            header.layout <= DL_AOS &&
+            (header.chunkSize > 0 || header.count == 0);
+        size_t available = file.size() - sizeof(header);
+        if (valid) {
+            size_t valueBytes = datasetComponents(getKind()) *
+                datasetScalarSize(getScalar());
+            valid = header.count <= available / valueBytes;
+        }
+        if (valid && header.count > 0) {
+            // после проверки count кусок не длиннее count и его размер
+            // не переполняется
+            chunkStride = datasetChunkBytes(header,
+                std::min<size_t>(header.chunkSize, header.count));
+            size_t last = getChunkCount() - 1;
+            valid = last <= available / chunkStride &&
+                chunkOffset(last) + datasetChunkBytes(header,
+                getChunkLength(last)) <= file.size();
+        }
+        if (!valid) {
+            header = DatasetHeader();
+            chunkStride = 0;
+            file.close();
+            return DS_BAD_HEADER;
+        }
+        return DS_OK;
+    }
+
+    ComplexKind getKind() const {
+        return ComplexKind(header.kind);
+    }
+
+    DatasetScalar getScalar() const {
+        return DatasetScalar(header.scalar);
+    }
+
+    DatasetLayout getLayout() const {
+        return DatasetLayout(header.layout);
+    }
+
+    size_t size() const {
+        return header.count;
+    }
+
+    size_t getChunkSize() const {
+        return header.chunkSize;
+    }
+
+    size_t getChunkCount() const {
+        return header.count == 0 ? 0 : header.count / header.chunkSize +
+            (header.count % header.chunkSize != 0);
+    }
+
+    size_t getChunkLength(size_t chunk) const {
+        return std::min<size_t>(header.chunkSize,
+            header.count - chunk * header.chunkSize);
+    }
+
+    // колонка component куска chunk без копирования; nullptr, если формат
+    // не double/SoA или индекс вне набора
+    const double* getColumn(size_t chunk, int component) const {
+        if (header.scalar != DS_DOUBLE || header.layout != DL_SOA ||
+            chunk >= getChunkCount() || component < 0 ||
+            component >= datasetComponents(getKind())) {
+            return nullptr;
+        }
+        size_t columnBytes = 0;
+        datasetChunkBytes(header, getChunkLength(chunk), &columnBytes);
+        return reinterpret_cast<const double*>(file.getData() +
+            chunkOffset(chunk) + component * columnBytes);
+    }
+
+    DatasetStatus readChunk(size_t chunk, ComplexArray& numbers) const {
+        if (getKind() != CK_COMPLEX_NUMBER) {
+            return DS_KIND_MISMATCH;
+        }
+        if (chunk >= getChunkCount()) {
+            return DS_OUT_OF_RANGE;
+        }
+        numbers.resize(getChunkLength(chunk));
+        double* lanes[4] = {numbers.getRealData(), numbers.getIData(),
+            nullptr, nullptr};
+        unpackChunk(chunk, lanes);
+        return DS_OK;
+    }
+
+    // комплексный набор читается с нулевыми j и k
+    DatasetStatus readChunk(size_t chunk, QuaternionArray& numbers) const {
+        if (chunk >= getChunkCount()) {
+            return DS_OUT_OF_RANGE;
+        }
+        numbers.resize(getChunkLength(chunk));
+        double* lanes[4] = {numbers.getRealData(), numbers.getIData(),
+            numbers.getJData(), numbers.getKData()};
+        if (getKind() == CK_COMPLEX_NUMBER) {
+            std::fill(lanes[2], lanes[2] + numbers.size(), 0.0);
+            std::fill(lanes[3], lanes[3] + numbers.size(), 0.0);
+        }
+        unpackChunk(chunk, lanes);
+        return DS_OK;
+    }
+private:
+    MappedFile file;
+    DatasetHeader header;
+    // байт от начала куска до начала следующего
+    size_t chunkStride;
+
+    size_t chunkOffset(size_t chunk) const {
+        return sizeof(header) + chunk * chunkStride;
+    }
+
+    template <class Scalar>
+    void unpackColumns(size_t chunk, double* const lanes[4]) const {
+        int components = datasetComponents(getKind());
+        size_t length = getChunkLength(chunk);
+        size_t columnBytes = 0;
+        datasetChunkBytes(header, length, &columnBytes);
+        const char* data = file.getData() + chunkOffset(chunk);
+        for (int c = 0; c < components; ++c) {
+            for (size_t i = 0; i < length; ++i) {
+                Scalar value;
+                size_t offset = header.layout == DL_AOS ?
+                    (i * components + c) * sizeof(Scalar) :
+                    c * columnBytes + i * sizeof(Scalar);
+                std::memcpy(&value, data + offset, sizeof(Scalar));
+                lanes[c][i] = value;
+            }
+        }
+    }
+
+    void unpackChunk(size_t chunk, double* const lanes[4]) const {
+        if (header.scalar == DS_FLOAT) {
+            unpackColumns<float>(chunk, lanes);
+        } else {
+            unpackColumns<double>(chunk, lanes);
+        }
+    }
+};
+
+// Текстовый формат чисел - тот же, что печатает show(): "a + bi" и
+// "a + bi + cj + dk". Числа пишутся через std::to_chars: с
+// SHORTEST_PRECISION - кратчайшая запись, которая читается обратно в то же
+// double, иначе fixed с precision знаками после точки.
+const int SHORTEST_PRECISION = -1;
+
+const char FORMAT_UNITS[] = {'i', 'j', 'k'};
+
+// верхняя граница длины записи; в fixed целая часть double - до 309 цифр
+inline size_t formattedBytes(ComplexKind kind, int precision) {
+    size_t number = precision < 0 ? 24 : 311 + precision;
+    size_t components = kind == CK_QUATERNION ? 4 : 2;
+    return components * number + (components - 1) * 4;
+}
+
+inline std::to_chars_result formatComponents(char* first, char* last,
+    const double* values, int components, int precision) {
+    std::to_chars_result result = {first, std::errc()};
+    for (int c = 0; c < components; ++c) {
+        if (c > 0) {
+            if (last - result.ptr < 3) {
+                return {last, std::errc::value_too_large};
+            }
+            std::memcpy(result.ptr, " + ", 3);
+            result.ptr += 3;
+        }
+        result = precision < 0 ? std::to_chars(result.ptr, last, values[c]) :
+            std::to_chars(result.ptr, last, values[c],
+                std::chars_format::fixed, precision);
+        if (result.ec != std::errc()) {
+            return result;
+        }
+        if (c > 0) {
+            if (result.ptr == last) {
+                return {last, std::errc::value_too_large};
+            }
+            *result.ptr++ = FORMAT_UNITS[c - 1];
+        }
+    }
+    return result;
+}
+
+// Пишет число в [first, last) без выделения памяти и без завершающего нуля;
+// ec == value_too_large, если буфер мал (хватает formattedBytes())
+inline std::to_chars_result formatNumber(char* first, char* last,
+    const ComplexNumber& number, int precision = SHORTEST_PRECISION) {
+    double values[2] = {number.getReal(), number.getI()};
+    return formatComponents(first, last, values, 2, precision);
+}
+
+inline std::to_chars_result formatNumber(char* first, char* last,
+    const Quaternion& number, int precision = SHORTEST_PRECISION) {
+    double values[4] = {number.getReal(), number.getI(), number.getJ(),
+        number.getK()};
+    return formatComponents(first, last, values, 4, precision);
+}
+
+inline std::to_chars_result formatNumber(char* first, char* last,
+    const Operand& number, int precision = SHORTEST_PRECISION) {
+    double values[4] = {number.getReal(), number.getI(), number.getJ(),
+        number.getK()};
+    return formatComponents(first, last, values,
+        number.getKind() == CK_QUATERNION ? 4 : 2, precision);
+}
+
+// Разбирает запись formatNumber() или show(); вид числа определяется по
+// числу компонент. Разделители - ровно " + ", как их пишет formatNumber().
+inline std::from_chars_result parseNumber(const char* begin,
+    const char* end, Operand& result) {
+    double values[4] = {0, 0, 0, 0};
+    const char* cursor = begin;
+    int components = 0;
+    while (components < 4) {
+        if (components > 0) {
+            if (end - cursor < 3 || std::memcmp(cursor, " + ", 3) != 0) {
+                break;
+            }
+            cursor += 3;
+        }
+        std::from_chars_result parsed = std::from_chars(cursor, end,
+            values[components]);
+        if (parsed.ec != std::errc()) {
+            return {begin, parsed.ec};
+        }
+        cursor = parsed.ptr;
+        if (components > 0) {
+            if (cursor == end || *cursor != FORMAT_UNITS[components - 1]) {
+                return {begin, std::errc::invalid_argument};
+            }
+            ++cursor;
+        }
+        ++components;
+    }
+    if (components != 2 && components != 4) {
+        return {begin, std::errc::invalid_argument};
+    }
+    result = Operand(components == 4 ? CK_QUATERNION : CK_COMPLEX_NUMBER,
+        Components{values[0], values[1], values[2], values[3]});
+    return {cursor, std::errc()};
+}
+
+// Разбирает текст из записей по одной на строку (как пишет FormattedWriter)
+// и дописывает их в result. В ComplexArray кватернион не помещается - это
+// ошибка разбора. false - текст не разобран, result дописан до ошибки.
+template <class Array>
+inline bool parseNumbers(const char* text, size_t length, Array& result) {
+    const char* end = text + length;
+    const char* line = text;
+    while (line < end) {
+        Operand number;
+        std::from_chars_result parsed = parseNumber(line, end, number);
+        if (parsed.ec != std::errc() || (parsed.ptr != end &&
+            *parsed.ptr != '\n')) {
+            return false;
+        }
+        if (std::is_same<Array, QuaternionArray>::value) {
+            result.pushBack(number.toQuaternion());
+        } else if (number.getKind() == CK_QUATERNION) {
+            return false;
+        } else {
+            result.pushBack(number.toComplexNumber());
+        }
+        line = parsed.ptr + (parsed.ptr != end);
+    }
+    return true;
+}
+
+const size_t FORMAT_BLOCK_BYTES = 1 << 20;
+
+// Пишет числа в дескриптор по одному в строке. Записи копятся в блоке,
+// выделенном в конструкторе, и уходят одним write(), когда следующая может
+// не поместиться, так что на мегабайт текста приходится один системный
+// вызов, а запись не выделяет память. Ошибка записи запоминается: после
+// неё write() и flush() возвращают false. Если в тот же дескриптор пишет
+// std::cout, его нужно сбросить до flush(). Вне POSIX запись в дескриптор
+// не поддерживается: flush() непустого блока отбрасывает его и возвращает
+// false.
+class FormattedWriter {
+public:
+    explicit FormattedWriter(int _descriptor,
+        int _precision = SHORTEST_PRECISION,
+        size_t blockBytes = FORMAT_BLOCK_BYTES) :
+        descriptor(_descriptor),
+        precision(_precision),
+        lineBytes(formattedBytes(CK_QUATERNION, _precision) + 1),
+        block(std::max(blockBytes, lineBytes)),
+        used(0),
+        good(true) {}
+
+    ~FormattedWriter() {
+        flush();
+    }
+
+    FormattedWriter(const FormattedWriter&) = delete;
+    FormattedWriter& operator= (const FormattedWriter&) = delete;
+
+    bool write(const ComplexNumber& number) {
+        double values[2] = {number.getReal(), number.getI()};
+        return writeComponents(values, 2);
+    }
+
+    bool write(const Quaternion& number) {
+        double values[4] = {number.getReal(), number.getI(), number.getJ(),
+            number.getK()};
+        return writeComponents(values, 4);
+    }
+
+    bool write(const ComplexArray& numbers) {
+        const double* real = numbers.getRealData();
+        const double* iCoef = numbers.getIData();
+        for (size_t i = 0; i < numbers.size() && good; ++i) {
+            double values[2] = {real[i], iCoef[i]};
+            writeComponents(values, 2);
+        }
+        return good;
+    }
+
+    bool write(const QuaternionArray& numbers) {
+        const double* real = numbers.getRealData();
+        const double* iCoef = numbers.getIData();
+        const double* jCoef = numbers.getJData();
+        const double* kCoef = numbers.getKData();
+        for (size_t i = 0; i < numbers.size() && good; ++i) {
+            double values[4] = {real[i], iCoef[i], jCoef[i], kCoef[i]};
+            writeComponents(values, 4);
+        }
+        return good;
+    }
+
+    bool flush() {
+        const char* data = block.data();
+        size_t remaining = used;
+        used = 0;
+#if defined(__unix__)
+        while (remaining > 0 && good) {
+            ssize_t written = ::write(descriptor, data, remaining);
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+            if (written <= 0) {
+                good = false;
+                break;
+            }
+            data += written;
+            remaining -= written;
+        }
+#else
+        // не поддерживается, см. комментарий к классу
+        (void)data;
+        good = good && remaining == 0;
+#endif
+        return good;
+    }
+
+    bool isGood() const {
+        return good;
+    }
+private:
+    int descriptor;
+    int precision;
+    size_t lineBytes;
+    std::vector<char> block;
+    size_t used;
+    bool good;
+
+    bool writeComponents(const double* values, int components) {
+        if (block.size() - used < lineBytes && !flush()) {
+            return false;
+        }
+        char* first = block.data() + used;
+        char* last = block.data() + block.size();
+        char* next = formatComponents(first, last, values, components,
+            precision).ptr;
+        *next++ = '\n';
+        used = next - block.data();
+        return good;
+    }
+};
+
+// Выделения памяти в текущем потоке, для тестов и замеров. Счётчик свой
+// у каждого потока: operator new в рабочих потоках не делит одну
+// атомарную переменную.
+thread_local size_t allocationCount = 0;
+
+// без noinline GCC встраивает malloc()/free() и ругается на пару
+// operator new/free
+#if defined(__GNUC__)
+#define ALLOCATOR_NOINLINE __attribute__((noinline))
+#else
+#define ALLOCATOR_NOINLINE
+#endif
+
+ALLOCATOR_NOINLINE void* operator new(std::size_t size) {
+    ++allocationCount;
+    if (void* ptr = std::malloc(size ? size : 1)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+ALLOCATOR_NOINLINE void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+ALLOCATOR_NOINLINE void operator delete(void* ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+// значение считается использованным: компилятор не выбросит вычисление
+template <class T>
+inline void benchmarkKeep(const T& value) {
+#if defined(__GNUC__)
+    asm volatile("" : : "g"(&value) : "memory");
+#else
+    const volatile char* bytes = reinterpret_cast<const volatile char*>(&value);
+    (void)bytes[0];
+#endif
+}
+
+// эталонное ДПФ за O(n^2) на операторах ComplexNumber
+void naiveDft(const ComplexArray& input, ComplexArray& output) {
+    size_t n = input.size();
+    output.resize(n);
+    for (size_t s = 0; s < n; ++s) {
+        ComplexNumber sum;
+        for (size_t r = 0; r < n; ++r) {
+            double angle = -2 * M_PI * double((r * s) % n) / n;
+            ComplexNumber root(std::cos(angle), std::sin(angle));
+            sum += input.get(r) * root;
+        }
+        output.set(s, sum);
+    }
+}
+
+// тройной цикл по матрицам из ComplexNumber, как их хранили раньше
+void naiveMatrixMultiply(const std::vector<ComplexNumber>& a,
+    const std::vector<ComplexNumber>& b, std::vector<ComplexNumber>& c,
+    size_t m, size_t k, size_t n) {
+    c.assign(m * n, ComplexNumber());
+    for (size_t i = 0; i < m; ++i) {
+        for (size_t j = 0; j < n; ++j) {
+            ComplexNumber sum;
+            for (size_t p = 0; p < k; ++p) {
+                sum += a[i * k + p] * b[p * n + j];
+            }
+            c[i * n + j] = sum;
+        }
+    }
+}
+
+void benchmarkCalculators() {
+    const int iterations = 1000000;
+    ComplexNumber c(1.0000001, 0.0000001);
+    Quaternion q(1.0000001, 0.0000001, 0.0000002, 0.0000003);
+    Operations ops[] = {OP_ADD, OP_SUBTRACT, OP_MULTIPLY, OP_DIVIDE};
+
+    {
+        Calculator calculator;
+        calculator.push(q);
+        size_t allocationsBefore = allocationCount;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i) {
+            calculator.push(i % 2 ? (ComplexNumber&)c : q);
+            calculator.calculate(ops[i % 4]);
+        }
+        auto finish = std::chrono::steady_clock::now();
+        double ns = std::chrono::duration<double, std::nano>(
+            finish - start).count();
+        std::cout << "Calculator: " << ns / iterations << " ns/op, " <<
+            double(allocationCount - allocationsBefore) / iterations <<
+            " allocations/op" << std::endl;
+    }
+    {
+        ValueCalculator calculator(16);
+        calculator.push(q);
+        size_t allocationsBefore = allocationCount;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i) {
+            calculator.push(i % 2 ? (ComplexNumber&)c : q);
+            calculator.calculate(ops[i % 4]);
+        }
+        auto finish = std::chrono::steady_clock::now();
+        double ns = std::chrono::duration<double, std::nano>(
+            finish - start).count();
+        std::cout << "ValueCalculator: " << ns / iterations << " ns/op, " <<
+            double(allocationCount - allocationsBefore) / iterations <<
+            " allocations/op" << std::endl;
+    }
+}
+
+void benchmarkBytecode() {
+    const int iterations = 1000000;
+    ComplexNumber c(1.0000001, 0.0000001);
+    Quaternion q(1.0000001, 0.0000001, 0.0000002, 0.0000003);
+    Operations ops[] = {OP_ADD, OP_MULTIPLY, OP_SUBTRACT, OP_DIVIDE};
+
+    RpnProgram program;
+    int input = program.addInput(CK_QUATERNION);
+    program.pushInput(input);
+    for (int i = 0; i < 8; ++i) {
+        program.pushLiteral(i % 2 ? (ComplexNumber&)c : q);
+        program.apply(ops[i % 4]);
+    }
+    BytecodeProgram bytecode;
+    bytecode.compile(program);
+    Operand inputs[] = {Operand(q)};
+    Operand result;
+    double checksum = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        ValueCalculator calculator(16);
+        calculator.push(q);
+        for (int j = 0; j < 8; ++j) {
+            calculator.push(j % 2 ? (ComplexNumber&)c : q);
+            calculator.calculate(ops[j % 4]);
+        }
+        checksum += calculator.top().getReal();
+    }
+    auto finish = std::chrono::steady_clock::now();
+    std::cout << "ValueCalculator formula: " << std::chrono::duration<
+        double, std::nano>(finish - start).count() / iterations <<
+        " ns/formula" << std::endl;
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        bytecode.run(inputs, result);
+        checksum += result.getReal();
+    }
+    finish = std::chrono::steady_clock::now();
+    std::cout << "BytecodeProgram formula: " << std::chrono::duration<
+        double, std::nano>(finish - start).count() / iterations <<
+        " ns/formula (checksum " << checksum << ")" << std::endl;
+}
+
+void benchmarkBatch() {
+    const size_t lanes = 1 << 20;
+    RpnProgram program;
+    int x = program.addInput(CK_QUATERNION);
+    int y = program.addInput(CK_COMPLEX_NUMBER);
+    program.pushInput(y);
+    program.pushInput(x);
+    program.apply(OP_MULTIPLY);
+    program.pushLiteral(Quaternion(0.5, 0.25, -1, 2));
+    program.apply(OP_ADD);
+    program.pushInput(x);
+    program.apply(OP_DIVIDE);
+    BytecodeProgram bytecode;
+    bytecode.compile(program);
+
+    QuaternionArray xs(lanes);
+    ComplexArray ys(lanes);
+    for (size_t i = 0; i < lanes; ++i) {
+        xs.set(i, Quaternion(1 + i * 1e-6, 0.5, -0.25, 2));
+        ys.set(i, ComplexNumber(2, -1e-6 * i));
+    }
+    double checksum = 0;
+    auto start = std::chrono::steady_clock::now();
+    Operand result;
+    for (size_t i = 0; i < lanes; ++i) {
+        Operand inputs[] = {Operand(xs.get(i)), Operand(ys.get(i))};
+        bytecode.run(inputs, result);
+        checksum += result.getReal();
+    }
+    auto finish = std::chrono::steady_clock::now();
+    std::cout << "BytecodeProgram per lane: " << std::chrono::duration<
+        double, std::nano>(finish - start).count() / lanes <<
+        " ns/lane" << std::endl;
+
+    BatchEvaluator evaluator(bytecode);
+    evaluator.bindInput(x, xs);
+    evaluator.bindInput(y, ys);
+    QuaternionArray results;
+    std::vector<unsigned char> status;
+    start = std::chrono::steady_clock::now();
+    evaluator.evaluate(results, status);
+    finish = std::chrono::steady_clock::now();
+    std::cout << "BatchEvaluator (" << workerCount(0) << " threads): " <<
+        std::chrono::duration<double, std::nano>(finish - start).count() /
+        lanes << " ns/lane (checksum " << checksum - results.get(7).getReal() <<
+        ")" << std::endl;
+}
+
+void benchmarkExpressions() {
+    const int iterations = 10000000;
+    Quaternion a(1, 0.5, -0.25, 2);
+    Quaternion b(0.5, 1, 2, -1);
+    Quaternion c(2, -1, 0.5, 0.25);
+    Quaternion d(-1, 0.25, 1, 0.5);
+    Quaternion e(1, 2, 3, 4);
+    Quaternion f(0.5, 0.5, 0.5, 0.5);
+    Quaternion sum;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        a.setReal(1 + i * 1e-9);
+        sum += a * b + c * d - e / f;
+    }
+    auto finish = std::chrono::steady_clock::now();
+    std::cout << "a*b + c*d - e/f operators: " << std::chrono::duration<
+        double, std::nano>(finish - start).count() / iterations <<
+        " ns" << std::endl;
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        a.setReal(1 + i * 1e-9);
+        sum += evaluate(lazy(a) * b + lazy(c) * d - lazy(e) / f);
+    }
+    finish = std::chrono::steady_clock::now();
+    std::cout << "a*b + c*d - e/f expression: " << std::chrono::duration<
+        double, std::nano>(finish - start).count() / iterations <<
+        " ns (checksum " << sum.getReal() << ")" << std::endl;
+}
+
+void benchmarkChainProduct() {
+    const size_t size = 1 << 22;
+    QuaternionArray chain(size);
+    for (size_t i = 0; i < size; ++i) {
+        double angle = 1e-4 * (i % 101);
+        chain.set(i, Quaternion(std::cos(angle), 0, std::sin(angle), 0));
+    }
+    auto start = std::chrono::steady_clock::now();
+    Quaternion serial = chain.get(0);
+    for (size_t i = 1; i < size; ++i) {
+        serial *= chain.get(i);
+    }
+    auto finish = std::chrono::steady_clock::now();
+    std::cout << "serial operator*= chain: " << std::chrono::duration<
+        double, std::nano>(finish - start).count() / size <<
+        " ns/element" << std::endl;
+
+    start = std::chrono::steady_clock::now();
+    Quaternion parallel = chainProduct(chain);
+    finish = std::chrono::steady_clock::now();
+    std::cout << "chainProduct: " << std::chrono::duration<
+        double, std::nano>(finish - start).count() / size <<
+        " ns/element" << std::endl;
+
+    QuaternionArray prefix;
+    start = std::chrono::steady_clock::now();
+    chainPrefixProduct(chain, prefix);
+    finish = std::chrono::steady_clock::now();
+    std::cout << "chainPrefixProduct: " << std::chrono::duration<
+        double, std::nano>(finish - start).count() / size <<
+        " ns/element (difference " << (serial - parallel).getReal() << ")" <<
+        std::endl;
+}
+
+void benchmarkFft() {
+    // наивное ДПФ квадратично, поэтому сравнивается только до 2^12
+    const size_t naiveLimit = 1 << 12;
+    for (size_t size = 64; size <= (size_t(1) << 24); size *= 4) {
+        ComplexArray signal(size);
+        for (size_t i = 0; i < size; ++i) {
+            signal.set(i, ComplexNumber(std::sin(0.1 * i), std::cos(0.3 * i)));
+        }
+        getFftPlan(size);
+        size_t repetitions = std::max<size_t>(1, (1 << 22) / size);
+        auto start = std::chrono::steady_clock::now();
+        for (size_t r = 0; r < repetitions; ++r) {
+            fft(signal);
+        }
+        auto finish = std::chrono::steady_clock::now();
+        std::cout << "fft n=" << size << ": " << std::chrono::duration<
+            double, std::micro>(finish - start).count() / repetitions <<
+            " us";
+        if (size <= naiveLimit) {
+            ComplexArray spectrum;
+            start = std::chrono::steady_clock::now();
+            naiveDft(signal, spectrum);
+            finish = std::chrono::steady_clock::now();
+            std::cout << ", naive DFT: " << std::chrono::duration<
+                double, std::micro>(finish - start).count() << " us";
+        }
+        std::cout << std::endl;
+    }
+    ComplexArray mixed(3 * 5 * 7 * 1024);
+    for (size_t i = 0; i < mixed.size(); ++i) {
+        mixed.set(i, ComplexNumber(std::sin(0.1 * i), 0));
+    }
+    auto start = std::chrono::steady_clock::now();
+    fft(mixed);
+    auto finish = std::chrono::steady_clock::now();
+    std::cout << "fft n=" << mixed.size() << " (mixed radix): " <<
+        std::chrono::duration<double, std::micro>(finish - start).count() <<
+        " us" << std::endl;
+}
+
+void benchmarkRpnParser() {
+    std::string text;
+    while (text.size() < (size_t(64) << 20)) {
+        text += "(1.25,-0.5) (0.1,0.2,0.3,0.4) * 3.75 + (2,1) /\n";
+    }
+    QuaternionArray result;
+    std::vector<unsigned char> status;
+    unsigned threadCounts[] = {1, 0};
+    for (unsigned threads : threadCounts) {
+        auto start = std::chrono::steady_clock::now();
+        runRpnText(text.data(), text.size(), result, status, threads);
+        auto finish = std::chrono::steady_clock::now();
+        double seconds = std::chrono::duration<double>(finish - start).count();
+        std::cout << "runRpnText (" << workerCount(threads) << " threads): " <<
+            text.size() / seconds / (1 << 20) << " MB/s, " <<
+            result.size() / seconds / 1e6 << " M lines/s" << std::endl;
+    }
+}
+
+void benchmarkDataset() {
+#if defined(__unix__)
+    const size_t size = 1 << 22;
+    QuaternionArray values(size);
+    for (size_t i = 0; i < size; ++i) {
+        values.set(i, Quaternion(i, 0.5, -0.25 * i, 1.0 / (i + 1)));
+    }
+    char path[] = "/tmp/datasetBenchXXXXXX";
+    int descriptor = mkstemp(path);
+    if (descriptor < 0) {
+        return;
+    }
+    close(descriptor);
+    double megabytes = size * 4 * sizeof(double) / double(1 << 20);
+    auto start = std::chrono::steady_clock::now();
+    DatasetWriter writer;
+    writer.open(path, CK_QUATERNION);
+    writer.append(values);
+    writer.close();
+    auto finish = std::chrono::steady_clock::now();
+    std::cout << "DatasetWriter: " << megabytes /
+        std::chrono::duration<double>(finish - start).count() << " MB/s" <<
+        std::endl;
+
+    start = std::chrono::steady_clock::now();
+    DatasetReader reader;
+    reader.open(path);
+    double sum = 0;
+    for (size_t chunk = 0; chunk < reader.getChunkCount(); ++chunk) {
+        const double* column = reader.getColumn(chunk, 3);
+        for (size_t i = 0; i < reader.getChunkLength(chunk); ++i) {
+            sum += column[i];
+        }
+    }
+    finish = std::chrono::steady_clock::now();
+    std::cout << "DatasetReader mapped column: " << megabytes / 4 /
+        std::chrono::duration<double>(finish - start).count() <<
+        " MB/s (checksum " << sum << ")" << std::endl;
+    unlink(path);
+#endif
+}
+
+
+// Прогоны с прогревом: каждый замер - batch операций, в отчёт идут
+// наносекунды на операцию по всем повторам.
+class MicroBenchmark {
+public:
+    MicroBenchmark(int _warmup = 5, int _repetitions = 25,
+        size_t _batch = 4096) :
+        warmup(_warmup), repetitions(_repetitions), batch(_batch) {}
+
+    size_t getBatch() const {
+        return batch;
+    }
+
+    // body(batch) выполняет batch операций
+    template <class Body>
+    void run(const std::string& name, const char* mode, Body body) {
+        for (int i = 0; i < warmup; ++i) {
+            body(batch);
+        }
+        Result result = {name, mode, std::vector<double>()};
+        for (int i = 0; i < repetitions; ++i) {
+            auto start = std::chrono::steady_clock::now();
+            body(batch);
+            auto finish = std::chrono::steady_clock::now();
+            result.samples.push_back(std::chrono::duration<double,
+                std::nano>(finish - start).count() / batch);
+        }
+        results.push_back(result);
+    }
+
+    void writeJson(std::ostream& out) const {
+        out << "{\n  \"warmup\": " << warmup << ",\n  \"repetitions\": " <<
+            repetitions << ",\n  \"batch\": " << batch <<
+            ",\n  \"unit\": \"ns/op\",\n  \"results\": [";
+        for (size_t r = 0; r < results.size(); ++r) {
+            std::vector<double> samples = results[r].samples;
+            std::sort(samples.begin(), samples.end());
+            double mean = 0;
+            for (double sample : samples) {
+                mean += sample;
+            }
+            mean /= samples.size();
+            double variance = 0;
+            for (double sample : samples) {
+                variance += (sample - mean) * (sample - mean);
+            }
+            if (samples.size() > 1) {
+                variance /= samples.size() - 1;
+            }
+            size_t middle = samples.size() / 2;
+            double median = samples.size() % 2 ? samples[middle] :
+                (samples[middle - 1] + samples[middle]) / 2;
+            out << (r ? "," : "") << "\n    {\"name\": \"" <<
+                results[r].name << "\", \"mode\": \"" << results[r].mode <<
+                "\", \"min\": " << samples.front() << ", \"median\": " <<
+                median << ", \"mean\": " << mean << ", \"stddev\": " <<
+                std::sqrt(variance) << ", \"max\": " << samples.back() <<
+                ", \"ops_per_second\": " << 1e9 / median << "}";
+        }
+        out << "\n  ]\n}\n";
+    }
+private:
+    struct Result {
+        std::string name;
+        const char* mode;
+        std::vector<double> samples;
+    };
+
+    int warmup;
+    int repetitions;
+    size_t batch;
+    std::vector<Result> results;
+};
+
+const size_t MICROBENCH_VALUES = 256;
+
+// Пропускная способность - независимые операции над таблицами значений,
+// задержка - цепочка x = x op y, где каждая операция ждёт предыдущую.
+// Цепочка строится только там, где результат того же вида, что и x.
+template <class L, class R, class Op>
+void microbenchOperator(MicroBenchmark& bench, const std::string& name,
+    std::vector<L>& left, std::vector<R>& right, Op op) {
+    bench.run(name, "throughput", [&](size_t batch) {
+        for (size_t i = 0; i < batch; ++i) {
+            auto result = op(left[i % MICROBENCH_VALUES],
+                right[(i * 7) % MICROBENCH_VALUES]);
+            benchmarkKeep(result);
+        }
+    });
+    typedef decltype(op(left[0], right[0])) Result;
+    if constexpr (std::is_same<Result, L>::value) {
+        bench.run(name, "latency", [&](size_t batch) {
+            L x = left[0];
+            for (size_t i = 0; i < batch; ++i) {
+                x = op(x, right[1]);
+            }
+            benchmarkKeep(x);
+        });
+    }
+}
+
+template <class L, class R>
+void microbenchOperators(MicroBenchmark& bench, const std::string& kinds,
+    std::vector<L>& left, std::vector<R>& right) {
+    microbenchOperator(bench, kinds + " +", left, right,
+        [](L& l, R& r) { return l + r; });
+    microbenchOperator(bench, kinds + " -", left, right,
+        [](L& l, R& r) { return l - r; });
+    microbenchOperator(bench, kinds + " *", left, right,
+        [](L& l, R& r) { return l * r; });
+    microbenchOperator(bench, kinds + " /", left, right,
+        [](L& l, R& r) { return l / r; });
+}
+
+// Calculator::calculate для каждой операции и пары видов; в имени сначала
+// вид левого операнда (вершины стека), затем правого
+void microbenchCalculator(MicroBenchmark& bench) {
+    ComplexNumber complexOperand(0.6, 0.8);
+    Quaternion quaternionOperand(0.5, 0.5, 0.5, 0.5);
+    ComplexNumber* operands[] = {&complexOperand, &quaternionOperand};
+    const char* kindNames[] = {"C", "Q"};
+    const char* operationNames[] = {"add", "subtract", "multiply", "divide"};
+    Operations operations[] = {OP_ADD, OP_SUBTRACT, OP_MULTIPLY, OP_DIVIDE};
+    // деструктор Calculator печатает в std::cout, отчёт должен остаться JSON
+    std::streambuf* output = std::cout.rdbuf(nullptr);
+    for (int operation = 0; operation < 4; ++operation) {
+        for (int l = 0; l < 2; ++l) {
+            for (int r = 0; r < 2; ++r) {
+                bench.run(std::string("Calculator::calculate ") +
+                    operationNames[operation] + " " + kindNames[l] +
+                    kindNames[r], "throughput", [&](size_t batch) {
+                    // свой калькулятор на batch: стек и список результатов
+                    // не растут от замера к замеру, их освобождение входит
+                    // в стоимость операций
+                    Calculator calculator;
+                    for (size_t i = 0; i < batch; ++i) {
+                        calculator.push(*operands[r]);
+                        calculator.push(*operands[l]);
+                        calculator.calculate(operations[operation]);
+                    }
+                    benchmarkKeep(*calculator.top());
+                });
+            }
+        }
+    }
+    std::cout.rdbuf(output);
+}
+
+void runMicroBenchmarks(std::ostream& out) {
+    MicroBenchmark bench;
+    std::vector<ComplexNumber> complexValues;
+    std::vector<Quaternion> quaternionValues;
+    std::vector<double> scalarValues;
+    for (size_t i = 0; i < MICROBENCH_VALUES; ++i) {
+        double angle = 0.01 * (i + 1);
+        complexValues.push_back(ComplexNumber(std::cos(angle),
+            std::sin(angle)));
+        quaternionValues.push_back(Quaternion(std::cos(angle),
+            std::sin(angle) * 0.6, 0, std::sin(angle) * 0.8));
+        scalarValues.push_back(1 + 1e-9 * i);
+    }
+    microbenchOperators(bench, "C op C", complexValues, complexValues);
+    microbenchOperators(bench, "C op Q", complexValues, quaternionValues);
+    microbenchOperators(bench, "C op double", complexValues, scalarValues);
+    microbenchOperators(bench, "Q op Q", quaternionValues, quaternionValues);
+    microbenchOperators(bench, "Q op C", quaternionValues, complexValues);
+    microbenchOperators(bench, "Q op double", quaternionValues, scalarValues);
+    microbenchCalculator(bench);
+    bench.writeJson(out);
+}
+
+void benchmarkDivision() {
+    const size_t size = 1 << 16;
+    const int rounds = 32;
+    std::vector<Quaternion> values;
+    for (size_t i = 0; i < size; ++i) {
+        values.push_back(Quaternion(std::sin(i + 0.5), std::cos(3.0 * i),
+            std::sin(7.0 * i), std::cos(0.1 * i) + 2));
+    }
+    // прежние формулы: два деления на сумму квадратов без масштабирования
+    auto legacyComplex = [](const ComplexNumber& a, const ComplexNumber& b) {
+        double denominator = b.getReal() * b.getReal() + b.getI() * b.getI();
+        return ComplexNumber(
+            (a.getReal() * b.getReal() + a.getI() * b.getI()) / denominator,
+            (b.getReal() * a.getI() - b.getI() * a.getReal()) / denominator);
+    };
+    auto legacyQuaternion = [](const Quaternion& a, const Quaternion& b) {
+        double norm = b.getReal() * b.getReal() + b.getI() * b.getI() +
+            b.getJ() * b.getJ() + b.getK() * b.getK();
+        return a * Quaternion(b.getReal() / norm, -b.getI() / norm,
+            -b.getJ() / norm, -b.getK() / norm);
+    };
+    auto measure = [&](const char* name, auto body) {
+        auto start = std::chrono::steady_clock::now();
+        for (int round = 0; round < rounds; ++round) {
+            for (size_t i = 1; i < size; ++i) {
+                auto result = body(values[i - 1], values[i]);
+                benchmarkKeep(result);
+            }
+        }
+        auto finish = std::chrono::steady_clock::now();
+        std::cout << name << ": " << std::chrono::duration<double,
+            std::nano>(finish - start).count() / (rounds * (size - 1)) <<
+            " ns/op" << std::endl;
+    };
+    measure("legacy complex division", [&](const Quaternion& a,
+        const Quaternion& b) {
+        return legacyComplex(ComplexNumber(a.getReal(), a.getI()),
+            ComplexNumber(b.getReal(), b.getI()));
+    });
+    measure("ComplexNumber::operator/", [](const Quaternion& a,
+        const Quaternion& b) {
+        return ComplexNumber(a.getReal(), a.getI()) /
+            ComplexNumber(b.getReal(), b.getI());
+    });
+    measure("legacy quaternion division", legacyQuaternion);
+    measure("Quaternion::operator/", [](const Quaternion& a,
+        const Quaternion& b) {
+        return a / b;
+    });
+
+    QuaternionArray array(values);
+    QuaternionArray ones(size);
+    QuaternionArray result;
+    for (size_t i = 0; i < size; ++i) {
+        ones.set(i, Quaternion(1, 0, 0, 0));
+    }
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < rounds; ++round) {
+        result = ones;
+        result /= array;
+    }
+    auto finish = std::chrono::steady_clock::now();
+    std::cout << "QuaternionArray 1 / q: " << std::chrono::duration<double,
+        std::nano>(finish - start).count() / (rounds * size) << " ns/element" <<
+        std::endl;
+    start = std::chrono::steady_clock::now();
+    for (int round = 0; round < rounds; ++round) {
+        reciprocal(array, result);
+    }
+    finish = std::chrono::steady_clock::now();
+    std::cout << "reciprocal(QuaternionArray): " << std::chrono::duration<
+        double, std::nano>(finish - start).count() / (rounds * size) <<
+        " ns/element" << std::endl;
+}
+
+void benchmarkRotation() {
+    // блок помещается в L2, иначе все варианты упираются в память
+    const size_t size = 1 << 14;
+    const int rounds = 256;
+    Quaternion rotation(std::cos(0.3), 0.6 * std::sin(0.3),
+        0.8 * std::sin(0.3), 0);
+    PointArray points(size);
+    for (size_t i = 0; i < size; ++i) {
+        points.set(i, std::sin(0.1 * i), std::cos(0.2 * i), 0.001 * i);
+    }
+    PointArray result(size);
+    auto measure = [&](auto body) {
+        auto start = std::chrono::steady_clock::now();
+        for (int round = 0; round < rounds; ++round) {
+            body();
+            benchmarkKeep(result.getXData()[round]);
+        }
+        auto finish = std::chrono::steady_clock::now();
+        return std::chrono::duration<double, std::nano>(
+            finish - start).count() / (rounds * size);
+    };
+    double chained = measure([&]() {
+        for (size_t i = 0; i < size; ++i) {
+            double x, y, z;
+            points.get(i, x, y, z);
+            Quaternion rotated = rotation * Quaternion(0, x, y, z) / rotation;
+            result.set(i, rotated.getI(), rotated.getJ(), rotated.getK());
+        }
+    });
+    std::cout << "q * p / q: " << chained << " ns/point" << std::endl;
+    double single = measure([&]() {
+        for (size_t i = 0; i < size; ++i) {
+            double x, y, z;
+            points.get(i, x, y, z);
+            rotation.rotate(x, y, z);
+            result.set(i, x, y, z);
+        }
+    });
+    std::cout << "Quaternion::rotate: " << single << " ns/point" << std::endl;
+    double batched = measure([&]() {
+        rotate(rotation, points, result, 1);
+    });
+    std::cout << "rotate(PointArray): " << batched << " ns/point (x" <<
+        chained / batched << ")" << std::endl;
+
+    // большой массив во всех потоках
+    const size_t largeSize = 1 << 22;
+    PointArray cloud(largeSize);
+    PointArray turned(largeSize);
+    for (size_t i = 0; i < largeSize; ++i) {
+        cloud.set(i, std::sin(0.1 * i), std::cos(0.2 * i), 0.001 * i);
+    }
+    auto start = std::chrono::steady_clock::now();
+    rotate(rotation, cloud, turned);
+    auto finish = std::chrono::steady_clock::now();
+    std::cout << "rotate(PointArray), 2^22 points, " << workerCount(0) <<
+        " threads: " << std::chrono::duration<double, std::nano>(
+        finish - start).count() / largeSize << " ns/point" << std::endl;
+}
+
+void benchmarkInterpolation() {
+    const size_t keyCount = 1 << 12;
+    const size_t sampleCount = 1 << 20;
+    QuaternionArray keyframes(keyCount);
+    for (size_t i = 0; i < keyCount; ++i) {
+        Quaternion key(std::cos(0.01 * i), std::sin(0.37 * i),
+            std::cos(0.11 * i), std::sin(0.05 * i));
+        keyframes.set(i, key * (1 / std::sqrt(key.norm())));
+    }
+    std::vector<double> times(sampleCount);
+    for (size_t i = 0; i < sampleCount; ++i) {
+        times[i] = (keyCount - 1.0) * i / sampleCount;
+    }
+    QuaternionArray result(sampleCount);
+    auto report = [&](const char* name,
+        std::chrono::steady_clock::time_point start) {
+        auto finish = std::chrono::steady_clock::now();
+        std::cout << name << ": " << std::chrono::duration<double,
+            std::nano>(finish - start).count() / sampleCount <<
+            " ns/sample" << std::endl;
+    };
+
+    // то, что приходилось писать без интерполяции: операторы и std::acos
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < sampleCount; ++i) {
+        size_t segment = std::min(size_t(times[i]), keyCount - 2);
+        double t = times[i] - segment;
+        Quaternion a = keyframes.get(segment);
+        Quaternion b = keyframes.get(segment + 1);
+        double dot = a.getReal() * b.getReal() + a.getI() * b.getI() +
+            a.getJ() * b.getJ() + a.getK() * b.getK();
+        if (dot < 0) {
+            b = b * -1.0;
+            dot = -dot;
+        }
+        double angle = std::acos(std::min(dot, 1.0));
+        Quaternion value = angle < 1e-6 ? a * (1 - t) + b * t :
+            (a * std::sin((1 - t) * angle) + b * std::sin(t * angle)) /
+            std::sin(angle);
+        result.set(i, value);
+    }
+    report("operators + std::acos", start);
+
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < sampleCount; ++i) {
+        size_t segment = std::min(size_t(times[i]), keyCount - 2);
+        result.set(i, slerp(keyframes.get(segment),
+            keyframes.get(segment + 1), times[i] - segment));
+    }
+    report("slerp", start);
+
+    start = std::chrono::steady_clock::now();
+    KeyframeTrack track(keyframes);
+    report("KeyframeTrack construction", start);
+    const char* names[] = {"KeyframeTrack NLERP", "KeyframeTrack SLERP",
+        "KeyframeTrack squad"};
+    InterpolationMode modes[] = {IM_NLERP, IM_SLERP, IM_SQUAD};
+    for (int mode = 0; mode < 3; ++mode) {
+        start = std::chrono::steady_clock::now();
+        track.sample(times.data(), sampleCount, modes[mode], result);
+        report(names[mode], start);
+    }
+}
+
+void benchmarkMatrix() {
+    // тройной цикл кубичен, поэтому сравнивается только до 1024
+    const size_t naiveLimit = 1024;
+    for (size_t size = 64; size <= 4096; size *= 4) {
+        ComplexMatrix a(size, size), b(size, size), rightSide(size, 1);
+        std::vector<ComplexNumber> left(size * size), right(size * size);
+        for (size_t i = 0; i < size * size; ++i) {
+            left[i] = ComplexNumber(std::sin(0.3 * i), std::cos(0.7 * i));
+            right[i] = ComplexNumber(std::cos(1.1 * i), std::sin(0.2 * i));
+            a.set(i / size, i % size, left[i]);
+            b.set(i / size, i % size, right[i]);
+        }
+        for (size_t i = 0; i < size; ++i) {
+            rightSide.set(i, 0, right[i]);
+        }
+        // малые размеры повторяются, чтобы замер не тонул в шуме
+        size_t rounds = std::max<size_t>(1, (size_t(1) << 24) /
+            (size * size * size));
+        // 8 операций с плавающей точкой на комплексное умножение-сложение
+        double flops = 8.0 * size * size * size * rounds;
+        auto measure = [&](const char* name, double work, auto body) {
+            auto start = std::chrono::steady_clock::now();
+            for (size_t round = 0; round < rounds; ++round) {
+                body();
+            }
+            auto finish = std::chrono::steady_clock::now();
+            std::cout << " " << name << " " << work / std::chrono::duration<
+                double, std::nano>(finish - start).count() << " GFLOP/s";
+        };
+        std::cout << "matrix " << size << ":";
+        if (size <= naiveLimit) {
+            std::vector<ComplexNumber> expected;
+            measure("naive", flops, [&]() {
+                naiveMatrixMultiply(left, right, expected, size, size, size);
+            });
+        }
+        ComplexMatrix product;
+        measure("multiply", flops, [&]() {
+            multiply(a, b, product);
+        });
+        ComplexMatrix solution;
+        measure("solve", flops / 3, [&]() {
+            solve(a, rightSide, solution);
+        });
+        std::cout << std::endl;
+    }
+}
+
+void benchmarkPolynomials() {
+    const size_t count = 1 << 16;
+    ComplexArray points(count);
+    for (size_t i = 0; i < count; ++i) {
+        points.set(i, ComplexNumber(std::sin(0.37 * i), std::cos(0.11 * i)));
+    }
+    ComplexArray values(count);
+    for (size_t degree : {16, 256}) {
+        ComplexArray coefficients(degree + 1);
+        for (size_t k = 0; k <= degree; ++k) {
+            coefficients.set(k, ComplexNumber(1.0 / (k + 1), -0.5 / (k + 2)));
+        }
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < count; ++i) {
+            ComplexNumber point = points.get(i);
+            ComplexNumber value = coefficients.get(degree);
+            for (size_t k = degree; k-- > 0;) {
+                value = value * point + coefficients.get(k);
+            }
+            benchmarkKeep(value.getReal());
+        }
+        auto finish = std::chrono::steady_clock::now();
+        std::cout << "Horner degree " << degree << ", ComplexNumber: " <<
+            std::chrono::duration<double, std::nano>(finish - start).count() /
+            count << " ns/point" << std::endl;
+        start = std::chrono::steady_clock::now();
+        evaluatePolynomial(coefficients, points, values, 1);
+        benchmarkKeep(values.get(count - 1).getReal());
+        finish = std::chrono::steady_clock::now();
+        std::cout << "Horner degree " << degree << ", batched: " <<
+            std::chrono::duration<double, std::nano>(finish - start).count() /
+            count << " ns/point" << std::endl;
+    }
+    for (size_t degree : {4, 16, 64, 256, 1000}) {
+        std::vector<ComplexArray> polynomials(std::max<size_t>(4,
+            (1 << 14) / degree));
+        for (size_t p = 0; p < polynomials.size(); ++p) {
+            polynomials[p].resize(degree + 1);
+            for (size_t k = 0; k <= degree; ++k) {
+                polynomials[p].set(k, ComplexNumber(std::sin(7.1 * k + p),
+                    std::cos(3.3 * k * k + p)));
+            }
+        }
+        std::vector<ComplexArray> roots;
+        std::vector<RootReport> reports;
+        auto start = std::chrono::steady_clock::now();
+        findRoots(polynomials, roots, reports);
+        auto finish = std::chrono::steady_clock::now();
+        double iterations = 0;
+        double residual = 0;
+        for (const RootReport& report : reports) {
+            iterations += report.iterations;
+            residual = std::max(residual, report.maxResidual);
+        }
+        std::cout << "Aberth degree " << degree << ": " <<
+            std::chrono::duration<double, std::micro>(finish - start).count() /
+            polynomials.size() << " us/polynomial, " <<
+            iterations / reports.size() << " iterations, residual " <<
+            residual << std::endl;
+    }
+}
+
+void benchmarkEscapeTime() {
+    EscapeGrid grid(768, 512, -2.2L, -1.2L, 3.3 / 768);
+    grid.maxIterations = 1000;
+    std::vector<uint32_t> counts;
+    renderEscapeTime(grid, counts, 1);
+    double iterations = 0;
+    for (uint32_t count : counts) {
+        iterations += count;
+    }
+    auto report = [&](const char* name,
+        std::chrono::steady_clock::time_point start) {
+        auto finish = std::chrono::steady_clock::now();
+        std::cout << "escape time, " << name << ": " << std::chrono::duration<
+            double, std::nano>(finish - start).count() / iterations <<
+            " ns/iteration" << std::endl;
+    };
+    double realOrigin = grid.realOrigin;
+    double iOrigin = grid.iOrigin;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t row = 0; row < grid.height; ++row) {
+        for (size_t column = 0; column < grid.width; ++column) {
+            ComplexNumber c(realOrigin + column * grid.realStep,
+                iOrigin + row * grid.iStep);
+            ComplexNumber z(0, 0);
+            unsigned count = 0;
+            while (count < grid.maxIterations && z.norm() <= 4) {
+                z = z * z + c;
+                ++count;
+            }
+            benchmarkKeep(count);
+        }
+    }
+    report("ComplexNumber", start);
+    start = std::chrono::steady_clock::now();
+    for (size_t row = 0; row < grid.height; ++row) {
+        for (size_t column = 0; column < grid.width; ++column) {
+            benchmarkKeep(escapeTime(ComplexNumber(0, 0),
+                ComplexNumber(realOrigin + column * grid.realStep,
+                    iOrigin + row * grid.iStep), grid.maxIterations, 2));
+        }
+    }
+    report("scalar", start);
+    start = std::chrono::steady_clock::now();
+    renderEscapeTime(grid, counts, 1);
+    benchmarkKeep(counts.back());
+    report("SIMD, 1 thread", start);
+    start = std::chrono::steady_clock::now();
+    renderEscapeTime(grid, counts);
+    benchmarkKeep(counts.back());
+    report("SIMD, all threads", start);
+    start = std::chrono::steady_clock::now();
+    renderEscapeTimePerturbed(grid, counts);
+    benchmarkKeep(counts.back());
+    report("perturbed", start);
+}
+
+void benchmarkOptimizer() {
+    const int iterations = 1000000;
+    std::vector<std::pair<const char*, RpnProgram>> programs;
+    // угол в градусах, pi / 180 записано формулой, как в исходнике
+    RpnProgram radians;
+    int angle = radians.addInput(CK_COMPLEX_NUMBER);
+    radians.pushLiteral(ComplexNumber(180, 0));
+    radians.pushLiteral(ComplexNumber(M_PI, 0));
+    radians.apply(OP_DIVIDE);
+    radians.pushInput(angle);
+    radians.apply(OP_MULTIPLY);
+    radians.pushLiteral(ComplexNumber(0, 0));
+    radians.apply(OP_ADD);
+    programs.emplace_back("degrees to radians", radians);
+    // ряд exp по схеме Горнера с коэффициентами 1 / k!
+    RpnProgram series;
+    int x = series.addInput(CK_COMPLEX_NUMBER);
+    double factorial = 1;
+    for (int k = 1; k <= 10; ++k) {
+        factorial *= k;
+    }
+    series.pushLiteral(ComplexNumber(factorial, 0));
+    series.pushLiteral(ComplexNumber(1, 0));
+    series.apply(OP_DIVIDE);
+    for (int k = 9; k >= 0; --k) {
+        series.pushInput(x);
+        series.apply(OP_MULTIPLY);
+        factorial /= k + 1;
+        series.pushLiteral(ComplexNumber(factorial, 0));
+        series.pushLiteral(ComplexNumber(1, 0));
+        series.apply(OP_DIVIDE);
+        series.apply(OP_ADD);
+    }
+    programs.emplace_back("exp series", series);
+    // калибровка: сумма (q - offset) / gain по четырём датчикам
+    RpnProgram calibration;
+    for (int sensor = 0; sensor < 4; ++sensor) {
+        int q = calibration.addInput(CK_QUATERNION);
+        calibration.pushLiteral(Quaternion(2, 0.5, 0, -0.25));
+        calibration.pushLiteral(Quaternion(0.1, 0.2, 0.3, 0.4));
+        calibration.pushInput(q);
+        calibration.apply(OP_SUBTRACT);
+        calibration.apply(OP_DIVIDE);
+        calibration.pushLiteral(ComplexNumber(1, 0));
+        calibration.apply(OP_MULTIPLY);
+        if (sensor > 0) {
+            calibration.apply(OP_ADD);
+        }
+    }
+    programs.emplace_back("calibration", calibration);
+    std::vector<Operand> inputs;
+    for (int i = 0; i < 4; ++i) {
+        inputs.push_back(Operand(Quaternion(1 + i, -0.5, 0.25 * i, 2)));
+    }
+    inputs[0] = Operand(ComplexNumber(0.3, -0.7));
+    for (auto& entry : programs) {
+        RpnProgram optimized;
+        RpnOptimizationReport report =
+            optimizeRpnProgram(entry.second, optimized);
+        double nanoseconds[2] = {};
+        const RpnProgram* variants[] = {&entry.second, &optimized};
+        for (int variant = 0; variant < 2; ++variant) {
+            BytecodeProgram bytecode;
+            bytecode.compile(*variants[variant]);
+            Operand result;
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < iterations; ++i) {
+                bytecode.run(inputs.data(), result);
+                benchmarkKeep(result);
+            }
+            auto finish = std::chrono::steady_clock::now();
+            nanoseconds[variant] = std::chrono::duration<double, std::nano>(
+                finish - start).count() / iterations;
+        }
+        std::cout << "optimizer, " << entry.first << ": " <<
+            report.instructionsBefore << " -> " << report.instructionsAfter <<
+            " instructions (folded " << report.foldedOperations <<
+            ", identities " << report.removedIdentities << ", reciprocals " <<
+            report.reciprocalDivisions << "), " << nanoseconds[0] << " -> " <<
+            nanoseconds[1] << " ns/formula" << std::endl;
+    }
+}
+
+void benchmarkCache() {
+    const size_t operations = 1 << 20;
+    const size_t distinct = 256;
+    std::vector<Operand> operands;
+    for (size_t i = 0; i < distinct; ++i) {
+        operands.push_back(i % 2 ? Operand(ComplexNumber(1.5 + i, -0.5)) :
+            Operand(Quaternion(0.25 * i, 1, -2, 1.0 / (i + 1))));
+    }
+    auto report = [&](const char* name,
+        std::chrono::steady_clock::time_point start) {
+        auto finish = std::chrono::steady_clock::now();
+        std::cout << "cache, " << name << ": " << std::chrono::duration<
+            double, std::nano>(finish - start).count() / operations <<
+            " ns/op" << std::endl;
+    };
+    // пары операндов и операции повторяются с периодом distinct
+    auto operation = [&](size_t i) {
+        return Operations(i * 7 % distinct % 4);
+    };
+    auto left = [&](size_t i) -> const Operand& {
+        return operands[i * 7 % distinct];
+    };
+    auto right = [&](size_t i) -> const Operand& {
+        return operands[i * 13 % distinct];
+    };
+    Operand result;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < operations; ++i) {
+        applyOperation(operation(i), left(i), right(i), result);
+        benchmarkKeep(result);
+    }
+    report("applyOperation", start);
+    CalculationCache cache(1024);
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < operations; ++i) {
+        cache.calculate(operation(i), left(i), right(i), result);
+        benchmarkKeep(result);
+    }
+    report("1 shard", start);
+    unsigned threads = workerCount(0);
+    CalculationCache sharded(1024, 4 * threads);
+    start = std::chrono::steady_clock::now();
+    parallelFor(threads, threads, [&](size_t task, unsigned) {
+        Operand local;
+        for (size_t i = task; i < operations; i += threads) {
+            sharded.calculate(operation(i), left(i), right(i), local);
+            benchmarkKeep(local);
+        }
+    });
+    report("sharded, all threads", start);
+    CacheCounters counters = sharded.getCounters();
+    std::cout << "cache, sharded: " << counters.hits << " hits, " <<
+        counters.misses << " misses" << std::endl;
+    std::vector<ComplexNumber> complexes;
+    for (size_t i = 0; i < distinct; ++i) {
+        complexes.push_back(ComplexNumber(1.5 + i, -0.5));
+    }
+    for (CalculationCache* calculatorCache : {(CalculationCache*)nullptr,
+        &cache}) {
+        std::streambuf* output = std::cout.rdbuf(nullptr);
+        start = std::chrono::steady_clock::now();
+        {
+            Calculator calculator;
+            calculator.setCache(calculatorCache);
+            for (size_t i = 0; i < operations; ++i) {
+                calculator.push(complexes[i * 13 % distinct]);
+                calculator.push(complexes[i * 7 % distinct]);
+                calculator.calculate(operation(i));
+                if (i % 1024 == 1023) {
+                    benchmarkKeep(calculator.top()->getReal());
+                }
+            }
+        }
+        std::cout.rdbuf(output);
+        report(calculatorCache ? "Calculator with cache" : "Calculator",
+            start);
+    }
+}
+
+void benchmarkFork() {
+    const int iterations = 10000;
+    ComplexNumber c(1.0000001, 0.0000001);
+    Quaternion q(1.0000001, 0.0000001, 0.0000002, 0.0000003);
+    std::streambuf* output = std::cout.rdbuf(nullptr);
+    std::vector<std::string> lines;
+    for (int depth : {16, 1024, 65536}) {
+        Calculator base;
+        std::stack<ComplexNumber*> copiedStack;
+        for (int i = 0; i < depth; ++i) {
+            base.push(i % 2 ? (ComplexNumber&)q : c);
+            copiedStack.push(i % 2 ? (ComplexNumber*)&q : &c);
+        }
+        // что было бы с копией std::stack: O(depth) на каждую развилку
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i) {
+            std::stack<ComplexNumber*> branch(copiedStack);
+            benchmarkKeep(branch.top());
+        }
+        auto finish = std::chrono::steady_clock::now();
+        double stackCopy = std::chrono::duration<double, std::nano>(
+            finish - start).count() / iterations;
+        // развилка "что если": копия, две операции, отказ от ветки
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i) {
+            Calculator branch(base);
+            branch.calculate(OP_MULTIPLY);
+            branch.push(c);
+            branch.calculate(OP_ADD);
+            benchmarkKeep(branch.top()->getReal());
+        }
+        finish = std::chrono::steady_clock::now();
+        double fork = std::chrono::duration<double, std::nano>(
+            finish - start).count() / iterations;
+        // undo: снимок перед каждой операцией на одном калькуляторе
+        std::vector<Calculator> history;
+        history.reserve(iterations);
+        Calculator current(base);
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i) {
+            history.push_back(current);
+            current.push(i % 2 ? (ComplexNumber&)q : c);
+            current.calculate(OP_MULTIPLY);
+        }
+        finish = std::chrono::steady_clock::now();
+        double undo = std::chrono::duration<double, std::nano>(
+            finish - start).count() / iterations;
+        benchmarkKeep(history[iterations / 2].top()->getReal());
+        lines.push_back("fork, depth " + std::to_string(depth) +
+            ": std::stack copy " + std::to_string(stackCopy) +
+            " ns, fork + 2 operations " + std::to_string(fork) +
+            " ns, snapshot + operation " + std::to_string(undo) + " ns");
+    }
+    std::cout.rdbuf(output);
+    for (const std::string& line : lines) {
+        std::cout << line << std::endl;
+    }
+}
+
+// литералы StaticRpnProgram для тестов и замеров
+struct StaticC1 {
+    static constexpr ComplexKind kind = CK_COMPLEX_NUMBER;
+    static constexpr Components value = {2, 3, 0, 0};
+};
+
+struct StaticC2 {
+    static constexpr ComplexKind kind = CK_COMPLEX_NUMBER;
+    static constexpr Components value = {4, 5, 0, 0};
+};
+
+struct StaticQ2 {
+    static constexpr ComplexKind kind = CK_QUATERNION;
+    static constexpr Components value = {1, 2, 3, 4};
+};
+
+struct StaticZero {
+    static constexpr ComplexKind kind = CK_COMPLEX_NUMBER;
+    static constexpr Components value = {0, 0, 0, 0};
+};
+
+typedef StaticRpnProgram<RpnLiteral<StaticC2>, RpnInput<0>, RpnApply<OP_ADD>,
+    RpnInput<0>, RpnApply<OP_DIVIDE>, RpnInput<1, CK_QUATERNION>,
+    RpnLiteral<StaticC1>, RpnLiteral<StaticQ2>, RpnApply<OP_SUBTRACT>,
+    RpnApply<OP_MULTIPLY>, RpnApply<OP_DIVIDE>> StaticFormula;
+
+void benchmarkStaticRpn() {
+    const int iterations = 1000000;
+    RpnProgram program;
+    int complexInput = program.addInput(CK_COMPLEX_NUMBER);
+    int quaternionInput = program.addInput(CK_QUATERNION);
+    program.pushLiteral(ComplexNumber(4, 5));
+    program.pushInput(complexInput);
+    program.apply(OP_ADD);
+    program.pushInput(complexInput);
+    program.apply(OP_DIVIDE);
+    program.pushInput(quaternionInput);
+    program.pushLiteral(ComplexNumber(2, 3));
+    program.pushLiteral(Quaternion(1, 2, 3, 4));
+    program.apply(OP_SUBTRACT);
+    program.apply(OP_MULTIPLY);
+    program.apply(OP_DIVIDE);
+    BytecodeProgram bytecode;
+    bytecode.compile(program);
+    Operand result;
+    double checksum = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        Operand inputs[] = {Operand(ComplexNumber(1 + i * 1e-7, 2)),
+            Operand(Quaternion(1, 2, 3, 4 + i * 1e-7))};
+        bytecode.run(inputs, result);
+        checksum += result.getReal();
+    }
+    auto finish = std::chrono::steady_clock::now();
+    std::cout << "BytecodeProgram formula: " << std::chrono::duration<
+        double, std::nano>(finish - start).count() / iterations <<
+        " ns/formula" << std::endl;
+
+    StaticFormula::Result staticResult;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        StaticFormula::evaluate(staticResult,
+            ComplexNumber(1 + i * 1e-7, 2), Quaternion(1, 2, 3, 4 + i * 1e-7));
+        checksum -= staticResult.getReal();
+    }
+    finish = std::chrono::steady_clock::now();
+    std::cout << "StaticRpnProgram formula: " << std::chrono::duration<
+        double, std::nano>(finish - start).count() / iterations <<
+        " ns/formula (checksum " << checksum << ")" << std::endl;
+}
+
+void benchmarkFormatting() {
+#if defined(__unix__)
+    const size_t count = 1 << 18;
+    QuaternionArray numbers(count);
+    for (size_t i = 0; i < count; ++i) {
+        numbers.set(i, Quaternion(std::sin(0.37 * i), 1.0 / (i + 1),
+            -std::exp(1e-5 * i), i * 0.125));
+    }
+    auto report = [&](const char* name,
+        std::chrono::steady_clock::time_point start) {
+        auto finish = std::chrono::steady_clock::now();
+        std::cout << name << ": " << std::chrono::duration<double,
+            std::nano>(finish - start).count() / count << " ns/number" <<
+            std::endl;
+    };
+    // как show(): поток с std::endl после каждого числа
+    std::ofstream stream("/dev/null");
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; ++i) {
+        Quaternion q = numbers.get(i);
+        stream << q.getReal() << " + " << q.getI() << "i + " << q.getJ() <<
+            "j + " << q.getK() << "k" << std::endl;
+    }
+    report("ostream with std::endl", start);
+    stream.precision(17);
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; ++i) {
+        Quaternion q = numbers.get(i);
+        stream << q.getReal() << " + " << q.getI() << "i + " << q.getJ() <<
+            "j + " << q.getK() << "k" << '\n';
+    }
+    stream.flush();
+    report("ostream, precision 17, '\\n'", start);
+    int descriptor = open("/dev/null", O_WRONLY);
+    start = std::chrono::steady_clock::now();
+    {
+        FormattedWriter writer(descriptor);
+        writer.write(numbers);
+    }
+    report("FormattedWriter shortest", start);
+    start = std::chrono::steady_clock::now();
+    {
+        FormattedWriter writer(descriptor, 6);
+        writer.write(numbers);
+    }
+    report("FormattedWriter fixed 6", start);
+    ::close(descriptor);
+#endif
+}
+
+void benchmarkScheduler() {
+    const size_t count = 1 << 16;
+    std::vector<CalculatorJob> jobs(count);
+    for (size_t i = 0; i < count; ++i) {
+        for (size_t j = 0; j < 32; ++j) {
+            double x = 1 + 0.001 * ((i + j * 31) % 1009);
+            jobs[i].stack.push_back(j % 2 ? Operand(ComplexNumber(x, -x)) :
+                Operand(Quaternion(x, 0.5, -x, 0.25)));
+        }
+        for (size_t j = 0; j < 31; ++j) {
+            jobs[i].operations.push_back(static_cast<Operations>(j % 4));
+        }
+    }
+    auto report = [&](const std::string& name,
+        std::chrono::steady_clock::time_point start) {
+        auto finish = std::chrono::steady_clock::now();
+        std::cout << name << ": " << std::chrono::duration<double,
+            std::nano>(finish - start).count() / count << " ns/job" <<
+            std::endl;
+    };
+    std::vector<Operand> stack;
+    auto start = std::chrono::steady_clock::now();
+    for (const CalculatorJob& job : jobs) {
+        benchmarkKeep(runCalculatorJob(job, stack).stack[0].getReal());
+    }
+    report("sequential jobs", start);
+    std::vector<unsigned> threadCounts(1, 1);
+    if (workerCount(0) > 1) {
+        threadCounts.push_back(workerCount(0));
+    }
+    for (unsigned threads : threadCounts) {
+        start = std::chrono::steady_clock::now();
+        {
+            CalculatorScheduler scheduler(threads);
+            for (const CalculatorJob& job : jobs) {
+                scheduler.submit(job, [&](CalculatorJobResult& result) {
+                    benchmarkKeep(result.stack[0].getReal());
+                });
+            }
+            scheduler.wait();
+        }
+        report("scheduler callbacks, " + std::to_string(threads) +
+            " threads", start);
+        std::vector<std::future<CalculatorJobResult>> futures;
+        futures.reserve(count);
+        start = std::chrono::steady_clock::now();
+        {
+            CalculatorScheduler scheduler(threads);
+            for (const CalculatorJob& job : jobs) {
+                futures.push_back(scheduler.submit(job));
+            }
+            for (std::future<CalculatorJobResult>& future : futures) {
+                benchmarkKeep(future.get().stack[0].getReal());
+            }
+        }
+        report("scheduler futures, " + std::to_string(threads) + " threads",
+            start);
+    }
+}
+
+void benchmarkTranscendentals() {
+    const size_t count = 1 << 20;
+    QuaternionArray quaternions(count), quaternionResult(count);
+    ComplexArray complexes(count), complexResult(count);
+    for (size_t i = 0; i < count; ++i) {
+        quaternions.set(i, Quaternion(std::sin(0.37 * i), std::cos(0.11 * i),
+            std::sin(1.7 * i), std::cos(0.05 * i)));
+        complexes.set(i, ComplexNumber(std::cos(0.29 * i),
+            std::sin(0.13 * i)));
+    }
+    auto report = [&](const char* name,
+        std::chrono::steady_clock::time_point start) {
+        auto finish = std::chrono::steady_clock::now();
+        std::cout << name << ": " << std::chrono::duration<double,
+            std::nano>(finish - start).count() / count << " ns/element" <<
+            std::endl;
+    };
+    const char* names[] = {"exp", "log", "pow 2.5", "sqrt", "sin"};
+    for (int function = 0; function < 5; ++function) {
+        std::string name = names[function];
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < count; ++i) {
+            Quaternion q = quaternions.get(i);
+            switch (function) {
+                case 0:
+                    quaternionResult.set(i, exp(q));
+                    break;
+                case 1:
+                    quaternionResult.set(i, log(q));
+                    break;
+                case 2:
+                    quaternionResult.set(i, pow(q, 2.5));
+                    break;
+                case 3:
+                    quaternionResult.set(i, sqrt(q));
+                    break;
+                case 4:
+                    quaternionResult.set(i, sin(q));
+                    break;
+            }
+        }
+        report(("scalar quaternion " + name).c_str(), start);
+        start = std::chrono::steady_clock::now();
+        switch (function) {
+            case 0:
+                exp(quaternions, quaternionResult);
+                break;
+            case 1:
+                log(quaternions, quaternionResult);
+                break;
+            case 2:
+                pow(quaternions, 2.5, quaternionResult);
+                break;
+            case 3:
+                sqrt(quaternions, quaternionResult);
+                break;
+            case 4:
+                sin(quaternions, quaternionResult);
+                break;
+        }
+        report(("QuaternionArray " + name).c_str(), start);
+    }
+    for (int function = 0; function < 2; ++function) {
+        std::string name = names[function];
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < count; ++i) {
+            ComplexNumber z = complexes.get(i);
+            complexResult.set(i, function == 0 ? exp(z) : log(z));
+        }
+        report(("scalar complex " + name).c_str(), start);
+        start = std::chrono::steady_clock::now();
+        if (function == 0) {
+            exp(complexes, complexResult);
+        } else {
+            log(complexes, complexResult);
+        }
+        report(("ComplexArray " + name).c_str(), start);
+    }
+    benchmarkKeep(quaternionResult.get(count / 2).getReal() +
+        complexResult.get(count / 2).getReal());
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 1 && std::string(argv[1]) == "--bench") {
+        benchmarkCalculators();
+        benchmarkBytecode();
+        benchmarkBatch();
+        benchmarkExpressions();
+        benchmarkChainProduct();
+        benchmarkFft();
+        benchmarkRpnParser();
+        benchmarkDataset();
+        benchmarkDivision();
+        benchmarkRotation();
+        benchmarkInterpolation();
+        benchmarkMatrix();
+        benchmarkTranscendentals();
+        benchmarkScheduler();
+        benchmarkFormatting();
+        benchmarkPolynomials();
+        benchmarkEscapeTime();
+        benchmarkOptimizer();
+        benchmarkCache();
+        benchmarkFork();
+        benchmarkStaticRpn();
+        return 0;
+    }
+    if (argc > 1 && std::string(argv[1]) == "--microbench") {
+        if (argc > 2) {
+            std::ofstream report(argv[2]);
+            runMicroBenchmarks(report);
+            return report ? 0 : 1;
+        }
+        runMicroBenchmarks(std::cout);
+        return 0;
+    }
+
+    ComplexNumber a;
+    assert(a.getReal() == 0);
+    assert(a.getI() == 0);
+    ComplexNumber b(1, 2);
+    assert(b.getReal() == 1);
+    assert(b.getI() == 2);
+    ComplexNumber c(b);
+    assert(c.getReal() == 1);
+    assert(c.getI() == 2);
+    c.setI(5);
+    c.setReal(4);
+    assert(c.getReal() == 4);
+    assert(c.getI() == 5);
+    c.setImaginary({6});
+    assert(c.getI() == 6);
+    
+    Quaternion qu1;
+    assert(qu1.getReal() == 0);
+    assert(qu1.getI() == 0);
+    assert(qu1.getJ() == 0);
+    assert(qu1.getK() == 0);
+    Quaternion qu2(1, -2, 3, -4);
+    Quaternion qu3(qu2);
+
+    assert(qu2.getReal() == 1);
+    assert(qu2.getI() == -2);
+    assert(qu2.getJ() == 3);
+    assert(qu2.getK() == -4);
+    assert(qu2.getReal() == qu3.getReal());
+    assert(qu2.getI() == qu3.getI());
+    qu1.setReal(1);
+    assert(qu1.getReal() == 1);
+    qu1.setI(10);
+    qu1.setJ(11);
+    qu1.setK(12);
+    assert(qu1.getI() == 10);
+    assert(qu1.getJ() == 11);
+    assert(qu1.getK() == 12);
+    qu1.setImaginary({1, 5, 9});
+    assert(qu1.getI() == 1);
+    assert(qu1.getJ() == 5);
+    assert(qu1.getK() == 9);
+    assert(a.getKind() == CK_COMPLEX_NUMBER);
+    assert(qu1.getKind() == CK_QUATERNION);
+    ComplexNumber* temp = &qu1;
+    assert(temp->getKind() == CK_QUATERNION);
+
+    ComplexNumber c1(2, 3);
+    ComplexNumber c2(4, 5);
+    ComplexNumber c3(2, 3);
+    ComplexNumber c4(0, 0);
+
+    assert(c1 == c3);
+    assert(!(c1 == c2));
+    assert(c4 == 0);
+    assert(!(c1 == c4));
+
+    ComplexNumber c5 = c1 + c2;
+    assert(c5 == ComplexNumber(6, 8));
+    ComplexNumber c6 = c1 + 2;
+    assert(c6 == ComplexNumber(4, 3));
+
+    ComplexNumber c7 = c1 - c2;
+    assert(c7 == ComplexNumber(-2, -2));
+    ComplexNumber c8 = c1 - 2;
+    assert(c8 == ComplexNumber(0, 3));
 
     ComplexNumber c9 = c1 * c2;
     assert(c9 == ComplexNumber(-7, 22));
@@ -780,7 +9148,7 @@ int main() {
     assert(calculator.size() == 1);
     ComplexNumber* resultAddQC = calculator.top();
     assert(resultAddQC->getKind() == CK_QUATERNION);
-    assert(*(Quaternion*)resultAddQC == q1 + *(Quaternion*)resultAddCC);
+    assert(*(Quaternion*)resultAddQC == q1 + Quaternion(*resultAddCC));
     calculator.push(c2);
     calculator.calculate(OP_ADD);
     assert(calculator.size() == 1);
@@ -807,7 +9175,7 @@ int main() {
     ComplexNumber* resultSubtractQC = calculator.top();
     assert(resultSubtractQC->getKind() == CK_QUATERNION);
     assert(*(Quaternion*)resultSubtractQC ==
-        q1 - *(Quaternion*)resultSubtractCC);
+        q1 - Quaternion(*resultSubtractCC));
     calculator.push(c2);
     calculator.calculate(OP_SUBTRACT);
     assert(calculator.size() == 2);
@@ -836,7 +9204,7 @@ int main() {
     ComplexNumber* resultMultiplyQC = calculator.top();
     assert(resultMultiplyQC->getKind() == CK_QUATERNION);
     assert(*(Quaternion*)resultMultiplyQC ==
-        q1 * *(Quaternion*)resultMultiplyCC);
+        q1 * Quaternion(*resultMultiplyCC));
     calculator.push(c2);
     calculator.calculate(OP_MULTIPLY);
     assert(calculator.size() == 3);
@@ -864,7 +9232,7 @@ int main() {
     assert(calculator.size() == 4);
     ComplexNumber* resultDivideQC = calculator.top();
     assert(resultDivideQC->getKind() == CK_QUATERNION);
-    assert(*(Quaternion*)resultDivideQC == q1 / *(Quaternion*)resultDivideCC);
+    assert(*(Quaternion*)resultDivideQC == q1 / Quaternion(*resultDivideCC));
     calculator.push(c2);
     calculator.calculate(OP_DIVIDE);
     assert(calculator.size() == 4);
@@ -896,6 +9264,1835 @@ int main() {
     calculator.calculate(OP_DIVIDE);
     assert(calculator.size() == 12);
 
+    ValueCalculator valueCalculator(16);
+    c1 = ComplexNumber(2, 3);
+    q1 = Quaternion(1, 2, 3, 4);
+    valueCalculator.push(c2);
+    valueCalculator.push(c1);
+    assert(valueCalculator.size() == 2);
+    assert(valueCalculator.top().toComplexNumber() == c1);
+    valueCalculator.calculate(OP_ADD);
+    assert(valueCalculator.size() == 1);
+    assert(valueCalculator.top().getKind() == CK_COMPLEX_NUMBER);
+    assert(valueCalculator.top().toComplexNumber() == c1 + c2);
+    valueCalculator.push(q1);
+    valueCalculator.calculate(OP_MULTIPLY);
+    assert(valueCalculator.top().getKind() == CK_QUATERNION);
+    assert(valueCalculator.top().toQuaternion() ==
+        q1 * Quaternion(c1 + c2));
+    valueCalculator.push(c2);
+    valueCalculator.calculate(OP_DIVIDE);
+    assert(valueCalculator.size() == 1);
+    assert(valueCalculator.top().toQuaternion() ==
+        Quaternion(c2) / (q1 * Quaternion(c1 + c2)));
+    valueCalculator.push(Quaternion());
+    valueCalculator.push(c1);
+    valueCalculator.calculate(OP_DIVIDE);
+    assert(valueCalculator.size() == 3);
+    valueCalculator.pop();
+    valueCalculator.pop();
+    {
+        // делитель (0, 0, j, k) оба калькулятора отклоняют одинаково
+        Quaternion jkDivisor(0, 0, 1, 1);
+        Calculator reference;
+        ValueCalculator valueReference;
+        reference.push(jkDivisor);
+        reference.push(q1);
+        reference.calculate(OP_DIVIDE);
+        valueReference.push(jkDivisor);
+        valueReference.push(q1);
+        valueReference.calculate(OP_DIVIDE);
+        assert(reference.size() == 2);
+        assert(valueReference.size() == reference.size());
+        assert(valueReference.top().toQuaternion() ==
+            *static_cast<Quaternion*>(reference.top()));
+    }
+    size_t allocationsBefore = allocationCount;
+    for (int i = 0; i < 100; ++i) {
+        valueCalculator.push(i % 2 ? c2 : q2);
+        valueCalculator.calculate(OP_SUBTRACT);
+    }
+    assert(allocationCount == allocationsBefore);
+    assert(valueCalculator.size() == 1);
+
+    std::vector<ComplexNumber> complexValues;
+    std::vector<Quaternion> quaternionValues;
+    for (int i = 0; i < 37; ++i) {
+        complexValues.push_back(ComplexNumber(i * 0.37 - 5, 3 - i * 0.11));
+        quaternionValues.push_back(
+            Quaternion(i * 0.37 - 5, 3 - i * 0.11, i * 0.5, 1.0 / (i + 1)));
+    }
+    ComplexArray complexArray(complexValues);
+    ComplexArray complexArray2(complexArray * c2 - 1.5);
+    QuaternionArray quaternionArray(quaternionValues);
+    QuaternionArray quaternionArray2(quaternionArray * q2 + c2);
+    assert(complexArray.size() == 37);
+    assert(quaternionArray.size() == 37);
+    ComplexArray complexSum = complexArray + complexArray2;
+    ComplexArray complexProduct = complexArray * complexArray2;
+    ComplexArray complexQuotient = complexArray / complexArray2;
+    ComplexArray complexScalarQuotient = complexArray / c2;
+    QuaternionArray quaternionDiff = quaternionArray - quaternionArray2;
+    QuaternionArray quaternionProduct = quaternionArray * quaternionArray2;
+    QuaternionArray quaternionQuotient = quaternionArray / quaternionArray2;
+    QuaternionArray quaternionScalarQuotient = quaternionArray / q2;
+    QuaternionArray quaternionComplexProduct = quaternionArray * c2;
+    QuaternionArray quaternionHalf = quaternionArray / 2;
+    const double tolerance = 1e-12;
+    for (size_t i = 0; i < complexArray.size(); ++i) {
+        ComplexNumber x = complexArray.get(i);
+        ComplexNumber y = complexArray2.get(i);
+        Quaternion p = quaternionArray.get(i);
+        Quaternion r = quaternionArray2.get(i);
+        assert(complexSum.get(i) == x + y);
+        assert(quaternionDiff.get(i) == p - r);
+        assert(quaternionHalf.get(i) == p / 2);
+        ComplexNumber complexErrors[] = {
+            complexProduct.get(i) - x * y,
+            complexQuotient.get(i) - x / y,
+            complexScalarQuotient.get(i) - x / c2
+        };
+        for (const ComplexNumber& error : complexErrors) {
+            assert(std::fabs(error.getReal()) < tolerance);
+            assert(std::fabs(error.getI()) < tolerance);
+        }
+        Quaternion quaternionErrors[] = {
+            quaternionProduct.get(i) - p * r,
+            quaternionQuotient.get(i) - p / r,
+            quaternionScalarQuotient.get(i) - p / q2,
+            quaternionComplexProduct.get(i) - p * Quaternion(c2)
+        };
+        for (const Quaternion& error : quaternionErrors) {
+            assert(std::fabs(error.getReal()) < tolerance);
+            assert(std::fabs(error.getI()) < tolerance);
+            assert(std::fabs(error.getJ()) < tolerance);
+            assert(std::fabs(error.getK()) < tolerance);
+        }
+    }
+
+    RpnProgram rpnProgram;
+    int complexInput = rpnProgram.addInput(CK_COMPLEX_NUMBER);
+    int quaternionInput = rpnProgram.addInput(CK_QUATERNION);
+    rpnProgram.pushLiteral(c2);
+    rpnProgram.pushInput(complexInput);
+    rpnProgram.apply(OP_ADD);
+    rpnProgram.pushInput(complexInput);
+    rpnProgram.apply(OP_DIVIDE);
+    rpnProgram.pushInput(quaternionInput);
+    rpnProgram.pushLiteral(c1);
+    rpnProgram.pushLiteral(q2);
+    rpnProgram.apply(OP_SUBTRACT);
+    rpnProgram.apply(OP_MULTIPLY);
+    rpnProgram.apply(OP_DIVIDE);
+    BytecodeProgram bytecodeProgram;
+    assert(bytecodeProgram.compile(rpnProgram));
+    assert(bytecodeProgram.getResultKind() == CK_QUATERNION);
+    assert(bytecodeProgram.getCode().size() == 8);
+    Operand rpnInputs[] = {Operand(c1), Operand(q1)};
+    Operand rpnResult;
+    assert(bytecodeProgram.run(rpnInputs, rpnResult) == RS_OK);
+    ValueCalculator rpnCheck;
+    rpnCheck.push(c2);
+    rpnCheck.push(c1);
+    rpnCheck.calculate(OP_ADD);
+    rpnCheck.push(c1);
+    rpnCheck.calculate(OP_DIVIDE);
+    rpnCheck.push(q1);
+    rpnCheck.push(c1);
+    rpnCheck.push(q2);
+    rpnCheck.calculate(OP_SUBTRACT);
+    rpnCheck.calculate(OP_MULTIPLY);
+    rpnCheck.calculate(OP_DIVIDE);
+    assert(rpnCheck.size() == 1);
+    assert(rpnResult.getKind() == rpnCheck.top().getKind());
+    assert(rpnResult.toQuaternion() == rpnCheck.top().toQuaternion());
+    Operand zeroInputs[] = {Operand(ComplexNumber(0, 0)), Operand(q1)};
+    assert(bytecodeProgram.run(zeroInputs, rpnResult) == RS_DIVIDE_BY_ZERO);
+    {
+        // как Calculator, делитель (0, 0, j, k) считается нулём
+        RpnProgram divisionProgram;
+        divisionProgram.pushInput(divisionProgram.addInput(CK_QUATERNION));
+        divisionProgram.pushInput(divisionProgram.addInput(CK_QUATERNION));
+        divisionProgram.apply(OP_DIVIDE);
+        BytecodeProgram divisionBytecode;
+        assert(divisionBytecode.compile(divisionProgram));
+        Quaternion divisors[] = {Quaternion(0, 0, 1, 1),
+            Quaternion(0, 0.5, 1, 1)};
+        for (Quaternion& divisor : divisors) {
+            Calculator reference;
+            reference.push(divisor);
+            reference.push(q1);
+            reference.calculate(OP_DIVIDE);
+            Operand divisionInputs[] = {Operand(divisor), Operand(q1)};
+            RpnStatus divisionStatus = divisionBytecode.run(divisionInputs,
+                rpnResult);
+            assert((divisionStatus == RS_DIVIDE_BY_ZERO) ==
+                (reference.size() == 2));
+            assert(divisionStatus != RS_OK || rpnResult.toQuaternion() ==
+                *static_cast<Quaternion*>(reference.top()));
+        }
+        Operand jkInputs[] = {Operand(divisors[0]), Operand(q1)};
+        assert(divisionBytecode.run(jkInputs, rpnResult) ==
+            RS_DIVIDE_BY_ZERO);
+    }
+    Operand wrongInputs[] = {Operand(q1), Operand(q1)};
+    assert(bytecodeProgram.run(wrongInputs, rpnResult) ==
+        RS_INPUT_KIND_MISMATCH);
+    assert(bytecodeProgram.run(rpnResult) == RS_INPUT_SIZE_MISMATCH);
+    RpnProgram badProgram;
+    badProgram.pushLiteral(c1);
+    badProgram.apply(OP_ADD);
+    BytecodeProgram badBytecode;
+    assert(!badBytecode.compile(badProgram));
+    assert(!badBytecode.getError().empty());
+    assert(badBytecode.run(rpnResult) == RS_INVALID_PROGRAM);
+
+    const size_t batchSize = 1000;
+    ComplexArray batchComplex(batchSize);
+    QuaternionArray batchQuaternion(batchSize);
+    for (size_t i = 0; i < batchSize; ++i) {
+        batchComplex.set(i, i % 7 == 3 ?
+            ComplexNumber() : ComplexNumber(0.5 * i, 1));
+        batchQuaternion.set(i, i % 11 == 5 ?
+            Quaternion(0, 0, 2, 0.125 * i) :
+            Quaternion(1, -0.25 * i, 2, 0.125 * i));
+    }
+    BatchEvaluator batchEvaluator(bytecodeProgram, 4);
+    batchEvaluator.bindInput(complexInput, batchComplex);
+    batchEvaluator.bindInput(quaternionInput, batchQuaternion);
+    QuaternionArray batchResult;
+    std::vector<unsigned char> batchStatus;
+    assert(batchEvaluator.evaluate(batchResult, batchStatus) == RS_OK);
+    assert(batchResult.size() == batchSize);
+    for (size_t i = 0; i < batchSize; ++i) {
+        Operand laneInputs[] = {Operand(batchComplex.get(i)),
+            Operand(batchQuaternion.get(i))};
+        RpnStatus laneStatus = bytecodeProgram.run(laneInputs, rpnResult);
+        assert(batchStatus[i] == laneStatus);
+        if (laneStatus == RS_OK) {
+            Quaternion laneError = batchResult.get(i) -
+                rpnResult.toQuaternion();
+            assert(std::fabs(laneError.getReal()) < tolerance);
+            assert(std::fabs(laneError.getI()) < tolerance);
+            assert(std::fabs(laneError.getJ()) < tolerance);
+            assert(std::fabs(laneError.getK()) < tolerance);
+        }
+    }
+    {
+        // делитель - кватернионный столбец, дорожки (0, 0, j, k) - нули,
+        // как в Calculator
+        RpnProgram batchDivision;
+        batchDivision.pushInput(batchDivision.addInput(CK_QUATERNION));
+        batchDivision.pushInput(batchDivision.addInput(CK_COMPLEX_NUMBER));
+        batchDivision.apply(OP_DIVIDE);
+        BytecodeProgram batchDivisionBytecode;
+        assert(batchDivisionBytecode.compile(batchDivision));
+        BatchEvaluator divisionEvaluator(batchDivisionBytecode, 4);
+        divisionEvaluator.bindInput(0, batchQuaternion);
+        divisionEvaluator.bindInput(1, batchComplex);
+        assert(divisionEvaluator.evaluate(batchResult, batchStatus) ==
+            RS_OK);
+        for (size_t i = 0; i < batchSize; ++i) {
+            Operand laneInputs[] = {Operand(batchQuaternion.get(i)),
+                Operand(batchComplex.get(i))};
+            RpnStatus laneStatus = batchDivisionBytecode.run(laneInputs,
+                rpnResult);
+            assert(batchStatus[i] == laneStatus);
+            assert((laneStatus == RS_DIVIDE_BY_ZERO) == (i % 11 == 5));
+        }
+    }
+    batchEvaluator.bindInput(quaternionInput, quaternionArray);
+    assert(batchEvaluator.evaluate(batchResult, batchStatus) ==
+        RS_INPUT_SIZE_MISMATCH);
+    batchEvaluator.bindInput(complexInput, quaternionArray);
+    assert(batchEvaluator.evaluate(batchResult, batchStatus) ==
+        RS_INPUT_KIND_MISMATCH);
+    BatchEvaluator unboundEvaluator(bytecodeProgram);
+    unboundEvaluator.bindInput(complexInput, batchComplex);
+    assert(unboundEvaluator.evaluate(batchResult, batchStatus) ==
+        RS_INPUT_NOT_BOUND);
+
+    Quaternion lazyQuaternion = evaluate(lazy(q1) * q2 + lazy(c1) * q3 -
+        lazy(q2) / c2);
+    Quaternion eagerQuaternion = q1 * q2 + c1 * q3 - q2 / c2;
+    Quaternion lazyError = lazyQuaternion - eagerQuaternion;
+    assert(std::fabs(lazyError.getReal()) < tolerance);
+    assert(std::fabs(lazyError.getI()) < tolerance);
+    assert(std::fabs(lazyError.getJ()) < tolerance);
+    assert(std::fabs(lazyError.getK()) < tolerance);
+    static_assert(decltype(lazy(c1) * c2 + 2.0)::kind == CK_COMPLEX_NUMBER,
+        "complex expression must stay complex");
+    static_assert(decltype(lazy(c1) * q2)::kind == CK_QUATERNION,
+        "mixed expression must be promoted");
+    ComplexNumber lazyComplex = evaluate(lazy(c1) * c2 - c2 / lazy(c1) + 2.0);
+    ComplexNumber lazyComplexError = lazyComplex - (c1 * c2 - c2 / c1 + 2);
+    assert(std::fabs(lazyComplexError.getReal()) < tolerance);
+    assert(std::fabs(lazyComplexError.getI()) < tolerance);
+    assert(evaluate(lazy(c1) + c2) == c1 + c2);
+    assert(evaluate(lazy(q1) / q2) == q1 / q2);
+    // выражение с временными операндами переживает их
+    ComplexNumber storedProduct = c1 * c2;
+    auto storedExpression = lazy(c1) * c2 + c1 * c2;
+    Quaternion storedQuaternion = q1;
+    auto storedMixed = lazy(Quaternion(q2)) - storedQuaternion;
+    storedQuaternion = q2;
+    assert(evaluate(storedExpression) ==
+        evaluate(lazy(c1) * c2 + storedProduct));
+    assert(evaluate(storedMixed) == q2 - q1);
+
+    BasicQuaternion<float> floatQuaternion(q1);
+    BasicQuaternion<long double> longQuaternion(q1);
+    assert(floatQuaternion.getJ() == 3.0f);
+    assert(Quaternion(longQuaternion) == q1);
+    assert(Quaternion(floatQuaternion * floatQuaternion) == q1 * q1);
+    BasicComplexNumber<float> floatComplex(c1);
+    assert(ComplexNumber(floatComplex / BasicComplexNumber<float>(2, 0)) ==
+        ComplexNumber(1, 1.5));
+#if __cplusplus >= 202002L
+    constexpr Quaternion constantProduct =
+        Quaternion(1, 2, 3, 4) * ComplexNumber(2, 3);
+    static_assert(constantProduct == Quaternion(-4, 7, 18, -1));
+    static_assert((ComplexNumber(2, 3) * ComplexNumber(4, 5)).getI() == 22);
+#endif
+
+    const size_t chainSize = 3 * CHAIN_BLOCK_SIZE + 123;
+    QuaternionArray rotations(chainSize);
+    for (size_t i = 0; i < chainSize; ++i) {
+        double angle = 0.001 * (i % 17);
+        rotations.set(i, Quaternion(std::cos(angle), std::sin(angle) * 0.6,
+            0, std::sin(angle) * 0.8));
+    }
+    Quaternion serialProduct = rotations.get(0);
+    for (size_t i = 1; i < chainSize; ++i) {
+        serialProduct *= rotations.get(i);
+    }
+    QuaternionArray prefixProducts;
+    chainPrefixProduct(rotations, prefixProducts, 3);
+    Quaternion chainResults[] = {chainProduct(rotations, 3),
+        chainProduct(rotations, 3, 64), prefixProducts.get(chainSize - 1)};
+    for (const Quaternion& chainResult : chainResults) {
+        Quaternion chainError = chainResult - serialProduct;
+        assert(std::fabs(chainError.getReal()) < 1e-9);
+        assert(std::fabs(chainError.getI()) < 1e-9);
+        assert(std::fabs(chainError.getJ()) < 1e-9);
+        assert(std::fabs(chainError.getK()) < 1e-9);
+    }
+    assert(prefixProducts.get(0) == rotations.get(0));
+    Quaternion prefixError = prefixProducts.get(2) -
+        rotations.get(0) * rotations.get(1) * rotations.get(2);
+    assert(std::fabs(prefixError.getReal()) < tolerance);
+
+    // неединичный кватернион: масштаб сокращается
+    Quaternion turn(1.5, -0.5, 2.0, 0.25);
+    const size_t pointCount = 3 * ROTATE_CHUNK_SIZE + 5;
+    PointArray points(pointCount);
+    for (size_t i = 0; i < pointCount; ++i) {
+        points.set(i, std::sin(0.3 * i), std::cos(1.7 * i) * 4,
+            0.01 * i - 20);
+    }
+    PointArray turned;
+    rotate(turn, points, turned, 3);
+    for (size_t i = 0; i < pointCount; i += 97) {
+        double pointX, pointY, pointZ;
+        points.get(i, pointX, pointY, pointZ);
+        Quaternion chained = turn * Quaternion(0, pointX, pointY, pointZ) /
+            turn;
+        double scale = std::fabs(pointX) + std::fabs(pointY) +
+            std::fabs(pointZ);
+        double turnedX, turnedY, turnedZ;
+        turned.get(i, turnedX, turnedY, turnedZ);
+        assert(std::fabs(turnedX - chained.getI()) < tolerance * scale);
+        assert(std::fabs(turnedY - chained.getJ()) < tolerance * scale);
+        assert(std::fabs(turnedZ - chained.getK()) < tolerance * scale);
+        turn.rotate(pointX, pointY, pointZ);
+        assert(std::fabs(pointX - chained.getI()) < tolerance * scale);
+        assert(std::fabs(pointY - chained.getJ()) < tolerance * scale);
+        assert(std::fabs(pointZ - chained.getK()) < tolerance * scale);
+    }
+    // поворот на месте в один поток даёт то же самое
+    rotate(turn, points, points, 1);
+    for (size_t i = 0; i < pointCount; ++i) {
+        assert(points.getXData()[i] == turned.getXData()[i]);
+        assert(points.getYData()[i] == turned.getYData()[i]);
+        assert(points.getZData()[i] == turned.getZData()[i]);
+    }
+    double unitX = 1, unitY = 0, unitZ = 0;
+    Quaternion(std::cos(M_PI / 4), 0, 0, std::sin(M_PI / 4)).rotate(
+        unitX, unitY, unitZ);
+    assert(std::fabs(unitX) < tolerance);
+    assert(std::fabs(unitY - 1) < tolerance);
+    assert(unitZ == 0);
+
+    const double epsilon = std::numeric_limits<double>::epsilon();
+    for (double x = 0.001; x < M_PI / 2; x += 0.001) {
+        assert(std::fabs(sincPolynomial(x) * x - std::sin(x)) <
+            4 * epsilon * std::sin(x));
+        assert(std::fabs(atanPolynomial(x / 1.6) - std::atan(x / 1.6)) <
+            4 * epsilon * std::atan(x / 1.6));
+        double squared = std::ldexp(x, int(1000 * x) - 700);
+        assert(std::fabs(squareRoot(squared) - std::sqrt(squared)) <=
+            epsilon * std::sqrt(squared));
+    }
+    assert(sincPolynomial(0) == 1);
+    assert(squareRoot(0) == 0);
+    assert(atanPolynomial(0) == 0);
+
+    // поворот вокруг оси z: slerp(1, (cos a, 0, 0, sin a), t) = поворот на ta
+    double halfTurn = 1.2;
+    Quaternion startTurn(1, 0, 0, 0);
+    Quaternion endTurn(std::cos(halfTurn), 0, 0, std::sin(halfTurn));
+    double steps[] = {0, 0.1, 0.25, 0.5, 0.9, 1};
+    for (double step : steps) {
+        Quaternion between = slerp(startTurn, endTurn, step);
+        assert(std::fabs(between.getReal() - std::cos(step * halfTurn)) <
+            4 * epsilon);
+        assert(std::fabs(between.getK() - std::sin(step * halfTurn)) <
+            4 * epsilon);
+        assert(between.getI() == 0 && between.getJ() == 0);
+        // -q - тот же поворот, путь выбирается кратчайший
+        assert(slerp(startTurn, endTurn * -1.0, step) == between);
+        Quaternion normalized = nlerp(startTurn, endTurn * -1.0, step);
+        assert(std::fabs(normalized.norm() - 1) < 4 * epsilon);
+        assert(normalized.getK() * between.getK() >= 0);
+    }
+    // малые углы: ряд против формулы через синусы в long double
+    Quaternion nearTurn(std::cos(1e-5), std::sin(1e-5) * 0.6,
+        std::sin(1e-5) * 0.8, 0);
+    for (double step : steps) {
+        Quaternion between = slerp(startTurn, nearTurn, step);
+        long double angle = 1e-5L * step;
+        assert(std::fabs(between.getReal() - (double)std::cos(angle)) <
+            2 * epsilon);
+        assert(std::fabs(between.getI() - (double)(std::sin(angle) * 0.6L)) <
+            2 * epsilon * 1e-5);
+        assert(std::fabs(between.getJ() - (double)(std::sin(angle) * 0.8L)) <
+            2 * epsilon * 1e-5);
+    }
+    // для поворотов с равным шагом вокруг одной оси контрольные точки
+    // squad совпадают с ключами, и squad превращается в slerp
+    Quaternion stepTurn(std::cos(0.3), 0, std::sin(0.3), 0);
+    Quaternion control = squadControlPoint(Quaternion(1, 0, 0, 0),
+        stepTurn, stepTurn * stepTurn);
+    Quaternion controlError = control - stepTurn;
+    assert(std::fabs(controlError.getReal()) < tolerance);
+    assert(std::fabs(controlError.getJ()) < tolerance);
+    Quaternion squadError = squad(startTurn, endTurn, startTurn, endTurn,
+        0.3) - slerp(startTurn, endTurn, 0.3);
+    assert(std::fabs(squadError.getReal()) < tolerance);
+    assert(std::fabs(squadError.getK()) < tolerance);
+
+    const size_t keyCount = 1000;
+    QuaternionArray keyframes(keyCount);
+    for (size_t i = 0; i < keyCount; ++i) {
+        Quaternion key(std::cos(0.01 * i), std::sin(0.37 * i),
+            std::cos(0.11 * i), std::sin(0.05 * i));
+        // у каждого третьего ключа знак перевёрнут
+        key *= (i % 3 ? 1.0 : -1.0) / std::sqrt(key.norm());
+        keyframes.set(i, key);
+    }
+    KeyframeTrack track(keyframes);
+    assert(track.size() == keyCount);
+    const size_t sampleCount = 2 * INTERPOLATION_CHUNK_SIZE + 17;
+    std::vector<double> times(sampleCount);
+    for (size_t i = 0; i < sampleCount; ++i) {
+        times[i] = (keyCount + 10.0) * i / sampleCount - 5;
+    }
+    InterpolationMode modes[] = {IM_NLERP, IM_SLERP, IM_SQUAD};
+    for (InterpolationMode mode : modes) {
+        QuaternionArray samples;
+        assert(track.sample(times.data(), sampleCount, mode, samples, 3));
+        assert(samples.size() == sampleCount);
+        for (size_t i = 0; i < sampleCount; i += 7) {
+            double clamped = std::min(std::max(times[i], 0.0),
+                keyCount - 1.0);
+            size_t segment = std::min(size_t(clamped), keyCount - 2);
+            double t = clamped - segment;
+            const QuaternionArray& keys = track.getKeys();
+            const QuaternionArray& controls = track.getControls();
+            Quaternion expected = mode == IM_NLERP ?
+                nlerp(keys.get(segment), keys.get(segment + 1), t) :
+                mode == IM_SLERP ?
+                slerp(keys.get(segment), keys.get(segment + 1), t) :
+                squad(keys.get(segment), keys.get(segment + 1),
+                    controls.get(segment), controls.get(segment + 1), t);
+            Quaternion sampleError = samples.get(i) - expected;
+            assert(std::fabs(sampleError.getReal()) < 8 * epsilon);
+            assert(std::fabs(sampleError.getI()) < 8 * epsilon);
+            assert(std::fabs(sampleError.getJ()) < 8 * epsilon);
+            assert(std::fabs(sampleError.getK()) < 8 * epsilon);
+        }
+        // моменты вне трека прижимаются к крайним ключам
+        Quaternion firstError = samples.get(0) - track.getKeys().get(0);
+        assert(std::fabs(firstError.getReal()) < 4 * epsilon);
+        assert(std::fabs(firstError.getK()) < 4 * epsilon);
+        Quaternion lastError = samples.get(sampleCount - 1) -
+            track.getKeys().get(keyCount - 1);
+        assert(std::fabs(lastError.getReal()) < 4 * epsilon);
+        assert(std::fabs(lastError.getK()) < 4 * epsilon);
+    }
+    QuaternionArray noSamples;
+    assert(!KeyframeTrack(QuaternionArray()).sample(times.data(),
+        sampleCount, IM_SLERP, noSamples));
+
+    // размеры пересекают границы GEMM_MR/NR, GEMM_MC, GEMM_KC и GEMM_NC
+    size_t gemmShapes[][3] = {{1, 1, 1}, {5, 3, 7}, {70, 300, 37},
+        {130, 20, 2100}};
+    for (auto& shape : gemmShapes) {
+        size_t m = shape[0], k = shape[1], n = shape[2];
+        std::vector<ComplexNumber> left(m * k), right(k * n), expected;
+        ComplexMatrix leftMatrix(m, k), rightMatrix(k, n);
+        for (size_t i = 0; i < m * k; ++i) {
+            left[i] = ComplexNumber(std::sin(0.3 * i), std::cos(0.7 * i));
+            leftMatrix.set(i / k, i % k, left[i]);
+        }
+        for (size_t i = 0; i < k * n; ++i) {
+            right[i] = ComplexNumber(std::cos(1.1 * i), std::sin(0.2 * i));
+            rightMatrix.set(i / n, i % n, right[i]);
+        }
+        naiveMatrixMultiply(left, right, expected, m, k, n);
+        ComplexMatrix product;
+        assert(multiply(leftMatrix, rightMatrix, product, 3) == MS_OK);
+        assert(product.getRows() == m && product.getColumns() == n);
+        for (size_t i = 0; i < m * n; ++i) {
+            ComplexNumber productError = product.get(i / n, i % n) -
+                expected[i];
+            assert(std::fabs(productError.getReal()) < tolerance * k);
+            assert(std::fabs(productError.getI()) < tolerance * k);
+        }
+    }
+    ComplexMatrix system(150, 150);
+    ComplexMatrix rightSide(150, 3);
+    for (size_t i = 0; i < 150; ++i) {
+        for (size_t j = 0; j < 150; ++j) {
+            // нулевая диагональ требует перестановок
+            system.set(i, j, i == j ? ComplexNumber() : ComplexNumber(
+                std::sin(0.1 * i * j + 1), std::cos(i + 2.0 * j)));
+        }
+        for (size_t j = 0; j < 3; ++j) {
+            rightSide.set(i, j, ComplexNumber(i * 0.01, j - 1.0));
+        }
+    }
+    ComplexMatrix solution;
+    assert(solve(system, rightSide, solution, 2) == MS_OK);
+    ComplexMatrix residual;
+    assert(multiply(system, solution, residual) == MS_OK);
+    for (size_t i = 0; i < 150; ++i) {
+        for (size_t j = 0; j < 3; ++j) {
+            ComplexNumber residualError = residual.get(i, j) -
+                rightSide.get(i, j);
+            assert(std::fabs(residualError.getReal()) < 1e-9);
+            assert(std::fabs(residualError.getI()) < 1e-9);
+        }
+    }
+    assert(multiply(system, system, system) == MS_OK);
+    assert(multiply(rightSide, rightSide, residual) == MS_SIZE_MISMATCH);
+    ComplexMatrix singular(3, 3);
+    singular.set(0, 0, ComplexNumber(1, 0));
+    singular.set(1, 1, ComplexNumber(0, 2));
+    std::vector<size_t> pivots;
+    assert(luDecompose(singular, pivots) == MS_SINGULAR);
+    assert(solve(rightSide, rightSide, solution) == MS_SIZE_MISMATCH);
+
+    // элементарные функции: тождества для скалярных, пакетные против них
+    ComplexNumber complexPoint(0.7, -1.3);
+    ComplexNumber complexError = exp(log(complexPoint)) - complexPoint;
+    assert(std::fabs(complexError.getReal()) < tolerance);
+    assert(std::fabs(complexError.getI()) < tolerance);
+    ComplexNumber complexRoot = sqrt(complexPoint);
+    complexError = complexRoot * complexRoot - complexPoint;
+    assert(std::fabs(complexError.getReal()) < tolerance);
+    assert(std::fabs(complexError.getI()) < tolerance);
+    ComplexNumber complexSine = sin(complexPoint);
+    ComplexNumber complexCosine = cos(complexPoint);
+    complexError = complexSine * complexSine + complexCosine * complexCosine -
+        ComplexNumber(1, 0);
+    assert(std::fabs(complexError.getReal()) < tolerance);
+    assert(std::fabs(complexError.getI()) < tolerance);
+    complexError = pow(complexPoint, ComplexNumber(2, 0)) -
+        complexPoint * complexPoint;
+    assert(std::fabs(complexError.getReal()) < tolerance);
+    assert(std::fabs(complexError.getI()) < tolerance);
+    assert(std::fabs(sqrt(ComplexNumber(-4, 0)).getI() - 2) < tolerance);
+    assert(std::fabs(log(ComplexNumber(-1, 0)).getI() - M_PI) < tolerance);
+    assert(pow(ComplexNumber(), 2.0).norm() == 0);
+    assert(pow(ComplexNumber(), 0.0).getReal() == 1);
+
+    Quaternion quaternionPoint(0.4, -0.8, 1.1, 0.3);
+    Quaternion quaternionError = exp(log(quaternionPoint)) - quaternionPoint;
+    assert(quaternionError.norm() < tolerance * tolerance);
+    Quaternion quaternionRoot = sqrt(quaternionPoint);
+    quaternionError = quaternionRoot * quaternionRoot - quaternionPoint;
+    assert(quaternionError.norm() < tolerance * tolerance);
+    quaternionError = pow(quaternionPoint, 3.0) -
+        quaternionPoint * quaternionPoint * quaternionPoint;
+    assert(quaternionError.norm() < tolerance * tolerance);
+    quaternionError = pow(quaternionPoint, -1.0) -
+        quaternionPoint.reciprocal();
+    assert(quaternionError.norm() < tolerance * tolerance);
+    // показатель приводится к типу компонент основания
+    BasicQuaternion<float> floatPoint(0.4f, -0.8f, 1.1f, 0.3f);
+    BasicQuaternion<float> floatSquare = pow(floatPoint, 2.0);
+    BasicQuaternion<float> floatError = floatSquare - floatPoint * floatPoint;
+    assert(floatError.norm() < 1e-8f);
+    complexError = pow(complexPoint, 2) - complexPoint * complexPoint;
+    assert(std::fabs(complexError.getReal()) < tolerance);
+    assert(std::fabs(complexError.getI()) < tolerance);
+    // на оси v кватернион - комплексное число w + i |v|
+    Quaternion pureI(0.4, 1.3, 0, 0);
+    ComplexNumber complexI(0.4, 1.3);
+    Quaternion axisError = sin(pureI) - Quaternion(sin(complexI));
+    assert(axisError.norm() < tolerance * tolerance);
+    axisError = cos(pureI) - Quaternion(cos(complexI));
+    assert(axisError.norm() < tolerance * tolerance);
+    Quaternion negativeLog = log(Quaternion(-2, 0, 0, 0));
+    assert(std::fabs(negativeLog.getReal() - std::log(2.0)) < tolerance);
+    assert(std::fabs(negativeLog.getI() - M_PI) < tolerance);
+    assert(std::fabs(sqrt(Quaternion(-9, 0, 0, 0)).getI() - 3) < tolerance);
+
+    // размер не кратен тайлу и чанку; попадают v = 0, w < 0 и нули
+    size_t transcendentalCount = TRANSCENDENTAL_CHUNK_SIZE + 1000;
+    QuaternionArray quaternionInputs(transcendentalCount);
+    ComplexArray complexInputs(transcendentalCount);
+    for (size_t i = 0; i < transcendentalCount; ++i) {
+        double vectorScale = i % 7 == 0 ? 0 : 1;
+        quaternionInputs.set(i, Quaternion(3 * std::sin(0.37 * i),
+            vectorScale * std::cos(0.11 * i), vectorScale * std::sin(1.7 * i),
+            vectorScale * 2 * std::cos(0.05 * i)));
+        complexInputs.set(i, ComplexNumber(3 * std::cos(0.29 * i),
+            vectorScale * 2 * std::sin(0.13 * i)));
+    }
+    quaternionInputs.set(1, Quaternion());
+    complexInputs.set(1, ComplexNumber());
+    for (int function = 0; function < 6; ++function) {
+        QuaternionArray quaternionOutputs;
+        ComplexArray complexOutputs = complexInputs;
+        switch (function) {
+            case 0:
+                exp(quaternionInputs, quaternionOutputs, 2);
+                exp(complexOutputs, complexOutputs, 2);
+                break;
+            case 1:
+                log(quaternionInputs, quaternionOutputs, 2);
+                log(complexOutputs, complexOutputs, 2);
+                break;
+            case 2:
+                sqrt(quaternionInputs, quaternionOutputs, 2);
+                sqrt(complexOutputs, complexOutputs, 2);
+                break;
+            case 3:
+                pow(quaternionInputs, 2.5, quaternionOutputs, 2);
+                pow(complexOutputs, 2.5, complexOutputs, 2);
+                break;
+            case 4:
+                sin(quaternionInputs, quaternionOutputs, 2);
+                sin(complexOutputs, complexOutputs, 2);
+                break;
+            case 5:
+                cos(quaternionInputs, quaternionOutputs, 2);
+                cos(complexOutputs, complexOutputs, 2);
+                break;
+        }
+        assert(quaternionOutputs.size() == transcendentalCount);
+        for (size_t i = 2; i < transcendentalCount; ++i) {
+            Quaternion q = quaternionInputs.get(i);
+            ComplexNumber z = complexInputs.get(i);
+            Quaternion expectedQ;
+            ComplexNumber expectedZ;
+            switch (function) {
+                case 0:
+                    expectedQ = exp(q);
+                    expectedZ = exp(z);
+                    break;
+                case 1:
+                    expectedQ = log(q);
+                    expectedZ = log(z);
+                    break;
+                case 2:
+                    expectedQ = sqrt(q);
+                    expectedZ = sqrt(z);
+                    break;
+                case 3:
+                    expectedQ = pow(q, 2.5);
+                    expectedZ = pow(z, 2.5);
+                    break;
+                case 4:
+                    expectedQ = sin(q);
+                    expectedZ = sin(z);
+                    break;
+                case 5:
+                    expectedQ = cos(q);
+                    expectedZ = cos(z);
+                    break;
+            }
+            // log у |q| = 1 точен лишь абсолютно, pow наследует его ошибку
+            double quaternionBound = 64 * epsilon *
+                std::max(std::sqrt(expectedQ.norm()), 1.0);
+            double complexBound = 64 * epsilon *
+                std::max(std::sqrt(expectedZ.norm()), 1.0);
+            assert(std::sqrt((quaternionOutputs.get(i) - expectedQ).norm()) <
+                quaternionBound);
+            assert(std::sqrt((complexOutputs.get(i) - expectedZ).norm()) <
+                complexBound);
+        }
+    }
+    QuaternionArray zeroPowers;
+    pow(quaternionInputs, 0.0, zeroPowers);
+    assert(zeroPowers.get(1).getReal() == 1);
+    assert(zeroPowers.get(5).getReal() == 1 && zeroPowers.get(5).getK() == 0);
+    QuaternionArray zeroLogs;
+    log(quaternionInputs, zeroLogs);
+    assert(zeroLogs.get(1).getReal() ==
+        -std::numeric_limits<double>::infinity());
+
+    CalculatorJob emptyJob;
+    emptyJob.operations.push_back(OP_ADD);
+    std::vector<Operand> jobStack;
+    CalculatorJobResult jobResult = runCalculatorJob(emptyJob, jobStack);
+    assert(jobResult.status == JS_EMPTY_STACK && jobResult.errorStep == 0);
+    CalculatorJob errorJob;
+    errorJob.stack.push_back(Operand(ComplexNumber(0, 0)));
+    errorJob.stack.push_back(Operand(Quaternion(1, 2, 3, 4)));
+    errorJob.operations.push_back(OP_DIVIDE);
+    errorJob.operations.push_back(OP_SUBTRACT);
+    errorJob.operations.push_back(OP_MULTIPLY);
+    jobResult = runCalculatorJob(errorJob, jobStack);
+    assert(jobResult.status == JS_DIVIDE_BY_ZERO);
+    assert(jobResult.errorStep == 0 && jobResult.errorCount == 2);
+    assert(jobResult.stack.size() == 1);
+    assert(jobResult.stack[0].toQuaternion() == Quaternion(1, 2, 3, 4));
+    // правило деления на 0 то же, что у самого Calculator: делитель
+    // (0, 0, j, k) отклоняется, (0, i, j, k) - нет
+    Quaternion jkDivisor(0, 0, 1, 1);
+    Quaternion ijkDivisor(0, 0.5, 1, 1);
+    Quaternion jobDividend(1, 2, 3, 4);
+    for (Quaternion* divisor : {&jkDivisor, &ijkDivisor}) {
+        Calculator reference;
+        reference.push(*divisor);
+        reference.push(jobDividend);
+        reference.calculate(OP_DIVIDE);
+        CalculatorJob divideJob;
+        divideJob.stack.push_back(Operand(*divisor));
+        divideJob.stack.push_back(Operand(jobDividend));
+        divideJob.operations.push_back(OP_DIVIDE);
+        jobResult = runCalculatorJob(divideJob, jobStack);
+        assert((jobResult.status == JS_DIVIDE_BY_ZERO) ==
+            (reference.size() == 2));
+        assert((reference.size() == 2) == (divisor == &jkDivisor));
+        assert(jobResult.stack.size() == size_t(reference.size()));
+        assert(jobResult.stack.back().toQuaternion() ==
+            *static_cast<Quaternion*>(reference.top()));
+    }
+    const size_t jobCount = 2000;
+    std::vector<CalculatorJob> jobs(jobCount);
+    for (size_t i = 0; i < jobCount; ++i) {
+        size_t depth = 1 + i % 9;
+        for (size_t j = 0; j < depth; ++j) {
+            double x = 1 + 0.01 * ((i * 7 + j * 13) % 101);
+            if ((i + j) % 3 == 0) {
+                jobs[i].stack.push_back(Operand(Quaternion(x, -x / 2, 0.5,
+                    x / 4)));
+            } else {
+                jobs[i].stack.push_back(Operand(ComplexNumber(x, 1 / x)));
+            }
+        }
+        for (size_t j = 0; j + 1 < depth; ++j) {
+            jobs[i].operations.push_back(
+                static_cast<Operations>((i + j) % 4));
+        }
+    }
+    for (size_t i = 0; i < jobCount; i += 97) {
+        ValueCalculator sequential;
+        for (const Operand& operand : jobs[i].stack) {
+            sequential.push(operand);
+        }
+        for (Operations operation : jobs[i].operations) {
+            sequential.calculate(operation);
+        }
+        jobResult = runCalculatorJob(jobs[i], jobStack);
+        assert(jobResult.status == JS_OK && jobResult.stack.size() == 1);
+        Quaternion expected = sequential.top().toQuaternion();
+        Quaternion actual = jobResult.stack[0].toQuaternion();
+        assert(std::sqrt((actual - expected).norm()) <
+            tolerance * std::max(std::sqrt(expected.norm()), 1.0));
+    }
+    std::vector<std::future<CalculatorJobResult>> futures;
+    std::vector<CalculatorJobResult> callbackResults(jobCount);
+    std::atomic<size_t> nestedJobs(0);
+    {
+        CalculatorScheduler scheduler(4);
+        assert(scheduler.getThreadCount() == 4);
+        for (size_t i = 0; i < jobCount; ++i) {
+            futures.push_back(scheduler.submit(jobs[i]));
+            scheduler.submit(jobs[i], [&, i](CalculatorJobResult& result) {
+                callbackResults[i] = std::move(result);
+                if (i % 100 == 0) {
+                    scheduler.submit(CalculatorJob(),
+                        [&](CalculatorJobResult&) { ++nestedJobs; });
+                }
+            });
+        }
+        scheduler.wait();
+        assert(nestedJobs == jobCount / 100);
+        for (size_t i = 0; i < jobCount; ++i) {
+            jobResult = runCalculatorJob(jobs[i], jobStack);
+            CalculatorJobResult scheduled = futures[i].get();
+            assert(scheduled.status == JS_OK && scheduled.stack.size() == 1);
+            assert(scheduled.stack[0].toQuaternion() ==
+                jobResult.stack[0].toQuaternion());
+            assert(callbackResults[i].stack[0].toQuaternion() ==
+                jobResult.stack[0].toQuaternion());
+        }
+        // деструктор дожидается заданий, поставленных без wait()
+        for (size_t i = 0; i < jobCount; ++i) {
+            scheduler.submit(errorJob,
+                [&](CalculatorJobResult& result) {
+                    if (result.status == JS_DIVIDE_BY_ZERO) {
+                        ++nestedJobs;
+                    }
+                });
+        }
+    }
+    assert(nestedJobs == jobCount / 100 + jobCount);
+
+    ComplexArray polynomial(8);
+    for (size_t k = 0; k < polynomial.size(); ++k) {
+        polynomial.set(k, ComplexNumber(std::cos(1.3 * k), 0.5 - 0.1 * k));
+    }
+    ComplexArray polynomialPoints(POLYNOMIAL_CHUNK_SIZE + 300);
+    for (size_t i = 0; i < polynomialPoints.size(); ++i) {
+        polynomialPoints.set(i, ComplexNumber(std::sin(0.01 * i),
+            std::cos(0.003 * i) * 1.2));
+    }
+    ComplexArray polynomialValues;
+    evaluatePolynomial(polynomial, polynomialPoints, polynomialValues, 3);
+    for (size_t i = 0; i < polynomialPoints.size(); i += 37) {
+        ComplexNumber point = polynomialPoints.get(i);
+        ComplexNumber expected = polynomial.get(7);
+        for (size_t k = 7; k-- > 0;) {
+            expected = expected * point + polynomial.get(k);
+        }
+        ComplexNumber scalar = evaluatePolynomial(polynomial, point);
+        assert(std::sqrt((scalar - expected).norm()) <
+            tolerance * (std::sqrt(expected.norm()) + 1));
+        assert(std::sqrt((polynomialValues.get(i) - scalar).norm()) <
+            tolerance * (std::sqrt(scalar.norm()) + 1));
+    }
+    ComplexNumber lastValue =
+        polynomialValues.get(polynomialValues.size() - 1);
+    evaluatePolynomial(polynomial, polynomialPoints, polynomialPoints);
+    assert(polynomialPoints.get(polynomialPoints.size() - 1) == lastValue);
+    evaluatePolynomial(ComplexArray(), polynomialPoints, polynomialValues);
+    assert(polynomialValues.get(5) == ComplexNumber(0, 0));
+
+    // z^5 - 1: корни из единицы
+    ComplexArray unity(6);
+    unity.set(0, ComplexNumber(-1, 0));
+    unity.set(5, ComplexNumber(1, 0));
+    ComplexArray foundRoots;
+    RootReport rootReport = findRoots(unity, foundRoots);
+    assert(rootReport.status == RT_OK && rootReport.convergedRoots == 5);
+    assert(foundRoots.size() == 5 && rootReport.maxResidual < tolerance);
+    for (int k = 0; k < 5; ++k) {
+        ComplexNumber expected(std::cos(2 * M_PI * k / 5),
+            std::sin(2 * M_PI * k / 5));
+        bool found = false;
+        for (size_t i = 0; i < foundRoots.size(); ++i) {
+            found = found ||
+                std::sqrt((foundRoots.get(i) - expected).norm()) < tolerance;
+        }
+        assert(found);
+    }
+    // многочлен по известным корням, с нулевым корнем и старшими нулями
+    ComplexNumber knownRoots[] = {ComplexNumber(0.5, 0.25),
+        ComplexNumber(-1, 2), ComplexNumber(3, -1), ComplexNumber(0, -0.5),
+        ComplexNumber(-2, -2), ComplexNumber(0, 0)};
+    ComplexArray fromRoots(1);
+    fromRoots.set(0, ComplexNumber(2, 1));
+    for (const ComplexNumber& root : knownRoots) {
+        ComplexArray next(fromRoots.size() + 1);
+        for (size_t k = 0; k < next.size(); ++k) {
+            ComplexNumber value(0, 0);
+            if (k > 0) {
+                value = value + fromRoots.get(k - 1);
+            }
+            if (k < fromRoots.size()) {
+                value = value - root * fromRoots.get(k);
+            }
+            next.set(k, value);
+        }
+        fromRoots = next;
+    }
+    fromRoots.pushBack(ComplexNumber(0, 0));
+    rootReport = findRoots(fromRoots, foundRoots);
+    assert(rootReport.status == RT_OK && foundRoots.size() == 6);
+    assert(foundRoots.get(0) == ComplexNumber(0, 0));
+    for (const ComplexNumber& root : knownRoots) {
+        bool found = false;
+        for (size_t i = 0; i < foundRoots.size(); ++i) {
+            found = found ||
+                std::sqrt((foundRoots.get(i) - root).norm()) < 1e-10;
+        }
+        assert(found);
+    }
+    // двойной корень сходится до eps^(1/2)
+    ComplexArray doubleRoot(3);
+    doubleRoot.set(0, ComplexNumber(1, 0));
+    doubleRoot.set(1, ComplexNumber(-2, 0));
+    doubleRoot.set(2, ComplexNumber(1, 0));
+    rootReport = findRoots(doubleRoot, foundRoots);
+    assert(rootReport.status == RT_OK);
+    assert(std::sqrt((foundRoots.get(0) - ComplexNumber(1, 0)).norm()) <
+        1e-6);
+    assert(findRoots(ComplexArray(4), foundRoots).status == RT_BAD_POLYNOMIAL);
+    ComplexArray invalidPolynomial(2);
+    invalidPolynomial.set(1, ComplexNumber(std::nan(""), 0));
+    assert(findRoots(invalidPolynomial, foundRoots).status ==
+        RT_BAD_POLYNOMIAL);
+    ComplexArray constant(1);
+    constant.set(0, ComplexNumber(3, 0));
+    rootReport = findRoots(constant, foundRoots);
+    assert(rootReport.status == RT_OK && foundRoots.size() == 0);
+    std::vector<ComplexArray> randomPolynomials;
+    for (size_t degree : {3, 40, 300}) {
+        ComplexArray coefficients(degree + 1);
+        for (size_t k = 0; k <= degree; ++k) {
+            coefficients.set(k, ComplexNumber(std::sin(7.1 * k + degree),
+                std::cos(3.3 * k * k)));
+        }
+        randomPolynomials.push_back(coefficients);
+    }
+    ComplexArray serialRoots;
+    ComplexArray parallelRoots;
+    rootReport = findRoots(randomPolynomials[2], serialRoots, 1);
+    assert(rootReport.status == RT_OK && rootReport.convergedRoots == 300);
+    assert(rootReport.maxResidual < 1e-13);
+    assert(findRoots(randomPolynomials[2], parallelRoots, 4).iterations ==
+        rootReport.iterations);
+    for (size_t i = 0; i < serialRoots.size(); ++i) {
+        assert(serialRoots.get(i) == parallelRoots.get(i));
+    }
+    rootReport = findRoots(randomPolynomials[2], parallelRoots, 1, 2);
+    assert(rootReport.status == RT_NOT_CONVERGED);
+    assert(rootReport.iterations == 2 && rootReport.convergedRoots < 300);
+    std::vector<ComplexArray> batchRoots;
+    std::vector<RootReport> batchReports;
+    findRoots(randomPolynomials, batchRoots, batchReports, 3);
+    assert(batchRoots.size() == 3 && batchReports.size() == 3);
+    for (size_t p = 0; p < randomPolynomials.size(); ++p) {
+        findRoots(randomPolynomials[p], serialRoots, 1);
+        assert(batchReports[p].status == RT_OK);
+        for (size_t i = 0; i < serialRoots.size(); ++i) {
+            assert(batchRoots[p].get(i) == serialRoots.get(i));
+        }
+    }
+
+    // ядро может собрать FMA, поэтому у самой границы множества счёт
+    // вправе разойтись с эталоном - но лишь в редких точках
+    EscapeGrid escapeGrid(131, 37, -2.1L, -1.2L, 0.065);
+    escapeGrid.maxIterations = 500;
+    std::vector<uint32_t> escapeCounts;
+    std::vector<uint32_t> otherCounts;
+    for (EscapeMode mode : {EM_MANDELBROT, EM_JULIA}) {
+        escapeGrid.mode = mode;
+        escapeGrid.juliaReal = -0.8;
+        escapeGrid.juliaI = 0.156;
+        renderEscapeTime(escapeGrid, escapeCounts, 1);
+        assert(escapeCounts.size() == 131 * 37);
+        size_t mismatches = 0;
+        for (size_t row = 0; row < 37; ++row) {
+            for (size_t column = 0; column < 131; ++column) {
+                ComplexNumber point(-2.1 + column * 0.065, -1.2 + row * 0.065);
+                ComplexNumber julia(-0.8, 0.156);
+                unsigned expected = mode == EM_JULIA ?
+                    escapeTime(point, julia, 500, 2) :
+                    escapeTime(ComplexNumber(0, 0), point, 500, 2);
+                unsigned actual = escapeCounts[row * 131 + column];
+                mismatches += actual != expected;
+            }
+        }
+        assert(mismatches * 100 < escapeCounts.size());
+        renderEscapeTime(escapeGrid, otherCounts, 4);
+        assert(otherCounts == escapeCounts);
+    }
+    escapeGrid.mode = EM_MANDELBROT;
+    assert(escapeTime(ComplexNumber(0, 0), ComplexNumber(0, 0), 77, 2) == 77);
+    assert(escapeTime(ComplexNumber(0, 0), ComplexNumber(2, 2), 77, 2) == 1);
+    assert(escapeTime(ComplexNumber(3, 0), ComplexNumber(0, 0), 77, 2) == 0);
+    EscapeGrid tinyGrid(1, 1, 0.0L, 0.0L, 1);
+    renderEscapeTime(tinyGrid, escapeCounts);
+    assert(escapeCounts.size() == 1 && escapeCounts[0] == 256);
+    tinyGrid.width = 0;
+    renderEscapeTime(tinyGrid, escapeCounts);
+    assert(escapeCounts.empty());
+    // при шаге 1e-15 соседние c в double отличаются на считанные ulp:
+    // перспективный рендер должен быть заметно ближе к long double
+    // эталону, чем прямой
+    const long double seahorseReal = -0.743643887037158704752191506114774L;
+    const long double seahorseI = 0.131825904205311970493132056385139L;
+    EscapeGrid deepGrid(64, 64, seahorseReal - 32e-15L, seahorseI - 32e-15L,
+        1e-15);
+    deepGrid.maxIterations = 5000;
+    std::vector<uint32_t> perturbedCounts;
+    renderEscapeTime(deepGrid, escapeCounts, 1);
+    assert(renderEscapeTimePerturbed(deepGrid, perturbedCounts, 1));
+    assert(renderEscapeTimePerturbed(deepGrid, otherCounts, 3));
+    assert(otherCounts == perturbedCounts);
+    size_t directMismatches = 0;
+    size_t perturbedMismatches = 0;
+    for (size_t row = 0; row < 64; ++row) {
+        for (size_t column = 0; column < 64; ++column) {
+            long double pointReal = deepGrid.realOrigin +
+                column * (long double)deepGrid.realStep;
+            long double pointI = deepGrid.iOrigin +
+                row * (long double)deepGrid.iStep;
+            long double real = 0;
+            long double iCoef = 0;
+            unsigned expected = 0;
+            while (expected < 5000 && real * real + iCoef * iCoef <= 4) {
+                long double nextReal = real * real - iCoef * iCoef + pointReal;
+                iCoef = 2 * real * iCoef + pointI;
+                real = nextReal;
+                ++expected;
+            }
+            directMismatches += escapeCounts[row * 64 + column] != expected;
+            perturbedMismatches +=
+                perturbedCounts[row * 64 + column] != expected;
+        }
+    }
+    assert(perturbedMismatches * 4 < directMismatches);
+    escapeGrid.mode = EM_JULIA;
+    assert(!renderEscapeTimePerturbed(escapeGrid, perturbedCounts));
+
+    RpnProgram algebraProgram;
+    int algebraX = algebraProgram.addInput(CK_COMPLEX_NUMBER);
+    int algebraQ = algebraProgram.addInput(CK_QUATERNION);
+    algebraProgram.pushLiteral(ComplexNumber(3, 0));
+    algebraProgram.pushLiteral(ComplexNumber(2, 0));
+    algebraProgram.apply(OP_MULTIPLY);
+    algebraProgram.pushInput(algebraX);
+    algebraProgram.apply(OP_DIVIDE);
+    algebraProgram.pushLiteral(ComplexNumber(0, 0));
+    algebraProgram.apply(OP_ADD);
+    algebraProgram.pushLiteral(ComplexNumber(1, 0));
+    algebraProgram.apply(OP_MULTIPLY);
+    // кватернионный 0 повышает вид результата и остаётся
+    algebraProgram.pushLiteral(Quaternion(0, 0, 0, 0));
+    algebraProgram.apply(OP_ADD);
+    algebraProgram.pushLiteral(Quaternion(1, -2, 0.5, 3));
+    algebraProgram.pushInput(algebraQ);
+    algebraProgram.apply(OP_DIVIDE);
+    algebraProgram.apply(OP_SUBTRACT);
+    RpnProgram optimizedProgram;
+    RpnOptimizationReport optimization =
+        optimizeRpnProgram(algebraProgram, optimizedProgram);
+    assert(optimization.foldedOperations == 1);
+    assert(optimization.removedIdentities == 2);
+    assert(optimization.reciprocalDivisions == 2);
+    assert(optimization.instructionsBefore == 15);
+    assert(optimization.instructionsAfter == 9);
+    assert(optimizedProgram.getInstructions().size() == 9);
+    assert(optimizedProgram.getInputKinds() == algebraProgram.getInputKinds());
+    BytecodeProgram plainBytecode;
+    BytecodeProgram optimizedBytecode;
+    assert(plainBytecode.compile(algebraProgram));
+    assert(optimizedBytecode.compile(optimizedProgram));
+    assert(optimizedBytecode.getResultKind() == CK_QUATERNION);
+    for (int i = 0; i < 20; ++i) {
+        Operand algebraInputs[] = {
+            Operand(ComplexNumber(std::sin(1.3 * i), 0.7 * i - 3)),
+            Operand(Quaternion(0.25 * i, -1, std::cos(i), 1e-3 * i))
+        };
+        Operand plainResult;
+        Operand optimizedResult;
+        assert(plainBytecode.run(algebraInputs, plainResult) == RS_OK);
+        assert(optimizedBytecode.run(algebraInputs, optimizedResult) ==
+            RS_OK);
+        assert(optimizedResult.getKind() == plainResult.getKind());
+        assert(optimizedResult.toQuaternion() == plainResult.toQuaternion());
+    }
+    optimization = optimizeRpnProgram(optimizedProgram, optimizedProgram);
+    assert(optimization.instructionsAfter == 9);
+    assert(optimization.foldedOperations == 0 &&
+        optimization.removedIdentities == 0);
+    // деление на нулевую константу не сворачивается
+    RpnProgram zeroDivisorProgram;
+    zeroDivisorProgram.pushLiteral(ComplexNumber(0, 0));
+    zeroDivisorProgram.pushLiteral(ComplexNumber(5, 0));
+    zeroDivisorProgram.apply(OP_DIVIDE);
+    optimization = optimizeRpnProgram(zeroDivisorProgram, optimizedProgram);
+    assert(optimization.instructionsAfter == 3);
+    assert(optimizedBytecode.compile(optimizedProgram));
+    assert(optimizedBytecode.run(rpnResult) == RS_DIVIDE_BY_ZERO);
+    // (0, 0, j, k) - тоже нуль для Calculator: ни свёртки, ни обратного
+    RpnProgram jkDivisorProgram;
+    jkDivisorProgram.pushLiteral(Quaternion(0, 0, 1, 1));
+    jkDivisorProgram.pushInput(jkDivisorProgram.addInput(CK_QUATERNION));
+    jkDivisorProgram.apply(OP_DIVIDE);
+    jkDivisorProgram.pushLiteral(Quaternion(0, 0, 1, 1));
+    jkDivisorProgram.pushLiteral(Quaternion(1, 2, 3, 4));
+    jkDivisorProgram.apply(OP_DIVIDE);
+    optimization = optimizeRpnProgram(jkDivisorProgram, optimizedProgram);
+    assert(optimization.foldedOperations == 0 &&
+        optimization.reciprocalDivisions == 0);
+    assert(optimizedBytecode.compile(optimizedProgram));
+    Operand jkDivisorInputs[] = {Operand(q1)};
+    assert(optimizedBytecode.run(jkDivisorInputs, rpnResult) ==
+        RS_DIVIDE_BY_ZERO);
+    optimization = optimizeRpnProgram(badProgram, optimizedProgram);
+    assert(optimization.instructionsAfter == 2);
+    assert(!optimizedBytecode.compile(optimizedProgram));
+
+    CalculationCache cache(2);
+    Operand cacheLeft(ComplexNumber(1, 2));
+    Operand cacheRight(Quaternion(3, -4, 0.5, 2));
+    Operand cached;
+    Operand computed;
+    assert(cache.calculate(OP_DIVIDE, cacheLeft, cacheRight, cached) ==
+        JS_OK);
+    assert(applyOperation(OP_DIVIDE, cacheLeft, cacheRight, computed) ==
+        JS_OK);
+    assert(cached.getKind() == CK_QUATERNION);
+    assert(cached.toQuaternion() == computed.toQuaternion());
+    cached = Operand();
+    assert(cache.calculate(OP_DIVIDE, cacheLeft, cacheRight, cached) ==
+        JS_OK);
+    assert(cached.toQuaternion() == computed.toQuaternion());
+    CacheCounters cacheCounters = cache.getCounters();
+    assert(cacheCounters.hits == 1 && cacheCounters.misses == 1);
+    assert(cacheCounters.size == 1 && cacheCounters.evictions == 0);
+    // деление на 0 кэшируется и не трогает result
+    Operand zeroOperand(ComplexNumber(0, 0));
+    for (int i = 0; i < 2; ++i) {
+        assert(cache.calculate(OP_DIVIDE, cacheLeft, zeroOperand, cached) ==
+            JS_DIVIDE_BY_ZERO);
+        assert(cached.toQuaternion() == computed.toQuaternion());
+    }
+    cacheCounters = cache.getCounters();
+    assert(cacheCounters.hits == 2 && cacheCounters.misses == 2);
+    // -0 - другой ключ. Обе записи были в обращении, стрелка снимает биты
+    // и вытесняет первую; дальше вытесняется запись без обращений.
+    Operand negativeZero(ComplexNumber(-0.0, 0));
+    assert(cache.calculate(OP_DIVIDE, cacheLeft, negativeZero, cached) ==
+        JS_DIVIDE_BY_ZERO);
+    cacheCounters = cache.getCounters();
+    assert(cacheCounters.misses == 3 && cacheCounters.evictions == 1);
+    assert(cacheCounters.size == 2);
+    cache.calculate(OP_DIVIDE, cacheLeft, negativeZero, cached);
+    assert(cache.getCounters().hits == 3);
+    cache.calculate(OP_DIVIDE, cacheLeft, cacheRight, cached);
+    assert(cache.getCounters().misses == 4);
+    cache.calculate(OP_DIVIDE, cacheLeft, negativeZero, cached);
+    cacheCounters = cache.getCounters();
+    assert(cacheCounters.hits == 4 && cacheCounters.evictions == 2);
+    cache.clear();
+    cacheCounters = cache.getCounters();
+    assert(cacheCounters.hits == 0 && cacheCounters.size == 0);
+    CalculationCache sharedCache(64, 3);
+    assert(sharedCache.getShardCount() == 4);
+    std::vector<Operand> cacheOperands;
+    for (int i = 0; i < 24; ++i) {
+        cacheOperands.push_back(i % 3 ? Operand(ComplexNumber(i, 1 - i)) :
+            Operand(Quaternion(0.5 * i, i, -1, i % 2)));
+    }
+    cacheOperands[5] = Operand(ComplexNumber(0, 0));
+    std::atomic<size_t> cacheMismatches(0);
+    std::vector<std::thread> cacheThreads;
+    for (int thread = 0; thread < 4; ++thread) {
+        cacheThreads.emplace_back([&, thread]() {
+            for (int round = 0; round < 2000; ++round) {
+                const Operand& l = cacheOperands[(round + thread) % 12];
+                const Operand& r = cacheOperands[round / 12 % 2 + 4];
+                Operations operation = Operations(round / 24 % 2 * 3);
+                Operand fromCache;
+                Operand direct;
+                JobStatus status = sharedCache.calculate(operation, l, r,
+                    fromCache);
+                bool same = status == applyOperation(operation, l, r,
+                    direct) && (status != JS_OK ||
+                    (fromCache.getKind() == direct.getKind() &&
+                    fromCache.toQuaternion() == direct.toQuaternion()));
+                cacheMismatches += !same;
+            }
+        });
+    }
+    for (std::thread& thread : cacheThreads) {
+        thread.join();
+    }
+    assert(cacheMismatches == 0);
+    cacheCounters = sharedCache.getCounters();
+    assert(cacheCounters.hits + cacheCounters.misses == 8000);
+    assert(cacheCounters.size <= 64 && cacheCounters.hits > 0);
+    assert(cacheCounters.evictions == cacheCounters.misses -
+        cacheCounters.size);
+    // Calculator с кэшем считает так же, как без него
+    Calculator plainCalculator;
+    Calculator cachedCalculator;
+    cachedCalculator.setCache(&sharedCache);
+    for (int round = 0; round < 2; ++round) {
+        for (Calculator* target : {&plainCalculator, &cachedCalculator}) {
+            target->push(q2);
+            target->push(c1);
+            target->calculate(OP_DIVIDE);
+            target->push(c2);
+            target->calculate(OP_MULTIPLY);
+            target->push(q1);
+            target->calculate(OP_SUBTRACT);
+        }
+        assert(cachedCalculator.top()->getKind() == CK_QUATERNION);
+        assert(*(Quaternion*)cachedCalculator.top() ==
+            *(Quaternion*)plainCalculator.top());
+    }
+    ComplexNumber zeroComplex(0, 0);
+    cachedCalculator.push(zeroComplex);
+    cachedCalculator.push(c1);
+    int depthBefore = cachedCalculator.size();
+    cachedCalculator.calculate(OP_DIVIDE);
+    assert(cachedCalculator.size() == depthBefore);
+    assert(cachedCalculator.top() == &c1);
+
+    // копия Calculator не зависит от жизни оригинала
+    Calculator* original = new Calculator;
+    original->push(c1);
+    original->push(c2);
+    original->calculate(OP_MULTIPLY);
+    original->push(q1);
+    Calculator branch(*original);
+    assert(branch.size() == 2 && branch.top() == &q1);
+    original->calculate(OP_ADD);
+    assert(original->size() == 1 && branch.size() == 2);
+    assert(branch.top() == &q1);
+    Calculator assigned;
+    assigned.push(c2);
+    assigned = *original;
+    assert(assigned.size() == 1 && assigned.top() == original->top());
+    delete original;
+    assert(*(Quaternion*)assigned.top() == q1 + Quaternion(c2 * c1));
+    branch.calculate(OP_SUBTRACT);
+    assert(branch.size() == 1);
+    assert(*(Quaternion*)branch.top() == q1 - Quaternion(c2 * c1));
+    assigned = assigned;
+    assert(assigned.size() == 1);
+    {
+        // длинные стеки отпускаются без рекурсии
+        Calculator deep;
+        for (int i = 0; i < 1000000; ++i) {
+            deep.push(c1);
+        }
+        Calculator deepBranch(deep);
+        for (int i = 0; i < 1000; ++i) {
+            deepBranch.calculate(OP_ADD);
+        }
+        assert(deep.size() == 1000000 && deepBranch.size() == 999000);
+        assert(deep.top() == &c1 && *deepBranch.top() == c1 * 1001);
+    }
+
+    // та же программа, что rpnProgram, заданная типом
+    static_assert(StaticFormula::resultKind == CK_QUATERNION, "");
+    static_assert(std::is_same<StaticFormula::Result, Quaternion>::value, "");
+    static_assert(StaticFormula::inputCount == 2, "");
+    static_assert(StaticFormula::shape.maxDepth == 4, "");
+    static_assert(!staticRpnShape<RpnInput<0>, RpnApply<OP_ADD>>().valid, "");
+    static_assert(!staticRpnShape<RpnInput<0>, RpnInput<0, CK_QUATERNION>,
+        RpnApply<OP_ADD>>().valid, "");
+    constexpr Components staticInputs[] = {{2, 3, 0, 0}, {1, 2, 3, 4}};
+    constexpr StaticRpnValue staticValue =
+        StaticFormula::compute(staticInputs);
+    static_assert(staticValue.status == RS_OK, "");
+    Quaternion staticResult;
+    assert(StaticFormula::evaluate(staticResult, c1, q1) == RS_OK);
+    // при компиляции FMA не бывает, а при выполнении компилятор может
+    // слить умножение со сложением
+    Quaternion staticDifference = staticResult - Quaternion(
+        staticValue.value.real, staticValue.value.iCoef,
+        staticValue.value.jCoef, staticValue.value.kCoef);
+    assert(std::sqrt(staticDifference.norm()) <
+        tolerance * std::sqrt(staticResult.norm()));
+    {
+        ComplexNumber staticC1(2, 3);
+        ComplexNumber staticC2(4, 5);
+        Quaternion staticQ2(1, 2, 3, 4);
+        Calculator staticCheck;
+        staticCheck.push(staticC2);
+        staticCheck.push(c1);
+        staticCheck.calculate(OP_ADD);
+        staticCheck.push(c1);
+        staticCheck.calculate(OP_DIVIDE);
+        staticCheck.push(q1);
+        staticCheck.push(staticC1);
+        staticCheck.push(staticQ2);
+        staticCheck.calculate(OP_SUBTRACT);
+        staticCheck.calculate(OP_MULTIPLY);
+        staticCheck.calculate(OP_DIVIDE);
+        assert(staticCheck.size() == 1);
+        assert(*(Quaternion*)staticCheck.top() == staticResult);
+    }
+    // деление на кватернионный вход: каждый пятый делитель - (0, 0, j, k)
+    typedef StaticRpnProgram<RpnInput<1, CK_QUATERNION>, RpnInput<0>,
+        RpnApply<OP_DIVIDE>> StaticQuaternionDivision;
+    RpnProgram quaternionDivision;
+    quaternionDivision.addInput(CK_COMPLEX_NUMBER);
+    quaternionDivision.addInput(CK_QUATERNION);
+    quaternionDivision.pushInput(1);
+    quaternionDivision.pushInput(0);
+    quaternionDivision.apply(OP_DIVIDE);
+    BytecodeProgram quaternionDivisionBytecode;
+    assert(quaternionDivisionBytecode.compile(quaternionDivision));
+    for (int i = 0; i < 50; ++i) {
+        ComplexNumber complexInput(std::sin(0.9 * i), i - 20.5);
+        bool jkOnly = i % 5 == 0;
+        Quaternion quaternionInput(jkOnly ? 0 : 0.5 * i,
+            jkOnly ? 0 : std::cos(i), -1.0 / (i + 1), i * 1e-3);
+        Operand bytecodeInputs[] = {Operand(complexInput),
+            Operand(quaternionInput)};
+        Operand bytecodeResult;
+        RpnStatus bytecodeStatus = bytecodeProgram.run(bytecodeInputs,
+            bytecodeResult);
+        assert(StaticFormula::evaluate(staticResult, complexInput,
+            quaternionInput) == bytecodeStatus);
+        assert(bytecodeStatus != RS_OK ||
+            staticResult == bytecodeResult.toQuaternion());
+        bytecodeStatus = quaternionDivisionBytecode.run(bytecodeInputs,
+            bytecodeResult);
+        assert((bytecodeStatus == RS_DIVIDE_BY_ZERO) == jkOnly);
+        assert(StaticQuaternionDivision::evaluate(staticResult,
+            complexInput, quaternionInput) == bytecodeStatus);
+        assert(bytecodeStatus != RS_OK ||
+            staticResult == bytecodeResult.toQuaternion());
+    }
+    typedef StaticRpnProgram<RpnLiteral<StaticZero>, RpnInput<0>,
+        RpnApply<OP_DIVIDE>> StaticZeroDivision;
+    ComplexNumber staticComplex(7, 7);
+    assert(StaticZeroDivision::evaluate(staticComplex, c1) ==
+        RS_DIVIDE_BY_ZERO);
+    assert(staticComplex == ComplexNumber(7, 7));
+    static_assert(StaticZeroDivision::compute(staticInputs).status ==
+        RS_DIVIDE_BY_ZERO, "");
+    {
+        // делитель (0, 0, j, k) Calculator тоже считает нулём
+        typedef StaticRpnProgram<RpnInput<0, CK_QUATERNION>,
+            RpnInput<1, CK_QUATERNION>, RpnApply<OP_DIVIDE>> StaticDivision;
+        constexpr Components jkInputs[] = {{0, 0, 1, 1}, {1, 2, 3, 4}};
+        static_assert(StaticDivision::compute(jkInputs).status ==
+            RS_DIVIDE_BY_ZERO, "");
+        Quaternion dividend(1, 2, 3, 4);
+        Quaternion divisors[] = {Quaternion(0, 0, 1, 1),
+            Quaternion(0, 0.5, 1, 1), Quaternion(0, 0, 0, 0)};
+        for (Quaternion& divisor : divisors) {
+            Calculator reference;
+            reference.push(divisor);
+            reference.push(dividend);
+            reference.calculate(OP_DIVIDE);
+            Quaternion quotient(7, 7, 7, 7);
+            RpnStatus divisionStatus = StaticDivision::evaluate(quotient,
+                divisor, dividend);
+            assert((divisionStatus == RS_DIVIDE_BY_ZERO) ==
+                (reference.size() == 2));
+            assert(divisionStatus != RS_OK ||
+                quotient == *static_cast<Quaternion*>(reference.top()));
+        }
+    }
+
+    size_t fftSizes[] = {1, 2, 8, 12, 30, 64, 77, 97, 1000, 1024};
+    for (size_t fftSize : fftSizes) {
+        ComplexArray signal(fftSize);
+        for (size_t i = 0; i < fftSize; ++i) {
+            signal.set(i, ComplexNumber(std::sin(0.7 * i) + 0.25,
+                std::cos(1.3 * i)));
+        }
+        ComplexArray spectrum;
+        naiveDft(signal, spectrum);
+        ComplexArray transformed = signal;
+        fft(transformed, FFT_FORWARD, 3);
+        for (size_t i = 0; i < fftSize; ++i) {
+            ComplexNumber fftError = transformed.get(i) - spectrum.get(i);
+            assert(std::fabs(fftError.getReal()) < 1e-9);
+            assert(std::fabs(fftError.getI()) < 1e-9);
+        }
+        fft(transformed, FFT_INVERSE);
+        for (size_t i = 0; i < fftSize; ++i) {
+            ComplexNumber roundTrip = transformed.get(i) - signal.get(i);
+            assert(std::fabs(roundTrip.getReal()) < tolerance);
+            assert(std::fabs(roundTrip.getI()) < tolerance);
+        }
+    }
+    assert(getFftPlan(1024) == getFftPlan(1024));
+    ComplexArray impulse(1 << 17);
+    impulse.set(1, ComplexNumber(1, 0));
+    fft(impulse, FFT_FORWARD, 4);
+    ComplexNumber harmonic = impulse.get(1 << 15);
+    assert(std::fabs(harmonic.getReal()) < tolerance);
+    assert(std::fabs(harmonic.getI() + 1) < tolerance);
+    // от FFT_PARALLEL_THRESHOLD стадии делятся между потоками; каждое
+    // значение считается теми же операциями, поэтому совпадение точное
+    size_t parallelFftSizes[] = {FFT_PARALLEL_THRESHOLD, 3 * 5 * 7 * 1024};
+    for (size_t fftSize : parallelFftSizes) {
+        ComplexArray signal(fftSize);
+        for (size_t i = 0; i < fftSize; ++i) {
+            signal.set(i, ComplexNumber(std::sin(0.7 * i) + 0.25,
+                std::cos(1.3 * i)));
+        }
+        ComplexArray serial = signal;
+        ComplexArray parallel = signal;
+        fft(serial, FFT_FORWARD, 1);
+        fft(parallel, FFT_FORWARD, 3);
+        for (size_t i = 0; i < fftSize; ++i) {
+            assert(serial.get(i) == parallel.get(i));
+        }
+        fft(serial, FFT_INVERSE, 1);
+        fft(parallel, FFT_INVERSE, 3);
+        for (size_t i = 0; i < fftSize; ++i) {
+            assert(serial.get(i) == parallel.get(i));
+            ComplexNumber roundTrip = parallel.get(i) - signal.get(i);
+            assert(std::fabs(roundTrip.getReal()) < 1e-9);
+            assert(std::fabs(roundTrip.getI()) < 1e-9);
+        }
+    }
+
+    const char rpnText[] =
+        "(1,2) (3,4) +\n"
+        "\n"
+        "# comment\n"
+        "  1 5 -\r\n"
+        "(1,0,0,0) (0,1,0,0) *\n"
+        "0 2 /\n"
+        "1 abc +\n"
+        "(1,2,3) 1 +\n"
+        "1 +\n"
+        "(0,0,1,1) (1,2,3,4) /\n"
+        "-2.5e1";
+    QuaternionArray parsedResults;
+    std::vector<unsigned char> parsedStatus;
+    runRpnText(rpnText, sizeof(rpnText) - 1, parsedResults, parsedStatus);
+    assert(parsedResults.size() == 9);
+    assert(parsedResults.get(0) == Quaternion(4, 6, 0, 0));
+    assert(parsedResults.get(1) == Quaternion(4, 0, 0, 0));
+    assert(parsedResults.get(2) == Quaternion(0, 1, 0, 0));
+    assert(parsedStatus[3] == RS_DIVIDE_BY_ZERO);
+    assert(parsedStatus[4] == RS_INVALID_PROGRAM);
+    assert(parsedStatus[5] == RS_INVALID_PROGRAM);
+    assert(parsedStatus[6] == RS_INVALID_PROGRAM);
+    // делитель (0, 0, j, k) Calculator считает нулём
+    assert(parsedStatus[7] == RS_DIVIDE_BY_ZERO);
+    assert(parsedStatus[8] == RS_OK);
+    assert(parsedResults.get(8) == Quaternion(-25, 0, 0, 0));
+    std::string longText;
+    for (size_t i = 0; i < 100000; ++i) {
+        longText += "(1.5,-2) (0,0,1,0.25) * " + std::to_string(i % 7) +
+            " +\n";
+    }
+    runRpnText(longText.data(), longText.size(), parsedResults,
+        parsedStatus, 3);
+    assert(parsedResults.size() == 100000);
+    Quaternion lineProduct = Quaternion(0, 0, 1, 0.25) *
+        Quaternion(1.5, -2, 0, 0);
+    assert(parsedResults.get(99999) == Quaternion(4, 0, 0, 0) + lineProduct);
+    // runRpnFile и временные файлы есть только на POSIX
+#if defined(__unix__)
+    char rpnPath[] = "/tmp/rpnXXXXXX";
+    int rpnFile = mkstemp(rpnPath);
+    assert(rpnFile >= 0);
+    assert(write(rpnFile, rpnText, sizeof(rpnText) - 1) ==
+        (ssize_t)(sizeof(rpnText) - 1));
+    close(rpnFile);
+    assert(runRpnFile(rpnPath, parsedResults, parsedStatus));
+    assert(parsedResults.size() == 9);
+    assert(parsedResults.get(0) == Quaternion(4, 6, 0, 0));
+    unlink(rpnPath);
+    assert(!runRpnFile(rpnPath, parsedResults, parsedStatus));
+#endif
+    const char* numberTexts[] = {"0", "-0.5", "3.14159", "1.", ".25",
+        "123456789012345", "0.1234567890123456789", "1e-3", "-2.5E+10",
+        "0.0000000000000000000001"};
+    for (const char* numberText : numberTexts) {
+        const char* numberEnd = numberText + std::strlen(numberText);
+        double fast = 0;
+        double reference = 0;
+        assert(parseRpnNumber(numberText, numberEnd, fast).ptr == numberEnd);
+        std::from_chars(numberText, numberEnd, reference);
+        assert(fast == reference);
+    }
+    const char parsedLine[] = "(1,2) (0.5,0,0,-1) / 3 *";
+    RpnProgram parsedProgram;
+    assert(parseRpnLine(parsedLine, parsedLine + sizeof(parsedLine) - 1,
+        parsedProgram));
+    BytecodeProgram parsedBytecode;
+    assert(parsedBytecode.compile(parsedProgram));
+    Operand compiledValue;
+    Operand streamedValue;
+    std::vector<Operand> parseStack;
+    assert(parsedBytecode.run(compiledValue) == RS_OK);
+    assert(evaluateRpnLine(parsedLine, parsedLine + sizeof(parsedLine) - 1,
+        parseStack, streamedValue) == RS_OK);
+    assert(streamedValue.getKind() == CK_QUATERNION);
+    assert(streamedValue.toQuaternion() == compiledValue.toQuaternion());
+
+    char formatted[256];
+    std::to_chars_result formattedEnd = formatNumber(formatted,
+        formatted + sizeof(formatted), ComplexNumber(1.5, -2));
+    assert(std::string(formatted, formattedEnd.ptr) == "1.5 + -2i");
+    formattedEnd = formatNumber(formatted, formatted + sizeof(formatted),
+        Quaternion(0.1, 2, -0.25, 1e3), 2);
+    assert(std::string(formatted, formattedEnd.ptr) ==
+        "0.10 + 2.00i + -0.25j + 1000.00k");
+    assert(formatNumber(formatted, formatted + 12,
+        Quaternion(1, 2, 3, 4.5)).ec == std::errc::value_too_large);
+    double formatSamples[] = {0.0, -0.0, 0.1, 1.0 / 3, -1e-310, 5e-324,
+        1.7976931348623157e308, std::numeric_limits<double>::infinity(),
+        -std::numeric_limits<double>::infinity(), 123456789.125};
+    allocationsBefore = allocationCount;
+    for (double a : formatSamples) {
+        for (double b : formatSamples) {
+            Quaternion sample(a, b, -b, a * 0.5);
+            formattedEnd = formatNumber(formatted,
+                formatted + sizeof(formatted), sample);
+            assert(formattedEnd.ec == std::errc() && formattedEnd.ptr <=
+                formatted + formattedBytes(CK_QUATERNION,
+                SHORTEST_PRECISION));
+            Operand parsedSample;
+            assert(parseNumber(formatted, formattedEnd.ptr,
+                parsedSample).ptr == formattedEnd.ptr);
+            assert(parsedSample.getKind() == CK_QUATERNION);
+            double sampleValues[4] = {a, b, -b, a * 0.5};
+            double parsedValues[4] = {parsedSample.getReal(),
+                parsedSample.getI(), parsedSample.getJ(),
+                parsedSample.getK()};
+            assert(std::memcmp(sampleValues, parsedValues,
+                sizeof(sampleValues)) == 0);
+        }
+    }
+    assert(allocationCount == allocationsBefore);
+    Operand parsedNumber;
+    const char showText[] = "1e+10 + -2.5i";
+    assert(parseNumber(showText, showText + sizeof(showText) - 1,
+        parsedNumber).ptr == showText + sizeof(showText) - 1);
+    assert(parsedNumber.getKind() == CK_COMPLEX_NUMBER);
+    assert(parsedNumber.toComplexNumber() == ComplexNumber(1e10, -2.5));
+    const char badTexts[][24] = {"1", "1 + 2j", "1 + 2i + 3j", "1 +2i",
+        "x + 1i"};
+    for (const char* badText : badTexts) {
+        assert(parseNumber(badText, badText + std::strlen(badText),
+            parsedNumber).ec != std::errc());
+    }
+    // временный файл и write() в дескриптор есть только на POSIX
+#if defined(__unix__)
+    QuaternionArray formattedValues(3000);
+    for (size_t i = 0; i < formattedValues.size(); ++i) {
+        formattedValues.set(i, Quaternion(std::sin(0.1 * i), 1.0 / (i + 1),
+            -std::exp(0.01 * i), i * 1e-5));
+    }
+    char formattedPath[] = "/tmp/formattedXXXXXX";
+    int formattedFile = mkstemp(formattedPath);
+    assert(formattedFile >= 0);
+    {
+        // маленький блок, чтобы проверить сброс посередине массива
+        FormattedWriter writer(formattedFile, SHORTEST_PRECISION, 4096);
+        assert(writer.write(formattedValues));
+        assert(writer.write(ComplexNumber(0.5, 0.25)));
+    }
+    close(formattedFile);
+    MappedFile formattedText;
+    assert(formattedText.open(formattedPath));
+    QuaternionArray parsedValues;
+    assert(parseNumbers(formattedText.getData(), formattedText.size(),
+        parsedValues));
+    assert(parsedValues.size() == formattedValues.size() + 1);
+    for (size_t i = 0; i < formattedValues.size(); ++i) {
+        assert(parsedValues.get(i) == formattedValues.get(i));
+    }
+    assert(parsedValues.get(3000) == Quaternion(0.5, 0.25, 0, 0));
+    ComplexArray parsedComplexes;
+    assert(!parseNumbers(formattedText.getData(), formattedText.size(),
+        parsedComplexes));
+    formattedText.close();
+    unlink(formattedPath);
+#else
+    {
+        FormattedWriter writer(1);
+        assert(writer.write(ComplexNumber(0.5, 0.25)));
+        assert(!writer.flush() && !writer.isGood());
+    }
+#endif
+
+    // DatasetReader отображает файл только на POSIX
+#if defined(__unix__)
+    char datasetPath[] = "/tmp/datasetXXXXXX";
+    int datasetFile = mkstemp(datasetPath);
+    assert(datasetFile >= 0);
+    close(datasetFile);
+    ComplexArray datasetValues(250);
+    for (size_t i = 0; i < datasetValues.size(); ++i) {
+        datasetValues.set(i, ComplexNumber(0.5 * i, 1.0 / (i + 1)));
+    }
+    ComplexArray datasetHead(130);
+    ComplexArray datasetTail(120);
+    for (size_t i = 0; i < datasetValues.size(); ++i) {
+        if (i < 130) {
+            datasetHead.set(i, datasetValues.get(i));
+        } else {
+            datasetTail.set(i - 130, datasetValues.get(i));
+        }
+    }
+    DatasetWriter datasetWriter;
+    assert(datasetWriter.open(datasetPath, CK_COMPLEX_NUMBER, DS_DOUBLE,
+        DL_SOA, 100) == DS_OK);
+    assert(datasetWriter.append(datasetHead) == DS_OK);
+    assert(datasetWriter.append(datasetTail) == DS_OK);
+    assert(datasetWriter.append(QuaternionArray(1)) == DS_KIND_MISMATCH);
+    assert(datasetWriter.close() == DS_OK);
+    DatasetReader datasetReader;
+    assert(datasetReader.open(datasetPath) == DS_OK);
+    assert(datasetReader.getKind() == CK_COMPLEX_NUMBER);
+    assert(datasetReader.size() == 250);
+    assert(datasetReader.getChunkCount() == 3);
+    assert(datasetReader.getChunkLength(2) == 50);
+    for (size_t chunk = 0; chunk < datasetReader.getChunkCount(); ++chunk) {
+        const double* columnReal = datasetReader.getColumn(chunk, 0);
+        const double* columnI = datasetReader.getColumn(chunk, 1);
+        assert(reinterpret_cast<uintptr_t>(columnReal) % SIMD_ALIGNMENT == 0);
+        assert(reinterpret_cast<uintptr_t>(columnI) % SIMD_ALIGNMENT == 0);
+        size_t length = datasetReader.getChunkLength(chunk);
+        ComplexArray squared(length);
+        complexMultiplyKernel(length, columnReal, columnI, columnReal,
+            columnI, squared.getRealData(), squared.getIData());
+        for (size_t i = 0; i < length; ++i) {
+            ComplexNumber original = datasetValues.get(chunk * 100 + i);
+            assert(squared.get(i) == original * original);
+        }
+    }
+    assert(datasetReader.getColumn(0, 2) == nullptr);
+    assert(datasetReader.getColumn(3, 0) == nullptr);
+    ComplexArray datasetChunk;
+    assert(datasetReader.readChunk(1, datasetChunk) == DS_OK);
+    assert(datasetChunk.get(0) == datasetValues.get(100));
+    QuaternionArray promotedChunk;
+    assert(datasetReader.readChunk(2, promotedChunk) == DS_OK);
+    assert(promotedChunk.get(49) == Quaternion(datasetValues.get(249)));
+    assert(datasetReader.readChunk(3, datasetChunk) == DS_OUT_OF_RANGE);
+    QuaternionArray datasetQuaternions(70);
+    for (size_t i = 0; i < datasetQuaternions.size(); ++i) {
+        datasetQuaternions.set(i, Quaternion(i, 0.25, -0.5 * i, 3));
+    }
+    assert(datasetWriter.open(datasetPath, CK_QUATERNION, DS_FLOAT, DL_AOS,
+        32) == DS_OK);
+    assert(datasetWriter.append(datasetQuaternions) == DS_OK);
+    assert(datasetWriter.close() == DS_OK);
+    assert(datasetReader.open(datasetPath) == DS_OK);
+    assert(datasetReader.getLayout() == DL_AOS);
+    assert(datasetReader.getColumn(0, 0) == nullptr);
+    assert(datasetReader.readChunk(0, datasetChunk) == DS_KIND_MISMATCH);
+    assert(datasetReader.readChunk(2, promotedChunk) == DS_OK);
+    assert(promotedChunk.size() == 6);
+    assert(promotedChunk.get(5) == datasetQuaternions.get(69));
+    auto patchDatasetSizes = [&](uint64_t count, uint64_t chunkSize) {
+        std::FILE* patched = std::fopen(datasetPath, "r+b");
+        assert(patched);
+        std::fseek(patched, offsetof(DatasetHeader, count), SEEK_SET);
+        std::fwrite(&count, sizeof(count), 1, patched);
+        std::fwrite(&chunkSize, sizeof(chunkSize), 1, patched);
+        std::fclose(patched);
+    };
+    patchDatasetSizes(uint64_t(1) << 62, 1);
+    assert(datasetReader.open(datasetPath) == DS_BAD_HEADER);
+    assert(datasetReader.size() == 0);
+    patchDatasetSizes(uint64_t(1) << 60, uint64_t(1) << 60);
+    assert(datasetReader.open(datasetPath) == DS_BAD_HEADER);
+    patchDatasetSizes(100, 32);
+    assert(datasetReader.open(datasetPath) == DS_BAD_HEADER);
+    patchDatasetSizes(70, ~uint64_t(0));
+    assert(datasetReader.open(datasetPath) == DS_OK);
+    assert(datasetReader.getChunkCount() == 1);
+    patchDatasetSizes(70, 32);
+    assert(datasetReader.open(datasetPath) == DS_OK);
+    assert(datasetReader.getChunkCount() == 3);
+    std::FILE* corrupted = std::fopen(datasetPath, "r+b");
+    assert(corrupted);
+    std::fputc('X', corrupted);
+    std::fclose(corrupted);
+    assert(datasetReader.open(datasetPath) == DS_BAD_HEADER);
+    unlink(datasetPath);
+    assert(datasetReader.open(datasetPath) == DS_IO_ERROR);
+#endif
+
+#if defined(CALCULATOR_STATS)
+    {
+        Calculator statsCalculator;
+        ComplexNumber statsComplex(1, 2);
+        Quaternion statsQuaternion(1, 2, 3, 4);
+        ComplexNumber statsZero;
+        statsCalculator.calculate(OP_ADD);
+        statsCalculator.push(statsComplex);
+        statsCalculator.calculate(OP_MULTIPLY);
+        statsCalculator.push(statsQuaternion);
+        statsCalculator.calculate(OP_MULTIPLY);
+        statsCalculator.push(statsComplex);
+        statsCalculator.calculate(OP_ADD);
+        assert(*(Quaternion*)statsCalculator.top() == Quaternion(statsComplex) +
+            statsQuaternion * Quaternion(statsComplex));
+        statsCalculator.push(statsZero);
+        statsCalculator.push(statsComplex);
+        statsCalculator.calculate(OP_DIVIDE);
+        const CalculatorStats& stats = statsCalculator.getStats();
+        assert(stats.operations[OP_ADD] == 2);
+        assert(stats.operations[OP_MULTIPLY] == 2);
+        assert(stats.operations[OP_DIVIDE] == 1);
+        assert(stats.promotions[CP_QC] == 1);
+        assert(stats.promotions[CP_CQ] == 1);
+        assert(stats.promotions[CP_CC] == 1);
+        assert(stats.emptyStack == 1);
+        assert(stats.oneOperand == 1);
+        assert(stats.divideByZero == 1);
+        assert(stats.allocations == 2);
+        assert(stats.allocatedBytes == 2 * sizeof(Quaternion));
+        assert(stats.peakDepth == 3);
+        assert(stats.calls == 5);
+        assert(stats.latency[OP_ADD].getCount() == 1);
+        assert(*statsCalculator.top() == statsComplex);
+        // копия продолжает счётчики оригинала
+        Calculator copiedStats(statsCalculator);
+        assert(copiedStats.getStats().operations[OP_ADD] == 2);
+        assert(copiedStats.getStats().latency[OP_ADD].getCount() == 1);
+        Calculator assignedStats;
+        assignedStats = statsCalculator;
+        assert(assignedStats.getStats().divideByZero == 1);
+        assert(assignedStats.getStats().peakDepth == 3);
+        statsCalculator.resetStats();
+        assert(copiedStats.getStats().operations[OP_ADD] == 2);
+        assert(statsCalculator.getStats().operations[OP_ADD] == 0);
+        for (uint64_t value : {0ull, 7ull, 8ull, 15ull, 16ull, 1000ull,
+            ~0ull}) {
+            int index = LatencyHistogram::bucketIndex(value);
+            assert(index < LatencyHistogram::BUCKET_COUNT);
+            uint64_t lower = LatencyHistogram::bucketLowerBound(index);
+            assert(lower <= value && value - lower <= value / 8);
+        }
+    }
+#endif
+
+    ComplexNumber hugeComplex(1e300, -3e300);
+    ComplexNumber hugeQuotient = hugeComplex / hugeComplex;
+    assert(std::fabs(hugeQuotient.getReal() - 1) < tolerance);
+    assert(std::fabs(hugeQuotient.getI()) < tolerance);
+    ComplexNumber tinyComplex(2e-310, 1e-300);
+    ComplexNumber tinyQuotient = ComplexNumber(1e-300, 0) / tinyComplex;
+    assert(std::fabs(tinyQuotient.getReal()) < 1e-9);
+    assert(std::fabs(tinyQuotient.getI() + 1) < 1e-9);
+    Quaternion hugeQuaternion(1e200, -2e200, 3e200, 4e200);
+    Quaternion hugeRatio = hugeQuaternion / hugeQuaternion;
+    assert(std::fabs(hugeRatio.getReal() - 1) < tolerance);
+    assert(std::fabs(hugeRatio.getJ()) < tolerance);
+    Quaternion tinyQuaternion(0, 1e-200, 0, -1e-200);
+    Quaternion tinyInverse = tinyQuaternion.reciprocal();
+    assert(std::fabs(tinyInverse.getI() + 5e199) < 1e185);
+    assert(std::fabs(tinyInverse.getK() - 5e199) < 1e185);
+    // деление массива на один кватернион у границ диапазона
+    Quaternion tinyDivisor(1e-200, 0, -2e-200, 1e-200);
+    Quaternion broadcastDivisors[] = {hugeQuaternion, tinyDivisor,
+        Quaternion(0.5, -1, 2, 0.25)};
+    for (const Quaternion& divisor : broadcastDivisors) {
+        QuaternionArray broadcast(5);
+        for (size_t i = 0; i < broadcast.size(); ++i) {
+            broadcast.set(i, divisor * double(i + 1));
+        }
+        broadcast /= divisor;
+        for (size_t i = 0; i < broadcast.size(); ++i) {
+            Quaternion error = broadcast.get(i) -
+                Quaternion(double(i + 1), 0, 0, 0);
+            assert(std::sqrt(error.norm()) < tolerance * (i + 1));
+        }
+    }
+    QuaternionArray hugeArray(3);
+    for (size_t i = 0; i < hugeArray.size(); ++i) {
+        hugeArray.set(i, Quaternion(1e300, 0, 0, 0));
+    }
+    hugeArray /= ComplexNumber(3e300, 4e300);
+    assert(std::fabs(hugeArray.get(2).getReal() - 0.12) < tolerance);
+    assert(std::fabs(hugeArray.get(2).getI() + 0.16) < tolerance);
+    assert(ComplexNumber(3, 4).norm() == 25);
+    assert(Quaternion(1, 2, 3, 4).norm() == 30);
+    assert(ComplexNumber(0, 2).reciprocal() == ComplexNumber(0, -0.5));
+    assert(ComplexNumber(0, 2).reciprocal() ==
+        ComplexNumber(1, 0) / ComplexNumber(0, 2));
+    // нормированная ошибка деления против long double
+    const double eps = std::numeric_limits<double>::epsilon();
+    std::vector<ComplexNumber> divisionComplex;
+    std::vector<Quaternion> divisionQuaternions;
+    for (int i = 0; i < 1000; ++i) {
+        double scale = std::ldexp(1.0, (i * 37) % 600 - 300);
+        divisionComplex.push_back(ComplexNumber(std::sin(i + 0.5) * scale,
+            std::cos(3.0 * i) * scale));
+        divisionQuaternions.push_back(Quaternion(std::sin(i + 0.5) * scale,
+            std::cos(3.0 * i) * scale, std::sin(7.0 * i) * scale,
+            std::cos(0.1 * i) * scale));
+    }
+    for (int i = 0; i + 1 < 1000; ++i) {
+        const ComplexNumber& numerator = divisionComplex[i];
+        const ComplexNumber& denominator = divisionComplex[i + 1];
+        ComplexNumber quotient = numerator / denominator;
+        long double denominatorNorm =
+            (long double)denominator.getReal() * denominator.getReal() +
+            (long double)denominator.getI() * denominator.getI();
+        long double exactReal = ((long double)numerator.getReal() *
+            denominator.getReal() + (long double)numerator.getI() *
+            denominator.getI()) / denominatorNorm;
+        long double exactI = ((long double)numerator.getI() *
+            denominator.getReal() - (long double)numerator.getReal() *
+            denominator.getI()) / denominatorNorm;
+        long double magnitude = std::sqrt(exactReal * exactReal +
+            exactI * exactI);
+        assert(std::fabs(quotient.getReal() - exactReal) <= 4 * eps * magnitude);
+        assert(std::fabs(quotient.getI() - exactI) <= 4 * eps * magnitude);
+    }
+    QuaternionArray divisionArray(divisionQuaternions);
+    QuaternionArray reciprocalArray;
+    reciprocal(divisionArray, reciprocalArray);
+    ComplexArray divisionComplexArray(divisionComplex);
+    ComplexArray complexReciprocals;
+    reciprocal(divisionComplexArray, complexReciprocals);
+    for (int i = 0; i < 1000; ++i) {
+        const Quaternion& value = divisionQuaternions[i];
+        long double norm = (long double)value.getReal() * value.getReal() +
+            (long double)value.getI() * value.getI() +
+            (long double)value.getJ() * value.getJ() +
+            (long double)value.getK() * value.getK();
+        long double exact[4] = {value.getReal() / norm, -value.getI() / norm,
+            -value.getJ() / norm, -value.getK() / norm};
+        long double magnitude = 1 / std::sqrt(norm);
+        Quaternion scalarInverse = value.reciprocal();
+        Quaternion batchInverse = reciprocalArray.get(i);
+        double scalarParts[4] = {scalarInverse.getReal(),
+            scalarInverse.getI(), scalarInverse.getJ(), scalarInverse.getK()};
+        double batchParts[4] = {batchInverse.getReal(), batchInverse.getI(),
+            batchInverse.getJ(), batchInverse.getK()};
+        for (int c = 0; c < 4; ++c) {
+            assert(std::fabs(scalarParts[c] - exact[c]) <= 3 * eps * magnitude);
+            assert(std::fabs(batchParts[c] - exact[c]) <= 4 * eps * magnitude);
+        }
+        ComplexNumber complexInverse = complexReciprocals.get(i);
+        ComplexNumber expectedInverse = divisionComplex[i].reciprocal();
+        // модуль обратного в long double: norm() в double у границ
+        // диапазона переполняется, и допуск схлопнулся бы в 0
+        long double complexNorm =
+            (long double)divisionComplex[i].getReal() *
+            divisionComplex[i].getReal() +
+            (long double)divisionComplex[i].getI() *
+            divisionComplex[i].getI();
+        double complexMagnitude = 1 / std::sqrt(complexNorm);
+        assert(std::isfinite(complexMagnitude) && complexMagnitude > 0);
+        assert(std::fabs(complexInverse.getReal() - expectedInverse.getReal())
+            <= 8 * eps * complexMagnitude);
+        assert(std::fabs(complexInverse.getI() - expectedInverse.getI()) <=
+            8 * eps * complexMagnitude);
+    }
+    double lanes[] = {3, -7, 0.1, 1e-310, 0, -0.0, INFINITY, 1e308, 5, 6, 7};
+    double inverses[11];
+    reciprocalLanes(11, lanes, inverses);
+    for (int i = 0; i < 11; ++i) {
+        double exact = 1 / lanes[i];
+        assert(inverses[i] == exact ||
+            std::fabs(inverses[i] - exact) <= eps * std::fabs(exact));
+    }
+    assert(std::isinf(inverses[4]) && inverses[5] < 0 && inverses[6] == 0);
+
     std::cout << "All tests passed!" << std::endl;
     
     return 0;